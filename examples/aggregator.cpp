@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2012 Christopher M. Baker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/*
+ * Fans each request to /aggregate out to a number of slow backends and answers with all of their responses.
+ * The backends are served by this example too: /backend/{id} answers after a random delay of up to --delay milliseconds.
+ * Because the backend requests are sent concurrently, an aggregate takes about as long as its slowest backend rather than the sum of them:
+ *
+ *   ./aggregator --backends 20 --delay 50 --deadline 200 &
+ *   curl localhost:9094/aggregate
+ */
+
+#include "../include/Application.hpp"
+#include "../include/rest/Rest.hpp"
+#include "../include/http/HttpAgent.hpp"
+using namespace nitrus;
+
+HttpAgent agent;
+
+/**
+ * A backend response that is sent after a delay.
+ */
+class DelayedResponse {
+private:
+	template <typename Signature> friend class Delegate;
+
+	HttpServer::HttpClient* _client;
+	std::string _id;
+
+	void OnClientDisconnected(const HttpServer::HttpClient::ClientDisconnectedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		_client = NULL;
+	}
+
+	void Send() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		// the aggregate may have cancelled this request when its deadline passed.
+		if (_client != NULL) {
+			_client->ClientDisconnected() -= delegate(&DelayedResponse::OnClientDisconnected, this);
+			_client->Begin("HTTP/1.1", 200, "OK").SendHeader("Content-Type", "application/json").Send(String::Format("{ \"Id\": %s }", _id.c_str())).End();
+		}
+
+		delete this;
+	}
+
+public:
+	DelayedResponse(HttpServer::HttpClient* client, const std::string& id) : _client(client), _id(id) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		_client->ClientDisconnected() += delegate(&DelayedResponse::OnClientDisconnected, this);
+		Thread::SetTimeout(TimeSpan::FromMilliseconds(Random::Uniform(0, Application::GetParameter("--delay", 50))), delegate(&DelayedResponse::Send, this));
+	}
+};
+
+/**
+ * An aggregate request waiting for its batch of backend requests to complete.
+ */
+class Aggregation {
+private:
+	template <typename Signature> friend class Delegate;
+
+	HttpServer::HttpClient* _client;
+
+	void OnBatchCompleted(const HttpAgent::BatchCompletedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		const HttpAgent::ResultCollection& results = args.Results();
+
+		_client->Begin("HTTP/1.1", 200, "OK")
+			.SendHeader("Content-Type", "application/json")
+			.SendHeader("X-Elapsed", String::Format("%.0fms", args.Elapsed().TotalMilliseconds()))
+			.Send("[");
+
+		for (size_t i = 0; i < results.size(); i++) {
+			_client->Send(i == 0 ? "" : ",");
+			_client->Send(results[i].GetStatus() == HttpAgent::Result::Status_Completed ? results[i].Content() : "null");
+		}
+
+		_client->Send("]").End();
+		delete this;
+	}
+
+public:
+	Aggregation(HttpServer::HttpClient* client) : _client(client) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		Socket::Endpoint backend("localhost", Application::GetParameter("--port", 9094));
+		HttpAgent::Batch& batch = agent.BeginBatch(TimeSpan::FromMilliseconds(Application::GetParameter("--deadline", 200)));
+
+		for (int i = 0; i < Application::GetParameter("--backends", 20); i++) {
+			batch.Add(backend, "GET", String::Format("/backend/%d", i));
+		}
+
+		batch.BatchCompleted() += delegate(&Aggregation::OnBatchCompleted, this);
+		batch.End();
+	}
+};
+
+void Backend(const Rest::Router::RequestEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+	new DelayedResponse(args.Client(), args.Match("id"));
+}
+
+void Aggregate(const Rest::Router::RequestEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+	new Aggregation(args.Client());
+}
+
+/**
+ * The entry point for the application.
+ * @param argc The number of elements in the second parameter.
+ * @param argv The array of arguments passed to this application from the system.
+ * @return EXIT_SUCCESS if the application completed successfully or EXIT_FAILURE if an error occurred.
+ */
+int main(int argc, char** argv) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+	Application::Initialize(argc, argv);
+
+	Rest::Router router;
+
+	router.Configure("/backend/{id}")
+		.Get(Rest::Router::RequestEventHandler(Backend));
+
+	router.Configure("/aggregate")
+		.Get(Rest::Router::RequestEventHandler(Aggregate));
+
+	router.Bind(Application::GetParameter("--port", 9094));
+	router.Listen();
+
+	return Application::Run();
+}
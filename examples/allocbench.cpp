@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2012 Christopher M. Baker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/*
+ * Counts the heap allocations made while serving a rest request.
+ * A router and a raw tcp client run on the same event loop, and the client sends one keep-alive request at a time.
+ * The count includes the few allocations made by the client to send each request and receive each response.
+ *
+ *   ./allocbench --requests 10000 --routes 20
+ */
+
+#include "../include/Application.hpp"
+#include "../include/rest/Rest.hpp"
+using namespace nitrus;
+
+#include <stdlib.h>
+
+size_t allocations = 0;
+
+void* operator new(size_t size) {
+	allocations++;
+
+	if (void* memory = malloc(size == 0 ? 1 : size)) {
+		return memory;
+	}
+
+	throw std::bad_alloc();
+}
+
+void operator delete(void* memory) throw() {
+	free(memory);
+}
+
+void operator delete(void* memory, size_t size) throw() {
+	free(memory);
+}
+
+TcpClient client;
+std::string response;
+std::string request;
+size_t sent = 0;
+size_t received = 0;
+size_t warmup = 0;
+size_t counted = 0;
+
+void ReadEntity(const Rest::Router::RequestEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+	args.Client()->Begin("HTTP/1.1", 200, "OK")
+		.SendHeader("Content-Type", "application/json")
+		.Send(String::Format("{ \"Id\": %s }", args.Match("entityId").c_str()))
+		.End();
+}
+
+void Ignore(const Rest::Router::RequestEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+}
+
+void SendRequest() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+	sent++;
+	client.Send(request);
+}
+
+void OnClientConnected(const TcpClient::ClientConnectedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+	SendRequest();
+}
+
+void OnDataReceived(const TcpClient::DataReceivedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+	size_t requests = Application::GetParameter<size_t>("--requests", 10000);
+	size_t end;
+
+	response += args.Data();
+
+	while ((end = response.find("0\r\n\r\n")) != std::string::npos) {
+		response.erase(0, end + 5);
+		received++;
+
+		if (received == warmup) {
+			counted = allocations;
+		}
+	}
+
+	if (received == warmup + requests) {
+		Log::Information("%lu requests, %.1f allocations per request", (unsigned long) requests, (double) (allocations - counted) / requests);
+		exit(EXIT_SUCCESS);
+	}
+
+	if (sent == received) {
+		SendRequest();
+	}
+}
+
+/**
+ * The entry point for the application.
+ * @param argc The number of elements in the second parameter.
+ * @param argv The array of arguments passed to this application from the system.
+ * @return EXIT_SUCCESS if the application completed successfully or EXIT_FAILURE if an error occurred.
+ */
+int main(int argc, char** argv) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+	Application::Initialize(argc, argv);
+
+	int port = Application::GetParameter("--port", 9093);
+	Rest::Router router;
+
+	// routes that are checked but never match, to include the cost of searching the routing table.
+	for (int i = Application::GetParameter("--routes", 20); i > 0; i--) {
+		router.Configure(String::Format("/route%d/{id}/items?sort={sort}", i))
+			.Get(Rest::Router::RequestEventHandler(Ignore));
+	}
+
+	router.Configure("/entities/{entityId}")
+		.Get(Rest::Router::RequestEventHandler(ReadEntity));
+
+	router.Bind(port);
+	router.Listen();
+
+	request = "GET /entities/42 HTTP/1.1\r\nHost: localhost\r\nUser-Agent: allocbench\r\nAccept: application/json\r\n\r\n";
+	warmup = 100;
+
+	client.ClientConnected() += delegate(OnClientConnected);
+	client.DataReceived() += delegate(OnDataReceived);
+	client.Connect(Socket::Endpoint("localhost", port));
+
+	return Application::Run();
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2012 Christopher M. Baker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/*
+ * Broadcasts server-sent events from /events and reports how long each broadcast takes.
+ * With --subscribers the example also opens that many local subscribers on the same event loop, for example:
+ *
+ *   ulimit -n 32768 && ./eventserver --subscribers 10000 --interval 1000
+ */
+
+#include "../include/Application.hpp"
+#include "../include/rest/Rest.hpp"
+#include "../include/http/HttpClient.hpp"
+#include "../include/http/EventChannel.hpp"
+using namespace nitrus;
+
+EventChannel channel;
+size_t broadcasts = 0;
+size_t received = 0;
+TimeSpan elapsed;
+
+void Subscribe(const Rest::Router::RequestEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+	channel.Subscribe(args.Client());
+}
+
+void OnContentReceived(const HttpClient::ContentReceivedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+	received += std::count(args.Content().begin(), args.Content().end(), '\n') / 2;
+}
+
+void OnClientConnected(const TcpClient::ClientConnectedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+	HttpClient* client = static_cast<HttpClient*>(sender);
+	client->ContentReceived() += delegate(OnContentReceived);
+	client->Begin("GET", "/events", "HTTP/1.1").SendHeader("Host", "localhost").Send("").End();
+}
+
+void Broadcast() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+	DateTime started = DateTime::Utc();
+	channel.Broadcast(String::Format("{ \"Sequence\": %lu }", (unsigned long) broadcasts++), "update");
+	elapsed += DateTime::Utc() - started;
+
+	Thread::SetTimeout(TimeSpan::FromMilliseconds(Application::GetParameter("--interval", 1000)), delegate(Broadcast));
+}
+
+void Report() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+	Log::Information("subscribers %lu, dropped %lu, broadcasts %lu, average broadcast %.3fms, events received %lu, loop lag %.0fms",
+		(unsigned long) channel.Subscribers(), (unsigned long) channel.Dropped(), (unsigned long) broadcasts,
+		broadcasts == 0 ? 0.0 : elapsed.TotalMilliseconds() / broadcasts, (unsigned long) received, Thread::Lag().TotalMilliseconds());
+
+	Thread::SetTimeout(TimeSpan::FromSeconds(5), delegate(Report));
+}
+
+/**
+ * The entry point for the application.
+ * @param argc The number of elements in the second parameter.
+ * @param argv The array of arguments passed to this application from the system.
+ * @return EXIT_SUCCESS if the application completed successfully or EXIT_FAILURE if an error occurred.
+ */
+int main(int argc, char** argv) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+	Application::Initialize(argc, argv);
+
+	int port = Application::GetParameter("--port", 9092);
+	Rest::Router router;
+
+	router.Configure("/events")
+		.Get(Rest::Router::RequestEventHandler(Subscribe));
+
+	router.Bind(port);
+	router.Listen();
+
+	for (int i = Application::GetParameter("--subscribers", 0); i > 0; i--) {
+		HttpClient* client = new HttpClient();
+		client->ClientConnected() += delegate(OnClientConnected);
+		client->Connect(Socket::Endpoint("localhost", port));
+	}
+
+	Broadcast();
+	Report();
+
+	return Application::Run();
+}
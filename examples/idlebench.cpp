@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2012 Christopher M. Baker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/*
+ * Opens a large number of idle keep-alive connections to the webserver example and reports what each one costs the server.
+ * Every connection makes a single request and then stays open without sending anything else.
+ * Connections are spread over 127.0.0.1, 127.0.0.2, ... so that the ephemeral port range is not exhausted, for example:
+ *
+ *   ulimit -n 204800 && ./webserver &
+ *   ulimit -n 204800 && ./idlebench --pid $! --connections 100000 --idle 10
+ *
+ * The resident memory and processor time of the server are read from /proc, so they are only reported on linux.
+ */
+
+#include "../include/Application.hpp"
+#include "../include/http/HttpClient.hpp"
+using namespace nitrus;
+
+#include <fstream>
+
+#ifndef _WIN32
+# include <sys/resource.h>
+#endif
+
+/**
+ * The number of connections opened to each loopback address.
+ */
+const size_t ConnectionsPerAddress = 20000;
+
+/**
+ * A sample of the resident memory and processor time used by a process.
+ */
+struct Usage {
+	double memory;
+	double processor;
+};
+
+size_t total = 0;
+size_t opened = 0;
+size_t completed = 0;
+size_t failed = 0;
+Usage baseline;
+Usage connected;
+DateTime idleStarted;
+
+/**
+ * Reads the resident memory, in bytes, and the processor time, in seconds, used by a process.
+ *
+ * @param pid The process to sample.
+ * @return The sample, or zeros if the process could not be sampled.
+ */
+Usage Sample(int pid) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+	Usage usage = Usage();
+
+#ifdef __linux__
+	std::ifstream statm(String::Format("/proc/%d/statm", pid).c_str());
+	std::ifstream stat(String::Format("/proc/%d/stat", pid).c_str());
+	std::string field;
+	double pages = 0, user = 0, system = 0;
+
+	statm >> field >> pages;
+
+	// skip the process id, name and the eleven fields that precede the processor times.
+	for (int i = 0; i < 13 && stat >> field; i++);
+	stat >> user >> system;
+
+	usage.memory = pages * sysconf(_SC_PAGESIZE);
+	usage.processor = (user + system) / sysconf(_SC_CLK_TCK);
+#endif
+
+	return usage;
+}
+
+void Report() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+	int pid = Application::GetParameter("--pid", 0);
+	Usage idle = Sample(pid);
+	double seconds = (DateTime::Utc() - idleStarted).TotalSeconds();
+	size_t connections = completed == 0 ? 1 : completed;
+
+	Log::Information("%lu connections idle, %lu failed", (unsigned long) completed, (unsigned long) failed);
+	Log::Information("server memory: %.0f bytes total, %.0f bytes per connection", connected.memory - baseline.memory, (connected.memory - baseline.memory) / connections);
+	Log::Information("server processor while idle: %.2f%% over %.0f seconds", 100 * (idle.processor - connected.processor) / seconds, seconds);
+	Log::Information("benchmark memory: %.0f bytes per connection", Sample(getpid()).memory / connections);
+
+	exit(EXIT_SUCCESS);
+}
+
+void OnSettled() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+	if (completed + failed != total) {
+		return;
+	}
+
+	connected = Sample(Application::GetParameter("--pid", 0));
+	idleStarted = DateTime::Utc();
+
+	Log::Information("all connections settled, idling for %d seconds", Application::GetParameter("--idle", 10));
+	Thread::SetTimeout(TimeSpan::FromSeconds(Application::GetParameter("--idle", 10)), delegate(Report));
+}
+
+void OnClientConnected(const TcpClient::ClientConnectedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+	static_cast<HttpClient*>(sender)->Begin("GET", "/entities", "HTTP/1.1").SendHeader("Host", "localhost").Send("").End();
+}
+
+void OnResponseEnded(const HttpClient::ResponseEndedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+	completed++;
+	OnSettled();
+}
+
+void OnClientDisconnected(const TcpClient::ClientDisconnectedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+	failed++;
+	OnSettled();
+}
+
+/**
+ * Opens the next batch of connections, keeping a bounded number of connections in progress.
+ */
+void Open() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+	size_t batch = Application::GetParameter<size_t>("--batch", 500);
+	int port = Application::GetParameter("--port", 9091);
+
+	for (size_t i = 0; i < batch && opened < total && opened - completed - failed < batch * 4; i++, opened++) {
+		HttpClient* client = new HttpClient();
+		client->ClientConnected() += delegate(OnClientConnected);
+		client->ResponseEnded() += delegate(OnResponseEnded);
+		client->ClientDisconnected() += delegate(OnClientDisconnected);
+		client->Connect(Socket::Endpoint(String::Format("127.0.0.%d", 1 + (int) (opened / ConnectionsPerAddress)), port));
+	}
+
+	if (opened < total) {
+		Thread::SetTimeout(TimeSpan::FromMilliseconds(10), delegate(Open));
+	}
+}
+
+/**
+ * The entry point for the application.
+ * @param argc The number of elements in the second parameter.
+ * @param argv The array of arguments passed to this application from the system.
+ * @return EXIT_SUCCESS if the application completed successfully or EXIT_FAILURE if an error occurred.
+ */
+int main(int argc, char** argv) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+	Application::Initialize(argc, argv);
+
+#ifndef _WIN32
+	struct rlimit limit;
+
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+#endif
+
+	total = Application::GetParameter<size_t>("--connections", 100000);
+	baseline = Sample(Application::GetParameter("--pid", 0));
+
+	Open();
+
+	return Application::Run();
+}
@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2012 Christopher M. Baker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/*
+ * Measures how quickly typical api payloads are parsed: a single record, a page of records, and a large batch.
+ * Each payload is an array of user records written with JsonWriter, and is parsed whole into a document and then one element at a time with a reader.
+ * The memory reported is what the document took from its arena, and the most any one element of the reader took:
+ *
+ *   ./jsonbench --bytes 100000000
+ */
+
+#include "../include/Application.hpp"
+#include "../include/rest/JsonWriter.hpp"
+#include "../include/rest/JsonReader.hpp"
+using namespace nitrus;
+
+/**
+ * The number of records in the payload of each round.
+ */
+const size_t Rounds[] = { 1, 100, 100000 };
+
+/**
+ * Writes an array of user records like those returned by a typical api.
+ *
+ * @param count The number of records.
+ * @return The payload.
+ */
+std::string Payload(size_t count) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+	std::string payload;
+	JsonWriter json(payload);
+
+	json.BeginArray();
+
+	for (size_t i = 0; i < count; i++) {
+		json.BeginObject()
+			.Key("id").Integer(1000000 + i)
+			.Key("name").String(String::Format("User %lu", (unsigned long) i))
+			.Key("email").String(String::Format("user%lu@example.com", (unsigned long) i))
+			.Key("active").Boolean(i % 3 != 0)
+			.Key("score").Number(i * 0.25)
+			.Key("bio").String("Writes \"software\" and\nreads books.")
+			.Key("tags").BeginArray().String("admin").String("beta").EndArray()
+			.Key("address").BeginObject().Key("city").String("Springfield").Key("zip").String("12345").EndObject()
+			.EndObject();
+	}
+
+	json.EndArray();
+	return payload;
+}
+
+/**
+ * The entry point for the application.
+ * @param argc The number of elements in the second parameter.
+ * @param argv The array of arguments passed to this application from the system.
+ * @return EXIT_SUCCESS if the application completed successfully or EXIT_FAILURE if an error occurred.
+ */
+int main(int argc, char** argv) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+	Application::Initialize(argc, argv);
+
+	size_t bytes = Application::GetParameter<size_t>("--bytes", 100000000);
+
+	for (size_t round = 0; round < sizeof(Rounds) / sizeof(*Rounds); round++) {
+		std::string payload = Payload(Rounds[round]);
+		size_t iterations = bytes / payload.size() + 1;
+		size_t records = 0;
+		size_t memory = 0;
+		size_t element = 0;
+		Arena arena;
+		DateTime started = DateTime::Utc();
+
+		for (size_t i = 0; i < iterations; i++) {
+			JsonDocument document(payload, arena);
+
+			if (document.Valid() == false) {
+				Log::Error("the payload is not valid at %lu", (unsigned long) document.ErrorPosition());
+				return EXIT_FAILURE;
+			}
+
+			records += document.Root().Count();
+			memory = arena.Bytes();
+			arena.Reset();
+		}
+
+		double parsed = (DateTime::Utc() - started).TotalSeconds();
+		started = DateTime::Utc();
+
+		for (size_t i = 0; i < iterations; i++) {
+			JsonReader reader(payload);
+
+			while (reader.Next()) {
+				records += reader.Current()["id"].IsIntegral();
+			}
+
+			if (reader.Valid() == false) {
+				Log::Error("the payload is not valid");
+				return EXIT_FAILURE;
+			}
+		}
+
+		double streamed = (DateTime::Utc() - started).TotalSeconds();
+
+		// measures the memory used by one element of the reader, which is the same for every element of this payload.
+		Arena single;
+		JsonParser parser(payload.data() + 1, payload.size() - 1, single);
+
+		parser.ParseValue();
+		element = single.Bytes();
+
+		if (records != iterations * Rounds[round] * 2) {
+			Log::Error("the payload was not read as expected");
+			return EXIT_FAILURE;
+		}
+
+		Log::Information("%6lu records, %8lu bytes: document %7.1f MB/s using %8lu bytes, reader %7.1f MB/s using %5lu bytes", (unsigned long) Rounds[round], (unsigned long) payload.size(), payload.size() * iterations / parsed / 1048576, (unsigned long) memory, payload.size() * iterations / streamed / 1048576, (unsigned long) element);
+	}
+
+	return EXIT_SUCCESS;
+}
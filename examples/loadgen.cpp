@@ -0,0 +1,296 @@
+/*
+ * Copyright (c) 2012 Christopher M. Baker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/*
+ * Sends requests to a server over a number of keep-alive connections for a fixed duration, and reports the throughput and a latency histogram.
+ * Without --rate, every connection sends its next request as soon as its last response ends, and latency is measured from when each request was sent:
+ *
+ *   ./loadgen --host localhost --port 9091 --path /entities --connections 64 --duration 30
+ *
+ * With --rate, requests are scheduled at a fixed rate however quickly the server answers, and wait for a free connection if none is available.
+ * Latency is measured from when each request was scheduled, so time spent waiting behind a stalled response is counted rather than hidden by the requests that were never sent.
+ * Requests still waiting or in flight when the duration ends are counted with the latency they have reached, which is the least their latency can be:
+ *
+ *   ./loadgen --host localhost --port 9091 --path /entities --connections 64 --duration 30 --rate 20000
+ *
+ * With --pipeline, up to that many requests are in flight on each connection.
+ */
+
+#include "../include/Application.hpp"
+#include "../include/Histogram.hpp"
+#include "../include/http/HttpClient.hpp"
+using namespace nitrus;
+
+#include <deque>
+#include <map>
+
+#ifndef _WIN32
+# include <sys/resource.h>
+#endif
+
+class Connection;
+
+std::string host;
+std::string path;
+int port = 80;
+size_t depth = 1;
+double rate = 0;
+std::vector<Connection*> connections;
+std::deque<uint64_t> backlog;
+Histogram latencies;
+std::map<int, size_t> codes;
+bool running = true;
+uint64_t started = 0;
+uint64_t scheduled = 0;
+size_t completed = 0;
+size_t errors = 0;
+size_t reconnects = 0;
+uint64_t received = 0;
+
+/**
+ * A keep-alive connection and the start times of the requests in flight on it, in the order they were sent.
+ * A connection that is closed is replaced by a new one, and the requests that were in flight on it are counted as errors.
+ */
+class Connection {
+private:
+	template <typename Signature> friend class Delegate;
+
+	HttpClient* _client;
+	std::vector<HttpClient*> _retired;
+	std::deque<uint64_t> _inflight;
+	bool _connected;
+
+	void OnClientConnected(const TcpClient::ClientConnectedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		_connected = true;
+		Fill();
+	}
+
+	void OnResponseStarted(const HttpClient::ResponseStartedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		codes[args.Code()]++;
+	}
+
+	void OnContentReceived(const HttpClient::ContentReceivedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		received += args.Content().size();
+	}
+
+	void OnResponseEnded(const HttpClient::ResponseEndedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		latencies.Record(DateTime::Microseconds() - _inflight.front());
+		_inflight.pop_front();
+		completed++;
+
+		Fill();
+	}
+
+	void OnClientDisconnected(const TcpClient::ClientDisconnectedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		errors += _inflight.size();
+		_inflight.clear();
+		_connected = false;
+
+		// the client is deleted from the event loop, once it has finished raising its events.
+		if (_retired.empty()) {
+			Thread::Invoke(delegate(&Connection::Collect, this));
+		}
+
+		_retired.push_back(_client);
+
+		if (running) {
+			reconnects++;
+			Open();
+		}
+	}
+
+	void Collect() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		for (std::vector<HttpClient*>::iterator i = _retired.begin(); i != _retired.end(); i++) {
+			delete *i;
+		}
+
+		_retired.clear();
+	}
+
+public:
+	Connection() : _client(NULL), _retired(), _inflight(), _connected(false) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		Open();
+	}
+
+	/**
+	 * Opens a new connection to the server.
+	 */
+	void Open() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		_client = new HttpClient();
+		_client->Pipeline(depth > 1);
+		_client->ClientConnected() += delegate(&Connection::OnClientConnected, this);
+		_client->ResponseStarted() += delegate(&Connection::OnResponseStarted, this);
+		_client->ContentReceived() += delegate(&Connection::OnContentReceived, this);
+		_client->ResponseEnded() += delegate(&Connection::OnResponseEnded, this);
+		_client->ClientDisconnected() += delegate(&Connection::OnClientDisconnected, this);
+
+		try {
+			_client->Connect(Socket::Endpoint(host, port));
+		}
+		catch (const Socket::ConnectionRefusedException& e) {
+			Log::Error("unable to connect to %s:%d", host.c_str(), port);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	/**
+	 * Sends requests until the connection is full: the next scheduled requests if a rate was given, or new requests otherwise.
+	 */
+	void Fill() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		while (running && _connected && _inflight.size() < depth && (rate == 0 || backlog.empty() == false)) {
+			if (rate == 0) {
+				_inflight.push_back(DateTime::Microseconds());
+			}
+			else {
+				_inflight.push_back(backlog.front());
+				backlog.pop_front();
+			}
+
+			_client->Begin("GET", path, "HTTP/1.1")
+				.SendHeader("Host", host)
+				.SendHeader("User-Agent", "loadgen")
+				.Send("")
+				.End();
+		}
+	}
+
+	/**
+	 * The number of requests in flight on the connection.
+	 *
+	 * @return The number of requests.
+	 */
+	size_t Inflight() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _inflight.size();
+	}
+
+	/**
+	 * Records the latency that the requests in flight on the connection have reached so far.
+	 *
+	 * @param now The current time in microseconds.
+	 */
+	void RecordInflight(uint64_t now) const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		for (std::deque<uint64_t>::const_iterator i = _inflight.begin(); i != _inflight.end(); i++) {
+			latencies.Record(now - *i);
+		}
+	}
+};
+
+/**
+ * Schedules the requests that are due at the requested rate and gives them to the connections that have room for them.
+ */
+void Tick() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+	uint64_t due = (uint64_t) ((DateTime::Microseconds() - started) * rate / 1000000);
+
+	for (; scheduled < due; scheduled++) {
+		backlog.push_back(started + (uint64_t) (scheduled * 1000000 / rate));
+	}
+
+	for (std::vector<Connection*>::iterator i = connections.begin(); i != connections.end() && backlog.empty() == false; i++) {
+		(*i)->Fill();
+	}
+
+	if (running) {
+		Thread::SetTimeout(TimeSpan::FromMilliseconds(1), delegate(Tick));
+	}
+}
+
+void Report() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+	uint64_t now = DateTime::Microseconds();
+	double seconds = (now - started) / 1000000.0;
+	double percentiles[] = { 50, 75, 90, 99, 99.9, 99.99, 99.999, 100 };
+	size_t inflight = 0;
+
+	running = false;
+
+	for (std::vector<Connection*>::iterator i = connections.begin(); i != connections.end(); i++) {
+		inflight += (*i)->Inflight();
+	}
+
+	// with a rate, the requests the server has not answered yet are the slowest ones, so leaving them out would hide a stall.
+	if (rate != 0) {
+		for (std::vector<Connection*>::iterator i = connections.begin(); i != connections.end(); i++) {
+			(*i)->RecordInflight(now);
+		}
+
+		for (std::deque<uint64_t>::iterator i = backlog.begin(); i != backlog.end(); i++) {
+			latencies.Record(now - *i);
+		}
+	}
+
+	Log::Information("%lu requests in %.1fs, %.0f requests/s, %.2f MB/s", (unsigned long) completed, seconds, completed / seconds, received / seconds / 1048576);
+	Log::Information("%lu errors, %lu reconnects, %lu in flight, %lu scheduled but not sent", (unsigned long) errors, (unsigned long) reconnects, (unsigned long) inflight, (unsigned long) backlog.size());
+
+	if (rate != 0) {
+		Log::Information("latency includes %lu unanswered requests, counted at how long they had waited", (unsigned long) (inflight + backlog.size()));
+	}
+
+	for (std::map<int, size_t>::iterator i = codes.begin(); i != codes.end(); i++) {
+		Log::Information("%d: %lu responses", i->first, (unsigned long) i->second);
+	}
+
+	Log::Information("latency: mean %.3fms, min %.3fms, max %.3fms", latencies.Mean() / 1000, latencies.Minimum() / 1000.0, latencies.Maximum() / 1000.0);
+
+	for (size_t i = 0; i < sizeof(percentiles) / sizeof(*percentiles); i++) {
+		Log::Information("%8.3f%% %12.3fms", percentiles[i], latencies.Percentile(percentiles[i]) / 1000.0);
+	}
+
+	exit(errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+/**
+ * The entry point for the application.
+ * @param argc The number of elements in the second parameter.
+ * @param argv The array of arguments passed to this application from the system.
+ * @return EXIT_SUCCESS if the application completed successfully or EXIT_FAILURE if an error occurred.
+ */
+int main(int argc, char** argv) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+	Application::Initialize(argc, argv);
+
+#ifndef _WIN32
+	struct rlimit limit;
+
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+#endif
+
+	host = Application::GetParameter("--host", "localhost");
+	path = Application::GetParameter("--path", "/");
+	port = Application::GetParameter("--port", 80);
+	depth = Application::GetParameter<size_t>("--pipeline", 1);
+	rate = Application::GetParameter("--rate", 0.0);
+	started = DateTime::Microseconds();
+
+	for (size_t i = Application::GetParameter<size_t>("--connections", 16); i > 0; i--) {
+		connections.push_back(new Connection());
+	}
+
+	if (rate != 0) {
+		Tick();
+	}
+
+	Thread::SetTimeout(TimeSpan::FromSeconds(Application::GetParameter("--duration", 10)), delegate(Report));
+
+	return Application::Run();
+}
@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2012 Christopher M. Baker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/*
+ * Measures how quickly long query strings are decoded and their parameters found.
+ * Each query string has a number of parameters with long values, a few of them percent-encoded, and is decoded by splitting it into strings one character at a time, as a baseline, and then by QueryString.
+ * Each decoded query string is then looked up by key in the reverse order, as a routing expression that names the parameters in another order would:
+ *
+ *   ./querybench --iterations 20000
+ */
+
+#include "../include/Application.hpp"
+#include "../include/http/QueryString.hpp"
+using namespace nitrus;
+
+/**
+ * The number of parameters in the query string of each round.
+ */
+const size_t Rounds[] = { 4, 16, 64 };
+
+/**
+ * Decodes a query string by splitting it at each ampersand and equals sign, then decoding each character in turn.
+ *
+ * @param query The query string.
+ * @return The decoded keys and values.
+ */
+std::vector<std::pair<std::string, std::string> > Baseline(const std::string& query) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+	std::vector<std::pair<std::string, std::string> > parameters;
+	std::vector<std::string> pairs = String::Split(query, '&');
+
+	for (size_t i = 0; i < pairs.size(); i++) {
+		std::vector<std::string> keyAndValue = String::Split(pairs[i], '=');
+		std::string decoded[2];
+
+		for (size_t j = 0; j < keyAndValue.size() && j < 2; j++) {
+			for (size_t k = 0; k < keyAndValue[j].size(); k++) {
+				char c = keyAndValue[j][k];
+
+				if (c == '+') {
+					decoded[j] += ' ';
+				}
+				else if (c == '%' && k + 2 < keyAndValue[j].size()) {
+					decoded[j] += (char) strtol(keyAndValue[j].substr(k + 1, 2).c_str(), NULL, 16);
+					k += 2;
+				}
+				else {
+					decoded[j] += c;
+				}
+			}
+		}
+
+		parameters.push_back(std::make_pair(decoded[0], decoded[1]));
+	}
+
+	return parameters;
+}
+
+/**
+ * The entry point for the application.
+ * @param argc The number of elements in the second parameter.
+ * @param argv The array of arguments passed to this application from the system.
+ * @return EXIT_SUCCESS if the application completed successfully or EXIT_FAILURE if an error occurred.
+ */
+int main(int argc, char** argv) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+	Application::Initialize(argc, argv);
+
+	size_t iterations = Application::GetParameter<size_t>("--iterations", 20000);
+
+	for (size_t round = 0; round < sizeof(Rounds) / sizeof(*Rounds); round++) {
+		std::string query;
+		std::vector<std::string> keys;
+		size_t decoded = 0;
+		DateTime started;
+
+		for (size_t i = 0; i < Rounds[round]; i++) {
+			query += String::Format("%sparameter%lu=%s%s", i == 0 ? "" : "&", (unsigned long) i, std::string(48, 'a' + i % 26).c_str(), i % 4 == 0 ? "%20and+more" : "");
+		}
+
+		for (size_t i = Rounds[round]; i > 0; i--) {
+			keys.push_back(String::Format("parameter%lu", (unsigned long) i - 1));
+		}
+
+		started = DateTime::Utc();
+
+		for (size_t i = 0; i < iterations; i++) {
+			decoded += Baseline(query).size();
+		}
+
+		double baseline = (DateTime::Utc() - started).TotalSeconds();
+		started = DateTime::Utc();
+
+		for (size_t i = 0; i < iterations; i++) {
+			decoded += QueryString(query).Count();
+		}
+
+		double parsed = (DateTime::Utc() - started).TotalSeconds();
+		size_t matched = 0;
+
+		started = DateTime::Utc();
+
+		for (size_t i = 0; i < iterations; i++) {
+			QueryString parameters(query);
+
+			for (size_t j = 0; j < keys.size(); j++) {
+				matched += parameters.Find(keys[j]) != std::string::npos;
+			}
+		}
+
+		double routed = (DateTime::Utc() - started).TotalSeconds();
+
+		if (decoded != iterations * Rounds[round] * 2 || matched != iterations * Rounds[round]) {
+			Log::Error("the query string was not decoded as expected");
+			return EXIT_FAILURE;
+		}
+
+		Log::Information("%2lu parameters, %4lu bytes: baseline %7.1f MB/s, decoded %7.1f MB/s, decoded and found %7.1f MB/s", (unsigned long) Rounds[round], (unsigned long) query.size(), query.size() * iterations / baseline / 1048576, query.size() * iterations / parsed / 1048576, query.size() * iterations / routed / 1048576);
+	}
+
+	return EXIT_SUCCESS;
+}
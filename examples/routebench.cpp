@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2012 Christopher M. Baker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/*
+ * Measures how the cost of routing a rest request grows with the number of routes.
+ * A router and a raw tcp client run on the same event loop, and the client sends one keep-alive request at a time.
+ * The request matches a single route, and the router is given 10, then 100, then 1000 other routes that share its prefix but do not match, and which a linear search would try first:
+ *
+ *   ./routebench --requests 20000
+ */
+
+#include "../include/Application.hpp"
+#include "../include/rest/Rest.hpp"
+using namespace nitrus;
+
+#include <stdlib.h>
+
+size_t allocations = 0;
+
+void* operator new(size_t size) {
+	allocations++;
+
+	if (void* memory = malloc(size == 0 ? 1 : size)) {
+		return memory;
+	}
+
+	throw std::bad_alloc();
+}
+
+void operator delete(void* memory) throw() {
+	free(memory);
+}
+
+void operator delete(void* memory, size_t size) throw() {
+	free(memory);
+}
+
+/**
+ * The number of routes configured in each round.
+ */
+const size_t Rounds[] = { 10, 100, 1000 };
+
+Rest::Router router;
+TcpClient client;
+std::string response;
+std::string request;
+size_t current = 0;
+size_t configured = 0;
+size_t received = 0;
+size_t counted = 0;
+DateTime started;
+
+void ReadEntity(const Rest::Router::RequestEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+	args.Client()->Begin("HTTP/1.1", 200, "OK")
+		.SendHeader("Content-Type", "application/json")
+		.Send(String::Format("{ \"Id\": %lld }", (long long) args.Number(0)))
+		.End();
+}
+
+void Ignore(const Rest::Router::RequestEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+}
+
+/**
+ * Adds routes until the router has the number of routes for the current round.
+ */
+void Configure() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+	for (; configured < Rounds[current]; configured++) {
+		router.Configure(String::Format("/entities/item%lu", (unsigned long) configured))
+			.Get(Rest::Router::RequestEventHandler(Ignore));
+	}
+
+	received = 0;
+	counted = allocations;
+	started = DateTime::Utc();
+}
+
+void OnClientConnected(const TcpClient::ClientConnectedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+	client.Send(request);
+}
+
+void OnDataReceived(const TcpClient::DataReceivedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+	size_t requests = Application::GetParameter<size_t>("--requests", 20000);
+	size_t end;
+
+	response += args.Data();
+
+	while ((end = response.find("0\r\n\r\n")) != std::string::npos) {
+		response.erase(0, end + 5);
+		received++;
+	}
+
+	if (received == requests) {
+		double seconds = (DateTime::Utc() - started).TotalSeconds();
+
+		Log::Information("%4lu routes: %8.0f requests/s, %.1f allocations per request", (unsigned long) Rounds[current], requests / seconds, (double) (allocations - counted) / requests);
+
+		if (++current == sizeof(Rounds) / sizeof(*Rounds)) {
+			exit(EXIT_SUCCESS);
+		}
+
+		Configure();
+	}
+
+	client.Send(request);
+}
+
+/**
+ * The entry point for the application.
+ * @param argc The number of elements in the second parameter.
+ * @param argv The array of arguments passed to this application from the system.
+ * @return EXIT_SUCCESS if the application completed successfully or EXIT_FAILURE if an error occurred.
+ */
+int main(int argc, char** argv) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+	Application::Initialize(argc, argv);
+
+	int port = Application::GetParameter("--port", 9095);
+
+	router.Configure("/entities/{entityId:int}")
+		.Get(Rest::Router::RequestEventHandler(ReadEntity));
+
+	router.Bind(port);
+	router.Listen();
+
+	request = "GET /entities/42 HTTP/1.1\r\nHost: localhost\r\nUser-Agent: routebench\r\nAccept: application/json\r\n\r\n";
+	Configure();
+
+	client.ClientConnected() += delegate(OnClientConnected);
+	client.DataReceived() += delegate(OnDataReceived);
+	client.Connect(Socket::Endpoint("localhost", port));
+
+	return Application::Run();
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2012 Christopher M. Baker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/*
+ * Runs the unit tests that start threads, write files or open sockets, which are left out of application initialization.
+ * Scratch files are written to the temporary directory and removed afterwards, and sockets are only opened on the loopback interface, for example:
+ *
+ *   TMPDIR=/tmp ./unittest
+ */
+
+#include "../include/Application.hpp"
+#include "../include/WorkerPool.hpp"
+#include "../include/http/AccessLog.hpp"
+#include "../include/http/EventChannel.hpp"
+#include "../include/fs/FileCache.hpp"
+using namespace nitrus;
+
+#ifdef NDEBUG
+# error The unit tests are made of assertions, so they cannot be built with NDEBUG defined.
+#endif
+
+int main(int argc, char** argv) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+	Application::Initialize(argc, argv);
+
+	WorkerPool::UnitTest();
+	AccessLog::UnitTest();
+	FileCache::UnitTest();
+	EventChannel::UnitTest();
+
+	Log::Information("All unit tests have passed.");
+	return EXIT_SUCCESS;
+}
@@ -21,39 +21,146 @@
  *
  */
 
+/*
+ * Requests a path from a server, reusing one persistent connection for all of the requests, and reports how often a pooled connection was reused.
+ *
+ *   ./webclient --host localhost --port 9091 --path /entities --requests 100
+ *
+ * With --concurrency, several requests are kept in flight at once. With --pipeline, up to that many of them share a connection instead of each opening its own.
+ *
+ *   ./webclient --host localhost --port 9091 --path /entities --requests 1000 --concurrency 16 --pipeline 8
+ *
+ * With --output, the response content is written straight to a file instead of being held in memory, and the download progress is reported.
+ *
+ *   ./webclient --host localhost --port 9091 --path /large.iso --output large.iso
+ *
+ * With --hedge 1, a duplicate request is sent when a response is slower than most recent responses, and the first response wins.
+ * With --retries, a request that fails or is answered with 502, 503 or 504 is retried after a jittered backoff.
+ *
+ *   ./webclient --host localhost --port 9094 --path /backend/1 --requests 1000 --concurrency 8 --hedge 1 --retries 2
+ */
+
 #include "../include/Application.hpp"
-#include "../include/http/HttpClient.hpp"
+#include "../include/http/HttpAgent.hpp"
 using namespace nitrus;
 
+HttpAgent agent;
+size_t remaining = 0;
+size_t outstanding = 0;
+FILE* output = NULL;
+uint64_t downloaded = 0;
+int percent = -1;
+size_t unfetched = 0;
+
+void SendRequest();
+
 void OnResponseStarted(const HttpClient::ResponseStartedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-	HttpClient* client = static_cast<HttpClient*>(sender);
 	Log::Debug("OnResponseStarted (%s, %d, %s)", args.Protocol().c_str(), args.Code(), args.Description().c_str());
 }
 
 void OnHeaderReceived(const HttpClient::HeaderReceivedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-	HttpClient* client = static_cast<HttpClient*>(sender);
 	Log::Debug("OnHeaderReceived (%s, %s)", args.Key().c_str(), args.Value().c_str());
 }
 
 void OnContentReceived(const HttpClient::ContentReceivedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-	HttpClient* client = static_cast<HttpClient*>(sender);
 	Log::Debug("OnContentReceived (%d)", args.Content().length());
 }
 
+void OnProgressChanged(const HttpClient::ProgressChangedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+	// without a content length, progress is reported for every megabyte instead of every percent.
+	int step = args.Total() != 0 ? (int) (100 * args.Received() / args.Total()) : (int) (args.Received() >> 20);
+
+	if (output != NULL && step != percent) {
+		percent = step;
+
+		if (args.Total() != 0) {
+			Log::Information("downloaded %llu of %llu bytes (%d%%)", (unsigned long long) args.Received(), (unsigned long long) args.Total(), percent);
+		}
+		else {
+			Log::Information("downloaded %llu bytes", (unsigned long long) args.Received());
+		}
+	}
+
+	downloaded = args.Received();
+}
+
+void Report() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+	Log::Information("%lu requests, %lu connections, %lu pipelined, %lu failed, %.1f%% pool hit rate, %.3fms connecting, %.3fms saved",
+		(unsigned long) agent.Requests(), (unsigned long) agent.Connects(), (unsigned long) agent.Pipelined(), (unsigned long) agent.Failed(), 100 * agent.HitRate(),
+		agent.ConnectTime().TotalMilliseconds(), agent.ConnectTimeSaved().TotalMilliseconds());
+
+	if (Application::GetParameter("--hedge", 0) != 0 || Application::GetParameter("--retries", 0) != 0) {
+		Log::Information("%lu hedges sent, %lu hedges won, %lu retries, %lu fetches failed",
+			(unsigned long) agent.Hedges(), (unsigned long) agent.HedgesWon(), (unsigned long) agent.FetchRetries(), (unsigned long) unfetched);
+
+		exit(unfetched == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+
+	if (output != NULL) {
+		Log::Information("%llu bytes written to %s", (unsigned long long) downloaded, Application::GetParameter("--output", "").c_str());
+		fclose(output);
+	}
+
+	exit(agent.Failed() == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
 void OnResponseEnded(const HttpClient::ResponseEndedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-	HttpClient* client = static_cast<HttpClient*>(sender);
-	Log::Debug("OnResponseEnded");
+	Log::Debug("OnResponseEnded (%s)", static_cast<HttpAgent::Request*>(sender)->Reused() ? "reused" : "new connection");
+	outstanding--;
+	SendRequest();
+}
+
+void OnRequestFailed(const HttpAgent::RequestFailedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+	Log::Error("OnRequestFailed");
+	outstanding--;
+	SendRequest();
+}
+
+void OnFetchCompleted(const HttpAgent::FetchCompletedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+	Log::Debug("OnFetchCompleted (%d, %.3fms, %lu attempts%s)", args.GetResult().Code(), args.Elapsed().TotalMilliseconds(), (unsigned long) args.Attempts(), args.HedgeWon() ? ", hedge won" : "");
+
+	if (args.GetResult().GetStatus() != HttpAgent::Result::Status_Completed) {
+		unfetched++;
+	}
+
+	outstanding--;
+	SendRequest();
 }
 
-void OnClientConnected(const TcpClient::ClientConnectedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-	HttpClient* client = static_cast<HttpClient*>(sender);
+void SendRequest() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+	if (remaining == 0) {
+		if (outstanding == 0) {
+			Report();
+		}
+
+		return;
+	}
+
+	remaining--;
+	outstanding++;
+	percent = -1;
+
+	if (Application::GetParameter("--hedge", 0) != 0 || Application::GetParameter("--retries", 0) != 0) {
+		HttpAgent::Fetch& fetch = agent.BeginFetch(Socket::Endpoint(Application::GetParameter("--host", "localhost"), Application::GetParameter("--port", 80)), "GET", Application::GetParameter("--path", "/"));
+		fetch.FetchCompleted() += delegate(OnFetchCompleted);
+		fetch.Hedge(Application::GetParameter("--hedge", 0) != 0).Retry(Application::GetParameter<size_t>("--retries", 0));
+		fetch.SendHeader("Host", Application::GetParameter("--host", "localhost")).End();
+		return;
+	}
 
-	client->ResponseStarted() += delegate(OnResponseStarted);
-	client->HeaderReceived() += delegate(OnHeaderReceived);
-	client->ContentReceived() += delegate(OnContentReceived);
-	client->ResponseEnded() += delegate(OnResponseEnded);
+	HttpAgent::Request& request = agent.Begin(Socket::Endpoint(Application::GetParameter("--host", "localhost"), Application::GetParameter("--port", 80)), "GET", Application::GetParameter("--path", "/"));
+	request.ResponseStarted() += delegate(OnResponseStarted);
+	request.HeaderReceived() += delegate(OnHeaderReceived);
+	request.ContentReceived() += delegate(OnContentReceived);
+	request.ProgressChanged() += delegate(OnProgressChanged);
+	request.ResponseEnded() += delegate(OnResponseEnded);
+	request.RequestFailed() += delegate(OnRequestFailed);
 
-	client->Begin("GET", Application::GetParameter("--path", "/"), "HTTP/1.1").SendHeader("Host", Application::GetParameter("--host", "localhost")).SendHeader("Connection", "close").Send("").End();
+	if (output != NULL) {
+		request.Download(fileno(output));
+	}
+
+	request.SendHeader("Host", Application::GetParameter("--host", "localhost")).Send("").End();
 }
 
 /**
@@ -64,8 +171,17 @@ void OnClientConnected(const TcpClient::ClientConnectedEventArgs& args, void* se
  */
 int main(int argc, char** argv) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
 	Application::Initialize(argc, argv);
-	HttpClient client;
-	client.ClientConnected() += delegate(OnClientConnected);
-	client.Connect(Socket::Endpoint(Application::GetParameter("--host", "localhost"), Application::GetParameter("--port", 80)));
+	remaining = Application::GetParameter<size_t>("--requests", 1);
+	agent.Pipeline(Application::GetParameter<size_t>("--pipeline", 1));
+
+	if (Application::GetParameter("--output", "").empty() == false && (output = fopen(Application::GetParameter("--output", "").c_str(), "wb")) == NULL) {
+		Log::Error("unable to open %s", Application::GetParameter("--output", "").c_str());
+		return EXIT_FAILURE;
+	}
+
+	for (size_t i = Application::GetParameter<size_t>("--concurrency", 1); i > 0; i--) {
+		SendRequest();
+	}
+
 	return Application::Run();
 }
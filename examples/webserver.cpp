@@ -27,7 +27,7 @@ using namespace nitrus;
 
 #include <vector>
 
-typedef int EntityId;
+typedef int64_t EntityId;
 typedef std::vector<EntityId> EntityIdList;
 
 class Controller {
@@ -43,34 +43,56 @@ public:
 	static EntityId GetEntityById(EntityId id) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
 		return id;
 	}
+
+	static uint64_t CountPrimes(uint64_t limit) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		uint64_t count = 0;
+
+		for (uint64_t n = 2; n <= limit; n++) {
+			bool prime = true;
+
+			for (uint64_t d = 2; d * d <= n && prime; d++) {
+				prime = n % d != 0;
+			}
+
+			count += prime;
+		}
+
+		return count;
+	}
 };
 
 class JsonView {
 public:
-	template <typename Type> static void Single(const Rest::Router::RequestEventArgs& args, Type value, const Delegate<std::string (Type)>& transform) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-		args.Client()->Begin("HTTP/1.1", 200, "OK").SendHeader("Content-Type", "application/json").Send(transform(value)).End();
+	template <typename Type> static void Single(const Rest::Router::RequestEventArgs& args, Type value, const Delegate<void (JsonWriter&, Type)>& transform) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		args.Client()->Begin("HTTP/1.1", 200, "OK").SendHeader("Content-Type", "application/json");
+
+		JsonWriter json(args.Client());
+		transform(json, value);
+		json.Close();
+
+		args.Client()->End();
 	}
 	
-	template <typename Iterator, typename Type> static void Collection(const Rest::Router::RequestEventArgs& args, Iterator begin, Iterator end, const Delegate<std::string (Type)>& transform) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-		args.Client()->Begin("HTTP/1.1", 200, "OK").SendHeader("Content-Type", "application/json").Send("[");
+	template <typename Iterator, typename Type> static void Collection(const Rest::Router::RequestEventArgs& args, Iterator begin, Iterator end, const Delegate<void (JsonWriter&, Type)>& transform) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		args.Client()->Begin("HTTP/1.1", 200, "OK").SendHeader("Content-Type", "application/json");
 
-		for (Iterator i = begin; i != end; i++) {
-			if (i != begin) {
-				args.Client()->Send(",");
-			}
+		JsonWriter json(args.Client());
+		json.BeginArray();
 
-			args.Client()->Send(transform(*i));
+		for (Iterator i = begin; i != end; i++) {
+			transform(json, *i);
 		}
 
-		args.Client()->Send("]").End();
+		json.EndArray().Close();
+		args.Client()->End();
 	}
 
-	template <typename Container> static void Collection(const Rest::Router::RequestEventArgs& args, const Container& container, const Delegate<std::string (typename Container::value_type)>& transform) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+	template <typename Container> static void Collection(const Rest::Router::RequestEventArgs& args, const Container& container, const Delegate<void (JsonWriter&, typename Container::value_type)>& transform) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
 		Collection(args, container.begin(), container.end(), transform);
 	}
 
-	static std::string Transform(EntityId id) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-		return String::Format("{ \"Id\": %d }", id);
+	static void Transform(JsonWriter& json, EntityId id) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		json.BeginObject().Key("Id").Integer(id).EndObject();
 	}
 
 	static void ReadEntities(const Rest::Router::RequestEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
@@ -78,7 +100,43 @@ public:
 	}
 	
 	static void ReadEntity(const Rest::Router::RequestEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-		Single(args, Controller::GetEntityById(args.Match<EntityId>("entityId")), delegate(Transform));
+		Single(args, Controller::GetEntityById(args.Number(0)), delegate(Transform));
+	}
+
+	static void ReadCache(const Rest::Router::RequestEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		const ResponseCache& cache = static_cast<Rest::Router*>(sender)->Cache();
+
+		args.Client()->Begin("HTTP/1.1", 200, "OK").SendHeader("Content-Type", "application/json");
+
+		JsonWriter json(args.Client());
+		json.BeginObject()
+			.Key("Hits").Unsigned(cache.Hits())
+			.Key("Misses").Unsigned(cache.Misses())
+			.Key("Evictions").Unsigned(cache.Evictions())
+			.Key("Expirations").Unsigned(cache.Expirations())
+			.Key("Count").Unsigned(cache.Count())
+			.Key("Bytes").Unsigned(cache.Bytes())
+			.EndObject()
+			.Close();
+
+		args.Client()->End();
+	}
+
+	// runs on a worker thread, so it writes to the response it is given rather than to the client.
+	static void ReadPrimes(const Rest::Router::WorkRequest& args, HttpServer::Response& response) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		std::string content;
+		JsonWriter json(content);
+
+		json.BeginObject()
+			.Key("Limit").Unsigned(args.Number(0))
+			.Key("Count").Unsigned(Controller::CountPrimes(args.Number(0)))
+			.EndObject()
+			.Close();
+
+		response.Begin("HTTP/1.1", 200, "OK")
+			.SendHeader("Content-Type", "application/json")
+			.Send(content)
+			.End();
 	}
 };
 
@@ -94,11 +152,48 @@ int main(int argc, char** argv) { StackTrace trace(__METHOD__, __FILE__, __LINE_
 	Rest::Router router(Application::GetParameter("--document-root", "www"));
 
 	router.Configure("/entities")
-		.Get(Rest::Router::RequestEventHandler(JsonView::ReadEntities));
+		.Get(Rest::Router::RequestEventHandler(JsonView::ReadEntities))
+		.Cache(TimeSpan::FromSeconds(5), "Accept");
 		
-	router.Configure("/entities/{entityId}")
+	router.Configure("/entities/{entityId:int}")
 		.Get(Rest::Router::RequestEventHandler(JsonView::ReadEntity));
 
+	router.Configure("/cache")
+		.Get(Rest::Router::RequestEventHandler(JsonView::ReadCache));
+
+	// counting primes is slow for a large limit, so it runs on the worker threads, two requests at a time, and identical requests share a count.
+	router.Configure("/primes/{limit:uint}")
+		.Offload("GET", Rest::Router::WorkHandler(JsonView::ReadPrimes))
+		.Concurrency(2)
+		.Coalesce();
+
+	// each client may count primes ten times at once, and then twice a second.
+	RateLimiter limiter(2, 10);
+	router.Limit("/primes", limiter);
+
+	router.ServeMetrics("/metrics");
+
+	// forwards /api to upstream servers given as --upstream localhost:9101,localhost:9102
+	Proxy proxy;
+	std::vector<std::string> upstreams = String::Split(Application::GetParameter("--upstream"), ',');
+
+	for (std::vector<std::string>::iterator i = upstreams.begin(); i != upstreams.end(); i++) {
+		std::vector<std::string> endpoint = String::Split(*i, ':');
+
+		if (endpoint.size() == 2) {
+			proxy.Add(Socket::Endpoint(endpoint[0], String::Convert<int>(endpoint[1])));
+		}
+	}
+
+	if (proxy.Upstreams().empty() == false) {
+		proxy.HealthCheck(Application::GetParameter("--health-check", "/entities"));
+		router.Forward(Application::GetParameter("--upstream-prefix", "/api"), proxy);
+	}
+
+	if (Application::GetParameter("--access-log").empty() == false) {
+		router.EnableAccessLog(Application::GetParameter("--access-log"));
+	}
+
 	router.Bind(Application::GetParameter("--port", 9091));
 	router.Listen();
 
@@ -31,11 +31,14 @@
 #include "TimeSpan.hpp"
 #include "DateTime.hpp"
 #include "Thread.hpp"
+#include "Arena.hpp"
+#include "Histogram.hpp"
 
 #include <time.h>
 #include <stdlib.h>
 #include <signal.h>
 #include <map>
+#include <vector>
 
 #ifdef _WIN32
 # define SIGDEBUG SIGBREAK
@@ -51,12 +54,24 @@ namespace nitrus {
 class Application {
 private:
 	typedef std::map<std::string, std::string> ParameterMap;
+	typedef std::vector<void (*)()> UnitTestCollection;
 
 	/**
 	 * A map used to hold global application parameters.
 	 */
 	static ParameterMap Parameters;
 
+	/**
+	 * Gets the unit tests registered by classes outside of the core.
+	 * The collection is created on first use, so classes can register from their static initializers in any order.
+	 *
+	 * @return The registered unit tests.
+	 */
+	static UnitTestCollection& UnitTests() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		static UnitTestCollection tests;
+		return tests;
+	}
+
 	/**
 	 * This function is used as the handler for all process debug signals.
 	 * When a signal is received, debugging information is printed to the standard output stream.
@@ -119,10 +134,28 @@ private:
 		TimeSpan::UnitTest();
 		DateTime::UnitTest();
 		Thread::UnitTest();
+		Arena::UnitTest();
+		Histogram::UnitTest();
+
+		for (size_t i = 0; i < UnitTests().size(); i++) {
+			UnitTests()[i]();
+		}
 	}
 
 public:
 
+	/**
+	 * Registers the unit test of a class outside of the core, which is run after the core unit tests when the application is initialized.
+	 * Every application runs these tests, so they must not start threads, write files or open sockets.
+	 *
+	 * @param test The unit test function.
+	 * @return True, so that the registration can initialize a static member of the class.
+	 */
+	static bool RegisterUnitTest(void (*test)()) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		UnitTests().push_back(test);
+		return true;
+	}
+
 	/**
 	 * Sets a global application parameter.
 	 *
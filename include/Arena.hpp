@@ -0,0 +1,387 @@
+/*
+ * Copyright (c) 2012 Christopher M. Baker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef ARENA_HPP_
+#define ARENA_HPP_
+
+#include <assert.h>
+#include <stddef.h>
+#include <new>
+#include <vector>
+
+#include "StackTrace.hpp"
+
+namespace nitrus {
+
+/**
+ * A class that provides a bump allocator for data that is released all at once, such as the data for a single request.
+ * Memory is handed out from fixed size blocks and is only reclaimed when the arena is reset.
+ * Blocks released by a reset are kept in a pool shared by all arenas, so an arena holds no memory between resets and reuses blocks without returning to the heap.
+ * Arenas are intended for use on the event loop thread only.
+ */
+class Arena {
+public:
+
+	/**
+	 * The size of the blocks that allocations are made from.
+	 */
+	static size_t DefaultBlockSize;
+
+	/**
+	 * The maximum number of unused blocks kept in the shared pool.
+	 */
+	static size_t DefaultPoolSize;
+
+	/**
+	 * A class that adapts an arena to the standard allocator interface so that containers can be allocated from it.
+	 * Deallocation does nothing; the memory is reclaimed when the arena is reset.
+	 */
+	template <typename T> class Allocator {
+	public:
+		typedef T value_type;
+		typedef T* pointer;
+		typedef const T* const_pointer;
+		typedef T& reference;
+		typedef const T& const_reference;
+		typedef size_t size_type;
+		typedef ptrdiff_t difference_type;
+
+		template <typename U> struct rebind {
+			typedef Allocator<U> other;
+		};
+
+	private:
+		template <typename U> friend class Allocator;
+		Arena* _arena;
+
+	public:
+
+		/**
+		 * Creates a new allocator for the specified arena.
+		 *
+		 * @param arena The arena to allocate from.
+		 */
+		Allocator(Arena& arena) : _arena(&arena) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+		}
+
+		/**
+		 * Creates a new allocator from the specified allocator.
+		 *
+		 * @param that The allocator to clone.
+		 */
+		template <typename U> Allocator(const Allocator<U>& that) : _arena(that._arena) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+		}
+
+		/**
+		 * Allocates uninitialized memory for the specified number of elements.
+		 *
+		 * @param count The number of elements.
+		 * @param hint Unused.
+		 * @return The memory.
+		 */
+		pointer allocate(size_type count, const void* hint = 0) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return static_cast<pointer>(_arena->Allocate(count * sizeof(T)));
+		}
+
+		/**
+		 * Releases memory returned by allocate. This does nothing until the arena is reset.
+		 *
+		 * @param p The memory.
+		 * @param count The number of elements.
+		 */
+		void deallocate(pointer p, size_type count) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+		}
+
+		/**
+		 * Constructs an element in allocated memory.
+		 *
+		 * @param p The memory.
+		 * @param value The value to copy.
+		 */
+		void construct(pointer p, const T& value) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			new (static_cast<void*>(p)) T(value);
+		}
+
+		/**
+		 * Destroys an element without releasing its memory.
+		 *
+		 * @param p The element.
+		 */
+		void destroy(pointer p) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			p->~T();
+		}
+
+		/**
+		 * The largest number of elements that could be allocated.
+		 *
+		 * @return The number of elements.
+		 */
+		size_type max_size() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return ((size_type) -1) / sizeof(T);
+		}
+
+		/**
+		 * Returns the address of an element.
+		 *
+		 * @param value The element.
+		 * @return The address.
+		 */
+		pointer address(reference value) const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return &value;
+		}
+
+		/**
+		 * Returns the address of an element.
+		 *
+		 * @param value The element.
+		 * @return The address.
+		 */
+		const_pointer address(const_reference value) const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return &value;
+		}
+
+		/**
+		 * Determines whether memory from one allocator may be released by another.
+		 *
+		 * @param that The allocator to compare to.
+		 * @return True if both allocators use the same arena, false otherwise.
+		 */
+		template <typename U> bool operator == (const Allocator<U>& that) const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _arena == that._arena;
+		}
+
+		/**
+		 * Determines whether memory from one allocator may not be released by another.
+		 *
+		 * @param that The allocator to compare to.
+		 * @return True if the allocators use different arenas, false otherwise.
+		 */
+		template <typename U> bool operator != (const Allocator<U>& that) const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _arena != that._arena;
+		}
+	};
+
+private:
+
+	/**
+	 * The header at the beginning of every block.
+	 */
+	struct Block {
+		Block* next;
+		size_t size;
+		size_t used;
+	};
+
+	/**
+	 * The alignment of every allocation.
+	 */
+	static const size_t Alignment = 16;
+
+	/**
+	 * The unused blocks shared by all arenas.
+	 */
+	static std::vector<Block*> Pool;
+
+	Block* _blocks;
+	size_t _allocations;
+	size_t _bytes;
+
+private:
+
+	/**
+	 * Arenas own their blocks and cannot be copied.
+	 *
+	 * @param that The arena to clone.
+	 */
+	Arena(const Arena& that);
+
+	/**
+	 * Arenas own their blocks and cannot be copied.
+	 *
+	 * @param that The arena to clone.
+	 * @return A reference to this arena.
+	 */
+	Arena& operator = (const Arena& that);
+
+	/**
+	 * The offset of the first usable byte in a block.
+	 *
+	 * @return The offset.
+	 */
+	static size_t HeaderSize() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return (sizeof(Block) + Alignment - 1) & ~(Alignment - 1);
+	}
+
+	/**
+	 * Takes a block from the shared pool or the heap.
+	 *
+	 * @param size The minimum number of usable bytes.
+	 * @return The block.
+	 */
+	static Block* Acquire(size_t size) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		Block* block;
+
+		if (size <= DefaultBlockSize - HeaderSize() && Pool.empty() == false) {
+			block = Pool.back();
+			Pool.pop_back();
+		}
+		else {
+			size_t capacity = size + HeaderSize() > DefaultBlockSize ? size + HeaderSize() : DefaultBlockSize;
+			block = static_cast<Block*>(::operator new(capacity));
+			block->size = capacity;
+		}
+
+		block->next = NULL;
+		block->used = HeaderSize();
+		return block;
+	}
+
+	/**
+	 * Returns a block to the shared pool, or to the heap if the pool is full or the block is oversized.
+	 *
+	 * @param block The block.
+	 */
+	static void Release(Block* block) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		if (block->size == DefaultBlockSize && Pool.size() < DefaultPoolSize) {
+			Pool.push_back(block);
+		}
+		else {
+			::operator delete(block);
+		}
+	}
+
+public:
+
+	/**
+	 * Creates a new empty arena. No memory is acquired until the first allocation.
+	 */
+	Arena() : _blocks(NULL), _allocations(0), _bytes(0) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+	}
+
+	/**
+	 * Allocates uninitialized memory that remains valid until the arena is reset.
+	 *
+	 * @param size The number of bytes.
+	 * @return The memory.
+	 */
+	void* Allocate(size_t size) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		size = (size + Alignment - 1) & ~(Alignment - 1);
+
+		if (_blocks == NULL || _blocks->used + size > _blocks->size) {
+			Block* block = Acquire(size);
+			block->next = _blocks;
+			_blocks = block;
+		}
+
+		void* memory = reinterpret_cast<char*>(_blocks) + _blocks->used;
+		_blocks->used += size;
+		_allocations++;
+		_bytes += size;
+
+		return memory;
+	}
+
+	/**
+	 * Releases all of the memory allocated from this arena.
+	 * Any object still using the memory must not be used afterwards.
+	 */
+	void Reset() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		while (_blocks != NULL) {
+			Block* next = _blocks->next;
+			Release(_blocks);
+			_blocks = next;
+		}
+
+		_allocations = 0;
+		_bytes = 0;
+	}
+
+	/**
+	 * The number of allocations made since the arena was last reset.
+	 *
+	 * @return The number of allocations.
+	 */
+	size_t Allocations() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _allocations;
+	}
+
+	/**
+	 * The number of bytes allocated since the arena was last reset.
+	 *
+	 * @return The number of bytes.
+	 */
+	size_t Bytes() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _bytes;
+	}
+
+	/**
+	 * Performs unit testing on functions in this class to ensure expected operation.
+	 */
+	static void UnitTest() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		Arena arena;
+		char* a = static_cast<char*>(arena.Allocate(3));
+		char* b = static_cast<char*>(arena.Allocate(5));
+
+		assert(b - a == (ptrdiff_t) Alignment);
+		assert(arena.Allocations() == 2);
+		assert(arena.Bytes() == 2 * Alignment);
+
+		void* large = arena.Allocate(DefaultBlockSize * 2);
+		assert(large != NULL);
+
+		{
+			std::vector<int, Allocator<int> > values = std::vector<int, Allocator<int> >(Allocator<int>(arena));
+
+			for (int i = 0; i < 1000; i++) {
+				values.push_back(i);
+			}
+
+			assert(values[999] == 999);
+		}
+
+		size_t pooled = Pool.size();
+		arena.Reset();
+
+		assert(arena.Allocations() == 0);
+		assert(Pool.size() > pooled);
+	}
+
+	/**
+	 * Deletes this arena and releases its memory.
+	 */
+	virtual ~Arena() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		Reset();
+	}
+};
+
+size_t Arena::DefaultBlockSize = 4096;
+size_t Arena::DefaultPoolSize = 256;
+std::vector<Arena::Block*> Arena::Pool = std::vector<Arena::Block*>();
+
+}
+
+#endif /* ARENA_HPP_ */
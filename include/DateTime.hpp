@@ -457,6 +457,18 @@ public:
 		return Epoch() + TimeSpan::FromSeconds(tv.tv_sec) + TimeSpan::FromMilliseconds(tv.tv_usec / 1000) - TimeSpan::FromMinutes(tz.tz_minuteswest);
 	}
 
+	/**
+	 * Returns the current system time in microseconds since the Unix epoch, for measuring intervals more finely than a date and time can.
+	 *
+	 * @return The number of microseconds.
+	 */
+	static uint64_t Microseconds() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+
+		return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+	}
+
 	/**
 	 * Performs unit testing on functions in this class to ensure expected operation.
 	 */
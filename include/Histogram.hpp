@@ -0,0 +1,278 @@
+/*
+ * Copyright (c) 2012 Christopher M. Baker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef HISTOGRAM_HPP_
+#define HISTOGRAM_HPP_
+
+#include <assert.h>
+#include <stdint.h>
+#include <vector>
+
+#include "StackTrace.hpp"
+
+namespace nitrus {
+
+/**
+ * A class that counts values, such as latencies, in buckets of bounded relative error so that percentiles can be read back without keeping every value.
+ * The buckets follow the layout of an HDR histogram: each power of two is divided into the same number of linear sub-buckets, so every recorded value is within one part in 10^digits of the value it is counted as.
+ * Recording a value is a few shifts and an increment, and the memory used depends only on the range and precision, not on the number of values.
+ */
+class Histogram {
+private:
+	uint64_t _highest;
+	int _subBucketHalfCountMagnitude;
+	uint64_t _subBucketHalfCount;
+	uint64_t _subBucketMask;
+	std::vector<uint64_t> _counts;
+	uint64_t _count;
+	uint64_t _minimum;
+	uint64_t _maximum;
+	double _sum;
+
+private:
+
+	/**
+	 * Finds the position of the highest set bit of a value.
+	 *
+	 * @param value The value, which must not be zero.
+	 * @return The position, from zero.
+	 */
+	static int Magnitude(uint64_t value) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		int magnitude = 0;
+
+		while (value >>= 1) {
+			magnitude++;
+		}
+
+		return magnitude;
+	}
+
+	/**
+	 * Finds the bucket that counts a value.
+	 *
+	 * @param value The value.
+	 * @return The index of the count.
+	 */
+	size_t Index(uint64_t value) const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		int bucket = Magnitude(value | _subBucketMask) - _subBucketHalfCountMagnitude;
+		size_t subBucket = (size_t) (value >> bucket);
+
+		return ((size_t) bucket << _subBucketHalfCountMagnitude) + subBucket;
+	}
+
+	/**
+	 * Finds the highest value counted by a bucket.
+	 *
+	 * @param index The index of the count.
+	 * @return The value.
+	 */
+	uint64_t HighestValue(size_t index) const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		int bucket = (int) (index >> _subBucketHalfCountMagnitude) - 1;
+		uint64_t subBucket = (index & (_subBucketHalfCount - 1)) + _subBucketHalfCount;
+
+		if (bucket < 0) {
+			return index;
+		}
+
+		return ((subBucket + 1) << bucket) - 1;
+	}
+
+public:
+
+	/**
+	 * Creates a new empty histogram.
+	 *
+	 * @param highest The highest value that can be told apart; larger values are counted as this value.
+	 * @param digits The number of significant decimal digits kept for each value, from one to five.
+	 */
+	Histogram(uint64_t highest = 3600000000ULL, int digits = 3) : _highest(highest < 2 ? 2 : highest), _subBucketHalfCountMagnitude(0), _subBucketHalfCount(1), _subBucketMask(0), _counts(), _count(0), _minimum(0), _maximum(0), _sum(0) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		uint64_t resolution = 2;
+
+		for (int i = 0; i < digits; i++) {
+			resolution *= 10;
+		}
+
+		// a power of two of sub-buckets large enough for the requested precision, half of which are used by each bucket after the first.
+		while ((_subBucketHalfCount << 1) < resolution) {
+			_subBucketHalfCount <<= 1;
+			_subBucketHalfCountMagnitude++;
+		}
+
+		_subBucketMask = (_subBucketHalfCount << 1) - 1;
+		_counts.resize(Index(_highest) + 1);
+	}
+
+	/**
+	 * Counts a value.
+	 *
+	 * @param value The value.
+	 */
+	void Record(uint64_t value) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		if (value > _highest) {
+			value = _highest;
+		}
+
+		_counts[Index(value)]++;
+		_minimum = _count == 0 || value < _minimum ? value : _minimum;
+		_maximum = value > _maximum ? value : _maximum;
+		_sum += value;
+		_count++;
+	}
+
+	/**
+	 * Adds the values counted by another histogram with the same range and precision.
+	 *
+	 * @param that The histogram to add.
+	 */
+	void Add(const Histogram& that) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		assert(that._counts.size() == _counts.size());
+
+		if (that._count == 0) {
+			return;
+		}
+
+		for (size_t i = 0; i < _counts.size(); i++) {
+			_counts[i] += that._counts[i];
+		}
+
+		_minimum = _count == 0 || that._minimum < _minimum ? that._minimum : _minimum;
+		_maximum = that._maximum > _maximum ? that._maximum : _maximum;
+		_sum += that._sum;
+		_count += that._count;
+	}
+
+	/**
+	 * Removes every value.
+	 */
+	void Reset() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		_counts.assign(_counts.size(), 0);
+		_count = 0;
+		_minimum = 0;
+		_maximum = 0;
+		_sum = 0;
+	}
+
+	/**
+	 * The number of values counted.
+	 *
+	 * @return The number of values.
+	 */
+	uint64_t Count() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _count;
+	}
+
+	/**
+	 * The smallest value counted.
+	 *
+	 * @return The value, or zero if the histogram is empty.
+	 */
+	uint64_t Minimum() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _minimum;
+	}
+
+	/**
+	 * The largest value counted.
+	 *
+	 * @return The value, or zero if the histogram is empty.
+	 */
+	uint64_t Maximum() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _maximum;
+	}
+
+	/**
+	 * The mean of the values counted.
+	 *
+	 * @return The mean, or zero if the histogram is empty.
+	 */
+	double Mean() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _count == 0 ? 0.0 : _sum / _count;
+	}
+
+	/**
+	 * Finds the value that a percentage of the values counted are less than or equal to.
+	 *
+	 * @param percentile The percentage, from zero to one hundred.
+	 * @return The highest value in the bucket that contains the percentile, but no more than the largest value counted.
+	 */
+	uint64_t Percentile(double percentile) const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		uint64_t target = (uint64_t) (percentile / 100 * _count + 0.5);
+		uint64_t total = 0;
+
+		target = target == 0 ? 1 : target;
+
+		for (size_t i = 0; i < _counts.size() && _count != 0; i++) {
+			if ((total += _counts[i]) >= target) {
+				uint64_t value = HighestValue(i);
+				return value < _maximum ? value : _maximum;
+			}
+		}
+
+		return _maximum;
+	}
+
+	/**
+	 * Performs unit testing on functions in this class to ensure expected operation.
+	 */
+	static void UnitTest() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		Histogram histogram(3600000000ULL, 3);
+
+		for (uint64_t i = 1; i <= 10000; i++) {
+			histogram.Record(i);
+		}
+
+		assert(histogram.Count() == 10000);
+		assert(histogram.Minimum() == 1);
+		assert(histogram.Maximum() == 10000);
+		assert(histogram.Mean() == 5000.5);
+		assert(histogram.Percentile(0) == 1);
+		assert(histogram.Percentile(100) == 10000);
+
+		// values are counted to within one part in a thousand.
+		assert(histogram.Percentile(50) >= 5000 && histogram.Percentile(50) <= 5005);
+		assert(histogram.Percentile(99) >= 9900 && histogram.Percentile(99) <= 9910);
+
+		Histogram other(3600000000ULL, 3);
+		other.Record(1000000);
+		other.Record(7200000000ULL);
+		histogram.Add(other);
+
+		assert(histogram.Count() == 10002);
+		assert(histogram.Maximum() == 3600000000ULL);
+		assert(histogram.Percentile(99.995) >= 1000000 && histogram.Percentile(99.995) <= 1001000);
+
+		histogram.Reset();
+		assert(histogram.Count() == 0);
+		assert(histogram.Percentile(50) == 0);
+	}
+
+	/**
+	 * Deletes this histogram.
+	 */
+	virtual ~Histogram() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+	}
+};
+
+}
+
+#endif /* HISTOGRAM_HPP_ */
@@ -25,7 +25,7 @@
 #define STACKTRACE_HPP_
 
 #include <sstream>
-#include <deque>
+#include <cstddef>
 #include <stdexcept>
 #include <string>
 
@@ -41,11 +41,18 @@
 # endif
 #endif
 
+#ifdef _WIN32
+# define thread_local_storage __declspec(thread)
+#else
+# define thread_local_storage __thread
+#endif
+
 namespace nitrus {
 
 /**
  * A static class that provides functionality for stack tracing.
  * An instance of this class should be explicitly created at the beginning of every function.
+ * Each thread has its own stack, which is linked through the traces themselves so that pushing and popping never allocates.
  */
 class StackTrace {
 private:
@@ -55,8 +62,8 @@ private:
 	 *
 	 * @param that The stack trace to copy.
 	 */
-	StackTrace(const StackTrace& that) : _function(that._function), _file(that._file), _line(that._line) {
-		Collection.push_front(this);
+	StackTrace(const StackTrace& that) : _function(that._function), _file(that._file), _line(that._line), _next(Top) {
+		Top = this;
 	}
 
 	/**
@@ -82,15 +89,15 @@ public:
 	 * @param file The name of the source file containing the function. This can be either relative or absolute, but should always be the __FILE__ macro.
 	 * @param line The line of the source file that contains the function declaration. This is one-based and should always be the __LINE__ macro.
 	 */
-	StackTrace(const char* function, const char* file, int line) : _function(function), _file(file), _line(line) {
-		Collection.push_front(this);
+	StackTrace(const char* function, const char* file, int line) : _function(function), _file(file), _line(line), _next(Top) {
+		Top = this;
 	}
 
 	/**
 	 * Deletes the trace and pops it off of the static stack trace.
 	 */
 	virtual ~StackTrace() {
-		Collection.pop_front();
+		Top = _next;
 	}
 
 	/**
@@ -99,8 +106,8 @@ public:
 	 * @param stream The output stream to print to.
 	 */
 	static void Print(std::ostream& stream) {
-		for (Container::const_iterator i = Collection.begin(); i != Collection.end(); i++) {
-			stream << std::endl << " at " << (*i)->_function << " (" << (*i)->_file << ":" << (*i)->_line << ")";
+		for (const StackTrace* i = Top; i != NULL; i = i->_next) {
+			stream << std::endl << " at " << i->_function << " (" << i->_file << ":" << i->_line << ")";
 		}
 	}
 
@@ -142,15 +149,15 @@ public:
 	}
 
 private:
-	typedef std::deque<StackTrace*> Container;
-	static Container Collection;
+	static thread_local_storage StackTrace* Top;
 
 	const char* _function;
 	const char* _file;
 	int _line;
+	StackTrace* _next;
 };
 
-StackTrace::Container StackTrace::Collection = StackTrace::Container();
+thread_local_storage StackTrace* StackTrace::Top = NULL;
 
 }
 
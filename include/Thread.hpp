@@ -24,7 +24,9 @@
 #ifndef THREAD_HPP_
 #define THREAD_HPP_
 
+#include <algorithm>
 #include <queue>
+#include <vector>
 
 #include "StackTrace.hpp"
 #include "TimeSpan.hpp"
@@ -34,9 +36,41 @@
 #ifdef _WIN32
 # include <windows.h>
 # define msleep(ms) ::Sleep(ms)
+# define thread_handle HANDLE
+# define thread_start(handle, function, argument) ((handle = ::CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE) function, argument, 0, NULL)) != NULL)
+# define thread_join(handle) ::WaitForSingleObject(handle, INFINITE)
+# define mutex_handle CRITICAL_SECTION
+# define mutex_create(handle) ::InitializeCriticalSection(&handle)
+# define mutex_destroy(handle) ::DeleteCriticalSection(&handle)
+# define mutex_lock(handle) ::EnterCriticalSection(&handle)
+# define mutex_unlock(handle) ::LeaveCriticalSection(&handle)
+# define condition_handle CONDITION_VARIABLE
+# define condition_create(handle) ::InitializeConditionVariable(&handle)
+# define condition_destroy(handle)
+# define condition_wait(handle, mutex) ::SleepConditionVariableCS(&handle, &mutex, INFINITE)
+# define condition_signal(handle) ::WakeConditionVariable(&handle)
+# define condition_broadcast(handle) ::WakeAllConditionVariable(&handle)
+# define memory_barrier() ::MemoryBarrier()
 #else
 # include <unistd.h>
+# include <pthread.h>
+# include <sys/time.h>
 # define msleep(ms) ::usleep((ms) * 1000);
+# define thread_handle pthread_t
+# define thread_start(handle, function, argument) (::pthread_create(&handle, NULL, function, argument) == 0)
+# define thread_join(handle) ::pthread_join(handle, NULL)
+# define mutex_handle pthread_mutex_t
+# define mutex_create(handle) ::pthread_mutex_init(&handle, NULL)
+# define mutex_destroy(handle) ::pthread_mutex_destroy(&handle)
+# define mutex_lock(handle) ::pthread_mutex_lock(&handle)
+# define mutex_unlock(handle) ::pthread_mutex_unlock(&handle)
+# define condition_handle pthread_cond_t
+# define condition_create(handle) ::pthread_cond_init(&handle, NULL)
+# define condition_destroy(handle) ::pthread_cond_destroy(&handle)
+# define condition_wait(handle, mutex) ::pthread_cond_wait(&handle, &mutex)
+# define condition_signal(handle) ::pthread_cond_signal(&handle)
+# define condition_broadcast(handle) ::pthread_cond_broadcast(&handle)
+# define memory_barrier() __sync_synchronize()
 #endif
 
 
@@ -58,6 +92,11 @@ private:
 	 */
 	static DateTime Started;
 
+	/**
+	 * The smoothed amount of time, in milliseconds, that the oldest due delegate of each event loop iteration has waited past its scheduled time.
+	 */
+	static double AverageLag;
+
 	/**
 	 * A container class for a delegate that is invoked at a future time.
 	 */
@@ -102,6 +141,16 @@ private:
 			_delegate();
 		}
 
+		/**
+		 * Determines whether this future event handler invokes the specified delegate.
+		 *
+		 * @param delegate The delegate to compare to.
+		 * @return True if the delegates are equal, false otherwise.
+		 */
+		bool Invokes(const Delegate<void ()>& delegate) const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _delegate == delegate;
+		}
+
 		/**
 		 * Compares this future event handler to another future event handler.
 		 *
@@ -126,6 +175,97 @@ private:
 	typedef std::priority_queue<FutureEventHandler, std::vector<FutureEventHandler>, std::greater<FutureEventHandler> > EventQueue;
 	static EventQueue FutureEvents;
 
+	/**
+	 * A container class for the delegates posted to the event loop by other threads, and the lock and condition that guard them.
+	 */
+	class Mailbox {
+	private:
+
+		/**
+		 * Mailboxes own a lock and cannot be copied.
+		 *
+		 * @param that The mailbox to clone.
+		 */
+		Mailbox(const Mailbox& that);
+
+		/**
+		 * Mailboxes own a lock and cannot be copied.
+		 *
+		 * @param that The mailbox to clone.
+		 * @return A reference to this mailbox.
+		 */
+		Mailbox& operator = (const Mailbox& that);
+
+	public:
+		mutex_handle mutex;
+		condition_handle condition;
+		std::vector<Delegate<void ()> > delegates;
+
+		/**
+		 * Creates a new empty mailbox.
+		 */
+		Mailbox() : mutex(), condition(), delegates() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			mutex_create(mutex);
+			condition_create(condition);
+		}
+
+		/**
+		 * Deletes the mailbox.
+		 */
+		virtual ~Mailbox() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			condition_destroy(condition);
+			mutex_destroy(mutex);
+		}
+	};
+
+	static Mailbox Posted;
+
+	/**
+	 * The number of delegates that other threads are expected to post, which keeps the event loop running while nothing is scheduled.
+	 */
+	static size_t Retained;
+
+	/**
+	 * Schedules the delegates posted by other threads to be invoked as soon as the thread is capable.
+	 */
+	static void Collect() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		std::vector<Delegate<void ()> > delegates;
+
+		mutex_lock(Posted.mutex);
+		delegates.swap(Posted.delegates);
+		mutex_unlock(Posted.mutex);
+
+		for (size_t i = 0; i < delegates.size(); i++) {
+			Invoke(delegates[i]);
+		}
+	}
+
+	/**
+	 * Waits until the specified time span has passed or another thread has posted a delegate, whichever is first.
+	 *
+	 * @param timeSpan The longest amount of time to wait.
+	 */
+	static void Wait(const TimeSpan& timeSpan) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		DateTime started = DateTime::Utc();
+		mutex_lock(Posted.mutex);
+
+		if (Posted.delegates.empty()) {
+#ifdef _WIN32
+			::SleepConditionVariableCS(&Posted.condition, &Posted.mutex, (DWORD) (timeSpan.TotalMilliseconds() + 0.999));
+#else
+			struct timeval now;
+			gettimeofday(&now, NULL);
+
+			uint64_t deadline = (uint64_t) now.tv_sec * 1000000 + now.tv_usec + (uint64_t) (timeSpan.TotalMilliseconds() * 1000);
+			struct timespec until = { (time_t) (deadline / 1000000), (long) (deadline % 1000000) * 1000 };
+			::pthread_cond_timedwait(&Posted.condition, &Posted.mutex, &until);
+#endif
+		}
+
+		mutex_unlock(Posted.mutex);
+		Idle += DateTime::Utc() - started;
+	}
+
 public:
 
 	/**
@@ -138,6 +278,17 @@ public:
 		return (duration - Idle.TotalMilliseconds()) / duration;
 	}
 
+	/**
+	 * Returns the scheduling lag of the event loop.
+	 * This is a moving average, sampled once per event loop iteration, of how long the oldest due delegate has waited past the time it was scheduled for.
+	 * A burst of delegates invoked together therefore counts once, and a lag that continues to grow means the event loop is saturated.
+	 *
+	 * @return The average scheduling lag.
+	 */
+	static TimeSpan Lag() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return TimeSpan::FromMilliseconds(AverageLag);
+	}
+
 	/**
 	 * Signals the current thread to stop processing for the specified time span.
 	 *
@@ -170,15 +321,84 @@ public:
 	}
 
 	/**
-	 * Processes all of the scheduled delegates until there are no more to execute.
-	 * Sleeps when waiting for a scheduled delegate to be ready to invoke to reduce processor usage.
+	 * Schedules a delegate to be executed as soon as the thread is capable, from any other thread.
+	 * If the event loop is waiting for its next scheduled delegate, it is woken at once.
+	 *
+	 * @param delegate The delegate to invoke.
+	 */
+	static void Post(const Delegate<void ()>& delegate) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		mutex_lock(Posted.mutex);
+		Posted.delegates.push_back(delegate);
+		condition_signal(Posted.condition);
+		mutex_unlock(Posted.mutex);
+	}
+
+	/**
+	 * Removes every scheduled or posted invocation of a delegate that has not run yet.
+	 * This is called from the event loop by objects that are deleted while a delegate bound to them is still pending.
+	 *
+	 * @param delegate The delegate to remove.
+	 */
+	static void Cancel(const Delegate<void ()>& delegate) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		EventQueue remaining;
+
+		for (; FutureEvents.empty() == false; FutureEvents.pop()) {
+			if (FutureEvents.top().Invokes(delegate) == false) {
+				remaining.push(FutureEvents.top());
+			}
+		}
+
+		FutureEvents = remaining;
+
+		mutex_lock(Posted.mutex);
+		Posted.delegates.erase(std::remove(Posted.delegates.begin(), Posted.delegates.end(), delegate), Posted.delegates.end());
+		mutex_unlock(Posted.mutex);
+	}
+
+	/**
+	 * Keeps the event loop running while nothing is scheduled, because another thread is expected to post a delegate.
+	 * Each call must be balanced by a call to Release, and both are called from the event loop.
+	 */
+	static void Retain() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		Retained++;
+	}
+
+	/**
+	 * Releases the event loop from waiting for a delegate to be posted by another thread.
+	 */
+	static void Release() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		Retained--;
+	}
+
+	/**
+	 * Processes all of the scheduled delegates until there are no more to execute and none are expected from other threads.
+	 * Waits when no scheduled delegate is ready to invoke to reduce processor usage, and wakes early for delegates posted by other threads.
+	 * Each iteration invokes every delegate that was due when it began, and delegates scheduled meanwhile wait for the next iteration.
 	 */
 	static void Run() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-		while (FutureEvents.empty() == false) {
-			FutureEventHandler event = FutureEvents.top();
-			FutureEvents.pop();
-			Sleep(event.Time() - DateTime::Utc());
-			event();
+		while (FutureEvents.empty() == false || Retained != 0) {
+			Collect();
+
+			if (FutureEvents.empty()) {
+				Wait(TimeSpan::FromSeconds(1));
+				continue;
+			}
+
+			DateTime now = DateTime::Utc();
+			DateTime due = FutureEvents.top().Time();
+
+			if (due > now) {
+				Wait(due - now);
+				continue;
+			}
+
+			AverageLag = AverageLag * 0.9 + (now - due).TotalMilliseconds() * 0.1;
+
+			while (FutureEvents.empty() == false && FutureEvents.top().Time() <= now) {
+				FutureEventHandler event = FutureEvents.top();
+				FutureEvents.pop();
+				event();
+			}
 		}
 	}
 
@@ -193,6 +413,9 @@ public:
 Thread::EventQueue Thread::FutureEvents = Thread::EventQueue();
 TimeSpan Thread::Idle = TimeSpan::Zero();
 DateTime Thread::Started = DateTime::Utc();
+Thread::Mailbox Thread::Posted;
+size_t Thread::Retained = 0;
+double Thread::AverageLag = 0;
 
 }
 
@@ -0,0 +1,326 @@
+/*
+ * Copyright (c) 2012 Christopher M. Baker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef WORKERPOOL_HPP_
+#define WORKERPOOL_HPP_
+
+#include "StackTrace.hpp"
+#include "Delegate.hpp"
+#include "Thread.hpp"
+
+#include <assert.h>
+#include <stdexcept>
+#include <deque>
+#include <vector>
+
+namespace nitrus {
+
+/**
+ * A class that runs work on a fixed number of background threads and hands each piece of work back to the event loop once it is done.
+ * Work is taken by the threads in the order it was queued, and finished work is posted to the event loop, which waits for it only while some is outstanding.
+ * The work itself must not touch anything the event loop owns, such as connections, since it runs at the same time as the event loop.
+ */
+class WorkerPool {
+public:
+
+	/**
+	 * The default number of background threads.
+	 */
+	static size_t DefaultThreads;
+
+	/**
+	 * A class that encapsulates an exception when the background threads could not be started.
+	 */
+	class WorkerPoolException : public std::runtime_error {
+	public:
+
+		/**
+		 * Creates a new worker pool exception.
+		 */
+		WorkerPoolException() : std::runtime_error(__METHOD__) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+		}
+
+		/**
+		 * Deletes this exception.
+		 */
+		virtual ~WorkerPoolException() throw() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+		}
+	};
+
+private:
+
+	/**
+	 * A piece of work, and what the event loop does once it is done.
+	 */
+	struct Job {
+		Delegate<void ()> work;
+		Delegate<void ()> completed;
+	};
+
+	std::vector<thread_handle> _threads;
+	mutex_handle _mutex;
+	condition_handle _condition;
+	std::deque<Job> _queued;
+	std::deque<Job> _finished;
+	bool _running;
+	size_t _outstanding;
+
+private:
+
+	/**
+	 * Worker pools own background threads and cannot be copied.
+	 *
+	 * @param that The worker pool to clone.
+	 */
+	WorkerPool(const WorkerPool& that);
+
+	/**
+	 * Worker pools own background threads and cannot be copied.
+	 *
+	 * @param that The worker pool to clone.
+	 * @return A reference to this worker pool.
+	 */
+	WorkerPool& operator = (const WorkerPool& that);
+
+	/**
+	 * The entry point for each background thread.
+	 * Takes queued work until the pool is deleted, and posts an update to the event loop when the first piece of a batch is finished.
+	 *
+	 * @param argument The worker pool.
+	 * @return Nothing.
+	 */
+	static void* Run(void* argument) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		WorkerPool* pool = static_cast<WorkerPool*>(argument);
+
+		mutex_lock(pool->_mutex);
+
+		while (true) {
+			while (pool->_running && pool->_queued.empty()) {
+				condition_wait(pool->_condition, pool->_mutex);
+			}
+
+			if (pool->_running == false) {
+				break;
+			}
+
+			Job job = pool->_queued.front();
+			pool->_queued.pop_front();
+			mutex_unlock(pool->_mutex);
+
+			job.work();
+
+			mutex_lock(pool->_mutex);
+			pool->_finished.push_back(job);
+
+			// the update that was already posted hands back everything finished before it runs
+			if (pool->_finished.size() == 1) {
+				Thread::Post(delegate(&WorkerPool::Update, pool));
+			}
+		}
+
+		mutex_unlock(pool->_mutex);
+		return NULL;
+	}
+
+	/**
+	 * Hands the finished work to the event loop, and releases the event loop once no work is outstanding.
+	 */
+	void Update() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		std::deque<Job> finished;
+
+		mutex_lock(_mutex);
+		finished.swap(_finished);
+		mutex_unlock(_mutex);
+
+		_outstanding -= finished.size();
+
+		if (_outstanding == 0) {
+			Thread::Release();
+		}
+
+		for (std::deque<Job>::iterator i = finished.begin(); i != finished.end(); i++) {
+			i->completed();
+		}
+	}
+
+public:
+
+	/**
+	 * Creates a new worker pool and starts its background threads.
+	 *
+	 * @param threads The number of background threads.
+	 */
+	WorkerPool(size_t threads = DefaultThreads) : _threads(), _mutex(), _condition(), _queued(), _finished(), _running(true), _outstanding(0) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		mutex_create(_mutex);
+		condition_create(_condition);
+
+		for (size_t i = 0; i < (threads == 0 ? 1 : threads); i++) {
+			thread_handle thread;
+
+			if (thread_start(thread, Run, this) == false) {
+				Stop();
+				throw WorkerPoolException();
+			}
+
+			_threads.push_back(thread);
+		}
+	}
+
+	/**
+	 * Queues work to run on a background thread.
+	 * This is called from the event loop, and the completion is invoked on the event loop once the work is done.
+	 *
+	 * @param work The work, which runs on a background thread.
+	 * @param completed The delegate invoked on the event loop once the work is done.
+	 */
+	void Queue(const Delegate<void ()>& work, const Delegate<void ()>& completed) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		Job job;
+		job.work = work;
+		job.completed = completed;
+
+		mutex_lock(_mutex);
+		_queued.push_back(job);
+		condition_signal(_condition);
+		mutex_unlock(_mutex);
+
+		if (_outstanding++ == 0) {
+			Thread::Retain();
+		}
+	}
+
+	/**
+	 * The number of background threads.
+	 *
+	 * @return The number of threads.
+	 */
+	size_t Threads() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _threads.size();
+	}
+
+	/**
+	 * The number of pieces of work that have been queued and not yet handed back to the event loop.
+	 *
+	 * @return The number of pieces of work.
+	 */
+	size_t Outstanding() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _outstanding;
+	}
+
+	/**
+	 * Performs unit testing on functions in this class to ensure expected operation.
+	 */
+	static void UnitTest() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		WorkerPool pool(2);
+		std::vector<Counter> counters(100);
+
+		assert(pool.Threads() == 2);
+
+		for (size_t i = 0; i < counters.size(); i++) {
+			pool.Queue(delegate(&Counter::Work, &counters[i]), delegate(&Counter::Completed, &counters[i]));
+		}
+
+		assert(pool.Outstanding() == 100);
+		Thread::Run();
+		assert(pool.Outstanding() == 0);
+
+		for (size_t i = 0; i < counters.size(); i++) {
+			assert(counters[i].worked && counters[i].completed);
+		}
+
+		// deleting a pool with work outstanding drops the completions, and the event loop stops waiting for them.
+		std::vector<Counter> dropped(100);
+		WorkerPool* stopped = new WorkerPool(1);
+
+		for (size_t i = 0; i < dropped.size(); i++) {
+			stopped->Queue(delegate(&Counter::Work, &dropped[i]), delegate(&Counter::Completed, &dropped[i]));
+		}
+
+		delete stopped;
+		Thread::Run();
+
+		for (size_t i = 0; i < dropped.size(); i++) {
+			assert(dropped[i].completed == false);
+		}
+	}
+
+	/**
+	 * Deletes this worker pool.
+	 * This will stop the background threads once they have finished the work they are running. Work that has not been handed back to the event loop is dropped without its completion, and the event loop no longer waits for it.
+	 */
+	virtual ~WorkerPool() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		Stop();
+		Thread::Cancel(delegate(&WorkerPool::Update, this));
+
+		if (_outstanding != 0) {
+			Thread::Release();
+		}
+	}
+
+private:
+
+	/**
+	 * Marks a piece of work run by the unit test, which is only completed once it has been worked.
+	 */
+	struct Counter {
+		bool worked;
+		bool completed;
+
+		Counter() : worked(false), completed(false) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+		}
+
+		void Work() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			worked = true;
+		}
+
+		void Completed() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			completed = worked;
+		}
+	};
+
+	/**
+	 * Stops the background threads and waits for them to finish.
+	 */
+	void Stop() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		mutex_lock(_mutex);
+		_running = false;
+		condition_broadcast(_condition);
+		mutex_unlock(_mutex);
+
+		for (size_t i = 0; i < _threads.size(); i++) {
+			thread_join(_threads[i]);
+		}
+
+		_threads.clear();
+		condition_destroy(_condition);
+		mutex_destroy(_mutex);
+	}
+};
+
+size_t WorkerPool::DefaultThreads = 4;
+
+}
+
+#endif /* WORKERPOOL_HPP_ */
@@ -26,10 +26,29 @@
 
 #include "../StackTrace.hpp"
 #include "../Event.hpp"
+#include "../String.hpp"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #include <vector>
 
+#ifdef _WIN32
+# include <process.h>
+# define file_seek ::_fseeki64
+# define process_id() ::_getpid()
+# define temporary_variable "TEMP"
+# define temporary_directory "."
+#else
+# include <unistd.h>
+# define file_seek ::fseeko
+# define process_id() ::getpid()
+# define temporary_variable "TMPDIR"
+# define temporary_directory "/tmp"
+#endif
+
 namespace nitrus {
 
 /**
@@ -136,6 +155,7 @@ private:
 	private:
 		FILE* _file;
 		std::vector<char> _buffer;
+		uint64_t _remaining;
 		ChunkReadEvent _chunkRead;
 		EndOfFileEvent _endOfFile;
 
@@ -148,13 +168,20 @@ private:
 		 * If the end of file is reached, this function will automatically dispose of this object.
 		 */
 		void Update() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-			size_t count = fread(&_buffer[0], 1, _buffer.size(), _file);
+			size_t count = _buffer.size();
+
+			if (_remaining < count) {
+				count = (size_t) _remaining;
+			}
+
+			count = fread(&_buffer[0], 1, count, _file);
+			_remaining -= count;
 
 			if (count > 0) {
 				_chunkRead(ChunkReadEventArgs(std::string(&_buffer[0], count)), this);
 			}
 
-			if (feof(_file)) {
+			if (_remaining == 0 || feof(_file) || ferror(_file)) {
 				_endOfFile(EndOfFileEventArgs(), this);
 				delete this;
 			}
@@ -170,11 +197,18 @@ private:
 		 *
 		 * @param path The path of the file to read.
 		 * @param bufferSize The desired size of each chunk.
+		 * @param offset The position in the file to start reading from.
+		 * @param length The maximum number of bytes to read.
 		 */
-		FileReader(const std::string& path, size_t bufferSize) : _file(fopen(path.c_str(), "rb")), _buffer(bufferSize), _chunkRead(), _endOfFile() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		FileReader(const std::string& path, size_t bufferSize, uint64_t offset, uint64_t length) : _file(fopen(path.c_str(), "rb")), _buffer(bufferSize), _remaining(length), _chunkRead(), _endOfFile() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
 			if (_file == NULL) {
 				throw FileNotFoundException();
 			}
+
+			if (offset != 0 && file_seek(_file, offset, SEEK_SET) != 0) {
+				fclose(_file);
+				throw FileNotFoundException();
+			}
 		}
 		
 		/**
@@ -182,7 +216,7 @@ private:
 		 *
 		 * @param that The file reader to clone.
 		 */
-		FileReader(const FileReader& that) : _file(that._file), _buffer(that._buffer), _chunkRead(that._chunkRead), _endOfFile(that._endOfFile) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		FileReader(const FileReader& that) : _file(that._file), _buffer(that._buffer), _remaining(that._remaining), _chunkRead(that._chunkRead), _endOfFile(that._endOfFile) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
 			
 		}
 		
@@ -194,6 +228,7 @@ private:
 		FileReader& operator = (const FileReader& that) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
 			_file = that._file;
 			_buffer = that._buffer;
+			_remaining = that._remaining;
 			_chunkRead = that._chunkRead;
 			_endOfFile = that._endOfFile;
 			
@@ -244,14 +279,32 @@ public:
 	 * @param chunkRead The method to invoke when a chunk has been read from the file.
 	 * @param endOfFile The method to invoke when all chunks have been read from the file and the end of file has been reached.
 	 * @param chunkSize The desired chunk size.
+	 * @param offset The position in the file to start reading from.
+	 * @param length The maximum number of bytes to read. By default the file is read until the end of file is reached.
 	 */
-	static void Read(const std::string& path, const ChunkReadEventHandler& chunkRead = ChunkReadEventHandler::Empty(), const EndOfFileEventHandler& endOfFile = EndOfFileEventHandler::Empty(), size_t chunkSize = DefaultChunkSize) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-		FileReader* reader = new FileReader(path, chunkSize);
+	static void Read(const std::string& path, const ChunkReadEventHandler& chunkRead = ChunkReadEventHandler::Empty(), const EndOfFileEventHandler& endOfFile = EndOfFileEventHandler::Empty(), size_t chunkSize = DefaultChunkSize, uint64_t offset = 0, uint64_t length = UINT64_MAX) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		FileReader* reader = new FileReader(path, chunkSize, offset, length);
 		reader->ChunkRead() += chunkRead;
 		reader->EndOfFile() += endOfFile;
 		reader->Read();
 	}
 
+	/**
+	 * Determines the size of a file.
+	 *
+	 * @param path The file path.
+	 * @return The size of the file in bytes.
+	 */
+	static uint64_t Size(const std::string& path) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		struct stat status;
+
+		if (stat(path.c_str(), &status) != 0) {
+			throw FileNotFoundException();
+		}
+
+		return (uint64_t) status.st_size;
+	}
+
 	/**
 	 * Extracts the file extension from a file path.
 	 *
@@ -267,6 +320,18 @@ public:
 
 		return path.substr(index + 1);
 	}
+
+	/**
+	 * Gets the path of a scratch file in the temporary directory that is unique to this process.
+	 * Unit tests run whenever an application starts, so their files must not go to the working directory or race another process.
+	 *
+	 * @param name The name of the file.
+	 * @return The path of the file.
+	 */
+	static std::string TemporaryPath(const std::string& name) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		const char* directory = getenv(temporary_variable);
+		return String::Format("%s/%s-%lu.tmp", directory == NULL || *directory == 0 ? temporary_directory : directory, name.c_str(), (unsigned long) process_id());
+	}
 };
 
 size_t File::DefaultChunkSize = 4096;
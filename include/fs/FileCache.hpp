@@ -0,0 +1,653 @@
+/*
+ * Copyright (c) 2012 Christopher M. Baker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef FILECACHE_HPP_
+#define FILECACHE_HPP_
+
+#include "../StackTrace.hpp"
+#include "../String.hpp"
+#include "../TimeSpan.hpp"
+#include "../DateTime.hpp"
+#include "File.hpp"
+#include "Directory.hpp"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <list>
+#include <map>
+#include <string>
+
+#ifdef _WIN32
+# include <io.h>
+# include <fcntl.h>
+# define file_open(path) ::_open(path, _O_RDONLY | _O_BINARY)
+# define file_close(handle) ::_close(handle)
+# define file_read_at(handle, buffer, size, offset) (::_lseeki64(handle, (__int64) (offset), SEEK_SET) < 0 ? -1 : ::_read(handle, buffer, (unsigned int) (size)))
+# define file_status struct _stat64
+# define file_stat(path, status) ::_stat64(path, status)
+# define file_fstat(handle, status) ::_fstat64(handle, status)
+#else
+# include <fcntl.h>
+# include <unistd.h>
+# define file_open(path) ::open(path, O_RDONLY)
+# define file_close(handle) ::close(handle)
+# define file_read_at(handle, buffer, size, offset) ::pread(handle, buffer, size, (off_t) (offset))
+# define file_status struct stat
+# define file_stat(path, status) ::stat(path, status)
+# define file_fstat(handle, status) ::fstat(handle, status)
+#endif
+
+namespace nitrus {
+
+/**
+ * A class that keeps what is known about recently served files, so that serving a file again needs no file system calls.
+ * Each file is looked up once and then revalidated with a single stat once its revalidation period has passed, and is reloaded if its size, modification time or inode changed.
+ * Small files are held entirely in memory and larger files are kept open, so that they can be read without opening them again.
+ * Paths that do not exist are remembered too, and once the cache holds more than its capacity the least recently used files are forgotten.
+ */
+class FileCache {
+public:
+
+	/**
+	 * The number of files that a cache holds by default, which bounds the number of files it keeps open.
+	 */
+	static size_t DefaultCapacity;
+
+	/**
+	 * The size of the largest file that is held in memory by default.
+	 */
+	static uint64_t DefaultInlineSize;
+
+	/**
+	 * How long a file is trusted by default before it is checked for changes.
+	 */
+	static TimeSpan DefaultRevalidation;
+
+	/**
+	 * A class that encapsulates a file kept open by the cache.
+	 * Whoever reads from it holds a reference, so it stays open until they are done even if the cache has forgotten the file.
+	 */
+	class Descriptor {
+	private:
+		int _handle;
+		size_t _references;
+
+	private:
+
+		/**
+		 * Descriptors own an open file and cannot be copied.
+		 *
+		 * @param that The descriptor to clone.
+		 */
+		Descriptor(const Descriptor& that);
+
+		/**
+		 * Descriptors own an open file and cannot be copied.
+		 *
+		 * @param that The descriptor to clone.
+		 * @return A reference to this descriptor.
+		 */
+		Descriptor& operator = (const Descriptor& that);
+
+		/**
+		 * Closes the file.
+		 */
+		virtual ~Descriptor() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			file_close(_handle);
+		}
+
+	public:
+
+		/**
+		 * Creates a new descriptor for an open file, holding one reference.
+		 *
+		 * @param handle The handle of the open file.
+		 */
+		Descriptor(int handle) : _handle(handle), _references(1) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+		}
+
+		/**
+		 * Takes another reference to this descriptor.
+		 *
+		 * @return This descriptor.
+		 */
+		Descriptor* Acquire() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_references++;
+			return this;
+		}
+
+		/**
+		 * Gives up a reference to this descriptor, and closes the file once no references are left.
+		 */
+		void Release() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			if (--_references == 0) {
+				delete this;
+			}
+		}
+
+		/**
+		 * Reads from the file at a position, without moving any shared position.
+		 *
+		 * @param buffer The buffer to read into.
+		 * @param size The most bytes to read.
+		 * @param offset The position in the file to read from.
+		 * @return The number of bytes read, which is zero at the end of the file or if the read failed.
+		 */
+		size_t Read(char* buffer, size_t size, uint64_t offset) const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			long count = (long) file_read_at(_handle, buffer, size, offset);
+			return count < 0 ? 0 : (size_t) count;
+		}
+	};
+
+	/**
+	 * A class that encapsulates what is known about a path.
+	 */
+	class Entry {
+	private:
+		friend class FileCache;
+
+		std::string _path;
+		bool _exists;
+		bool _directory;
+		uint64_t _size;
+		time_t _modified;
+		uint64_t _inode;
+		std::string _contentType;
+		std::string _content;
+		bool _loaded;
+		Descriptor* _descriptor;
+		DateTime _validated;
+
+	public:
+
+		/**
+		 * Creates a new entry for a path that has not been looked up.
+		 *
+		 * @param path The path.
+		 */
+		Entry(const std::string& path = "") : _path(path), _exists(false), _directory(false), _size(0), _modified(0), _inode(0), _contentType(), _content(), _loaded(false), _descriptor(NULL), _validated() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+		}
+
+		/**
+		 * Creates a new entry from the specified entry, sharing its open file.
+		 *
+		 * @param that The entry to clone.
+		 */
+		Entry(const Entry& that) : _path(that._path), _exists(that._exists), _directory(that._directory), _size(that._size), _modified(that._modified), _inode(that._inode), _contentType(that._contentType), _content(that._content), _loaded(that._loaded), _descriptor(that._descriptor == NULL ? NULL : that._descriptor->Acquire()), _validated(that._validated) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+		}
+
+		/**
+		 * Copies the specified entry into this entry, sharing its open file.
+		 *
+		 * @param that The entry to clone.
+		 * @return A reference to this entry.
+		 */
+		Entry& operator = (const Entry& that) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			Descriptor* descriptor = that._descriptor == NULL ? NULL : that._descriptor->Acquire();
+
+			if (_descriptor != NULL) {
+				_descriptor->Release();
+			}
+
+			_path = that._path;
+			_exists = that._exists;
+			_directory = that._directory;
+			_size = that._size;
+			_modified = that._modified;
+			_inode = that._inode;
+			_contentType = that._contentType;
+			_content = that._content;
+			_loaded = that._loaded;
+			_descriptor = descriptor;
+			_validated = that._validated;
+
+			return *this;
+		}
+
+		/**
+		 * The path.
+		 *
+		 * @return The path.
+		 */
+		const std::string& Path() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _path;
+		}
+
+		/**
+		 * Determines whether the path is a file or a directory that could be opened.
+		 *
+		 * @return True if the path exists, false otherwise.
+		 */
+		bool Exists() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _exists;
+		}
+
+		/**
+		 * Determines whether the path is a directory.
+		 *
+		 * @return True if the path is a directory, false otherwise.
+		 */
+		bool IsDirectory() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _directory;
+		}
+
+		/**
+		 * The size of the file.
+		 *
+		 * @return The number of bytes.
+		 */
+		uint64_t Size() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _size;
+		}
+
+		/**
+		 * The time the file was last modified.
+		 *
+		 * @return The number of seconds since the epoch.
+		 */
+		time_t Modified() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _modified;
+		}
+
+		/**
+		 * The media type of the file, from its extension.
+		 *
+		 * @return The media type.
+		 */
+		const std::string& ContentType() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _contentType;
+		}
+
+		/**
+		 * Determines whether the contents of the file are held in memory.
+		 *
+		 * @return True if the contents are in memory, false if the file must be read with Open.
+		 */
+		bool IsLoaded() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _loaded;
+		}
+
+		/**
+		 * The contents of the file, if they are held in memory.
+		 *
+		 * @return The contents.
+		 */
+		const std::string& Content() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _content;
+		}
+
+		/**
+		 * Takes a reference to the open file, for a file whose contents are not held in memory.
+		 * The reference must be released once the file has been read.
+		 *
+		 * @return The descriptor, or NULL if the file is not kept open.
+		 */
+		Descriptor* Open() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _descriptor == NULL ? NULL : _descriptor->Acquire();
+		}
+
+		/**
+		 * Deletes this entry.
+		 */
+		virtual ~Entry() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			if (_descriptor != NULL) {
+				_descriptor->Release();
+			}
+		}
+	};
+
+private:
+	typedef std::list<Entry> Entries;
+	typedef std::map<std::string, Entries::iterator> Index;
+
+	Entries _entries;
+	Index _index;
+	size_t _capacity;
+	uint64_t _inlineSize;
+	TimeSpan _revalidation;
+	size_t _bytes;
+	uint64_t _hits;
+	uint64_t _misses;
+
+private:
+
+	/**
+	 * Caches cannot be copied, since the index refers to the entries by position.
+	 *
+	 * @param that The cache to clone.
+	 */
+	FileCache(const FileCache& that);
+
+	/**
+	 * Caches cannot be copied, since the index refers to the entries by position.
+	 *
+	 * @param that The cache to clone.
+	 * @return A reference to this cache.
+	 */
+	FileCache& operator = (const FileCache& that);
+
+	/**
+	 * Looks up a path, replacing anything known about it.
+	 * The file is opened once, and either read into memory and closed or kept open.
+	 *
+	 * @param entry The entry to fill in.
+	 */
+	void Load(Entry& entry) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		_bytes -= entry._content.size();
+		entry = Entry(entry._path);
+
+		int handle = file_open(entry._path.c_str());
+		file_status status;
+
+		if (handle < 0) {
+			entry._directory = Directory::Exists(entry._path);
+			entry._exists = entry._directory;
+			return;
+		}
+
+		if (file_fstat(handle, &status) != 0) {
+			file_close(handle);
+			return;
+		}
+
+		entry._exists = true;
+		entry._directory = (status.st_mode & S_IFMT) == S_IFDIR;
+		entry._size = (uint64_t) status.st_size;
+		entry._modified = status.st_mtime;
+		entry._inode = (uint64_t) status.st_ino;
+
+		if (entry._directory) {
+			file_close(handle);
+			return;
+		}
+
+		entry._contentType = ContentType(entry._path);
+
+		if (entry._size > _inlineSize) {
+			entry._descriptor = new Descriptor(handle);
+			return;
+		}
+
+		entry._content.resize((size_t) entry._size);
+
+		size_t count = 0;
+
+		while (count < entry._content.size()) {
+			long read = (long) file_read_at(handle, &entry._content[count], entry._content.size() - count, count);
+
+			if (read <= 0) {
+				break;
+			}
+
+			count += (size_t) read;
+		}
+
+		file_close(handle);
+		entry._content.resize(count);
+		entry._size = count;
+		entry._loaded = true;
+		_bytes += count;
+	}
+
+	/**
+	 * Determines whether a path still looks the same as when it was looked up, with a single stat.
+	 *
+	 * @param entry The entry for the path.
+	 * @return True if the path is unchanged, false otherwise.
+	 */
+	static bool Unchanged(const Entry& entry) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		file_status status;
+
+		if (file_stat(entry._path.c_str(), &status) != 0) {
+			return entry._exists == false;
+		}
+
+		return entry._exists && entry._directory == ((status.st_mode & S_IFMT) == S_IFDIR) && entry._size == (uint64_t) status.st_size && entry._modified == status.st_mtime && entry._inode == (uint64_t) status.st_ino;
+	}
+
+public:
+
+	/**
+	 * Creates a new empty cache.
+	 *
+	 * @param capacity The number of files to hold.
+	 * @param inlineSize The size of the largest file to hold in memory. Larger files are kept open instead.
+	 * @param revalidation How long a file is trusted before it is checked for changes.
+	 */
+	FileCache(size_t capacity = DefaultCapacity, uint64_t inlineSize = DefaultInlineSize, const TimeSpan& revalidation = DefaultRevalidation) : _entries(), _index(), _capacity(capacity == 0 ? 1 : capacity), _inlineSize(inlineSize), _revalidation(revalidation), _bytes(0), _hits(0), _misses(0) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+	}
+
+	/**
+	 * The media type for a file, from its extension.
+	 *
+	 * @param path The path of the file.
+	 * @return The media type, which is application/octet-stream for an unknown extension.
+	 */
+	static std::string ContentType(const std::string& path) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		static const char* types[][2] = {
+			{ "html", "text/html; charset=utf-8" },
+			{ "htm", "text/html; charset=utf-8" },
+			{ "css", "text/css; charset=utf-8" },
+			{ "js", "text/javascript; charset=utf-8" },
+			{ "json", "application/json" },
+			{ "txt", "text/plain; charset=utf-8" },
+			{ "xml", "application/xml" },
+			{ "svg", "image/svg+xml" },
+			{ "png", "image/png" },
+			{ "jpg", "image/jpeg" },
+			{ "jpeg", "image/jpeg" },
+			{ "gif", "image/gif" },
+			{ "webp", "image/webp" },
+			{ "ico", "image/x-icon" },
+			{ "woff", "font/woff" },
+			{ "woff2", "font/woff2" },
+			{ "wasm", "application/wasm" },
+			{ "pdf", "application/pdf" },
+			{ "mp4", "video/mp4" }
+		};
+
+		std::string extension = String::ToLowerCase(File::GetExtension(path));
+
+		for (size_t i = 0; i < sizeof(types) / sizeof(*types); i++) {
+			if (extension == types[i][0]) {
+				return types[i][1];
+			}
+		}
+
+		return "application/octet-stream";
+	}
+
+	/**
+	 * Finds what is known about a path, looking it up or revalidating it if needed.
+	 * The entry is only valid until the cache is next used.
+	 *
+	 * @param path The path.
+	 * @return The entry for the path.
+	 */
+	const Entry& Find(const std::string& path) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		DateTime now = DateTime::Utc();
+		Index::iterator i = _index.find(path);
+
+		if (i != _index.end()) {
+			Entry& entry = *i->second;
+			_entries.splice(_entries.begin(), _entries, i->second);
+
+			if (now - entry._validated >= _revalidation) {
+				if (Unchanged(entry) == false) {
+					Load(entry);
+					_misses++;
+				}
+				else {
+					_hits++;
+				}
+
+				entry._validated = now;
+				return entry;
+			}
+
+			_hits++;
+			return entry;
+		}
+
+		_misses++;
+		_entries.push_front(Entry(path));
+		_index[path] = _entries.begin();
+
+		Load(_entries.front());
+		_entries.front()._validated = now;
+
+		while (_entries.size() > _capacity) {
+			_bytes -= _entries.back()._content.size();
+			_index.erase(_entries.back()._path);
+			_entries.pop_back();
+		}
+
+		return _entries.front();
+	}
+
+	/**
+	 * Forgets every file.
+	 * Files still being read stay open until they are released.
+	 */
+	void Clear() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		_entries.clear();
+		_index.clear();
+		_bytes = 0;
+	}
+
+	/**
+	 * The number of files this cache holds.
+	 *
+	 * @return The number of files.
+	 */
+	size_t Capacity() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _capacity;
+	}
+
+	/**
+	 * The number of paths held, including those that do not exist.
+	 *
+	 * @return The number of paths.
+	 */
+	size_t Count() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _entries.size();
+	}
+
+	/**
+	 * The number of bytes of file contents held in memory.
+	 *
+	 * @return The number of bytes.
+	 */
+	size_t Bytes() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _bytes;
+	}
+
+	/**
+	 * The number of lookups answered without opening the file.
+	 *
+	 * @return The number of hits.
+	 */
+	uint64_t Hits() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _hits;
+	}
+
+	/**
+	 * The number of lookups that opened the file, because it was not held or had changed.
+	 *
+	 * @return The number of misses.
+	 */
+	uint64_t Misses() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _misses;
+	}
+
+	/**
+	 * Performs unit testing on functions in this class to ensure expected operation.
+	 */
+	static void UnitTest() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		assert(ContentType("/index.HTML") == "text/html; charset=utf-8");
+		assert(ContentType("/a/b.min.js") == "text/javascript; charset=utf-8");
+		assert(ContentType("/archive") == "application/octet-stream");
+
+		FileCache cache(2, 4, TimeSpan::Zero());
+		std::string path = File::TemporaryPath("nitrus-filecache");
+		FILE* file = fopen(path.c_str(), "wb");
+
+		assert(file != NULL);
+		fwrite("abc", 1, 3, file);
+		fclose(file);
+
+		const Entry& small = cache.Find(path);
+		assert(small.Exists() && small.IsDirectory() == false && small.IsLoaded() && small.Content() == "abc" && small.Size() == 3);
+		assert(small.ContentType() == "application/octet-stream" && cache.Bytes() == 3);
+
+		cache.Find(path);
+		assert(cache.Hits() == 1 && cache.Misses() == 1);
+
+		// a changed size is noticed on the next lookup, and a file larger than the inline size is kept open instead.
+		file = fopen(path.c_str(), "wb");
+		fwrite("abcdef", 1, 6, file);
+		fclose(file);
+
+		const Entry& large = cache.Find(path);
+		Descriptor* descriptor = large.Open();
+		char buffer[8];
+
+		assert(large.IsLoaded() == false && large.Size() == 6 && descriptor != NULL && cache.Misses() == 2 && cache.Bytes() == 0);
+		assert(descriptor->Read(buffer, sizeof(buffer), 2) == 4 && std::string(buffer, 4) == "cdef");
+
+		// the file stays open for its reader after the cache forgets it.
+		cache.Clear();
+		assert(descriptor->Read(buffer, 1, 0) == 1 && buffer[0] == 'a');
+		descriptor->Release();
+
+		remove(path.c_str());
+		assert(cache.Find(path).Exists() == false);
+		assert(cache.Find(".").IsDirectory() && cache.Find(".").Exists());
+
+		cache.Find(File::TemporaryPath("nitrus-filecache-missing"));
+		assert(cache.Count() == 2);
+	}
+
+	/**
+	 * Deletes this cache.
+	 */
+	virtual ~FileCache() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+	}
+};
+
+size_t FileCache::DefaultCapacity = 256;
+uint64_t FileCache::DefaultInlineSize = 65536;
+TimeSpan FileCache::DefaultRevalidation = TimeSpan::FromSeconds(1);
+
+}
+
+#endif /* FILECACHE_HPP_ */
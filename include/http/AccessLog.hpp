@@ -0,0 +1,376 @@
+/*
+ * Copyright (c) 2012 Christopher M. Baker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef ACCESSLOG_HPP_
+#define ACCESSLOG_HPP_
+
+#include "../StackTrace.hpp"
+#include "../String.hpp"
+#include "../TimeSpan.hpp"
+#include "../DateTime.hpp"
+#include "../Thread.hpp"
+#include "../net/Socket.hpp"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <vector>
+
+#ifdef _WIN32
+# define time_utc(time, result) ::gmtime_s(result, time)
+#else
+# define time_utc(time, result) ::gmtime_r(time, result)
+#endif
+
+namespace nitrus {
+
+/**
+ * A class that writes http access records to a file from a background thread.
+ * Each connection fills in a fixed size record as its request arrives, copying the raw bytes of the request line, and the event loop copies the completed record into a fixed size ring buffer.
+ * Records are formatted and written in batches by the background thread, so recording a request never allocates on the event loop.
+ * The ring buffer has a single producer (the event loop) and a single consumer (the background thread), so no locks are required.
+ * When the ring buffer is full, records are dropped and counted rather than blocking the event loop.
+ */
+class AccessLog {
+public:
+
+	/**
+	 * How often the background thread writes pending records to the file.
+	 */
+	static TimeSpan DefaultFlushFrequency;
+
+	/**
+	 * The default number of records the ring buffer can hold.
+	 */
+	static size_t DefaultCapacity;
+
+	/**
+	 * A class that encapsulates an exception when the access log could not be started.
+	 */
+	class AccessLogException : public std::runtime_error {
+	public:
+
+		/**
+		 * Creates a new access log exception.
+		 */
+		AccessLogException() : std::runtime_error(__METHOD__) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+		}
+
+		/**
+		 * Deletes this exception.
+		 */
+		virtual ~AccessLogException() throw() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+		}
+	};
+
+	/**
+	 * A fixed size record of a single request.
+	 * Strings are truncated so that recording a request never allocates.
+	 */
+	struct Record {
+		uint64_t time;
+		uint64_t latency;
+		uint64_t bytes;
+		int status;
+		int port;
+		char method[16];
+		char address[48];
+		char path[256];
+
+		/**
+		 * Sets the client of the record, which stays the same for every request of a connection.
+		 *
+		 * @param endpoint The endpoint of the client.
+		 */
+		void Client(const Socket::Endpoint& endpoint) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			port = endpoint.Port();
+			Copy(address, sizeof(address), endpoint.Address().data(), endpoint.Address().size());
+		}
+
+		/**
+		 * Sets the request of the record, copying the method and path straight out of the received request line.
+		 *
+		 * @param method The first byte of the request method.
+		 * @param methodLength The number of bytes in the request method.
+		 * @param path The first byte of the request path.
+		 * @param pathLength The number of bytes in the request path.
+		 */
+		void Request(const char* method, size_t methodLength, const char* path, size_t pathLength) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			Copy(this->method, sizeof(this->method), method, methodLength);
+			Copy(this->path, sizeof(this->path), path, pathLength);
+		}
+	};
+
+private:
+	FILE* _file;
+	std::vector<Record> _records;
+	size_t _mask;
+	volatile size_t _head;
+	volatile size_t _tail;
+	volatile size_t _dropped;
+	volatile bool _running;
+	unsigned int _flush;
+	thread_handle _thread;
+
+private:
+
+	/**
+	 * Access logs own a background thread and cannot be copied.
+	 *
+	 * @param that The access log to clone.
+	 */
+	AccessLog(const AccessLog& that);
+
+	/**
+	 * Access logs own a background thread and cannot be copied.
+	 *
+	 * @param that The access log to clone.
+	 * @return A reference to this access log.
+	 */
+	AccessLog& operator = (const AccessLog& that);
+
+	/**
+	 * Creates a new access log that writes to an open file without a background thread.
+	 * Pending records are only written by Flush or on deletion, which lets the unit test fill the ring buffer deterministically.
+	 *
+	 * @param file The open file, which is closed when the access log is deleted.
+	 * @param capacity The number of records that may be pending before records are dropped. This is rounded up to a power of two.
+	 */
+	AccessLog(FILE* file, size_t capacity) : _file(file), _records(), _mask(0), _head(0), _tail(0), _dropped(0), _running(false), _flush(0), _thread() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		Reserve(capacity);
+	}
+
+	/**
+	 * Sizes the ring buffer.
+	 *
+	 * @param capacity The number of records that may be pending before records are dropped. This is rounded up to a power of two.
+	 */
+	void Reserve(size_t capacity) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		size_t size = 1;
+
+		while (size < capacity) {
+			size <<= 1;
+		}
+
+		_records.resize(size);
+		_mask = size - 1;
+	}
+
+	/**
+	 * Copies bytes into a fixed size buffer as a string, truncating them if necessary.
+	 *
+	 * @param destination The buffer.
+	 * @param size The size of the buffer.
+	 * @param source The first byte to copy.
+	 * @param length The number of bytes to copy.
+	 */
+	static void Copy(char* destination, size_t size, const char* source, size_t length) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		size_t count = length < size - 1 ? length : size - 1;
+		memcpy(destination, source, count);
+		destination[count] = '\0';
+	}
+
+	/**
+	 * Formats and writes all pending records to the file.
+	 * This runs on the background thread, so it must not use StackTrace or any function that does.
+	 */
+	void Flush() {
+		char line[512];
+		char date[32];
+		size_t head = _head;
+		memory_barrier();
+
+		for (size_t i = _tail; i != head; i++) {
+			const Record& record = _records[i & _mask];
+			time_t seconds = (time_t) (record.time / 1000000);
+			struct tm utc;
+
+			time_utc(&seconds, &utc);
+			strftime(date, sizeof(date), "%d/%b/%Y:%H:%M:%S +0000", &utc);
+
+			int length = snprintf(line, sizeof(line), "%s:%d - - [%s] \"%s %s\" %d %llu %lluus\n", record.address, record.port, date, record.method, record.path, record.status, (unsigned long long) record.bytes, (unsigned long long) record.latency);
+
+			if (length > 0) {
+				fwrite(line, 1, (size_t) length < sizeof(line) ? (size_t) length : sizeof(line) - 1, _file);
+			}
+		}
+
+		memory_barrier();
+		_tail = head;
+		fflush(_file);
+	}
+
+	/**
+	 * The entry point for the background thread.
+	 * This runs on the background thread, so it must not use StackTrace or any function that does.
+	 *
+	 * @param argument The access log.
+	 * @return Nothing.
+	 */
+	static void* Run(void* argument) {
+		AccessLog* log = static_cast<AccessLog*>(argument);
+
+		while (log->_running) {
+			msleep(log->_flush);
+			log->Flush();
+		}
+
+		log->Flush();
+		return NULL;
+	}
+
+public:
+
+	/**
+	 * Creates a new access log that appends to the specified file.
+	 *
+	 * @param path The path of the log file.
+	 * @param capacity The number of records that may be pending before records are dropped. This is rounded up to a power of two.
+	 * @param flush How often pending records are written to the file.
+	 */
+	AccessLog(const std::string& path, size_t capacity = DefaultCapacity, const TimeSpan& flush = DefaultFlushFrequency) : _file(fopen(path.c_str(), "ab")), _records(), _mask(0), _head(0), _tail(0), _dropped(0), _running(true), _flush((unsigned int) flush.TotalMilliseconds()), _thread() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		if (_file == NULL) {
+			throw AccessLogException();
+		}
+
+		Reserve(capacity);
+
+		if (thread_start(_thread, Run, this) == false) {
+			fclose(_file);
+			throw AccessLogException();
+		}
+	}
+
+	/**
+	 * Records a completed request.
+	 * This is called from the event loop and only copies the record into the ring buffer.
+	 *
+	 * @param request The record of the client and request.
+	 * @param status The response status code.
+	 * @param bytes The number of response content bytes.
+	 * @param started The time the request started arriving, in microseconds since the epoch.
+	 * @param ended The time the response was ended, in microseconds since the epoch.
+	 */
+	void Write(const Record& request, int status, uint64_t bytes, uint64_t started, uint64_t ended) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		size_t head = _head;
+
+		if (head - _tail > _mask) {
+			_dropped++;
+			return;
+		}
+
+		Record& record = _records[head & _mask];
+		record = request;
+		record.time = ended;
+		record.latency = ended > started ? ended - started : 0;
+		record.bytes = bytes;
+		record.status = status;
+
+		memory_barrier();
+		_head = head + 1;
+	}
+
+	/**
+	 * The number of records that have been dropped because the ring buffer was full.
+	 *
+	 * @return The number of records.
+	 */
+	size_t Dropped() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _dropped;
+	}
+
+	/**
+	 * Performs unit testing on functions in this class to ensure expected operation.
+	 */
+	static void UnitTest() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		std::string method = "GET";
+		std::string target = "/index.html?q=1";
+		Record request;
+
+		request.Client(Socket::Endpoint("127.0.0.1", 8080));
+		request.Request(method.data(), method.size(), target.data(), 11);
+		assert(std::string(request.path) == "/index.html" && std::string(request.address) == "127.0.0.1" && request.port == 8080);
+
+		FILE* file = tmpfile();
+
+		if (file == NULL) {
+			throw AccessLogException();
+		}
+
+		// the ring holds four records and is only flushed when asked, so the last two of six are dropped
+		AccessLog log(file, 3);
+
+		for (int i = 0; i < 6; i++) {
+			log.Write(request, 200 + i, 10, 1000000000000000ULL, 1000000000001500ULL);
+		}
+
+		assert(log.Dropped() == 2);
+		log.Flush();
+
+		// flushing frees the ring again
+		for (int i = 0; i < 5; i++) {
+			log.Write(request, 204 + i, 10, 1000000000000000ULL, 1000000000001500ULL);
+		}
+
+		assert(log.Dropped() == 3);
+		log.Flush();
+
+		char line[512];
+		int lines = 0;
+		rewind(file);
+
+		while (fgets(line, sizeof(line), file) != NULL) {
+			assert(strstr(line, "127.0.0.1:8080 - - [") == line && strstr(line, String::Format("\"GET /index.html\" %d 10 1500us\n", 200 + lines).c_str()) != NULL);
+			lines++;
+		}
+
+		assert(lines == 8);
+	}
+
+	/**
+	 * Deletes this access log.
+	 * This will stop the background thread after all pending records have been written.
+	 */
+	virtual ~AccessLog() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		if (_running) {
+			_running = false;
+			thread_join(_thread);
+		}
+		else {
+			Flush();
+		}
+
+		fclose(_file);
+	}
+};
+
+TimeSpan AccessLog::DefaultFlushFrequency = TimeSpan::FromMilliseconds(100);
+size_t AccessLog::DefaultCapacity = 4096;
+
+}
+
+#endif /* ACCESSLOG_HPP_ */
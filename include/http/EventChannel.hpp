@@ -0,0 +1,473 @@
+/*
+ * Copyright (c) 2012 Christopher M. Baker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef EVENTCHANNEL_HPP_
+#define EVENTCHANNEL_HPP_
+
+#include "../StackTrace.hpp"
+#include "../String.hpp"
+#include "../Thread.hpp"
+#include "HttpServer.hpp"
+
+#include <assert.h>
+#include <deque>
+#include <map>
+
+namespace nitrus {
+
+/**
+ * A class that broadcasts server-sent events (text/event-stream) to a set of subscribed http clients.
+ * Each event is serialized once into a shared buffer that is referenced by every subscriber until it has been written.
+ * Subscribers that fall too far behind are disconnected rather than buffering without bound.
+ */
+class EventChannel {
+public:
+
+	/**
+	 * The default maximum number of unsent bytes a subscriber may have before it is disconnected.
+	 */
+	static size_t DefaultBacklogSize;
+
+	/**
+	 * How often pending events are retried for subscribers that could not accept all data.
+	 */
+	static TimeSpan DefaultFlushFrequency;
+
+private:
+
+	/**
+	 * A class that provides a reference counted, immutable buffer.
+	 * The buffer holds a single event framed as a chunk so that it can be written to chunked and unchunked responses alike.
+	 */
+	class SharedBuffer {
+	private:
+		struct Contents {
+			std::string data;
+			size_t header;
+			size_t references;
+		};
+
+		Contents* _contents;
+
+	public:
+
+		/**
+		 * Creates a new shared buffer containing the specified event payload.
+		 *
+		 * @param payload The serialized event.
+		 */
+		SharedBuffer(const std::string& payload) : _contents(new Contents()) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			std::string header = String::Format("%x\r\n", (unsigned) payload.size());
+
+			_contents->data.reserve(header.size() + payload.size() + 2);
+			_contents->data.append(header).append(payload).append("\r\n");
+			_contents->header = header.size();
+			_contents->references = 1;
+		}
+
+		/**
+		 * Creates a new reference to the specified shared buffer.
+		 *
+		 * @param that The shared buffer to reference.
+		 */
+		SharedBuffer(const SharedBuffer& that) : _contents(that._contents) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_contents->references++;
+		}
+
+		/**
+		 * Changes this buffer to reference the specified shared buffer.
+		 *
+		 * @param that The shared buffer to reference.
+		 * @return A reference to this shared buffer.
+		 */
+		SharedBuffer& operator = (const SharedBuffer& that) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			that._contents->references++;
+			Release();
+			_contents = that._contents;
+
+			return *this;
+		}
+
+		/**
+		 * Returns the bytes to send to a client.
+		 *
+		 * @param chunked True to include the chunk framing, false for the event payload only.
+		 * @return The start of the bytes.
+		 */
+		const char* Data(bool chunked) const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _contents->data.data() + (chunked ? 0 : _contents->header);
+		}
+
+		/**
+		 * Returns the number of bytes to send to a client.
+		 *
+		 * @param chunked True to include the chunk framing, false for the event payload only.
+		 * @return The number of bytes.
+		 */
+		size_t Size(bool chunked) const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return chunked ? _contents->data.size() : _contents->data.size() - _contents->header - 2;
+		}
+
+		/**
+		 * Releases the reference held by this buffer.
+		 */
+		void Release() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			if (--_contents->references == 0) {
+				delete _contents;
+			}
+		}
+
+		/**
+		 * Deletes this reference to the shared buffer.
+		 * The contents are deleted when the last reference is deleted.
+		 */
+		virtual ~SharedBuffer() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			Release();
+		}
+	};
+
+	/**
+	 * A class that tracks the events that have not yet been written to a single subscriber.
+	 */
+	class Subscriber {
+	private:
+		HttpServer::HttpClient* _client;
+		bool _chunked;
+		bool _dropped;
+		std::deque<SharedBuffer> _backlog;
+		size_t _offset;
+		size_t _bytes;
+
+	public:
+
+		/**
+		 * Creates a new subscriber.
+		 *
+		 * @param client The client receiving events.
+		 * @param chunked True if the response is sent with chunked transfer encoding.
+		 */
+		Subscriber(HttpServer::HttpClient* client = NULL, bool chunked = true) : _client(client), _chunked(chunked), _dropped(false), _backlog(), _offset(0), _bytes(0) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+		}
+
+		/**
+		 * Queues an event to be written to the subscriber.
+		 *
+		 * @param buffer The serialized event.
+		 */
+		void Push(const SharedBuffer& buffer) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			if (_dropped == false) {
+				_backlog.push_back(buffer);
+				_bytes += buffer.Size(_chunked);
+			}
+		}
+
+		/**
+		 * Writes as many queued events as the connection will accept without blocking.
+		 * Events are written straight to the socket, so nothing is written while the connection still has data of its own queued, such as the response headers.
+		 *
+		 * @return True if all queued events have been written, false otherwise.
+		 */
+		bool Flush() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			if (_client->Unsent() != 0) {
+				return false;
+			}
+
+			try {
+				while (_backlog.empty() == false) {
+					const SharedBuffer& buffer = _backlog.front();
+					size_t size = buffer.Size(_chunked);
+					size_t count = _client->Connection()->Socket::Send(buffer.Data(_chunked) + _offset, size - _offset);
+
+					_offset += count;
+
+					if (_offset < size) {
+						return false;
+					}
+
+					_bytes -= size;
+					_offset = 0;
+					_backlog.pop_front();
+				}
+			}
+			catch (const Socket::SendException& e) {
+				Drop();
+			}
+
+			return true;
+		}
+
+		/**
+		 * Stops writing events to the subscriber and shuts down its connection.
+		 * The subscriber is removed once the client has been disconnected.
+		 */
+		void Drop() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_dropped = true;
+			_backlog.clear();
+			_bytes = 0;
+			_offset = 0;
+			_client->Connection()->Shutdown();
+		}
+
+		/**
+		 * The number of bytes queued for the subscriber.
+		 *
+		 * @return The number of bytes.
+		 */
+		size_t Bytes() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _bytes;
+		}
+
+		/**
+		 * Determines whether the subscriber has been dropped.
+		 *
+		 * @return True if dropped, false otherwise.
+		 */
+		bool Dropped() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _dropped;
+		}
+
+		/**
+		 * Deletes this subscriber.
+		 */
+		virtual ~Subscriber() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+		}
+	};
+
+	typedef std::map<HttpServer::HttpClient*, Subscriber> SubscriberCollection;
+
+	SubscriberCollection _subscribers;
+	size_t _backlogSize;
+	TimeSpan _poll;
+	bool _updating;
+	size_t _dropped;
+
+private:
+	template <typename Signature> friend class Delegate;
+
+	/**
+	 * Called when a subscribed client has disconnected.
+	 *
+	 * @param args The event arguments.
+	 * @param sender The client that was disconnected.
+	 */
+	void OnClientDisconnected(const HttpServer::HttpClient::ClientDisconnectedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		_subscribers.erase(static_cast<HttpServer::HttpClient*>(sender));
+	}
+
+	/**
+	 * Flushes a subscriber and disconnects it if it has exceeded its backlog.
+	 *
+	 * @param subscriber The subscriber to flush.
+	 * @return True if the subscriber still has queued events, false otherwise.
+	 */
+	bool Flush(Subscriber& subscriber) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		if (subscriber.Flush()) {
+			return false;
+		}
+		else if (subscriber.Bytes() > _backlogSize) {
+			subscriber.Drop();
+			_dropped++;
+			return false;
+		}
+
+		return true;
+	}
+
+	/**
+	 * Retries all subscribers with queued events.
+	 * A single timer is shared by every subscriber, and it is only scheduled while some subscriber is behind.
+	 */
+	void Update() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		bool pending = false;
+
+		for (SubscriberCollection::iterator i = _subscribers.begin(); i != _subscribers.end(); i++) {
+			if (i->second.Bytes() != 0 && Flush(i->second)) {
+				pending = true;
+			}
+		}
+
+		if ((_updating = pending)) {
+			Thread::SetTimeout(_poll, delegate(&EventChannel::Update, this));
+		}
+	}
+
+public:
+
+	/**
+	 * Creates a new event channel with no subscribers.
+	 *
+	 * @param backlogSize The maximum number of unsent bytes a subscriber may have before it is disconnected.
+	 * @param poll How often pending events are retried for subscribers that are behind.
+	 */
+	EventChannel(size_t backlogSize = DefaultBacklogSize, const TimeSpan& poll = DefaultFlushFrequency) : _subscribers(), _backlogSize(backlogSize), _poll(poll), _updating(false), _dropped(0) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+	}
+
+	/**
+	 * Responds to a request with an event stream and subscribes the client to future events.
+	 *
+	 * @param client The client that requested the event stream.
+	 */
+	void Subscribe(HttpServer::HttpClient* client) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		client->Begin("HTTP/1.1", 200, "OK")
+			.SendHeader("Server", "nitrus")
+			.SendHeader("Content-Type", "text/event-stream")
+			.SendHeader("Cache-Control", "no-cache")
+			.Send("");
+
+		_subscribers[client] = Subscriber(client, client->Chunked());
+		client->ClientDisconnected() += delegate(&EventChannel::OnClientDisconnected, this);
+	}
+
+	/**
+	 * Sends an event to every subscriber.
+	 * The event is serialized once and shared by all subscribers.
+	 *
+	 * @param data The event data. Multiple lines are sent as multiple data fields.
+	 * @param event The optional event type.
+	 * @param id The optional event identifier.
+	 */
+	void Broadcast(const std::string& data, const std::string& event = "", const std::string& id = "") { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		std::string payload;
+
+		if (event.empty() == false) {
+			payload.append("event: ").append(event).append("\n");
+		}
+
+		if (id.empty() == false) {
+			payload.append("id: ").append(id).append("\n");
+		}
+
+		for (size_t start = 0, end; start <= data.size(); start = end + 1) {
+			if ((end = data.find('\n', start)) == std::string::npos) {
+				end = data.size();
+			}
+
+			payload.append("data: ").append(data, start, end - start).append("\n");
+		}
+
+		SharedBuffer buffer(payload.append("\n"));
+		bool pending = false;
+
+		for (SubscriberCollection::iterator i = _subscribers.begin(); i != _subscribers.end(); i++) {
+			i->second.Push(buffer);
+
+			if (Flush(i->second)) {
+				pending = true;
+			}
+		}
+
+		if (pending && _updating == false) {
+			_updating = true;
+			Thread::SetTimeout(_poll, delegate(&EventChannel::Update, this));
+		}
+	}
+
+	/**
+	 * The number of subscribed clients.
+	 *
+	 * @return The number of clients.
+	 */
+	size_t Subscribers() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _subscribers.size();
+	}
+
+	/**
+	 * The total number of subscribers that have been disconnected for falling too far behind.
+	 *
+	 * @return The number of subscribers.
+	 */
+	size_t Dropped() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _dropped;
+	}
+
+	/**
+	 * Performs unit testing on functions in this class to ensure expected operation.
+	 */
+	static void UnitTest() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		SharedBuffer buffer(std::string(300, 'x'));
+		SharedBuffer copy = buffer;
+		assert(std::string(copy.Data(true), copy.Size(true)) == "12c\r\n" + std::string(300, 'x') + "\r\n");
+		assert(std::string(copy.Data(false), copy.Size(false)) == std::string(300, 'x'));
+
+		// a subscriber on a loopback connection whose peer stops reading is dropped once its backlog is exceeded
+		Socket listener(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		Socket peer(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		TcpClient connection;
+		Socket::Endpoint endpoint;
+		HttpServer server;
+
+		listener.Bind(0);
+		listener.Listen();
+		peer.SetOption(SOL_SOCKET, SO_RCVBUF, 4096);
+		peer.Connect(Socket::Endpoint("127.0.0.1", listener.LocalEndpoint().Port()));
+		assert(listener.Accept(connection, endpoint));
+		connection.Block(false);
+		connection.SetOption(SOL_SOCKET, SO_SNDBUF, 4096);
+
+		HttpServer::HttpClient client(&connection, endpoint, &server);
+		EventChannel channel(16384, TimeSpan::Zero());
+		channel._subscribers[&client] = Subscriber(&client, true);
+
+		// an event waits while the response headers are still queued by the connection, and follows them once they are written
+		connection.Queued().append("HTTP/1.1 200 OK\r\n\r\n");
+		channel.Broadcast("hello\nworld", "greeting", "1");
+		assert(channel._subscribers[&client].Bytes() == 53 && channel._updating);
+
+		connection.Socket::Send(connection.Queued());
+		connection.Queued().clear();
+		Thread::Run();
+
+		assert(channel._updating == false && channel._subscribers[&client].Bytes() == 0);
+		assert(peer.Receive(72) == "HTTP/1.1 200 OK\r\n\r\n2f\r\nevent: greeting\nid: 1\ndata: hello\ndata: world\n\n\r\n");
+
+		for (int i = 0; i < 100000 && channel.Dropped() == 0; i++) {
+			channel.Broadcast(std::string(1024, 'x'));
+		}
+
+		assert(channel.Dropped() == 1 && channel._subscribers[&client].Dropped() && channel._subscribers[&client].Bytes() == 0);
+
+		// the retry timer stops once no subscriber is behind
+		Thread::Run();
+		assert(channel._updating == false);
+		channel._subscribers.clear();
+	}
+
+	/**
+	 * Deletes this event channel.
+	 */
+	virtual ~EventChannel() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		for (SubscriberCollection::iterator i = _subscribers.begin(); i != _subscribers.end(); i++) {
+			i->first->ClientDisconnected() -= delegate(&EventChannel::OnClientDisconnected, this);
+		}
+	}
+};
+
+size_t EventChannel::DefaultBacklogSize = 65536;
+TimeSpan EventChannel::DefaultFlushFrequency = TimeSpan::FromMilliseconds(10);
+
+}
+
+#endif /* EVENTCHANNEL_HPP_ */
@@ -0,0 +1,2335 @@
+/*
+ * Copyright (c) 2012 Christopher M. Baker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef HTTPAGENT_HPP_
+#define HTTPAGENT_HPP_
+
+#include "../Application.hpp"
+#include "../Random.hpp"
+#include "../StackTrace.hpp"
+#include "../String.hpp"
+#include "../Thread.hpp"
+#include "HttpClient.hpp"
+
+#include <assert.h>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <set>
+#include <vector>
+#include <utility>
+
+namespace nitrus {
+
+/**
+ * A class that sends http requests over pools of persistent connections, one pool for each host.
+ * A connection is returned to the pool of its host when a response ends, unless the server asked for it to be closed, and is reused by the next request to that host.
+ * A repeatable request that fails on a reused connection before any of the response is received is retried once on a new connection, since the server may have closed the idle connection as the request was sent.
+ * Its headers and content are kept for the retry only up to a limit, and a request with more content fails instead.
+ * If pipelining is enabled, idempotent requests may also be sent on a busy connection behind other idempotent requests, and are retried in the same way if the connection closes first.
+ * A fetch sends an idempotent request as one or more requests, hedging slow responses and retrying failures, to cut the tail latency seen by the caller.
+ * An agent must outlive the batches and fetches begun with it. Requests still in flight when it is deleted are dropped without raising any more events.
+ */
+class HttpAgent {
+public:
+
+	/**
+	 * The maximum number of idle connections kept open to each host.
+	 */
+	static size_t DefaultMaximumIdleConnections;
+
+	/**
+	 * The maximum number of requests from a single batch in flight at once.
+	 */
+	static size_t DefaultBatchConcurrency;
+
+	/**
+	 * The number of recent response latencies kept for each host.
+	 */
+	static size_t DefaultLatencySamples;
+
+	/**
+	 * The number of latencies needed before the hedge delay for a host is taken from them.
+	 */
+	static size_t DefaultMinimumLatencySamples;
+
+	/**
+	 * The fraction of recent responses from a host that start before a fetch sends a hedge.
+	 */
+	static double DefaultHedgePercentile;
+
+	/**
+	 * The hedge delay used until enough latencies have been recorded for a host.
+	 */
+	static TimeSpan DefaultHedgeDelay;
+
+	/**
+	 * The base backoff before a fetch is retried.
+	 */
+	static TimeSpan DefaultRetryBackoff;
+
+	/**
+	 * The number of bytes of request content kept so that a request can be retried on a new connection. A request with more content is not retried.
+	 */
+	static size_t DefaultMaximumRecordedContent;
+
+	/**
+	 * A class that encapsulates the failure of a request.
+	 */
+	class RequestFailedEventArgs : public EventArgs {
+	public:
+
+		/**
+		 * Creates a new event argument.
+		 */
+		RequestFailedEventArgs() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+		}
+
+		/**
+		 * Deletes the event argument.
+		 */
+		virtual ~RequestFailedEventArgs() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+		}
+	};
+
+	typedef EventHandler<const RequestFailedEventArgs&> RequestFailedEventHandler;
+	typedef Event<const RequestFailedEventArgs&> RequestFailedEvent;
+
+	class Request;
+	class Batch;
+	class Fetch;
+
+private:
+	class Pool;
+
+	/**
+	 * A class that encapsulates a pooled connection, the request whose response it is receiving and the requests pipelined behind it.
+	 * A pipelined request that is cancelled stays queued as NULL so that its response is still read and discarded.
+	 */
+	class Connection : public HttpClient {
+	private:
+		HttpAgent* _agent;
+		Pool* _pool;
+		Request* _request;
+		std::deque<Request*> _queued;
+		bool _connected;
+		bool _reusable;
+		DateTime _opened;
+
+	private:
+		friend class HttpAgent;
+		template <typename Signature> friend class Delegate;
+
+		/**
+		 * Called when the connection has been established.
+		 *
+		 * @param args The event arguments.
+		 * @param sender The sender of the event.
+		 */
+		void OnConnected(const TcpClient::ClientConnectedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_agent->OnConnected(this);
+		}
+
+		/**
+		 * Called when a response has started.
+		 *
+		 * @param args The event arguments.
+		 * @param sender The sender of the event.
+		 */
+		void OnResponseStarted(const HttpClient::ResponseStartedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_agent->OnResponseStarted(this, args);
+		}
+
+		/**
+		 * Called when a response header has been received.
+		 *
+		 * @param args The event arguments.
+		 * @param sender The sender of the event.
+		 */
+		void OnHeaderReceived(const HttpClient::HeaderReceivedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_agent->OnHeaderReceived(this, args);
+		}
+
+		/**
+		 * Called when response content has been received.
+		 *
+		 * @param args The event arguments.
+		 * @param sender The sender of the event.
+		 */
+		void OnContentReceived(const HttpClient::ContentReceivedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_agent->OnContentReceived(this, args);
+		}
+
+		/**
+		 * Called when more of the response content has been received.
+		 *
+		 * @param args The event arguments.
+		 * @param sender The sender of the event.
+		 */
+		void OnProgressChanged(const HttpClient::ProgressChangedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_agent->OnProgressChanged(this, args);
+		}
+
+		/**
+		 * Called when a response has ended.
+		 *
+		 * @param args The event arguments.
+		 * @param sender The sender of the event.
+		 */
+		void OnResponseEnded(const HttpClient::ResponseEndedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_agent->OnResponseEnded(this, args);
+		}
+
+		/**
+		 * Called when the connection has been disconnected.
+		 *
+		 * @param args The event arguments.
+		 * @param sender The sender of the event.
+		 */
+		void OnDisconnected(const TcpClient::ClientDisconnectedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_agent->OnDisconnected(this);
+		}
+
+	public:
+
+		/**
+		 * Creates a new connection for the specified pool. The connection is not opened until Open is called.
+		 *
+		 * @param agent The agent that owns the connection.
+		 * @param pool The pool of the host to connect to.
+		 */
+		Connection(HttpAgent* agent, Pool* pool) : HttpClient(), _agent(agent), _pool(pool), _request(NULL), _queued(), _connected(false), _reusable(false), _opened() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			ClientConnected() += delegate(&Connection::OnConnected, this);
+			ResponseStarted() += delegate(&Connection::OnResponseStarted, this);
+			HeaderReceived() += delegate(&Connection::OnHeaderReceived, this);
+			ContentReceived() += delegate(&Connection::OnContentReceived, this);
+			ProgressChanged() += delegate(&Connection::OnProgressChanged, this);
+			ResponseEnded() += delegate(&Connection::OnResponseEnded, this);
+			ClientDisconnected() += delegate(&Connection::OnDisconnected, this);
+		}
+
+		/**
+		 * Stops the connection from raising events in the agent, so that it can be deleted along with the agent.
+		 */
+		void Detach() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			ClientConnected() -= delegate(&Connection::OnConnected, this);
+			ResponseStarted() -= delegate(&Connection::OnResponseStarted, this);
+			HeaderReceived() -= delegate(&Connection::OnHeaderReceived, this);
+			ContentReceived() -= delegate(&Connection::OnContentReceived, this);
+			ProgressChanged() -= delegate(&Connection::OnProgressChanged, this);
+			ResponseEnded() -= delegate(&Connection::OnResponseEnded, this);
+			ClientDisconnected() -= delegate(&Connection::OnDisconnected, this);
+		}
+
+		/**
+		 * Starts connecting to the host of the pool.
+		 */
+		void Open() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_opened = DateTime::Utc();
+			Connect(_pool->Endpoint());
+		}
+
+		/**
+		 * Deletes this connection.
+		 */
+		virtual ~Connection() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+		}
+	};
+
+	/**
+	 * A class that encapsulates the idle connections to a single host, and the busy connections that more requests may be pipelined on.
+	 */
+	class Pool {
+	private:
+		Socket::Endpoint _endpoint;
+		std::vector<Connection*> _idle;
+		std::vector<Connection*> _pipelines;
+		std::vector<TimeSpan> _latencies;
+		size_t _nextLatency;
+
+	public:
+
+		/**
+		 * Creates a new empty pool.
+		 *
+		 * @param endpoint The endpoint of the host.
+		 */
+		Pool(const Socket::Endpoint& endpoint) : _endpoint(endpoint), _idle(), _pipelines(), _latencies(), _nextLatency(0) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+		}
+
+		/**
+		 * The endpoint of the host.
+		 *
+		 * @return The endpoint.
+		 */
+		const Socket::Endpoint& Endpoint() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _endpoint;
+		}
+
+		/**
+		 * Takes the most recently used idle connection.
+		 *
+		 * @return The connection, or NULL if there are no idle connections.
+		 */
+		Connection* Take() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			if (_idle.empty()) {
+				return NULL;
+			}
+
+			Connection* connection = _idle.back();
+			_idle.pop_back();
+
+			return connection;
+		}
+
+		/**
+		 * Returns a connection to the pool, or disconnects it if the pool is full.
+		 *
+		 * @param connection The connection.
+		 */
+		void Return(Connection* connection) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			if (_idle.size() < DefaultMaximumIdleConnections) {
+				_idle.push_back(connection);
+			}
+			else {
+				connection->Disconnect();
+			}
+		}
+
+		/**
+		 * Finds a busy connection with room for another pipelined request.
+		 *
+		 * @param depth The maximum number of requests in flight on a connection.
+		 * @return The connection, or NULL if every pipeline is full.
+		 */
+		Connection* Join(size_t depth) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			for (std::vector<Connection*>::iterator i = _pipelines.begin(); i != _pipelines.end(); i++) {
+				if ((*i)->_queued.size() + 1 < depth) {
+					return *i;
+				}
+			}
+
+			return NULL;
+		}
+
+		/**
+		 * Allows more requests to be pipelined on a busy connection.
+		 *
+		 * @param connection The connection.
+		 */
+		void Pipeline(Connection* connection) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_pipelines.push_back(connection);
+		}
+
+		/**
+		 * Stops requests from being pipelined on a connection.
+		 *
+		 * @param connection The connection.
+		 */
+		void Unpipeline(Connection* connection) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_pipelines.erase(std::remove(_pipelines.begin(), _pipelines.end(), connection), _pipelines.end());
+		}
+
+		/**
+		 * Records the time from the start of a request to the start of its response, replacing the oldest latency once enough have been kept.
+		 *
+		 * @param latency The latency.
+		 */
+		void Record(const TimeSpan& latency) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			if (_latencies.size() < DefaultLatencySamples) {
+				_latencies.push_back(latency);
+			}
+			else {
+				_latencies[_nextLatency++ % _latencies.size()] = latency;
+			}
+		}
+
+		/**
+		 * Finds the latency that a fraction of the recent responses from the host started within.
+		 *
+		 * @param fraction The fraction of responses, from zero to one.
+		 * @param fallback The latency returned until enough have been recorded.
+		 * @return The latency.
+		 */
+		TimeSpan Percentile(double fraction, const TimeSpan& fallback) const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			if (_latencies.size() < DefaultMinimumLatencySamples || _latencies.empty()) {
+				return fallback;
+			}
+
+			std::vector<TimeSpan> latencies = _latencies;
+			std::vector<TimeSpan>::iterator nth = latencies.begin() + (size_t) (fraction * (latencies.size() - 1));
+			std::nth_element(latencies.begin(), nth, latencies.end());
+
+			return *nth;
+		}
+
+		/**
+		 * Removes a connection that has been disconnected.
+		 *
+		 * @param connection The connection.
+		 */
+		void Remove(Connection* connection) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_idle.erase(std::remove(_idle.begin(), _idle.end(), connection), _idle.end());
+			Unpipeline(connection);
+		}
+
+		/**
+		 * Deletes this pool.
+		 */
+		virtual ~Pool() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+		}
+	};
+
+public:
+
+	/**
+	 * A class that encapsulates a single request and its response.
+	 * Headers and content may be sent before a connection is available; they are written once the request has been given a connection.
+	 * The request is deleted by the agent after its response has ended or it has failed.
+	 */
+	class Request {
+	private:
+		typedef std::vector<std::pair<std::string, std::string> > Headers;
+
+		HttpAgent* _agent;
+		Pool* _pool;
+		Connection* _connection;
+		std::string _method;
+		std::string _path;
+		Headers _headers;
+		std::deque<std::string> _content;
+		size_t _contentSize;
+		bool _transmitted;
+		bool _recorded;
+		bool _ended;
+		bool _responding;
+		bool _reused;
+		bool _retried;
+		bool _deferred;
+		bool _pipelinable;
+		bool _done;
+		DateTime _begun;
+		int _sink;
+		uint64_t _sinkOffset;
+		HttpClient::ResponseStartedEvent _responseStarted;
+		HttpClient::HeaderReceivedEvent _headerReceived;
+		HttpClient::ContentReceivedEvent _contentReceived;
+		HttpClient::ProgressChangedEvent _progressChanged;
+		HttpClient::ResponseEndedEvent _responseEnded;
+		RequestFailedEvent _requestFailed;
+
+	private:
+		friend class HttpAgent;
+
+		/**
+		 * Requests are owned by the agent and cannot be copied.
+		 *
+		 * @param that The request to clone.
+		 */
+		Request(const Request& that);
+
+		/**
+		 * Requests are owned by the agent and cannot be copied.
+		 *
+		 * @param that The request to clone.
+		 * @return A reference to this request.
+		 */
+		Request& operator = (const Request& that);
+
+		/**
+		 * Records whether the request is sent over a connection that was already open.
+		 * What is sent over such a connection is kept for a retry, as long as the method is repeatable and the content is small enough.
+		 *
+		 * @param reused Whether the connection was already open.
+		 */
+		void Reuse(bool reused) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_reused = reused;
+			_recorded = reused && Repeatable(_method) && _contentSize <= DefaultMaximumRecordedContent;
+		}
+
+		/**
+		 * Whether the request may be sent again on a new connection after its connection closed before the response started.
+		 *
+		 * @return True if what was sent has been kept and the request has not been retried yet, false otherwise.
+		 */
+		bool Retryable() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _recorded && _retried == false;
+		}
+
+		/**
+		 * Releases what has been sent so far, after which the request can no longer be retried.
+		 */
+		void Forget() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_recorded = false;
+			_contentSize = 0;
+			Headers().swap(_headers);
+			_content.clear();
+		}
+
+		/**
+		 * Writes the request line and everything sent so far to the connection.
+		 * What was written is kept if the request may need to be retried and is small enough, and released otherwise.
+		 * A download starts over at its offset on every connection, so a retried download overwrites what was written before.
+		 */
+		void Transmit() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_transmitted = true;
+
+			// a pipelined request is given the sink when the response ahead of it ends.
+			if (_sink >= 0 && _connection->_request == this) {
+				_connection->Download(_sink, _sinkOffset);
+			}
+
+			_connection->Begin(_method, _path, "HTTP/1.1");
+
+			for (Headers::iterator i = _headers.begin(); i != _headers.end(); i++) {
+				_connection->SendHeader(i->first, i->second);
+			}
+
+			for (std::deque<std::string>::iterator i = _content.begin(); i != _content.end(); i++) {
+				_connection->Send(*i);
+			}
+
+			if (_ended) {
+				_connection->Send("").End();
+			}
+
+			if (_recorded == false) {
+				Forget();
+			}
+		}
+
+	public:
+
+		/**
+		 * Creates a new request.
+		 *
+		 * @param agent The agent sending the request.
+		 * @param pool The pool of the host the request is sent to.
+		 * @param method The http method.
+		 * @param path The path.
+		 */
+		Request(HttpAgent* agent, Pool* pool, const std::string& method, const std::string& path) : _agent(agent), _pool(pool), _connection(NULL), _method(method), _path(path), _headers(), _content(), _contentSize(0), _transmitted(false), _recorded(false), _ended(false), _responding(false), _reused(false), _retried(false), _deferred(false), _pipelinable(false), _done(false), _begun(DateTime::Utc()), _sink(-1), _sinkOffset(0), _responseStarted(), _headerReceived(), _contentReceived(), _progressChanged(), _responseEnded(), _requestFailed() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+		}
+
+		/**
+		 * The event used to notify when the start of the response has been received.
+		 *
+		 * @return The event.
+		 */
+		HttpClient::ResponseStartedEvent& ResponseStarted() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _responseStarted;
+		}
+
+		/**
+		 * The event used to notify when a response header has been received.
+		 *
+		 * @return The event.
+		 */
+		HttpClient::HeaderReceivedEvent& HeaderReceived() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _headerReceived;
+		}
+
+		/**
+		 * The event used to notify when partial content has been received.
+		 *
+		 * @return The event.
+		 */
+		HttpClient::ContentReceivedEvent& ContentReceived() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _contentReceived;
+		}
+
+		/**
+		 * The event used to notify how much of the response content has been received.
+		 *
+		 * @return The event.
+		 */
+		HttpClient::ProgressChangedEvent& ProgressChanged() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _progressChanged;
+		}
+
+		/**
+		 * The event used to notify when the end of the response has been received.
+		 *
+		 * @return The event.
+		 */
+		HttpClient::ResponseEndedEvent& ResponseEnded() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _responseEnded;
+		}
+
+		/**
+		 * The event used to notify when the request could not be completed.
+		 *
+		 * @return The event.
+		 */
+		RequestFailedEvent& RequestFailed() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _requestFailed;
+		}
+
+		/**
+		 * Sends a request header.
+		 *
+		 * @param key The key of the header.
+		 * @param value The value of the header.
+		 * @return A reference to this request.
+		 */
+		Request& SendHeader(const std::string& key, const std::string& value) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			if (_transmitted) {
+				_connection->SendHeader(key, value);
+			}
+
+			if (_transmitted == false || _recorded) {
+				_headers.push_back(std::make_pair(key, value));
+			}
+
+			return *this;
+		}
+
+		/**
+		 * Sends partial request content.
+		 *
+		 * @param data The content.
+		 * @return A reference to this request.
+		 */
+		Request& Send(const std::string& data) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			if (_transmitted) {
+				_connection->Send(data);
+			}
+
+			if ((_transmitted == false || _recorded) && data.empty() == false) {
+				_content.push_back(data);
+				_contentSize += data.size();
+			}
+
+			// content that has not been written yet is still kept until it is.
+			if (_recorded && _contentSize > DefaultMaximumRecordedContent) {
+				_recorded = false;
+
+				if (_transmitted) {
+					Forget();
+				}
+			}
+
+			return *this;
+		}
+
+		/**
+		 * Ends the request.
+		 *
+		 * @return A reference to this request.
+		 */
+		Request& End() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_ended = true;
+
+			if (_transmitted) {
+				_connection->Send("").End();
+			}
+			else if (_deferred) {
+				_deferred = false;
+				_agent->Dispatch(this, false);
+			}
+
+			return *this;
+		}
+
+		/**
+		 * Writes the response content to a file instead of raising content received events.
+		 * This must be called before the response starts; see HttpClient::Download.
+		 *
+		 * @param descriptor The file descriptor, opened for writing.
+		 * @param offset The offset in the file where the content begins.
+		 * @return A reference to this request.
+		 */
+		Request& Download(int descriptor, uint64_t offset = 0) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_sink = descriptor;
+			_sinkOffset = offset;
+
+			if (_transmitted && _connection->_request == this) {
+				_connection->Download(descriptor, offset);
+			}
+
+			return *this;
+		}
+
+		/**
+		 * Stops reading the response, so that the host waits until Resume is called.
+		 * This lets a caller that passes the response on hold off a host that is faster than where the response is going.
+		 * This does nothing until the response is being received on a connection.
+		 *
+		 * @return A reference to this request.
+		 */
+		Request& Pause() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			if (_connection != NULL && _connection->_request == this) {
+				_connection->Pause();
+			}
+
+			return *this;
+		}
+
+		/**
+		 * Starts reading a paused response again.
+		 *
+		 * @return A reference to this request.
+		 */
+		Request& Resume() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			if (_connection != NULL && _connection->_request == this) {
+				_connection->Resume();
+			}
+
+			return *this;
+		}
+
+		/**
+		 * Abandons the request. No further events are raised and its connection is closed rather than reused.
+		 * A pipelined request that is still waiting for the responses ahead of it leaves the connection open; its response is discarded.
+		 */
+		void Cancel() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_agent->Abandon(this);
+		}
+
+		/**
+		 * Whether the request was sent over a connection taken from the pool.
+		 *
+		 * @return True if the connection was reused, false if it was opened for this request.
+		 */
+		bool Reused() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _reused;
+		}
+
+		/**
+		 * Deletes this request.
+		 */
+		virtual ~Request() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+		}
+	};
+
+	/**
+	 * A class that encapsulates the outcome of one request in a batch.
+	 */
+	class Result {
+	public:
+		enum Status {
+			Status_Pending,
+			Status_Completed,
+			Status_Failed,
+			Status_TimedOut
+		};
+
+		typedef std::multimap<std::string, std::string> HeaderCollection;
+
+	private:
+		friend class Batch;
+		friend class Fetch;
+
+		Status _status;
+		int _code;
+		HeaderCollection _headers;
+		std::string _content;
+
+	public:
+
+		/**
+		 * Creates a new pending result.
+		 */
+		Result() : _status(Status_Pending), _code(0), _headers(), _content() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+		}
+
+		/**
+		 * Whether the response was received, the request failed, or the batch deadline passed first.
+		 *
+		 * @return The status.
+		 */
+		Status GetStatus() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _status;
+		}
+
+		/**
+		 * The response code, or zero if no response was started.
+		 *
+		 * @return The response code.
+		 */
+		int Code() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _code;
+		}
+
+		/**
+		 * The response headers.
+		 *
+		 * @return The headers.
+		 */
+		const HeaderCollection& Headers() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _headers;
+		}
+
+		/**
+		 * The response content.
+		 *
+		 * @return The content.
+		 */
+		const std::string& Content() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _content;
+		}
+
+		/**
+		 * Deletes this result.
+		 */
+		virtual ~Result() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+		}
+	};
+
+	typedef std::vector<Result> ResultCollection;
+
+	/**
+	 * A class that encapsulates the completion of a batch.
+	 */
+	class BatchCompletedEventArgs : public EventArgs {
+	private:
+		const ResultCollection& _results;
+		TimeSpan _elapsed;
+		bool _timedOut;
+
+	public:
+
+		/**
+		 * Creates a new event argument with the specified data.
+		 *
+		 * @param results The results, in the order the requests were added.
+		 * @param elapsed The time from the start of the batch to its completion.
+		 * @param timedOut Whether the deadline passed before every request finished.
+		 */
+		BatchCompletedEventArgs(const ResultCollection& results, const TimeSpan& elapsed, bool timedOut) : _results(results), _elapsed(elapsed), _timedOut(timedOut) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+		}
+
+		/**
+		 * The results, in the order the requests were added.
+		 *
+		 * @return The results.
+		 */
+		const ResultCollection& Results() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _results;
+		}
+
+		/**
+		 * The time from the start of the batch to its completion.
+		 *
+		 * @return The elapsed time.
+		 */
+		const TimeSpan& Elapsed() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _elapsed;
+		}
+
+		/**
+		 * Whether the deadline passed before every request finished, in which case some results are timed out.
+		 *
+		 * @return True if the batch timed out, false otherwise.
+		 */
+		bool TimedOut() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _timedOut;
+		}
+
+		/**
+		 * Deletes the event argument.
+		 */
+		virtual ~BatchCompletedEventArgs() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+		}
+	};
+
+	typedef EventHandler<const BatchCompletedEventArgs&> BatchCompletedEventHandler;
+	typedef Event<const BatchCompletedEventArgs&> BatchCompletedEvent;
+
+	/**
+	 * A class that sends a group of requests concurrently and completes once with all of their results.
+	 * At most a fixed number of requests are in flight at once; the rest start as earlier ones finish.
+	 * If the deadline passes first, the requests still in flight are cancelled and the batch completes with the results it has.
+	 * The batch is deleted by the agent once its deadline has passed.
+	 */
+	class Batch {
+	private:
+
+		/**
+		 * A request that has been added to the batch.
+		 */
+		struct Call {
+			Socket::Endpoint endpoint;
+			std::string method;
+			std::string path;
+			std::string content;
+			Request* request;
+		};
+
+		HttpAgent* _agent;
+		TimeSpan _deadline;
+		size_t _concurrency;
+		std::vector<Call> _calls;
+		ResultCollection _results;
+		size_t _next;
+		size_t _active;
+		size_t _finished;
+		bool _completed;
+		DateTime _started;
+		BatchCompletedEvent _batchCompleted;
+
+	private:
+		template <typename Signature> friend class Delegate;
+
+		/**
+		 * Batches are owned by the agent and cannot be copied.
+		 *
+		 * @param that The batch to clone.
+		 */
+		Batch(const Batch& that);
+
+		/**
+		 * Batches are owned by the agent and cannot be copied.
+		 *
+		 * @param that The batch to clone.
+		 * @return A reference to this batch.
+		 */
+		Batch& operator = (const Batch& that);
+
+		/**
+		 * Finds the call for a request.
+		 *
+		 * @param request The request.
+		 * @return The index of the call.
+		 */
+		size_t Find(void* request) const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			size_t i = 0;
+
+			while (_calls[i].request != request) {
+				i++;
+			}
+
+			return i;
+		}
+
+		/**
+		 * Starts as many of the remaining requests as the concurrency limit allows.
+		 */
+		void StartNext() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			for (; _next < _calls.size() && _active < _concurrency; _next++, _active++) {
+				Call& call = _calls[_next];
+
+				call.request = &_agent->Begin(call.endpoint, call.method, call.path);
+				call.request->ResponseStarted() += delegate(&Batch::OnResponseStarted, this);
+				call.request->HeaderReceived() += delegate(&Batch::OnHeaderReceived, this);
+				call.request->ContentReceived() += delegate(&Batch::OnContentReceived, this);
+				call.request->ResponseEnded() += delegate(&Batch::OnResponseEnded, this);
+				call.request->RequestFailed() += delegate(&Batch::OnRequestFailed, this);
+				call.request->SendHeader("Host", call.endpoint.Address()).Send(call.content).End();
+			}
+		}
+
+		/**
+		 * Records that a request has finished, and starts the next one or completes the batch.
+		 *
+		 * @param index The index of the call.
+		 * @param status The status of the request.
+		 */
+		void Finish(size_t index, Result::Status status) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_calls[index].request = NULL;
+			_results[index]._status = status;
+			_active--;
+			_finished++;
+
+			if (_finished == _calls.size()) {
+				Complete(false);
+			}
+			else {
+				StartNext();
+			}
+		}
+
+		/**
+		 * Raises the completion of the batch.
+		 *
+		 * @param timedOut Whether the deadline passed before every request finished.
+		 */
+		void Complete(bool timedOut) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_completed = true;
+			_batchCompleted(BatchCompletedEventArgs(_results, DateTime::Utc() - _started, timedOut), this);
+		}
+
+		/**
+		 * Called when the deadline of the batch has passed.
+		 * Requests still in flight are cancelled and every unfinished result is marked as timed out.
+		 * The batch is deleted here, since nothing refers to it after its deadline.
+		 */
+		void OnDeadline() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			if (_completed == false) {
+				for (size_t i = 0; i < _calls.size(); i++) {
+					if (_calls[i].request != NULL) {
+						_calls[i].request->Cancel();
+						_calls[i].request = NULL;
+					}
+
+					if (_results[i]._status == Result::Status_Pending) {
+						_results[i]._status = Result::Status_TimedOut;
+					}
+				}
+
+				Complete(true);
+			}
+
+			delete this;
+		}
+
+		/**
+		 * Called when a response has started.
+		 *
+		 * @param args The event arguments.
+		 * @param sender The request.
+		 */
+		void OnResponseStarted(const HttpClient::ResponseStartedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_results[Find(sender)]._code = args.Code();
+		}
+
+		/**
+		 * Called when a response header has been received.
+		 *
+		 * @param args The event arguments.
+		 * @param sender The request.
+		 */
+		void OnHeaderReceived(const HttpClient::HeaderReceivedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_results[Find(sender)]._headers.insert(std::make_pair(args.Key(), args.Value()));
+		}
+
+		/**
+		 * Called when response content has been received.
+		 *
+		 * @param args The event arguments.
+		 * @param sender The request.
+		 */
+		void OnContentReceived(const HttpClient::ContentReceivedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_results[Find(sender)]._content += args.Content();
+		}
+
+		/**
+		 * Called when a response has ended.
+		 *
+		 * @param args The event arguments.
+		 * @param sender The request.
+		 */
+		void OnResponseEnded(const HttpClient::ResponseEndedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			Finish(Find(sender), Result::Status_Completed);
+		}
+
+		/**
+		 * Called when a request has failed.
+		 *
+		 * @param args The event arguments.
+		 * @param sender The request.
+		 */
+		void OnRequestFailed(const RequestFailedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			Finish(Find(sender), Result::Status_Failed);
+		}
+
+	public:
+
+		/**
+		 * Creates a new empty batch.
+		 *
+		 * @param agent The agent used to send the requests.
+		 * @param deadline How long the batch may take, measured from End.
+		 * @param concurrency The maximum number of requests in flight at once.
+		 */
+		Batch(HttpAgent* agent, const TimeSpan& deadline, size_t concurrency) : _agent(agent), _deadline(deadline), _concurrency(concurrency == 0 ? 1 : concurrency), _calls(), _results(), _next(0), _active(0), _finished(0), _completed(false), _started(), _batchCompleted() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_agent->_operations++;
+		}
+
+		/**
+		 * The event used to notify when every request has finished or the deadline has passed.
+		 *
+		 * @return The event.
+		 */
+		BatchCompletedEvent& BatchCompleted() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _batchCompleted;
+		}
+
+		/**
+		 * Adds a request to the batch.
+		 *
+		 * @param endpoint The endpoint of the host.
+		 * @param method The http method.
+		 * @param path The path.
+		 * @param content The request content.
+		 * @return A reference to this batch.
+		 */
+		Batch& Add(const Socket::Endpoint& endpoint, const std::string& method, const std::string& path, const std::string& content = "") { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			Call call = { endpoint, method, path, content, NULL };
+
+			_calls.push_back(call);
+			_results.push_back(Result());
+
+			return *this;
+		}
+
+		/**
+		 * Starts sending the requests. No requests may be added afterwards.
+		 * Handlers must be registered for completion before this is called, since an empty batch completes immediately.
+		 */
+		void End() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_started = DateTime::Utc();
+			Thread::SetTimeout(_deadline, delegate(&Batch::OnDeadline, this));
+
+			if (_calls.empty()) {
+				Complete(false);
+			}
+			else {
+				StartNext();
+			}
+		}
+
+		/**
+		 * Deletes this batch.
+		 */
+		virtual ~Batch() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_agent->_operations--;
+		}
+	};
+
+	/**
+	 * A class that encapsulates the completion of a fetch.
+	 */
+	class FetchCompletedEventArgs : public EventArgs {
+	private:
+		const Result& _result;
+		TimeSpan _elapsed;
+		size_t _attempts;
+		bool _hedgeWon;
+
+	public:
+
+		/**
+		 * Creates a new event argument with the specified data.
+		 *
+		 * @param result The result of the fetch.
+		 * @param elapsed The time from the start of the fetch to its completion.
+		 * @param attempts The number of requests sent, including hedges and retries.
+		 * @param hedgeWon Whether the result came from a hedged request.
+		 */
+		FetchCompletedEventArgs(const Result& result, const TimeSpan& elapsed, size_t attempts, bool hedgeWon) : _result(result), _elapsed(elapsed), _attempts(attempts), _hedgeWon(hedgeWon) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+		}
+
+		/**
+		 * The result of the fetch.
+		 *
+		 * @return The result.
+		 */
+		const Result& GetResult() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _result;
+		}
+
+		/**
+		 * The time from the start of the fetch to its completion.
+		 *
+		 * @return The elapsed time.
+		 */
+		const TimeSpan& Elapsed() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _elapsed;
+		}
+
+		/**
+		 * The number of requests sent, including hedges and retries.
+		 *
+		 * @return The number of requests.
+		 */
+		size_t Attempts() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _attempts;
+		}
+
+		/**
+		 * Whether the result came from a hedged request rather than the request it duplicated.
+		 *
+		 * @return True if the hedge won, false otherwise.
+		 */
+		bool HedgeWon() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _hedgeWon;
+		}
+
+		/**
+		 * Deletes the event argument.
+		 */
+		virtual ~FetchCompletedEventArgs() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+		}
+	};
+
+	typedef EventHandler<const FetchCompletedEventArgs&> FetchCompletedEventHandler;
+	typedef Event<const FetchCompletedEventArgs&> FetchCompletedEvent;
+
+	/**
+	 * A class that sends an idempotent request until it succeeds, and completes once with the first response.
+	 * If hedging is enabled and no response has started by the time most responses from the host have (the hedge percentile of recent latencies), a duplicate request is sent to the next endpoint, or on another connection to the same endpoint.
+	 * The first response to start wins and the other requests are cancelled.
+	 * A request that fails, or whose response is 502, 503 or 504, is retried a bounded number of times after an exponential backoff with full jitter.
+	 * Hedges and retries are only sent for idempotent methods, so that a request such as a POST is never processed twice.
+	 * The fetch deletes itself once it has completed and its timers have fired.
+	 */
+	class Fetch {
+	private:
+		typedef std::vector<std::pair<std::string, std::string> > Headers;
+
+		struct Attempt {
+			Request* request;
+			bool hedge;
+			bool retryable;
+		};
+
+		HttpAgent* _agent;
+		std::vector<Socket::Endpoint> _endpoints;
+		std::string _method;
+		std::string _path;
+		Headers _headers;
+		std::string _content;
+		bool _hedging;
+		size_t _retries;
+		TimeSpan _backoff;
+		std::vector<Attempt> _attempts;
+		size_t _next;
+		size_t _sent;
+		size_t _failures;
+		size_t _timers;
+		bool _completed;
+		Request* _winner;
+		bool _hedgeWon;
+		Result _result;
+		DateTime _started;
+		FetchCompletedEvent _fetchCompleted;
+
+	private:
+		template <typename Signature> friend class Delegate;
+
+		/**
+		 * Fetches are owned by themselves and cannot be copied.
+		 *
+		 * @param that The fetch to clone.
+		 */
+		Fetch(const Fetch& that);
+
+		/**
+		 * Fetches are owned by themselves and cannot be copied.
+		 *
+		 * @param that The fetch to clone.
+		 * @return A reference to this fetch.
+		 */
+		Fetch& operator = (const Fetch& that);
+
+		/**
+		 * Finds the attempt for a request.
+		 *
+		 * @param request The request.
+		 * @return The index of the attempt.
+		 */
+		size_t Find(void* request) const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			size_t i = 0;
+
+			while (_attempts[i].request != request) {
+				i++;
+			}
+
+			return i;
+		}
+
+		/**
+		 * Sends the request to the next endpoint.
+		 * A hedge is never pipelined, so that it does not wait behind the request it duplicates.
+		 *
+		 * @param hedge Whether the request duplicates one that is still in flight.
+		 */
+		void Send(bool hedge) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			Attempt attempt = { &_agent->Start(_endpoints[_next++ % _endpoints.size()], _method, _path, hedge == false), hedge, false };
+
+			_sent++;
+			_attempts.push_back(attempt);
+
+			attempt.request->ResponseStarted() += delegate(&Fetch::OnResponseStarted, this);
+			attempt.request->HeaderReceived() += delegate(&Fetch::OnHeaderReceived, this);
+			attempt.request->ContentReceived() += delegate(&Fetch::OnContentReceived, this);
+			attempt.request->ResponseEnded() += delegate(&Fetch::OnResponseEnded, this);
+			attempt.request->RequestFailed() += delegate(&Fetch::OnRequestFailed, this);
+
+			for (Headers::iterator i = _headers.begin(); i != _headers.end(); i++) {
+				attempt.request->SendHeader(i->first, i->second);
+			}
+
+			attempt.request->Send(_content).End();
+		}
+
+		/**
+		 * Schedules a callback and keeps the fetch alive until it has been called.
+		 *
+		 * @param delay The delay before the callback.
+		 * @param callback The callback.
+		 */
+		void Schedule(const TimeSpan& delay, const Delegate<void()>& callback) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_timers++;
+			Thread::SetTimeout(delay, callback);
+		}
+
+		/**
+		 * Releases a callback scheduled by the fetch, and deletes the fetch once it has completed and nothing else is scheduled.
+		 */
+		void Release() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			if (--_timers == 0 && _completed) {
+				delete this;
+			}
+		}
+
+		/**
+		 * Raises the completion of the fetch and cancels every request still in flight.
+		 *
+		 * @param status The status of the result.
+		 */
+		void Complete(Result::Status status) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			std::vector<Attempt> attempts;
+			attempts.swap(_attempts);
+
+			for (std::vector<Attempt>::iterator i = attempts.begin(); i != attempts.end(); i++) {
+				if (i->request != _winner) {
+					i->request->Cancel();
+				}
+			}
+
+			_completed = true;
+			_result._status = status;
+			_fetchCompleted(FetchCompletedEventArgs(_result, DateTime::Utc() - _started, _sent, _hedgeWon), this);
+
+			// the fetch is deleted from the event loop, once the request that completed it has finished raising its events.
+			_timers++;
+			Thread::Invoke(delegate(&Fetch::Release, this));
+		}
+
+		/**
+		 * Called when a request has failed or its response asked for it to be retried.
+		 * The fetch waits for any other request still in flight, and otherwise retries after a backoff or gives up.
+		 *
+		 * @param index The index of the attempt.
+		 */
+		void Fail(size_t index) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_attempts.erase(_attempts.begin() + index);
+
+			if (_attempts.empty() == false) {
+				return;
+			}
+			else if (_failures++ < _retries) {
+				_agent->_fetchRetries++;
+				Schedule(Backoff(_backoff, _failures), delegate(&Fetch::OnBackoff, this));
+			}
+			else {
+				Complete(Result::Status_Failed);
+			}
+		}
+
+		/**
+		 * Called when the hedge delay has passed. A hedge is sent if no response has started.
+		 */
+		void OnHedge() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			if (_completed == false && _winner == NULL && _attempts.empty() == false) {
+				_agent->_hedges++;
+				Send(true);
+			}
+
+			Release();
+		}
+
+		/**
+		 * Called when the backoff before a retry has passed.
+		 */
+		void OnBackoff() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			if (_completed == false) {
+				Send(false);
+			}
+
+			Release();
+		}
+
+		/**
+		 * Called when a response has started.
+		 * The first response that does not ask for a retry wins, and the other requests are cancelled.
+		 *
+		 * @param args The event arguments.
+		 * @param sender The request.
+		 */
+		void OnResponseStarted(const HttpClient::ResponseStartedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			size_t index = Find(sender);
+
+			_result._code = args.Code();
+
+			if (args.Code() == 502 || args.Code() == 503 || args.Code() == 504) {
+				_attempts[index].retryable = true;
+				return;
+			}
+
+			_winner = _attempts[index].request;
+			_hedgeWon = _attempts[index].hedge;
+
+			if (_hedgeWon) {
+				_agent->_hedgesWon++;
+			}
+
+			for (size_t i = 0; i < _attempts.size(); i++) {
+				if (i != index) {
+					_attempts[i].request->Cancel();
+				}
+			}
+
+			_attempts.assign(1, _attempts[index]);
+		}
+
+		/**
+		 * Called when a response header has been received.
+		 *
+		 * @param args The event arguments.
+		 * @param sender The request.
+		 */
+		void OnHeaderReceived(const HttpClient::HeaderReceivedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			if (sender == _winner) {
+				_result._headers.insert(std::make_pair(args.Key(), args.Value()));
+			}
+		}
+
+		/**
+		 * Called when response content has been received.
+		 *
+		 * @param args The event arguments.
+		 * @param sender The request.
+		 */
+		void OnContentReceived(const HttpClient::ContentReceivedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			if (sender == _winner) {
+				_result._content += args.Content();
+			}
+		}
+
+		/**
+		 * Called when a response has ended.
+		 *
+		 * @param args The event arguments.
+		 * @param sender The request.
+		 */
+		void OnResponseEnded(const HttpClient::ResponseEndedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			if (sender == _winner) {
+				Complete(Result::Status_Completed);
+			}
+			else {
+				Fail(Find(sender));
+			}
+		}
+
+		/**
+		 * Called when a request has failed.
+		 * If the winning response was cut short, what was received of it is discarded and the fetch carries on as if no response had started.
+		 *
+		 * @param args The event arguments.
+		 * @param sender The request.
+		 */
+		void OnRequestFailed(const RequestFailedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			if (sender == _winner) {
+				_winner = NULL;
+				_hedgeWon = false;
+				_result = Result();
+			}
+
+			Fail(Find(sender));
+		}
+
+	public:
+
+		/**
+		 * Creates a new fetch that has not been sent.
+		 *
+		 * @param agent The agent used to send the requests.
+		 * @param endpoints The endpoints to send the requests to, in order.
+		 * @param method The http method.
+		 * @param path The path.
+		 */
+		Fetch(HttpAgent* agent, const std::vector<Socket::Endpoint>& endpoints, const std::string& method, const std::string& path) : _agent(agent), _endpoints(endpoints), _method(method), _path(path), _headers(), _content(), _hedging(false), _retries(0), _backoff(DefaultRetryBackoff), _attempts(), _next(0), _sent(0), _failures(0), _timers(0), _completed(false), _winner(NULL), _hedgeWon(false), _result(), _started(), _fetchCompleted() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_agent->_operations++;
+
+		}
+
+		/**
+		 * The event used to notify when the fetch has completed, successfully or not.
+		 *
+		 * @return The event.
+		 */
+		FetchCompletedEvent& FetchCompleted() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _fetchCompleted;
+		}
+
+		/**
+		 * Enables hedging. This is ignored for a method that is not idempotent.
+		 *
+		 * @param enabled Whether to send a hedge when the response is slower than usual.
+		 * @return A reference to this fetch.
+		 */
+		Fetch& Hedge(bool enabled) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_hedging = enabled && Repeatable(_method);
+
+			return *this;
+		}
+
+		/**
+		 * Enables retries. This is ignored for a method that is not idempotent.
+		 * The backoff before the nth retry is chosen at random from zero to the base backoff times two to the n - 1.
+		 *
+		 * @param retries The maximum number of times to retry.
+		 * @param backoff The base backoff.
+		 * @return A reference to this fetch.
+		 */
+		Fetch& Retry(size_t retries, const TimeSpan& backoff = DefaultRetryBackoff) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_retries = Repeatable(_method) ? retries : 0;
+			_backoff = backoff;
+
+			return *this;
+		}
+
+		/**
+		 * Adds a header to every request sent.
+		 *
+		 * @param key The key of the header.
+		 * @param value The value of the header.
+		 * @return A reference to this fetch.
+		 */
+		Fetch& SendHeader(const std::string& key, const std::string& value) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_headers.push_back(std::make_pair(key, value));
+
+			return *this;
+		}
+
+		/**
+		 * Adds content to every request sent.
+		 *
+		 * @param data The content.
+		 * @return A reference to this fetch.
+		 */
+		Fetch& Send(const std::string& data) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_content += data;
+
+			return *this;
+		}
+
+		/**
+		 * Sends the first request. Handlers must be registered for completion before this is called.
+		 * A fetch without any endpoints fails at once.
+		 */
+		void End() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_started = DateTime::Utc();
+
+			if (_endpoints.empty()) {
+				Complete(Result::Status_Failed);
+				return;
+			}
+
+			if (_hedging) {
+				Schedule(_agent->Find(_endpoints[0])->Percentile(DefaultHedgePercentile, DefaultHedgeDelay), delegate(&Fetch::OnHedge, this));
+			}
+
+			Send(false);
+		}
+
+		/**
+		 * Deletes this fetch.
+		 */
+		virtual ~Fetch() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_agent->_operations--;
+		}
+	};
+
+private:
+	typedef std::map<std::string, Pool*> Pools;
+
+	Pools _pools;
+	std::set<Request*> _requestsInFlight;
+	std::set<Connection*> _connections;
+	std::vector<Request*> _refused;
+	std::vector<Request*> _retiredRequests;
+	std::vector<Connection*> _retiredConnections;
+	bool _collecting;
+	size_t _operations;
+	size_t _pipelineDepth;
+	size_t _requests;
+	size_t _reused;
+	size_t _pipelined;
+	size_t _connects;
+	size_t _retried;
+	size_t _failed;
+	size_t _hedges;
+	size_t _hedgesWon;
+	size_t _fetchRetries;
+	TimeSpan _connectTime;
+
+	/**
+	 * Whether the unit test of this class has been registered to run when the application is initialized.
+	 */
+	static bool UnitTestRegistered;
+
+private:
+	template <typename Signature> friend class Delegate;
+
+	/**
+	 * Agents own their connections and cannot be copied.
+	 *
+	 * @param that The agent to clone.
+	 */
+	HttpAgent(const HttpAgent& that);
+
+	/**
+	 * Agents own their connections and cannot be copied.
+	 *
+	 * @param that The agent to clone.
+	 * @return A reference to this agent.
+	 */
+	HttpAgent& operator = (const HttpAgent& that);
+
+	/**
+	 * Finds the pool for a host, creating it if needed.
+	 *
+	 * @param endpoint The endpoint of the host.
+	 * @return The pool.
+	 */
+	Pool* Find(const Socket::Endpoint& endpoint) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		std::string key = String::Format("%s:%d", endpoint.Address().c_str(), endpoint.Port());
+		Pools::iterator i = _pools.find(key);
+
+		if (i != _pools.end()) {
+			return i->second;
+		}
+
+		return _pools[key] = new Pool(endpoint);
+	}
+
+	/**
+	 * Whether a request may be pipelined.
+	 * HEAD is excluded even though it is idempotent, since the client cannot tell that its response has no content.
+	 *
+	 * @param method The http method.
+	 * @return True if the method is idempotent, false otherwise.
+	 */
+	static bool Idempotent(const std::string& method) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return method == "GET" || method == "PUT" || method == "DELETE" || method == "OPTIONS" || method == "TRACE";
+	}
+
+	/**
+	 * Whether a request may be sent more than once, as a hedge or a retry.
+	 * Unlike pipelining, HEAD is included, since a duplicate is never read from the same connection.
+	 *
+	 * @param method The http method.
+	 * @return True if the method is idempotent, false otherwise.
+	 */
+	static bool Repeatable(const std::string& method) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return Idempotent(method) || method == "HEAD";
+	}
+
+	/**
+	 * Picks the delay before a fetch is retried: a random delay up to the base backoff, doubled for each earlier failure, so that fetches that failed together do not retry together.
+	 *
+	 * @param backoff The base backoff.
+	 * @param failures The number of times the fetch has failed, from one.
+	 * @return The delay.
+	 */
+	static TimeSpan Backoff(const TimeSpan& backoff, size_t failures) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return TimeSpan::FromMilliseconds(Random::Uniform(0, backoff.TotalMilliseconds() * (1 << std::min<size_t>(failures - 1, 16))));
+	}
+
+	/**
+	 * Begins a request to a host.
+	 *
+	 * @param endpoint The endpoint of the host.
+	 * @param method The http method.
+	 * @param path The path.
+	 * @param pipelinable Whether the request may be pipelined if pipelining is enabled.
+	 * @return The request.
+	 */
+	Request& Start(const Socket::Endpoint& endpoint, const std::string& method, const std::string& path, bool pipelinable) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		Request* request = new Request(this, Find(endpoint), method, path);
+
+		_requestsInFlight.insert(request);
+		_requests++;
+		request->_pipelinable = pipelinable && _pipelineDepth > 1 && Idempotent(method);
+
+		// requests that may be pipelined are held until they have ended, since a pipelined request must be written all at once.
+		if (request->_pipelinable) {
+			request->_deferred = true;
+		}
+		else {
+			Dispatch(request, false);
+		}
+
+		return *request;
+	}
+
+	/**
+	 * Gives a request a connection, taking an idle one from the pool unless a new one is required.
+	 * If pipelining is enabled, an ended idempotent request with no idle connection is queued on a busy connection instead, and the connections carrying such requests accept more until their pipelines are full.
+	 *
+	 * @param request The request.
+	 * @param fresh Whether a new connection must be opened.
+	 */
+	void Dispatch(Request* request, bool fresh) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		bool pipelinable = request->_pipelinable && request->_ended;
+		Connection* connection = fresh ? NULL : request->_pool->Take();
+
+		request->Reuse(connection != NULL);
+
+		if (connection != NULL) {
+			_reused++;
+			connection->_request = request;
+			request->_connection = connection;
+			request->Transmit();
+
+			if (pipelinable) {
+				request->_pool->Pipeline(connection);
+			}
+
+			return;
+		}
+
+		if (fresh == false && pipelinable && (connection = request->_pool->Join(_pipelineDepth)) != NULL) {
+			_pipelined++;
+			connection->_queued.push_back(request);
+			request->_connection = connection;
+			request->Reuse(true);
+
+			// requests queued on a connection that is still being opened are written once it connects.
+			if (connection->_connected) {
+				request->Transmit();
+			}
+
+			return;
+		}
+
+		connection = new Connection(this, request->_pool);
+		_connections.insert(connection);
+		connection->Pipeline(_pipelineDepth > 1);
+		connection->_request = request;
+		request->_connection = connection;
+		_connects++;
+
+		try {
+			connection->Open();
+
+			if (pipelinable) {
+				request->_pool->Pipeline(connection);
+			}
+		}
+		catch (const Socket::ConnectionRefusedException& e) {
+			connection->_request = NULL;
+			request->_connection = NULL;
+			Retire(connection);
+
+			// report the failure from the event loop so that the caller has registered for it.
+			if (_refused.empty()) {
+				Thread::Invoke(delegate(&HttpAgent::FailRefused, this));
+			}
+
+			_refused.push_back(request);
+		}
+	}
+
+	/**
+	 * Fails the requests whose connections were refused.
+	 */
+	void FailRefused() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		std::vector<Request*> refused;
+		refused.swap(_refused);
+
+		for (std::vector<Request*>::iterator i = refused.begin(); i != refused.end(); i++) {
+			if ((*i)->_done == false) {
+				Fail(*i);
+			}
+		}
+	}
+
+	/**
+	 * Raises the failure of a request and schedules it to be deleted.
+	 *
+	 * @param request The request.
+	 */
+	void Fail(Request* request) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		_failed++;
+		Retire(request);
+		request->_requestFailed(RequestFailedEventArgs(), request);
+	}
+
+	/**
+	 * Abandons a request and closes its connection.
+	 *
+	 * @param request The request.
+	 */
+	void Abandon(Request* request) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		if (request->_done) {
+			return;
+		}
+
+		Connection* connection = request->_connection;
+		Retire(request);
+
+		if (connection == NULL) {
+			return;
+		}
+
+		request->_connection = NULL;
+
+		if (connection->_request == request) {
+			connection->_request = NULL;
+			connection->Disconnect();
+		}
+		else {
+			std::replace(connection->_queued.begin(), connection->_queued.end(), request, (Request*) NULL);
+		}
+	}
+
+	/**
+	 * Schedules a finished request to be deleted once the event loop has finished dispatching its events.
+	 *
+	 * @param request The request.
+	 */
+	void Retire(Request* request) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		request->_done = true;
+		_requestsInFlight.erase(request);
+		_retiredRequests.push_back(request);
+		Schedule();
+	}
+
+	/**
+	 * Schedules a disconnected connection to be deleted once the event loop has finished dispatching its events.
+	 *
+	 * @param connection The connection.
+	 */
+	void Retire(Connection* connection) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		_connections.erase(connection);
+		_retiredConnections.push_back(connection);
+		Schedule();
+	}
+
+	/**
+	 * Schedules the retired requests and connections to be deleted.
+	 */
+	void Schedule() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		if (_collecting == false) {
+			_collecting = true;
+			Thread::Invoke(delegate(&HttpAgent::Collect, this));
+		}
+	}
+
+	/**
+	 * Deletes the retired requests and connections.
+	 */
+	void Collect() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		for (std::vector<Request*>::iterator i = _retiredRequests.begin(); i != _retiredRequests.end(); i++) {
+			delete *i;
+		}
+
+		for (std::vector<Connection*>::iterator i = _retiredConnections.begin(); i != _retiredConnections.end(); i++) {
+			delete *i;
+		}
+
+		_retiredRequests.clear();
+		_retiredConnections.clear();
+		_collecting = false;
+	}
+
+	/**
+	 * Called when a new connection has been established.
+	 *
+	 * @param connection The connection.
+	 */
+	void OnConnected(Connection* connection) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		_connectTime += DateTime::Utc() - connection->_opened;
+		connection->_connected = true;
+
+		if (connection->_request != NULL) {
+			connection->_request->Transmit();
+		}
+
+		for (std::deque<Request*>::iterator i = connection->_queued.begin(); i != connection->_queued.end(); i++) {
+			if (*i != NULL) {
+				(*i)->Transmit();
+			}
+		}
+	}
+
+	/**
+	 * Called when a response has started on a connection.
+	 * HTTP/1.1 connections are persistent unless the server says otherwise; earlier protocols must ask to be kept alive.
+	 * Nothing more is pipelined on a connection that is not known to be persistent.
+	 *
+	 * @param connection The connection.
+	 * @param args The event arguments.
+	 */
+	void OnResponseStarted(Connection* connection, const HttpClient::ResponseStartedEventArgs& args) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		Request* request = connection->_request;
+		connection->_reusable = args.Protocol() == "HTTP/1.1";
+
+		if (connection->_reusable == false) {
+			connection->_pool->Unpipeline(connection);
+		}
+
+		if (request != NULL) {
+			request->_pool->Record(DateTime::Utc() - request->_begun);
+			request->_responding = true;
+			request->Forget();
+			request->_responseStarted(args, request);
+		}
+	}
+
+	/**
+	 * Called when a response header has been received on a connection.
+	 *
+	 * @param connection The connection.
+	 * @param args The event arguments.
+	 */
+	void OnHeaderReceived(Connection* connection, const HttpClient::HeaderReceivedEventArgs& args) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		if (String::ToLowerCase(args.Key()) == "connection" && (connection->_reusable = String::ToLowerCase(args.Value()) != "close") == false) {
+			connection->_pool->Unpipeline(connection);
+		}
+
+		if (connection->_request != NULL) {
+			connection->_request->_headerReceived(args, connection->_request);
+		}
+	}
+
+	/**
+	 * Called when response content has been received on a connection.
+	 *
+	 * @param connection The connection.
+	 * @param args The event arguments.
+	 */
+	void OnContentReceived(Connection* connection, const HttpClient::ContentReceivedEventArgs& args) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		if (connection->_request != NULL) {
+			connection->_request->_contentReceived(args, connection->_request);
+		}
+	}
+
+	/**
+	 * Called when more of the response content has been received on a connection.
+	 *
+	 * @param connection The connection.
+	 * @param args The event arguments.
+	 */
+	void OnProgressChanged(Connection* connection, const HttpClient::ProgressChangedEventArgs& args) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		if (connection->_request != NULL) {
+			connection->_request->_progressChanged(args, connection->_request);
+		}
+	}
+
+	/**
+	 * Called when a response has ended on a connection.
+	 * The next pipelined request, if any, starts receiving its response. Otherwise the connection is returned to the pool before the event is raised so that a request made by a handler can reuse it.
+	 *
+	 * @param connection The connection.
+	 * @param args The event arguments.
+	 */
+	void OnResponseEnded(Connection* connection, const HttpClient::ResponseEndedEventArgs& args) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		Request* request = connection->_request;
+		connection->_request = NULL;
+
+		// the request may have paused the connection, which must be read again by whatever uses it next.
+		connection->Resume();
+
+		if (connection->_queued.empty() == false) {
+			Request* next = connection->_request = connection->_queued.front();
+			connection->_queued.pop_front();
+
+			if (next != NULL && next->_sink >= 0) {
+				connection->Download(next->_sink, next->_sinkOffset);
+			}
+		}
+		else {
+			connection->_pool->Unpipeline(connection);
+
+			// a request that was cancelled while pipelined has already ended.
+			if (connection->_reusable && (request == NULL || request->_ended)) {
+				connection->_pool->Return(connection);
+			}
+			else {
+				connection->Disconnect();
+			}
+		}
+
+		if (request == NULL) {
+			return;
+		}
+
+		request->_connection = NULL;
+		Retire(request);
+		request->_responseEnded(args, request);
+	}
+
+	/**
+	 * Called when a connection has been disconnected.
+	 * The request receiving its response and every request pipelined behind it are recovered.
+	 *
+	 * @param connection The connection.
+	 */
+	void OnDisconnected(Connection* connection) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		Request* request = connection->_request;
+		std::deque<Request*> queued;
+
+		queued.swap(connection->_queued);
+		connection->_pool->Remove(connection);
+		connection->_request = NULL;
+		Retire(connection);
+
+		if (request != NULL) {
+			Recover(request);
+		}
+
+		for (std::deque<Request*>::iterator i = queued.begin(); i != queued.end(); i++) {
+			if (*i != NULL) {
+				Recover(*i);
+			}
+		}
+	}
+
+	/**
+	 * Retries or fails a request whose connection closed before its response ended.
+	 * A repeatable request that was sent on a reused connection and has not received any of its response is retried once on a new connection, if its content was small enough to be recorded; otherwise the request fails.
+	 * Other methods are never retried, since the server may have acted on the request before the connection closed.
+	 *
+	 * @param request The request.
+	 */
+	void Recover(Request* request) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		request->_connection = NULL;
+		request->_transmitted = false;
+
+		if (request->Retryable()) {
+			request->_retried = true;
+			_retried++;
+			Dispatch(request, true);
+		}
+		else {
+			Fail(request);
+		}
+	}
+
+public:
+
+	/**
+	 * Creates a new agent without any connections.
+	 */
+	HttpAgent() : _pools(), _requestsInFlight(), _connections(), _refused(), _retiredRequests(), _retiredConnections(), _collecting(false), _operations(0), _pipelineDepth(1), _requests(0), _reused(0), _pipelined(0), _connects(0), _retried(0), _failed(0), _hedges(0), _hedgesWon(0), _fetchRetries(0), _connectTime() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+	}
+
+	/**
+	 * Begins a request to a host.
+	 * The request is written once a connection is available, and its events are raised from the event loop, so handlers may be registered after this returns.
+	 *
+	 * @param endpoint The endpoint of the host.
+	 * @param method The http method.
+	 * @param path The path.
+	 * @return The request.
+	 */
+	Request& Begin(const Socket::Endpoint& endpoint, const std::string& method, const std::string& path) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return Start(endpoint, method, path, true);
+	}
+
+	/**
+	 * Sets how many idempotent requests may be in flight on a single connection.
+	 * With a depth greater than one, GET, PUT, DELETE, OPTIONS and TRACE requests are sent once they have ended: on an idle connection if there is one, and otherwise behind the requests on a busy connection before a new connection is opened.
+	 * Responses are matched to requests in the order the requests were sent. Only enable pipelining for hosts known to support it.
+	 *
+	 * @param depth The maximum number of requests in flight on a connection, or one to disable pipelining.
+	 * @return A reference to this agent.
+	 */
+	HttpAgent& Pipeline(size_t depth) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		_pipelineDepth = depth == 0 ? 1 : depth;
+
+		return *this;
+	}
+
+	/**
+	 * Begins a batch of requests that are sent concurrently.
+	 * Add the requests, register for completion and then call End to start sending them.
+	 *
+	 * @param deadline How long the batch may take before it completes with partial results.
+	 * @param concurrency The maximum number of requests in flight at once.
+	 * @return The batch.
+	 */
+	Batch& BeginBatch(const TimeSpan& deadline, size_t concurrency = DefaultBatchConcurrency) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return *new Batch(this, deadline, concurrency);
+	}
+
+	/**
+	 * Begins a fetch of an idempotent request that may be hedged across, and retried on, several hosts serving the same content.
+	 * Configure the fetch, register for completion and then call End to send it.
+	 *
+	 * @param endpoints The endpoints of the hosts, tried in order.
+	 * @param method The http method.
+	 * @param path The path.
+	 * @return The fetch.
+	 */
+	Fetch& BeginFetch(const std::vector<Socket::Endpoint>& endpoints, const std::string& method, const std::string& path) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return *new Fetch(this, endpoints, method, path);
+	}
+
+	/**
+	 * Begins a fetch of an idempotent request to a single host. Hedges are sent on another connection to the same host.
+	 *
+	 * @param endpoint The endpoint of the host.
+	 * @param method The http method.
+	 * @param path The path.
+	 * @return The fetch.
+	 */
+	Fetch& BeginFetch(const Socket::Endpoint& endpoint, const std::string& method, const std::string& path) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return BeginFetch(std::vector<Socket::Endpoint>(1, endpoint), method, path);
+	}
+
+	/**
+	 * The number of requests begun by this agent.
+	 *
+	 * @return The number of requests.
+	 */
+	size_t Requests() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _requests;
+	}
+
+	/**
+	 * The number of requests sent over an idle connection taken from a pool.
+	 *
+	 * @return The number of requests.
+	 */
+	size_t Reused() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _reused;
+	}
+
+	/**
+	 * The number of requests pipelined behind other requests on a busy connection.
+	 *
+	 * @return The number of requests.
+	 */
+	size_t Pipelined() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _pipelined;
+	}
+
+	/**
+	 * The number of connections opened by this agent.
+	 *
+	 * @return The number of connections.
+	 */
+	size_t Connects() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _connects;
+	}
+
+	/**
+	 * The number of requests retried on a new connection after a reused connection was closed.
+	 *
+	 * @return The number of requests.
+	 */
+	size_t Retried() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _retried;
+	}
+
+	/**
+	 * The number of requests that failed.
+	 *
+	 * @return The number of requests.
+	 */
+	size_t Failed() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _failed;
+	}
+
+	/**
+	 * The number of hedges sent by fetches.
+	 *
+	 * @return The number of hedges.
+	 */
+	size_t Hedges() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _hedges;
+	}
+
+	/**
+	 * The number of hedges whose response started before the response to the request they duplicated.
+	 *
+	 * @return The number of hedges.
+	 */
+	size_t HedgesWon() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _hedgesWon;
+	}
+
+	/**
+	 * The number of times a fetch was retried after a backoff.
+	 *
+	 * @return The number of retries.
+	 */
+	size_t FetchRetries() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _fetchRetries;
+	}
+
+	/**
+	 * The fraction of requests that were sent over an existing connection, either idle or pipelined.
+	 *
+	 * @return The hit rate, from zero to one.
+	 */
+	double HitRate() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _requests == 0 ? 0.0 : (double) (_reused + _pipelined) / _requests;
+	}
+
+	/**
+	 * The total time spent establishing new connections.
+	 *
+	 * @return The time spent.
+	 */
+	const TimeSpan& ConnectTime() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _connectTime;
+	}
+
+	/**
+	 * An estimate of the connection time saved by reusing connections: the average time to connect for every reused or pipelined request.
+	 *
+	 * @return The time saved.
+	 */
+	TimeSpan ConnectTimeSaved() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _connects == 0 ? TimeSpan::Zero() : TimeSpan::FromMilliseconds(_connectTime.TotalMilliseconds() * (_reused + _pipelined) / _connects);
+	}
+
+	/**
+	 * Performs unit testing on functions in this class to ensure expected operation.
+	 * Nothing is sent, so the requests tested here are never given a connection.
+	 */
+	static void UnitTest() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		Pool pool(Socket::Endpoint("localhost", 80));
+
+		// the fallback is used until enough latencies have been recorded, and then the oldest are replaced.
+		for (size_t i = 1; i < DefaultMinimumLatencySamples; i++) {
+			pool.Record(TimeSpan::FromMilliseconds(i));
+		}
+
+		assert(pool.Percentile(0.5, TimeSpan::FromSeconds(1)) == TimeSpan::FromSeconds(1));
+
+		for (size_t i = DefaultMinimumLatencySamples; i <= DefaultLatencySamples; i++) {
+			pool.Record(TimeSpan::FromMilliseconds(i));
+		}
+
+		assert(pool.Percentile(0, TimeSpan::Zero()) == TimeSpan::FromMilliseconds(1));
+		assert(pool.Percentile(0.95, TimeSpan::Zero()) == TimeSpan::FromMilliseconds(95));
+		assert(pool.Percentile(1, TimeSpan::Zero()) == TimeSpan::FromMilliseconds(DefaultLatencySamples));
+
+		for (size_t i = 0; i < DefaultLatencySamples; i++) {
+			pool.Record(TimeSpan::FromSeconds(2));
+		}
+
+		assert(pool.Percentile(0, TimeSpan::Zero()) == TimeSpan::FromSeconds(2));
+
+		// the backoff doubles with each failure up to a limit, and is spread from zero to its bound.
+		for (size_t failures = 1; failures <= 20; failures++) {
+			TimeSpan bound = TimeSpan::FromMilliseconds(25.0 * (1 << std::min<size_t>(failures - 1, 16)));
+			bool spread = false;
+
+			for (size_t i = 0; i < 1000; i++) {
+				TimeSpan backoff = Backoff(TimeSpan::FromMilliseconds(25), failures);
+				assert(backoff >= TimeSpan::Zero() && backoff <= bound);
+				spread = spread || backoff > TimeSpan::FromMilliseconds(bound.TotalMilliseconds() / 2);
+			}
+
+			assert(spread);
+		}
+
+		assert(Repeatable("GET") && Repeatable("HEAD") && Repeatable("PUT") && Repeatable("DELETE"));
+		assert(Repeatable("POST") == false && Repeatable("PATCH") == false);
+		assert(Idempotent("GET") && Idempotent("HEAD") == false && Idempotent("POST") == false);
+
+		// only a repeatable request on a reused connection is retried, and only once.
+		Request post(NULL, &pool, "POST", "/");
+		post.Reuse(true);
+		assert(post.Retryable() == false);
+
+		Request get(NULL, &pool, "GET", "/");
+		get.Reuse(false);
+		assert(get.Retryable() == false);
+		get.Reuse(true);
+		assert(get.Retryable());
+		get._retried = true;
+		assert(get.Retryable() == false);
+
+		// a request whose content is too large to keep is not retried.
+		Request put(NULL, &pool, "PUT", "/");
+		put.Reuse(true);
+		put.Send(std::string(DefaultMaximumRecordedContent, 'a'));
+		assert(put.Retryable());
+		put.Send("a");
+		assert(put.Retryable() == false);
+
+		Request deferred(NULL, &pool, "PUT", "/");
+		deferred.Send(std::string(DefaultMaximumRecordedContent + 1, 'a')).End();
+		deferred.Reuse(true);
+		assert(deferred.Retryable() == false && deferred._content.size() == 1);
+	}
+
+	/**
+	 * Deletes this agent and closes its connections.
+	 * Requests still in flight are deleted without raising any more events, and nothing the agent scheduled on the event loop is left to run.
+	 */
+	virtual ~HttpAgent() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		assert(_operations == 0);
+
+		Thread::Cancel(delegate(&HttpAgent::Collect, this));
+		Thread::Cancel(delegate(&HttpAgent::FailRefused, this));
+		Collect();
+
+		// the connections are detached first, since deleting a connection raises its disconnection.
+		for (std::set<Connection*>::iterator i = _connections.begin(); i != _connections.end(); i++) {
+			(*i)->Detach();
+			delete *i;
+		}
+
+		for (std::set<Request*>::iterator i = _requestsInFlight.begin(); i != _requestsInFlight.end(); i++) {
+			delete *i;
+		}
+
+		_connections.clear();
+		_requestsInFlight.clear();
+		_refused.clear();
+
+		for (Pools::iterator i = _pools.begin(); i != _pools.end(); i++) {
+			delete i->second;
+		}
+	}
+};
+
+size_t HttpAgent::DefaultMaximumIdleConnections = 32;
+size_t HttpAgent::DefaultBatchConcurrency = 16;
+size_t HttpAgent::DefaultLatencySamples = 100;
+size_t HttpAgent::DefaultMinimumLatencySamples = 20;
+double HttpAgent::DefaultHedgePercentile = 0.95;
+TimeSpan HttpAgent::DefaultHedgeDelay = TimeSpan::FromMilliseconds(50);
+TimeSpan HttpAgent::DefaultRetryBackoff = TimeSpan::FromMilliseconds(25);
+size_t HttpAgent::DefaultMaximumRecordedContent = 65536;
+bool HttpAgent::UnitTestRegistered = Application::RegisterUnitTest(&HttpAgent::UnitTest);
+
+}
+
+#endif /* HTTPAGENT_HPP_ */
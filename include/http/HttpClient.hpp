@@ -25,14 +25,20 @@
 #define HTTPCLIENT_HPP_
 
 #include "../StackTrace.hpp"
+#include "../Log.hpp"
 #include "../state/StateMachine.hpp"
 #include "../net/TcpClient.hpp"
 
+#ifdef _WIN32
+# include <io.h>
+#endif
+
 namespace nitrus {
 
 /**
  * A class that provides functionality for connecting to servers over the hypertext transfer protocol.
  * The socket communication provided by this class is insecure; therefore, any sensitive data should be handled by an HttpsClient instead.
+ * By default a request may only begin once the previous response has ended; see Pipeline to send requests while responses are outstanding.
  */
 class HttpClient : public TcpClient {
 public:
@@ -149,15 +155,16 @@ public:
 	/**
 	 * A class that encapsulates content for an HTTP response.
 	 * This content may be the complete content or may be a partial chunk of the content.
+	 * The content is only valid while the event is being raised; handlers that need it afterwards must copy it.
 	 */
 	class ContentReceivedEventArgs : public EventArgs {
 	private:
-		std::string _content;
+		const std::string& _content;
 
 	public:
 
 		/**
-		 * Creates a new event argument.
+		 * Creates a new event argument that refers to the content rather than copying it.
 		 *
 		 * @param content The content.
 		 */
@@ -185,6 +192,55 @@ public:
 	typedef EventHandler<const ContentReceivedEventArgs&> ContentReceivedEventHandler;
 	typedef Event<const ContentReceivedEventArgs&> ContentReceivedEvent;
 
+	/**
+	 * A class that encapsulates the progress of an HTTP response body.
+	 */
+	class ProgressChangedEventArgs : public EventArgs {
+	private:
+		uint64_t _received;
+		uint64_t _total;
+
+	public:
+
+		/**
+		 * Creates a new event argument.
+		 *
+		 * @param received The number of content bytes received so far.
+		 * @param total The content length, or zero if the response did not specify one.
+		 */
+		ProgressChangedEventArgs(uint64_t received, uint64_t total) : _received(received), _total(total) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+		}
+
+		/**
+		 * The number of content bytes received so far.
+		 *
+		 * @return The number of bytes.
+		 */
+		uint64_t Received() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _received;
+		}
+
+		/**
+		 * The content length of the response.
+		 *
+		 * @return The number of bytes, or zero if the response did not specify a content length.
+		 */
+		uint64_t Total() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _total;
+		}
+
+		/**
+		 * Deletes this event argument.
+		 */
+		virtual ~ProgressChangedEventArgs() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+		}
+	};
+
+	typedef EventHandler<const ProgressChangedEventArgs&> ProgressChangedEventHandler;
+	typedef Event<const ProgressChangedEventArgs&> ProgressChangedEvent;
+
 	/**
 	 * A class that encapsulates the end of an HTTP response.
 	 */
@@ -235,6 +291,14 @@ private:
 		State_WaitForDisconnect
 	};
 
+	enum PipelineState {
+		PipelineState_Idle,
+		PipelineState_RequestActionLine,
+		PipelineState_RequestHeaderLine,
+		PipelineState_RequestLastHeader,
+		PipelineState_RequestChunk
+	};
+
 	enum Trigger {
 		Trigger_Connected,
 		Trigger_RequestBegin,
@@ -247,20 +311,80 @@ private:
 		Trigger_ContentLength,
 		Trigger_ConnectionClose,
 		Trigger_EndOfChunks,
+		Trigger_NextResponse,
 		Trigger_Disconnect
 	};
 
 	StateMachine<State, Trigger> _stateMachine;
+	StateMachine<PipelineState, Trigger> _pipeline;
+	bool _pipelined;
+	size_t _queued;
 	std::string _buffer;
 	size_t _contentLength;
+	uint64_t _received;
+	uint64_t _total;
+	int _sink;
+	uint64_t _sinkOffset;
+	bool _aborted;
 	ResponseStartedEvent _responseStarted;
 	HeaderReceivedEvent _headerReceived;
 	ContentReceivedEvent _contentReceived;
+	ProgressChangedEvent _progressChanged;
 	ResponseEndedEvent _responseEnded;
 
 private:
 	template <typename Signature> friend class Delegate;
 
+	/**
+	 * Writes data to a file descriptor at the specified offset without moving its file position.
+	 *
+	 * @param descriptor The file descriptor.
+	 * @param data The data.
+	 * @param size The number of bytes.
+	 * @param offset The offset in the file.
+	 * @return The number of bytes written, or a negative value if an error occurred.
+	 */
+	static long WriteAt(int descriptor, const char* data, size_t size, uint64_t offset) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+#ifdef _WIN32
+		return _lseeki64(descriptor, offset, SEEK_SET) < 0 ? -1 : _write(descriptor, data, (unsigned int) size);
+#else
+		return ::pwrite(descriptor, data, size, offset);
+#endif
+	}
+
+	/**
+	 * Hands a piece of response content to the sink or to the content received event.
+	 * Content written to a sink is never raised as an event, so a download uses no more memory than a single read from the socket.
+	 * If the sink cannot be written to, the download is abandoned and the connection is closed without ending the response.
+	 *
+	 * @param content The content.
+	 * @return True if the content was delivered, false if the connection was closed.
+	 */
+	bool Deliver(const std::string& content) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		if (_sink >= 0) {
+			for (size_t written = 0; written < content.size(); ) {
+				long count = WriteAt(_sink, content.data() + written, content.size() - written, _sinkOffset + _received + written);
+
+				if (count <= 0) {
+					Log::Error("unable to write the response content to descriptor %d", _sink);
+					_sink = -1;
+					_aborted = true;
+					Disconnect();
+					return false;
+				}
+
+				written += count;
+			}
+		}
+		else {
+			_contentReceived(ContentReceivedEventArgs(content), this);
+		}
+
+		_received += content.size();
+		_progressChanged(ProgressChangedEventArgs(_received, _total), this);
+		return true;
+	}
+
 	/**
 	 * Called when the tcp client has connected to the server.
 	 *
@@ -278,6 +402,10 @@ private:
 	 * @param sender The sender of the event.
 	 */
 	void OnClientDisconnected(const TcpClient::ClientDisconnectedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		if (_pipeline.CanFire(Trigger_Disconnect)) {
+			_pipeline.Fire(Trigger_Disconnect);
+		}
+
 		_stateMachine.Fire(Trigger_Disconnect);
 	}
 
@@ -289,7 +417,7 @@ private:
 	 * @param sender The sender of the event.
 	 */
 	void OnDataReceived(const TcpClient::DataReceivedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-		_buffer += args.Data();
+		_buffer.append(args.Data());
 		_stateMachine.Fire(Trigger_Continue);
 	}
 
@@ -301,6 +429,8 @@ private:
 	 */
 	void OnWaitForConnectionEntered() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
 		_buffer.clear();
+		_sink = -1;
+		_queued = 0;
 	}
 
 	/**
@@ -312,6 +442,33 @@ private:
 		_stateMachine.Fire(Trigger_Break);
 	}
 
+	/**
+	 * Called when the last header has been sent for a pipelined http request.
+	 * This will send another header specifying chunked transfer encoding.
+	 */
+	void OnPipelinedLastHeaderEntered() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		TcpClient::Send("Transfer-Encoding: chunked\r\n\r\n");
+		_pipeline.Fire(Trigger_Break);
+	}
+
+	/**
+	 * Whether a response is expected or being received.
+	 *
+	 * @return True if the state machine is between the end of a request and the end of its response, false otherwise.
+	 */
+	bool Responding() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _stateMachine.State() >= State_ResponseActionLine && _stateMachine.State() <= State_ResponseChunkAndConnectionClose;
+	}
+
+	/**
+	 * Whether the request being written is pipelined behind an outstanding response.
+	 *
+	 * @return True if the request is written by the pipeline state machine, false otherwise.
+	 */
+	bool Pipelining() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _pipeline.State() != PipelineState_Idle;
+	}
+
 	/**
 	 * Called when the action line should attempt to be parsed.
 	 * If the action line is successfully parsed, the state machine moves to the next state.
@@ -336,6 +493,9 @@ private:
 		_buffer.erase(0, endOfDescription + 2);
 
 		_contentLength = 0;
+		_received = 0;
+		_total = 0;
+		_aborted = false;
 		_responseStarted(ResponseStartedEventArgs(protocol, code, description), this);
 		_stateMachine.Fire(Trigger_Break);
 	}
@@ -370,6 +530,7 @@ private:
 			}
 			else if (String::ToLowerCase(key) == "content-length") {
 				_contentLength = String::Convert<size_t>(value);
+				_total = _contentLength;
 				_stateMachine.Fire(Trigger_ContentLength);
 			}
 			else if (String::ToLowerCase(key) == "connection" && String::ToLowerCase(value) == "close") {
@@ -384,16 +545,38 @@ private:
 	/**
 	 * Called when content should attempt to be received.
 	 * This will wait until the socket has been closed before transitioning states.
+	 * The buffer is handed over rather than copied, since all of it is content.
 	 * If partial data was received, the state machine waits for more data.
 	 */
 	void ContentUntilClosedEntered() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
 		if (_buffer.empty() == false) {
-			_contentReceived(ContentReceivedEventArgs(_buffer), this);
-			_buffer.clear();
-			_stateMachine.Fire(Trigger_Continue);
+			std::string chunk;
+			chunk.swap(_buffer);
+
+			if (Deliver(chunk)) {
+				_stateMachine.Fire(Trigger_Continue);
+			}
 		}
 	}
 
+	/**
+	 * Removes up to the remaining content length from the front of the buffer.
+	 * The buffer is handed over rather than copied when all of it is content, which is the common case for large bodies.
+	 *
+	 * @param chunk The string that receives the content.
+	 */
+	void TakeContent(std::string& chunk) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		if (_buffer.size() <= _contentLength) {
+			chunk.swap(_buffer);
+		}
+		else {
+			chunk.assign(_buffer, 0, _contentLength);
+			_buffer.erase(0, _contentLength);
+		}
+
+		_contentLength -= chunk.size();
+	}
+
 	/**
 	 * Called when content should attempt to be received.
 	 * If partial data was received, the state machine waits for more data.
@@ -403,43 +586,37 @@ private:
 			_stateMachine.Fire(Trigger_Break);
 		}
 		else if (_buffer.empty() == false) {
-			size_t count = _buffer.size();
+			std::string chunk;
+			TakeContent(chunk);
 
-			if (_contentLength < count) {
-				count = _contentLength;
+			if (Deliver(chunk)) {
+				_stateMachine.Fire(Trigger_Continue);
 			}
-
-			std::string chunk = _buffer.substr(0, count);
-			_buffer.erase(0, count);
-			_contentLength -= count;
-
-			_contentReceived(ContentReceivedEventArgs(chunk), this);
-			_stateMachine.Fire(Trigger_Continue);
 		}
 	}
 
 	/**
 	 * Called when the chunk size should attempt to be parsed.
 	 * If it is successfully parsed, the state machine moves to the next state.
+	 * The last chunk is only consumed once the blank line that ends its trailers has been received, so that nothing of the next response on the connection is discarded.
 	 * If partial data was received, the state machine waits for more data.
 	 */
 	void ChunkSizeEntered() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-		size_t endOfSize;
+		size_t endOfSize, endOfTrailers;
 
 		if ((endOfSize = _buffer.find("\r\n")) == std::string::npos) {
 			return;
 		}
-		else {
-			_contentLength = String::Convert<size_t>(_buffer.substr(0, endOfSize), std::hex);
-			_buffer.erase(0, endOfSize + 2);
 
-			if (_contentLength == 0) {
-				_buffer.erase(0, endOfSize + 2);
-				_stateMachine.Fire(Trigger_EndOfChunks);
-			}
-			else {
-				_stateMachine.Fire(Trigger_Break);
-			}
+		_contentLength = String::Convert<size_t>(_buffer.substr(0, endOfSize), std::hex);
+
+		if (_contentLength != 0) {
+			_buffer.erase(0, endOfSize + 2);
+			_stateMachine.Fire(Trigger_Break);
+		}
+		else if ((endOfTrailers = _buffer.find("\r\n\r\n", endOfSize)) != std::string::npos) {
+			_buffer.erase(0, endOfTrailers + 4);
+			_stateMachine.Fire(Trigger_EndOfChunks);
 		}
 	}
 
@@ -455,18 +632,12 @@ private:
 			}
 		}
 		else if (_buffer.empty() == false) {
-			size_t count = _buffer.size();
+			std::string chunk;
+			TakeContent(chunk);
 
-			if (_contentLength < count) {
-				count = _contentLength;
+			if (Deliver(chunk)) {
+				_stateMachine.Fire(Trigger_Continue);
 			}
-
-			std::string chunk = _buffer.substr(0, count);
-			_buffer.erase(0, count);
-			_contentLength -= count;
-
-			_contentReceived(ContentReceivedEventArgs(chunk), this);
-			_stateMachine.Fire(Trigger_Continue);
 		}
 	}
 
@@ -474,7 +645,10 @@ private:
 	 * Called when a request has been completely parsed and has ended for a connection close response.
 	 */
 	void EndOfResponseContentUntilClosedEntered() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-		EndEntered();
+		if (_aborted == false) {
+			EndEntered();
+		}
+
 		_stateMachine.Fire(Trigger_Break);
 	}
 
@@ -482,7 +656,16 @@ private:
 	 * Called when a request has been completely parsed and has ended.
 	 */
 	void EndEntered() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		bool next = _queued != 0;
+
+		_sink = -1;
 		_responseEnded(ResponseEndedEventArgs(), this);
+
+		// the handlers may have disconnected, in which case the queued responses will never arrive.
+		if (next && _stateMachine.State() == State_EndOfResponse) {
+			_queued--;
+			_stateMachine.Fire(Trigger_NextResponse);
+		}
 	}
 
 public:
@@ -490,7 +673,7 @@ public:
 	/**
 	 * Creates a new http client.
 	 */
-	HttpClient() : _stateMachine(State_WaitForConnection), _buffer(), _contentLength(0), _responseStarted(), _headerReceived(), _contentReceived(), _responseEnded() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+	HttpClient() : _stateMachine(State_WaitForConnection), _pipeline(PipelineState_Idle), _pipelined(false), _queued(0), _buffer(), _contentLength(0), _received(0), _total(0), _sink(-1), _sinkOffset(0), _aborted(false), _responseStarted(), _headerReceived(), _contentReceived(), _progressChanged(), _responseEnded() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
 		ClientConnected() += delegate(&HttpClient::OnClientConnected, this);
 		DataReceived() += delegate(&HttpClient::OnDataReceived, this);
 		ClientDisconnected() += delegate(&HttpClient::OnClientDisconnected, this);
@@ -624,7 +807,31 @@ public:
 		_stateMachine.Configure(State_EndOfResponse)
 			.OnEntry(delegate(&HttpClient::EndEntered, this))
 			.Permit(Trigger_Disconnect, State_WaitForConnection)
+			.Permit(Trigger_NextResponse, State_ResponseActionLine)
 			.Permit(Trigger_RequestBegin, State_RequestActionLine);
+
+		_pipeline.Configure(PipelineState_Idle)
+			.Permit(Trigger_RequestBegin, PipelineState_RequestActionLine);
+
+		_pipeline.Configure(PipelineState_RequestActionLine)
+			.Permit(Trigger_Disconnect, PipelineState_Idle)
+			.Permit(Trigger_RequestHeader, PipelineState_RequestHeaderLine)
+			.Permit(Trigger_RequestChunk, PipelineState_RequestLastHeader);
+
+		_pipeline.Configure(PipelineState_RequestHeaderLine)
+			.Permit(Trigger_Disconnect, PipelineState_Idle)
+			.Permit(Trigger_RequestHeader, PipelineState_RequestHeaderLine)
+			.Permit(Trigger_RequestChunk, PipelineState_RequestLastHeader);
+
+		_pipeline.Configure(PipelineState_RequestLastHeader)
+			.OnEntry(delegate(&HttpClient::OnPipelinedLastHeaderEntered, this))
+			.Permit(Trigger_Disconnect, PipelineState_Idle)
+			.Permit(Trigger_Break, PipelineState_RequestChunk);
+
+		_pipeline.Configure(PipelineState_RequestChunk)
+			.Permit(Trigger_Disconnect, PipelineState_Idle)
+			.Permit(Trigger_RequestChunk, PipelineState_RequestChunk)
+			.Permit(Trigger_RequestEnd, PipelineState_Idle);
 	}
 
 	/**
@@ -654,6 +861,15 @@ public:
 		return _contentReceived;
 	}
 
+	/**
+	 * The event used to notify how much of the response content has been received.
+	 *
+	 * @return The event.
+	 */
+	ProgressChangedEvent& ProgressChanged() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _progressChanged;
+	}
+
 	/**
 	 * The event used to notify when the end of a response has been received.
 	 *
@@ -672,7 +888,13 @@ public:
 	 * @return A reference to this http client.
 	 */
 	HttpClient& Begin(const std::string& method, const std::string& path, const std::string& protocol) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-		_stateMachine.Fire(Trigger_RequestBegin);
+		if (_pipelined && (Responding() || _queued != 0 || Pipelining())) {
+			_pipeline.Fire(Trigger_RequestBegin);
+		}
+		else {
+			_stateMachine.Fire(Trigger_RequestBegin);
+		}
+
 		TcpClient::Send(method + " " + path + " " + protocol + "\r\n");
 
 		return *this;
@@ -686,7 +908,13 @@ public:
 	 * @return A reference to this http client.
 	 */
 	HttpClient& SendHeader(const std::string& key, const std::string& value) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-		_stateMachine.Fire(Trigger_RequestHeader);
+		if (Pipelining()) {
+			_pipeline.Fire(Trigger_RequestHeader);
+		}
+		else {
+			_stateMachine.Fire(Trigger_RequestHeader);
+		}
+
 		TcpClient::Send(key + ": " + value + "\r\n");
 
 		return *this;
@@ -699,7 +927,13 @@ public:
 	 * @return A reference to this http client.
 	 */
 	HttpClient& Send(const std::string& data) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-		_stateMachine.Fire(Trigger_RequestChunk);
+		if (Pipelining()) {
+			_pipeline.Fire(Trigger_RequestChunk);
+		}
+		else {
+			_stateMachine.Fire(Trigger_RequestChunk);
+		}
+
 
 		if (data.empty() == false) {
 			TcpClient::Send(String::Format("%x\r\n", data.size()) + data + "\r\n");
@@ -714,9 +948,52 @@ public:
 	 * @return A reference to this http client.
 	 */
 	HttpClient& End() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-		_stateMachine.Fire(Trigger_RequestEnd);
+		if (Pipelining() == false) {
+			_stateMachine.Fire(Trigger_RequestEnd);
+			TcpClient::Send("0\r\n\r\n");
+
+			return *this;
+		}
+
+		_pipeline.Fire(Trigger_RequestEnd);
 		TcpClient::Send("0\r\n\r\n");
 
+		// if the responses ahead of this request have already ended, start waiting for its response now.
+		if (++_queued == 1 && _stateMachine.State() == State_EndOfResponse) {
+			_queued--;
+			_stateMachine.Fire(Trigger_NextResponse);
+		}
+
+		return *this;
+	}
+
+	/**
+	 * Enables or disables pipelining, which allows a request to begin before the responses to earlier requests have ended.
+	 * Pipelined requests are written immediately and their responses are raised in the order the requests were sent.
+	 * Only idempotent requests should be pipelined, and only to servers known to support it: if the connection closes, the requests whose responses had not started are lost and must be sent again.
+	 *
+	 * @param enabled Whether to allow pipelining.
+	 * @return A reference to this http client.
+	 */
+	HttpClient& Pipeline(bool enabled) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		_pipelined = enabled;
+
+		return *this;
+	}
+
+	/**
+	 * Writes the content of the next response to a file instead of raising content received events.
+	 * The content is written at the specified offset as it arrives and is never held in memory, so a response of any size can be downloaded.
+	 * The file descriptor is not closed; the download ends with the response, and progress is reported by the progress changed event.
+	 *
+	 * @param descriptor The file descriptor, opened for writing.
+	 * @param offset The offset in the file where the content begins.
+	 * @return A reference to this http client.
+	 */
+	HttpClient& Download(int descriptor, uint64_t offset = 0) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		_sink = descriptor;
+		_sinkOffset = offset;
+
 		return *this;
 	}
 
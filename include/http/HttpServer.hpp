@@ -25,8 +25,16 @@
 #define HTTPSERVER_HPP_
 
 #include "../StackTrace.hpp"
+#include "../Application.hpp"
+#include "../Arena.hpp"
 #include "../state/StateMachine.hpp"
 #include "../net/TcpServer.hpp"
+#include "AccessLog.hpp"
+
+#include <assert.h>
+#include <set>
+#include <math.h>
+#include <stdio.h>
 
 namespace nitrus {
 
@@ -37,6 +45,345 @@ namespace nitrus {
 class HttpServer : public TcpServer {
 public:
 
+	/**
+	 * A class that decides whether new requests should be rejected because the server is overloaded.
+	 * A request is rejected when the event loop lag or the number of requests in progress exceeds the configured maximum.
+	 * Rejected requests are answered with a 503 Service Unavailable response without notifying any listeners.
+	 * The response is sent as soon as the request headers have been received; a request with a body has its connection closed rather than its body read.
+	 * A maximum of zero disables that check; both checks are disabled by default.
+	 */
+	class SheddingPolicy {
+	private:
+		TimeSpan _maximumLag;
+		size_t _maximumPending;
+		TimeSpan _retryAfter;
+		std::set<std::string> _exemptions;
+		size_t _pending;
+		size_t _rejected;
+
+		/**
+		 * Whether the unit test of this class has been registered to run when the application is initialized.
+		 */
+		static bool UnitTestRegistered;
+
+	public:
+
+		/**
+		 * Creates a new shedding policy that never rejects requests.
+		 */
+		SheddingPolicy() : _maximumLag(), _maximumPending(0), _retryAfter(TimeSpan::FromSeconds(1)), _exemptions(), _pending(0), _rejected(0) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+		}
+
+		/**
+		 * Sets the event loop lag above which new requests are rejected.
+		 *
+		 * @param lag The maximum lag.
+		 * @return A reference to this policy.
+		 */
+		SheddingPolicy& MaximumLag(const TimeSpan& lag) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_maximumLag = lag;
+			return *this;
+		}
+
+		/**
+		 * Sets the number of requests in progress above which new requests are rejected.
+		 *
+		 * @param pending The maximum number of requests in progress.
+		 * @return A reference to this policy.
+		 */
+		SheddingPolicy& MaximumPending(size_t pending) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_maximumPending = pending;
+			return *this;
+		}
+
+		/**
+		 * Sets the delay that rejected clients are asked to wait before retrying.
+		 *
+		 * @param retryAfter The delay sent in the Retry-After header.
+		 * @return A reference to this policy.
+		 */
+		SheddingPolicy& RetryAfter(const TimeSpan& retryAfter) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_retryAfter = retryAfter;
+			return *this;
+		}
+
+		/**
+		 * Exempts a path from being rejected, such as a health check.
+		 * The query string of a request is ignored when comparing paths.
+		 *
+		 * @param path The path to exempt.
+		 * @return A reference to this policy.
+		 */
+		SheddingPolicy& Exempt(const std::string& path) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_exemptions.insert(path);
+			return *this;
+		}
+
+		/**
+		 * Determines whether a new request for the specified path is allowed to be processed.
+		 * If the request is admitted, it is counted as in progress until it is released.
+		 *
+		 * @param path The requested path.
+		 * @return True if the request is admitted, false if it should be rejected.
+		 */
+		bool Admit(const std::string& path) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return Admit(path, Thread::Lag());
+		}
+
+		/**
+		 * Determines whether a new request for the specified path is allowed to be processed at the specified event loop lag.
+		 * If the request is admitted, it is counted as in progress until it is released.
+		 *
+		 * @param path The requested path.
+		 * @param lag The event loop lag.
+		 * @return True if the request is admitted, false if it should be rejected.
+		 */
+		bool Admit(const std::string& path, const TimeSpan& lag) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			bool overloaded = (_maximumPending != 0 && _pending >= _maximumPending) || (_maximumLag > TimeSpan::Zero() && lag > _maximumLag);
+
+			if (overloaded && _exemptions.find(path.substr(0, path.find('?'))) == _exemptions.end()) {
+				_rejected++;
+				return false;
+			}
+
+			_pending++;
+			return true;
+		}
+
+		/**
+		 * Releases a request that was previously admitted.
+		 */
+		void Release() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_pending--;
+		}
+
+		/**
+		 * The delay that rejected clients are asked to wait before retrying.
+		 *
+		 * @return The delay.
+		 */
+		const TimeSpan& RetryAfter() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _retryAfter;
+		}
+
+		/**
+		 * The number of requests currently in progress.
+		 *
+		 * @return The number of requests.
+		 */
+		size_t Pending() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _pending;
+		}
+
+		/**
+		 * The total number of requests that have been rejected.
+		 *
+		 * @return The number of requests.
+		 */
+		size_t Rejected() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _rejected;
+		}
+
+		/**
+		 * Performs unit testing on functions in this class to ensure expected operation.
+		 */
+		static void UnitTest() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			SheddingPolicy disabled;
+			assert(disabled.Admit("/", TimeSpan::FromSeconds(10)) && disabled.Admit("/", TimeSpan::FromSeconds(10)) && disabled.Pending() == 2);
+
+			SheddingPolicy pending;
+			pending.MaximumPending(2).Exempt("/health");
+			assert(pending.Admit("/a", TimeSpan::Zero()) && pending.Admit("/b", TimeSpan::Zero()));
+			assert(pending.Admit("/c", TimeSpan::Zero()) == false && pending.Rejected() == 1 && pending.Pending() == 2);
+
+			// an exempt path is admitted while overloaded, with or without a query string, and still counts as in progress
+			assert(pending.Admit("/health", TimeSpan::Zero()) && pending.Admit("/health?verbose=1", TimeSpan::Zero()) && pending.Pending() == 4);
+			assert(pending.Admit("/health/deep", TimeSpan::Zero()) == false && pending.Rejected() == 2);
+
+			pending.Release();
+			pending.Release();
+			pending.Release();
+			assert(pending.Pending() == 1 && pending.Admit("/c", TimeSpan::Zero()));
+
+			SheddingPolicy lag;
+			lag.MaximumLag(TimeSpan::FromMilliseconds(100)).Exempt("/health").RetryAfter(TimeSpan::FromMilliseconds(1500));
+			assert(lag.Admit("/a", TimeSpan::FromMilliseconds(100)) && lag.Pending() == 1);
+			assert(lag.Admit("/a", TimeSpan::FromMilliseconds(101)) == false && lag.Rejected() == 1 && lag.Pending() == 1);
+			assert(lag.Admit("/health", TimeSpan::FromMilliseconds(101)) && lag.RetryAfter() == TimeSpan::FromMilliseconds(1500));
+		}
+
+		/**
+		 * Deletes this shedding policy.
+		 */
+		virtual ~SheddingPolicy() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+		}
+	};
+
+	class HttpClient;
+
+	/**
+	 * A class that encapsulates a response recorded as it was sent, without the framing of any one connection, so that it can be sent again with HttpClient::Replay.
+	 * The headers are kept as the lines that were sent, so replaying them costs a single copy.
+	 */
+	class Response {
+	private:
+		friend class HttpClient;
+
+		std::string _protocol;
+		int _status;
+		std::string _description;
+		std::string _headers;
+		std::string _content;
+		bool _complete;
+
+	public:
+
+		/**
+		 * Creates a new empty response.
+		 */
+		Response() : _protocol(), _status(0), _description(), _headers(), _content(), _complete(false) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+		}
+
+		/**
+		 * Creates a new complete response.
+		 *
+		 * @param protocol The protocol.
+		 * @param status The response code.
+		 * @param description The description of the response code.
+		 * @param headers The header lines, each ending with a carriage return and line feed.
+		 * @param content The content.
+		 */
+		Response(const std::string& protocol, int status, const std::string& description, const std::string& headers, const std::string& content) : _protocol(protocol), _status(status), _description(description), _headers(headers), _content(content), _complete(true) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+		}
+
+		/**
+		 * Begins writing this response, in the same way as HttpClient::Begin, discarding anything written before.
+		 * A response written this way needs no connection, so it can be written away from the event loop and sent later with HttpClient::Replay.
+		 *
+		 * @param protocol The protocol.
+		 * @param code The response code.
+		 * @param description The description of the response code.
+		 * @return A reference to this response.
+		 */
+		Response& Begin(const std::string& protocol, int code, const std::string& description) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_protocol = protocol;
+			_status = code;
+			_description = description;
+			_headers.clear();
+			_content.clear();
+			_complete = false;
+
+			return *this;
+		}
+
+		/**
+		 * Writes a header to this response.
+		 *
+		 * @param key The key of the header.
+		 * @param value The value of the header.
+		 * @return A reference to this response.
+		 */
+		Response& SendHeader(const std::string& key, const std::string& value) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_headers += key + ": " + value + "\r\n";
+			return *this;
+		}
+
+		/**
+		 * Writes partial content to this response.
+		 *
+		 * @param data The content.
+		 * @return A reference to this response.
+		 */
+		Response& Send(const std::string& data) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_content += data;
+			return *this;
+		}
+
+		/**
+		 * Ends this response, which makes it complete.
+		 *
+		 * @return A reference to this response.
+		 */
+		Response& End() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_complete = true;
+			return *this;
+		}
+
+		/**
+		 * The protocol.
+		 *
+		 * @return The protocol.
+		 */
+		const std::string& Protocol() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _protocol;
+		}
+
+		/**
+		 * The response code.
+		 *
+		 * @return The response code.
+		 */
+		int Status() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _status;
+		}
+
+		/**
+		 * The description of the response code.
+		 *
+		 * @return The description.
+		 */
+		const std::string& Description() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _description;
+		}
+
+		/**
+		 * The header lines, each ending with a carriage return and line feed.
+		 *
+		 * @return The header lines.
+		 */
+		const std::string& Headers() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _headers;
+		}
+
+		/**
+		 * The content.
+		 *
+		 * @return The content.
+		 */
+		const std::string& Content() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _content;
+		}
+
+		/**
+		 * Determines whether the response was ended, rather than cut short by the connection closing.
+		 *
+		 * @return True if the response is complete, false otherwise.
+		 */
+		bool Complete() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _complete;
+		}
+
+		/**
+		 * The number of bytes held by the response.
+		 *
+		 * @return The number of bytes.
+		 */
+		size_t Size() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _protocol.size() + _description.size() + _headers.size() + _content.size();
+		}
+
+		/**
+		 * Deletes this response.
+		 */
+		virtual ~Response() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+		}
+	};
+
 	/**
 	 * A class that provides a state machine for sending and receiving data for a single client.
 	 * This class manages the events and synchronization of messages.
@@ -240,8 +587,113 @@ public:
 		typedef EventHandler<const ClientDisconnectedEventArgs&> ClientDisconnectedEventHandler;
 		typedef Event<const ClientDisconnectedEventArgs&> ClientDisconnectedEvent;
 
+		/**
+		 * A class that encapsulates a response that was recorded while it was sent.
+		 */
+		class ResponseRecordedEventArgs : public EventArgs {
+		private:
+			const HttpServer::Response& _response;
+
+		public:
+
+			/**
+			 * Creates a new event argument.
+			 *
+			 * @param response The recorded response.
+			 */
+			ResponseRecordedEventArgs(const HttpServer::Response& response) : _response(response) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+			}
+
+			/**
+			 * The recorded response, which is not complete if the connection closed before the response ended.
+			 *
+			 * @return The response.
+			 */
+			const HttpServer::Response& Recorded() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				return _response;
+			}
+
+			/**
+			 * Deletes the event argument.
+			 */
+			virtual ~ResponseRecordedEventArgs() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+			}
+		};
+
+		typedef EventHandler<const ResponseRecordedEventArgs&> ResponseRecordedEventHandler;
+
+		/**
+		 * A class that encapsulates the end of a response.
+		 */
+		class ResponseEndedEventArgs : public EventArgs {
+		private:
+			int _status;
+			uint64_t _bytes;
+			uint64_t _latency;
+
+		public:
+
+			/**
+			 * Creates a new event argument.
+			 *
+			 * @param status The response code.
+			 * @param bytes The number of bytes of content sent.
+			 * @param latency The number of microseconds from the first byte of the request to the end of the response.
+			 */
+			ResponseEndedEventArgs(int status, uint64_t bytes, uint64_t latency) : _status(status), _bytes(bytes), _latency(latency) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+			}
+
+			/**
+			 * The response code.
+			 *
+			 * @return The response code.
+			 */
+			int Status() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				return _status;
+			}
+
+			/**
+			 * The number of bytes of content sent.
+			 *
+			 * @return The number of bytes.
+			 */
+			uint64_t Bytes() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				return _bytes;
+			}
+
+			/**
+			 * The time from the first byte of the request to the end of the response.
+			 *
+			 * @return The number of microseconds.
+			 */
+			uint64_t Latency() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				return _latency;
+			}
+
+			/**
+			 * Deletes the event argument.
+			 */
+			virtual ~ResponseEndedEventArgs() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+			}
+		};
+
+		typedef EventHandler<const ResponseEndedEventArgs&> ResponseEndedEventHandler;
+		typedef Event<const ResponseEndedEventArgs&> ResponseEndedEvent;
+
 	private:
 
+		/**
+		 * A response being recorded and the handler to give it to once it has ended.
+		 */
+		struct Recording {
+			HttpServer::Response response;
+			ResponseRecordedEventHandler handler;
+		};
+
 		enum State {
 			State_RequestActionLine,
 			State_RequestHeaderLine,
@@ -276,6 +728,7 @@ public:
 			Trigger_ContentLength,
 			Trigger_ConnectionClose,
 			Trigger_EndOfChunks,
+			Trigger_Reject,
 
 			Trigger_ResponseBegin,
 			Trigger_ResponseHeader,
@@ -287,12 +740,26 @@ public:
 		StateMachine<State, Trigger> _stateMachine;
 		TcpClient* _client;
 		Socket::Endpoint _endpoint;
+		HttpServer* _server;
+		bool _admitted;
+		bool _rejected;
+		int _rejection;
+		std::string _reason;
+		TimeSpan _retryAfter;
+		AccessLog::Record _record;
+		int _status;
+		uint64_t _bytes;
+		uint64_t _received;
 		std::string _buffer;
+		Arena _arena;
 		RequestStartedEvent _requestStarted;
 		HeaderReceivedEvent _headerReceived;
 		ContentReceivedEvent _contentReceived;
 		RequestEndedEvent _requestEnded;
 		size_t _contentLength;
+		size_t _chunk;
+		Recording* _recording;
+		ResponseEndedEvent _responseEnded;
 		ClientDisconnectedEvent _clientDisconnected;
 
 	private:
@@ -313,13 +780,21 @@ public:
 		/**
 		 * Called when data is read from the tcp client.
 		 * This will progress through the state machine and trigger events.
+		 * Data received while a response is being sent belongs to a pipelined request; it is kept until the response ends.
 		 *
 		 * @param args The event arguments.
 		 * @param sender The sender of the event.
 		 */
 		void OnDataReceived(const TcpClient::DataReceivedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			if (_buffer.empty() && _stateMachine.State() == State_RequestActionLine) {
+				_received = DateTime::Microseconds();
+			}
+
 			_buffer += args.Data();
-			_stateMachine.Fire(Trigger_Continue);
+
+			if (_stateMachine.CanFire(Trigger_Continue)) {
+				_stateMachine.Fire(Trigger_Continue);
+			}
 		}
 
 		/**
@@ -340,13 +815,32 @@ public:
 				return;
 			}
 
+			if (_server->_accessLog != NULL) {
+				_record.Request(_buffer.data(), endOfMethod, _buffer.data() + endOfMethod + 1, endOfPath - endOfMethod - 1);
+			}
+
 			std::string method = _buffer.substr(0, endOfMethod);
 			std::string path = _buffer.substr(endOfMethod + 1, endOfPath - endOfMethod - 1);
 			std::string protocol = _buffer.substr(endOfPath + 1, endOfProtocol - endOfPath - 1);
 			_buffer.erase(0, endOfProtocol + 2);
 
 			_contentLength = 0;
-			_requestStarted(RequestStartedEventArgs(method, path, protocol), this);
+			_rejected = _server->_sheddingPolicy.Admit(path) == false;
+			_admitted = _rejected == false;
+
+			if (_rejected) {
+				_rejection = 503;
+				_reason = "Service Unavailable";
+				_retryAfter = _server->_sheddingPolicy.RetryAfter();
+			}
+
+			_status = 0;
+			_bytes = 0;
+
+			if (_rejected == false) {
+				_requestStarted(RequestStartedEventArgs(method, path, protocol), this);
+			}
+
 			_stateMachine.Fire(Trigger_Break);
 		}
 
@@ -363,7 +857,14 @@ public:
 			}
 			else if (endOfValue == 0) {
 				_buffer.erase(0, 2);
-				_stateMachine.Fire(Trigger_Break);
+
+				// a rejected request with a body is answered now and its connection closed, rather than reading the body only to discard it
+				if (_rejected && (_contentLength != 0 || _stateMachine.State() == State_RequestHeaderLineAndTransferEncodingChunked || _stateMachine.State() == State_RequestHeaderLineAndTransferEncodingChunkedAndConnectionClose)) {
+					_stateMachine.Fire(Trigger_Reject);
+				}
+				else {
+					_stateMachine.Fire(Trigger_Break);
+				}
 			}
 			else if ((endOfKey = _buffer.find(":")) == std::string::npos) {
 				return;
@@ -373,7 +874,9 @@ public:
 				std::string value = _buffer.substr(endOfKey + 2, endOfValue - endOfKey - 2);
 				_buffer.erase(0, endOfValue + 2);
 
-				_headerReceived(HeaderReceivedEventArgs(key, value), this);
+				if (_rejected == false) {
+					_headerReceived(HeaderReceivedEventArgs(key, value), this);
+				}
 
 				if (String::ToLowerCase(key) == "transfer-encoding" && String::ToLowerCase(value) == "chunked") {
 					_stateMachine.Fire(Trigger_TransferEncodingChunked);
@@ -410,7 +913,10 @@ public:
 				_buffer.erase(0, count);
 				_contentLength -= count;
 
-				_contentReceived(ContentReceivedEventArgs(chunk), this);
+				if (_rejected == false) {
+					_contentReceived(ContentReceivedEventArgs(chunk), this);
+				}
+
 				_stateMachine.Fire(Trigger_Continue);
 			}
 		}
@@ -418,25 +924,25 @@ public:
 		/**
 		 * Called when the chunk size should attempt to be parsed.
 		 * If it is successfully parsed, the state machine moves to the next state.
+		 * The last chunk is only consumed once the blank line that ends its trailers has been received, so that nothing of a pipelined request that follows is discarded.
 		 * If partial data was received, the state machine waits for more data.
 		 */
 		void ChunkSizeEntered() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-			size_t endOfSize;
+			size_t endOfSize, endOfTrailers;
 
 			if ((endOfSize = _buffer.find("\r\n")) == std::string::npos) {
 				return;
 			}
-			else {
-				_contentLength = String::Convert<size_t>(_buffer.substr(0, endOfSize), std::hex);
-				_buffer.erase(0, endOfSize + 2);
 
-				if (_contentLength == 0) {
-					_buffer.erase(0, endOfSize + 2);
-					_stateMachine.Fire(Trigger_EndOfChunks);
-				}
-				else {
-					_stateMachine.Fire(Trigger_Break);
-				}
+			_contentLength = String::Convert<size_t>(_buffer.substr(0, endOfSize), std::hex);
+
+			if (_contentLength != 0) {
+				_buffer.erase(0, endOfSize + 2);
+				_stateMachine.Fire(Trigger_Break);
+			}
+			else if ((endOfTrailers = _buffer.find("\r\n\r\n", endOfSize)) != std::string::npos) {
+				_buffer.erase(0, endOfTrailers + 4);
+				_stateMachine.Fire(Trigger_EndOfChunks);
 			}
 		}
 
@@ -462,7 +968,10 @@ public:
 				_buffer.erase(0, count);
 				_contentLength -= count;
 
-				_contentReceived(ContentReceivedEventArgs(chunk), this);
+				if (_rejected == false) {
+					_contentReceived(ContentReceivedEventArgs(chunk), this);
+				}
+
 				_stateMachine.Fire(Trigger_Continue);
 			}
 		}
@@ -471,7 +980,24 @@ public:
 		 * Called when a request has been completely parsed and has ended.
 		 */
 		void EndEntered() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-			_requestEnded(RequestEndedEventArgs(), this);
+			if (_rejected) {
+				SendRejection();
+			}
+			else {
+				_requestEnded(RequestEndedEventArgs(), this);
+			}
+		}
+
+		/**
+		 * Answers a rejected request with its response code and a Retry-After header, rounded up to whole seconds.
+		 */
+		void SendRejection() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			Begin("HTTP/1.1", _rejection, _reason.c_str())
+				.SendHeader("Server", "nitrus")
+				.SendHeader("Retry-After", String::Format("%d", (int) ceil(_retryAfter.TotalSeconds())))
+				.SendHeader("Content-Type", "text/plain")
+				.Send("")
+				.End();
 		}
 
 		/**
@@ -505,10 +1031,12 @@ public:
 		 *
 		 * @param client The client that was accepted by the http server.
 		 * @param endpoint The endpoint of the client.
+		 * @param server The http server that accepted the client.
 		 */
-		HttpClient(TcpClient* client, const Socket::Endpoint& endpoint) : _stateMachine(State_RequestActionLine), _client(client), _endpoint(endpoint), _buffer(), _requestStarted(), _headerReceived(), _contentReceived(), _requestEnded(), _contentLength(0), _clientDisconnected() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		HttpClient(TcpClient* client, const Socket::Endpoint& endpoint, HttpServer* server) : _stateMachine(State_RequestActionLine), _client(client), _endpoint(endpoint), _server(server), _admitted(false), _rejected(false), _rejection(0), _reason(), _retryAfter(), _record(), _status(0), _bytes(0), _received(0), _buffer(), _arena(), _requestStarted(), _headerReceived(), _contentReceived(), _requestEnded(), _contentLength(0), _chunk(std::string::npos), _recording(NULL), _responseEnded(), _clientDisconnected() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
 			client->DataReceived() += delegate(&HttpClient::OnDataReceived, this);
 			client->ClientDisconnected() += delegate(&HttpClient::OnClientDisconnected, this);
+			_record.Client(endpoint);
 
 			_stateMachine.Configure(State_RequestActionLine)
 				.OnEntry(delegate(&HttpClient::ActionLineEntered, this))
@@ -533,23 +1061,27 @@ public:
 			_stateMachine.Configure(State_RequestHeaderLineAndContentLengthAndConnectionClose)
 				.OnEntry(delegate(&HttpClient::HeaderLineEntered, this))
 				.Permit(Trigger_Continue, State_RequestHeaderLineAndContentLengthAndConnectionClose)
+				.Permit(Trigger_Reject, State_EndOfRequestAndConnectionClose)
 				.Permit(Trigger_Break, State_RequestContentAndConnectionClose);
 
 			_stateMachine.Configure(State_RequestHeaderLineAndTransferEncodingChunkedAndConnectionClose)
 				.OnEntry(delegate(&HttpClient::HeaderLineEntered, this))
 				.Permit(Trigger_Continue, State_RequestHeaderLineAndTransferEncodingChunkedAndConnectionClose)
+				.Permit(Trigger_Reject, State_EndOfRequestAndConnectionClose)
 				.Permit(Trigger_Break, State_RequestChunkSizeAndConnectionClose);
 
 			_stateMachine.Configure(State_RequestHeaderLineAndTransferEncodingChunked)
 				.OnEntry(delegate(&HttpClient::HeaderLineEntered, this))
 				.Permit(Trigger_Continue, State_RequestHeaderLineAndTransferEncodingChunked)
 				.Permit(Trigger_ConnectionClose, State_RequestHeaderLineAndTransferEncodingChunkedAndConnectionClose)
+				.Permit(Trigger_Reject, State_EndOfRequestAndConnectionClose)
 				.Permit(Trigger_Break, State_RequestChunkSize);
 
 			_stateMachine.Configure(State_RequestHeaderLineAndContentLength)
 				.OnEntry(delegate(&HttpClient::HeaderLineEntered, this))
 				.Permit(Trigger_Continue, State_RequestHeaderLineAndContentLength)
 				.Permit(Trigger_ConnectionClose, State_RequestHeaderLineAndContentLengthAndConnectionClose)
+				.Permit(Trigger_Reject, State_EndOfRequestAndConnectionClose)
 				.Permit(Trigger_Break, State_RequestContent);
 
 			_stateMachine.Configure(State_RequestContent)
@@ -628,29 +1160,47 @@ public:
 
 		/**
 		 * Creates a new http client by copying another http client.
+		 * The admission by the shedding policy is not copied, since only the client that was admitted releases it.
 		 *
 		 * @param that The client to clone.
 		 */
-		HttpClient(const HttpClient& that) : _stateMachine(that._stateMachine), _client(that._client), _endpoint(that._endpoint), _buffer(that._buffer), _requestStarted(that._requestStarted), _headerReceived(that._headerReceived), _contentReceived(that._contentReceived), _requestEnded(that._requestEnded), _contentLength(that._contentLength), _clientDisconnected(that._clientDisconnected) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		HttpClient(const HttpClient& that) : _stateMachine(that._stateMachine), _client(that._client), _endpoint(that._endpoint), _server(that._server), _admitted(false), _rejected(that._rejected), _rejection(that._rejection), _reason(that._reason), _retryAfter(that._retryAfter), _record(that._record), _status(that._status), _bytes(that._bytes), _received(that._received), _buffer(that._buffer), _arena(), _requestStarted(that._requestStarted), _headerReceived(that._headerReceived), _contentReceived(that._contentReceived), _requestEnded(that._requestEnded), _contentLength(that._contentLength), _chunk(that._chunk), _recording(NULL), _responseEnded(that._responseEnded), _clientDisconnected(that._clientDisconnected) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
 
 		}
 
 		/**
 		 * Copies the specified http client into this http client.
+		 * The admission by the shedding policy is not copied, and any admission held by this client is released first.
 		 *
 		 * @param that The client to clone.
 		 * @return A reference to this http client.
 		 */
 		HttpClient& operator = (const HttpClient& that) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			if (_admitted && this != &that) {
+				_admitted = false;
+				_server->_sheddingPolicy.Release();
+			}
+
 			_stateMachine = that._stateMachine;
 			_client = that._client;
 			_endpoint = that._endpoint;
+			_server = that._server;
+			_rejected = that._rejected;
+			_rejection = that._rejection;
+			_reason = that._reason;
+			_retryAfter = that._retryAfter;
+			_record = that._record;
+			_status = that._status;
+			_bytes = that._bytes;
+			_received = that._received;
 			_buffer = that._buffer;
 			_requestStarted = that._requestStarted;
 			_headerReceived = that._headerReceived;
 			_contentReceived = that._contentReceived;
 			_requestEnded = that._requestEnded;
 			_contentLength = that._contentLength;
+			_chunk = that._chunk;
+			_responseEnded = that._responseEnded;
 			_clientDisconnected = that._clientDisconnected;
 
 			return *this;
@@ -703,6 +1253,13 @@ public:
 		HttpClient& Begin(const char* protocol, int code, const char* description) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
 			_stateMachine.Fire(Trigger_ResponseBegin);
 			_client->Send(String::Format("%s %d %s\r\n", protocol, code, description));
+			_status = code;
+
+			if (_recording != NULL) {
+				_recording->response._protocol = protocol;
+				_recording->response._status = code;
+				_recording->response._description = description;
+			}
 
 			return *this;
 		}
@@ -718,6 +1275,10 @@ public:
 			_stateMachine.Fire(Trigger_ResponseHeader);
 			_client->Send(key + ": " + value + "\r\n");
 
+			if (_recording != NULL) {
+				_recording->response._headers += key + ": " + value + "\r\n";
+			}
+
 			return *this;
 		}
 
@@ -729,6 +1290,11 @@ public:
 		 */
 		HttpClient& Send(const std::string& data) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
 			_stateMachine.Fire(Trigger_ResponseChunk);
+			_bytes += data.size();
+
+			if (_recording != NULL) {
+				_recording->response._content += data;
+			}
 
 			if (data.empty() == false) {
 				if (_stateMachine.State() == State_ResponseChunk) {
@@ -742,6 +1308,74 @@ public:
 			return *this;
 		}
 
+		/**
+		 * The number of bytes queued on the connection that have not been written yet, so that a large response can wait for a slow client rather than be held in memory.
+		 *
+		 * @return The number of bytes.
+		 */
+		size_t Unsent() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _client->Queued().size();
+		}
+
+		/**
+		 * Begins partial response content that is written in place, by appending to the data queued on the connection, rather than passed to Send.
+		 * For a chunked response, room is left for the size of the chunk, which is filled in by EndContent.
+		 * Nothing else may be sent until EndContent is called, and it must be called before returning to the event loop.
+		 *
+		 * @return The data queued on the connection, to append the content to.
+		 */
+		std::string& BeginContent() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			std::string& queued = _client->Queued();
+
+			_stateMachine.Fire(Trigger_ResponseChunk);
+			_chunk = queued.size();
+
+			if (_stateMachine.State() == State_ResponseChunk) {
+				// a chunk size may have leading zeros, so a fixed width leaves room for any size.
+				queued.append("00000000\r\n");
+			}
+
+			return queued;
+		}
+
+		/**
+		 * Ends partial response content that was written in place after BeginContent.
+		 *
+		 * @return A reference to this http client.
+		 */
+		HttpClient& EndContent() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			std::string& queued = _client->Queued();
+			size_t header = _stateMachine.State() == State_ResponseChunk ? 10 : 0;
+
+			if (_chunk == std::string::npos || queued.size() < _chunk + header) {
+				_chunk = std::string::npos;
+				return *this;
+			}
+
+			size_t size = queued.size() - _chunk - header;
+
+			if (_recording != NULL) {
+				_recording->response._content.append(queued, _chunk + header, size);
+			}
+
+			if (size == 0) {
+				queued.erase(_chunk);
+			}
+			else if (header != 0) {
+				char digits[9];
+
+				sprintf(digits, "%08x", (unsigned) size);
+				queued.replace(_chunk, 8, digits, 8);
+				queued.append("\r\n");
+			}
+
+			_bytes += size;
+			_chunk = std::string::npos;
+			_client->Send("", 0);
+
+			return *this;
+		}
+
 		/**
 		 * Ends a response to a request.
 		 *
@@ -752,10 +1386,153 @@ public:
 				_client->Send("0\r\n\r\n");
 			}
 
+			if (_admitted) {
+				_admitted = false;
+				_server->_sheddingPolicy.Release();
+			}
+
+			uint64_t ended = DateTime::Microseconds();
+
+			if (_server->_accessLog != NULL) {
+				_server->_accessLog->Write(_record, _status, _bytes, _received, ended);
+			}
+
+			_responseEnded(ResponseEndedEventArgs(_status, _bytes, ended - _received), this);
+
+			// a pipelined request that is already waiting started arriving no later than now.
+			if (_buffer.empty() == false) {
+				_received = ended;
+			}
+
+			// release the memory held for this request so that an idle connection holds no buffers.
+			if (_buffer.empty()) {
+				std::string().swap(_buffer);
+			}
+
+			_arena.Reset();
+
+			// the recording is handed off first, since ending the response may start the next pipelined request.
+			if (_recording != NULL) {
+				Recording* recording = _recording;
+
+				_recording = NULL;
+				recording->response._complete = true;
+				recording->handler(ResponseRecordedEventArgs(recording->response), this);
+				delete recording;
+			}
+
 			_stateMachine.Fire(Trigger_ResponseEnd);
 			return *this;
 		}
 
+		/**
+		 * Records the response to the current request as it is sent, and gives it to a handler once it has ended.
+		 * If the connection closes first, the handler is given the response as far as it was sent, which is not complete, so that it is always called exactly once.
+		 *
+		 * @param handler The event handler to give the recorded response to.
+		 * @return A reference to this http client.
+		 */
+		HttpClient& Record(const ResponseRecordedEventHandler& handler) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			if (_recording == NULL) {
+				_recording = new Recording();
+			}
+
+			_recording->response = HttpServer::Response();
+			_recording->handler = handler;
+
+			return *this;
+		}
+
+		/**
+		 * Sends a recorded response to the current request, from its status line to its end.
+		 * The content is sent in one piece, framed for this connection.
+		 *
+		 * @param response The recorded response.
+		 * @return A reference to this http client.
+		 */
+		HttpClient& Replay(const HttpServer::Response& response) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			Begin(response.Protocol().c_str(), response.Status(), response.Description().c_str());
+
+			_stateMachine.Fire(Trigger_ResponseHeader);
+			_client->Send(response.Headers());
+
+			if (_recording != NULL) {
+				_recording->response._headers += response.Headers();
+			}
+
+			return Send(response.Content()).End();
+		}
+
+		/**
+		 * Rejects the current request without notifying any more listeners, such as when the client has made too many requests.
+		 * If the request is rejected before its headers end and it has a body, the rejection is sent once they end and the connection is closed instead of reading the body.
+		 * If the body is already being received, the rest of it is read and discarded and the rejection is sent once it has been, otherwise it is sent now.
+		 *
+		 * @param code The response code, such as 429.
+		 * @param description The response description, such as "Too Many Requests".
+		 * @param retryAfter The delay the client is asked to wait before retrying.
+		 * @return A reference to this http client.
+		 */
+		HttpClient& Reject(int code, const std::string& description, const TimeSpan& retryAfter) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_rejected = true;
+			_rejection = code;
+			_reason = description;
+			_retryAfter = retryAfter;
+
+			if (_stateMachine.State() == State_EndOfRequest || _stateMachine.State() == State_EndOfRequestAndConnectionClose) {
+				SendRejection();
+			}
+
+			return *this;
+		}
+
+		/**
+		 * The memory used for data that lives only as long as the current request.
+		 * Everything allocated from it is released when the response ends.
+		 *
+		 * @return The arena for the current request.
+		 */
+		Arena& Memory() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _arena;
+		}
+
+		/**
+		 * The endpoint of the client.
+		 *
+		 * @return The endpoint.
+		 */
+		const Socket::Endpoint& Endpoint() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _endpoint;
+		}
+
+		/**
+		 * The tcp connection used to communicate with the client.
+		 *
+		 * @return The connection.
+		 */
+		TcpClient* Connection() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _client;
+		}
+
+		/**
+		 * Determines whether the content of the current response is sent with chunked transfer encoding.
+		 * This is only meaningful after the response headers have been completed by sending content.
+		 *
+		 * @return True if content is sent in chunks, false if content is sent until the connection is closed.
+		 */
+		bool Chunked() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _stateMachine.State() == State_ResponseChunk;
+		}
+
+		/**
+		 * The event used to notify listeners when a response has ended, with the time taken from the first byte of the request.
+		 *
+		 * @return The event.
+		 */
+		ResponseEndedEvent& ResponseEnded() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _responseEnded;
+		}
+
 		/**
 		 * The event used to notify listeners when a client is disconnected.
 		 *
@@ -769,6 +1546,15 @@ public:
 		 * Deletes this client handler.
 		 */
 		virtual ~HttpClient() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			if (_admitted) {
+				_server->_sheddingPolicy.Release();
+			}
+
+			if (_recording != NULL) {
+				_recording->handler(ResponseRecordedEventArgs(_recording->response), this);
+				delete _recording;
+			}
+
 			_client->DataReceived() -= delegate(&HttpClient::OnDataReceived, this);
 			_client->ClientDisconnected() -= delegate(&HttpClient::OnClientDisconnected, this);
 		}
@@ -834,6 +1620,8 @@ public:
 
 private:
 	ClientAcceptedEvent _clientAccepted;
+	SheddingPolicy _sheddingPolicy;
+	AccessLog* _accessLog;
 
 private:
 	template <typename Signature> friend class Delegate;
@@ -846,7 +1634,7 @@ private:
 	 * @param sender The sender of the event.
 	 */
 	void OnClientAccepted(const TcpServer::ClientAcceptedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-		HttpClient* client = new HttpClient(args.Client(), args.Endpoint());
+		HttpClient* client = new HttpClient(args.Client(), args.Endpoint(), this);
 		_clientAccepted(ClientAcceptedEventArgs(client), this);
 	}
 
@@ -855,7 +1643,7 @@ public:
 	/**
 	 * Creates a new http server that listens for http client connections.
 	 */
-	HttpServer() : _clientAccepted() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+	HttpServer() : _clientAccepted(), _sheddingPolicy(), _accessLog(NULL) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
 		TcpServer::ClientAccepted() += delegate(&HttpServer::OnClientAccepted, this);
 	}
 
@@ -868,14 +1656,48 @@ public:
 		return _clientAccepted;
 	}
 
+	/**
+	 * The policy used to reject new requests when the server is overloaded.
+	 *
+	 * @return The shedding policy.
+	 */
+	SheddingPolicy& LoadShedding() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _sheddingPolicy;
+	}
+
+	/**
+	 * Starts writing an access record for every response to the specified file.
+	 * Records are written asynchronously by a background thread.
+	 *
+	 * @param path The path of the log file.
+	 * @param capacity The number of records that may be pending before records are dropped.
+	 */
+	void EnableAccessLog(const std::string& path, size_t capacity = AccessLog::DefaultCapacity) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		AccessLog* log = new AccessLog(path, capacity);
+		delete _accessLog;
+		_accessLog = log;
+	}
+
+	/**
+	 * The access log used to record responses.
+	 *
+	 * @return The access log, or NULL if access logging is not enabled.
+	 */
+	AccessLog* Access() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _accessLog;
+	}
+
 	/**
 	 * Deletes this http server and stops listening for http client connections.
 	 */
 	virtual ~HttpServer() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		delete _accessLog;
 		TcpServer::ClientAccepted() -= delegate(&HttpServer::OnClientAccepted, this);
 	}
 };
 
+bool HttpServer::SheddingPolicy::UnitTestRegistered = Application::RegisterUnitTest(&HttpServer::SheddingPolicy::UnitTest);
+
 }
 
 #endif /* HTTPSERVER_HPP_ */
@@ -0,0 +1,345 @@
+/*
+ * Copyright (c) 2012 Christopher M. Baker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef QUERYSTRING_HPP_
+#define QUERYSTRING_HPP_
+
+#include "../StackTrace.hpp"
+#include "../Application.hpp"
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+namespace nitrus {
+
+/**
+ * A class that decodes the parameters of a query string, such as a=1&b=two%20words, in a single pass.
+ * Keys and values are percent-decoded, with a plus decoded as a space, into one buffer and are referred to by their ranges within it, so parsing makes at most two allocations however many parameters there are.
+ * Runs of ordinary characters are skipped eight at a time by testing a whole word for the four characters that need attention.
+ * A percent sign that is not followed by two hexadecimal digits is kept as it is, and empty parameters, such as those left by a trailing ampersand, are ignored.
+ */
+class QueryString {
+public:
+
+	/**
+	 * A decoded parameter, stored as ranges of the decoded buffer.
+	 */
+	struct Parameter {
+		size_t key;
+		size_t keyLength;
+		size_t value;
+		size_t valueLength;
+		bool assigned;
+	};
+
+private:
+	std::string _decoded;
+	std::vector<Parameter> _parameters;
+
+	/**
+	 * Whether the unit test of this class has been registered to run when the application is initialized.
+	 */
+	static bool UnitTestRegistered;
+
+	/**
+	 * Determines whether any byte of a word is zero.
+	 *
+	 * @param word The word.
+	 * @return Non-zero if a byte is zero, zero otherwise.
+	 */
+	static uint64_t HasZero(uint64_t word) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return (word - 0x0101010101010101ULL) & ~word & 0x8080808080808080ULL;
+	}
+
+	/**
+	 * Converts a hexadecimal digit to its value.
+	 *
+	 * @param c The digit.
+	 * @return The value, or -1 if the character is not a hexadecimal digit.
+	 */
+	static int Hex(char c) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+	}
+
+public:
+
+	/**
+	 * Finds the next character that ends or changes a key or value: a percent sign, a plus, an ampersand or an equals sign.
+	 *
+	 * @param data The characters.
+	 * @param begin The position to start from.
+	 * @param end The position to stop at.
+	 * @return The position of the character, or the end if there is none.
+	 */
+	static size_t Scan(const char* data, size_t begin, size_t end) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		static const uint64_t ones = 0x0101010101010101ULL;
+
+		for (; begin + sizeof(uint64_t) <= end; begin += sizeof(uint64_t)) {
+			uint64_t word;
+			memcpy(&word, data + begin, sizeof(word));
+
+			if (HasZero(word ^ (ones * '%')) | HasZero(word ^ (ones * '+')) | HasZero(word ^ (ones * '&')) | HasZero(word ^ (ones * '='))) {
+				break;
+			}
+		}
+
+		for (; begin < end; begin++) {
+			char c = data[begin];
+
+			if (c == '%' || c == '+' || c == '&' || c == '=') {
+				break;
+			}
+		}
+
+		return begin;
+	}
+
+	/**
+	 * Creates a new empty query string.
+	 */
+	QueryString() : _decoded(), _parameters() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+	}
+
+	/**
+	 * Creates a new query string from a range of a string.
+	 *
+	 * @param value The string, such as a request path.
+	 * @param begin The position of the query string, after the question mark.
+	 * @param length The length of the query string.
+	 */
+	QueryString(const std::string& value, size_t begin = 0, size_t length = std::string::npos) : _decoded(), _parameters() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		begin = begin < value.size() ? begin : value.size();
+		Parse(value.data() + begin, length < value.size() - begin ? length : value.size() - begin);
+	}
+
+	/**
+	 * Replaces the parameters with those of a query string.
+	 *
+	 * @param data The query string, without the question mark.
+	 * @param length The length of the query string.
+	 */
+	void Parse(const char* data, size_t length) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		Parameter parameter = { 0, 0, 0, 0, false };
+		size_t begin = 0;
+
+		_decoded.clear();
+		_decoded.reserve(length);
+		_parameters.clear();
+
+		while (begin <= length) {
+			size_t next = Scan(data, begin, length);
+
+			_decoded.append(data + begin, next - begin);
+
+			if (next == length || data[next] == '&') {
+				if (parameter.assigned) {
+					parameter.valueLength = _decoded.size() - parameter.value;
+				}
+				else {
+					parameter.keyLength = _decoded.size() - parameter.key;
+				}
+
+				if (parameter.keyLength != 0 || parameter.assigned) {
+					_parameters.push_back(parameter);
+				}
+
+				parameter.key = _decoded.size();
+				parameter.keyLength = 0;
+				parameter.value = 0;
+				parameter.valueLength = 0;
+				parameter.assigned = false;
+			}
+			else if (data[next] == '=' && parameter.assigned == false) {
+				parameter.keyLength = _decoded.size() - parameter.key;
+				parameter.value = _decoded.size();
+				parameter.assigned = true;
+			}
+			else if (data[next] == '+') {
+				_decoded += ' ';
+			}
+			else if (data[next] == '%' && next + 2 < length && Hex(data[next + 1]) >= 0 && Hex(data[next + 2]) >= 0) {
+				_decoded += (char) (Hex(data[next + 1]) << 4 | Hex(data[next + 2]));
+				next += 2;
+			}
+			else {
+				_decoded += data[next];
+			}
+
+			begin = next + 1;
+		}
+	}
+
+	/**
+	 * The number of parameters.
+	 *
+	 * @return The number of parameters.
+	 */
+	size_t Count() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _parameters.size();
+	}
+
+	/**
+	 * Gets the decoded key of a parameter.
+	 *
+	 * @param index The position of the parameter.
+	 * @return The key.
+	 */
+	std::string Key(size_t index) const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		const Parameter& parameter = _parameters.at(index);
+		return _decoded.substr(parameter.key, parameter.keyLength);
+	}
+
+	/**
+	 * Gets the decoded value of a parameter.
+	 *
+	 * @param index The position of the parameter.
+	 * @return The value, which is empty if the parameter had no equals sign.
+	 */
+	std::string Value(size_t index) const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		const Parameter& parameter = _parameters.at(index);
+		return _decoded.substr(parameter.value, parameter.valueLength);
+	}
+
+	/**
+	 * Determines whether a parameter was given a value with an equals sign, as in a=, rather than being a bare key.
+	 *
+	 * @param index The position of the parameter.
+	 * @return True if the parameter was assigned, false otherwise.
+	 */
+	bool Assigned(size_t index) const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _parameters.at(index).assigned;
+	}
+
+	/**
+	 * Determines whether the decoded key of a parameter equals a range of a string.
+	 *
+	 * @param index The position of the parameter.
+	 * @param key The string.
+	 * @param begin The position of the range.
+	 * @param length The length of the range.
+	 * @return True if the key is equal, false otherwise.
+	 */
+	bool KeyEquals(size_t index, const std::string& key, size_t begin, size_t length) const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		const Parameter& parameter = _parameters[index];
+		return parameter.keyLength == length && _decoded.compare(parameter.key, length, key, begin, length) == 0;
+	}
+
+	/**
+	 * Determines whether the decoded value of a parameter equals a range of a string.
+	 *
+	 * @param index The position of the parameter.
+	 * @param value The string.
+	 * @param begin The position of the range.
+	 * @param length The length of the range.
+	 * @return True if the value is equal, false otherwise.
+	 */
+	bool ValueEquals(size_t index, const std::string& value, size_t begin, size_t length) const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		const Parameter& parameter = _parameters[index];
+		return parameter.valueLength == length && _decoded.compare(parameter.value, length, value, begin, length) == 0;
+	}
+
+	/**
+	 * Finds the first parameter with a key equal to a range of a string.
+	 *
+	 * @param key The string.
+	 * @param begin The position of the range.
+	 * @param length The length of the range.
+	 * @return The position of the parameter, or std::string::npos if there is none.
+	 */
+	size_t Find(const std::string& key, size_t begin, size_t length) const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		for (size_t i = 0; i < _parameters.size(); i++) {
+			if (KeyEquals(i, key, begin, length)) {
+				return i;
+			}
+		}
+
+		return std::string::npos;
+	}
+
+	/**
+	 * Finds the first parameter with a key.
+	 *
+	 * @param key The key.
+	 * @return The position of the parameter, or std::string::npos if there is none.
+	 */
+	size_t Find(const std::string& key) const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return Find(key, 0, key.size());
+	}
+
+	/**
+	 * Gets the decoded value of the first parameter with a key.
+	 *
+	 * @param key The key.
+	 * @param defaultValue The default value to return if not found.
+	 * @return The value if the key exists, the default value otherwise.
+	 */
+	std::string Get(const std::string& key, const std::string& defaultValue = "") const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		size_t i = Find(key);
+		return i == std::string::npos ? defaultValue : Value(i);
+	}
+
+	/**
+	 * Performs unit testing on functions in this class to ensure expected operation.
+	 */
+	static void UnitTest() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		QueryString query("/search?q=two+words%21&sort=name&flag&empty=&&x=a=b&bad=%zz%4", 8);
+
+		assert(query.Count() == 6);
+		assert(query.Key(0) == "q" && query.Value(0) == "two words!");
+		assert(query.Get("sort") == "name");
+		assert(query.Find("flag") == 2 && query.Assigned(2) == false && query.Value(2) == "");
+		assert(query.Assigned(3) && query.Value(3) == "");
+		assert(query.Get("x") == "a=b");
+		assert(query.Get("bad") == "%zz%4");
+		assert(query.Get("missing", "none") == "none");
+
+		QueryString encoded("%73ort=%E2%82%AC&a%26b=1");
+		assert(encoded.Get("sort") == "\xE2\x82\xAC" && encoded.Get("a&b") == "1");
+
+		// characters that need attention are found wherever they fall within a word.
+		for (size_t i = 0; i < 20; i++) {
+			std::string value = std::string(i, 'a') + "&" + std::string(20 - i, 'b');
+			assert(Scan(value.data(), 0, value.size()) == i);
+		}
+
+		assert(Scan("abcdefghijklmnop", 0, 16) == 16);
+		assert(QueryString("").Count() == 0 && QueryString("&&").Count() == 0);
+	}
+
+	/**
+	 * Deletes this query string.
+	 */
+	virtual ~QueryString() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+	}
+};
+
+bool QueryString::UnitTestRegistered = Application::RegisterUnitTest(&QueryString::UnitTest);
+
+}
+
+#endif /* QUERYSTRING_HPP_ */
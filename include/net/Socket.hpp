@@ -42,6 +42,7 @@
 # define sock_bind     ::bind
 # define sock_listen   ::listen
 # define sock_accept   ::accept
+# define sock_getname  ::getsockname
 # define sock_setopt   ::setsockopt
 # define sock_ioctl    ::ioctlsocket
 # define sock_receive(handle, buffer, size) ::recv(handle, buffer, size, 0)
@@ -49,6 +50,7 @@
 # define sock_recvfrom ::recvfrom
 # define sock_sendto   ::sendto
 # define sock_error    ::WSAGetLastError
+# define sock_shutdown(handle) ::shutdown(handle, SD_BOTH)
 #else
 # include <stdio.h>
 # include <stdlib.h>
@@ -59,8 +61,10 @@
 # include <sys/time.h>
 # include <sys/ioctl.h>
 # include <netinet/in.h>
+# include <netinet/tcp.h>
 # include <arpa/inet.h>
 # include <netdb.h>
+# include <poll.h>
 # include <errno.h>
 # define INVALID_SOCKET (-1)
 # define ERR_INPROGRESS EINPROGRESS
@@ -70,16 +74,24 @@
 # define sock_close    ::close
 # define sock_connect  ::connect
 # define sock_select   ::select
+# define sock_poll     ::poll
 # define sock_bind     ::bind
 # define sock_listen   ::listen
 # define sock_accept   ::accept
+# define sock_getname  ::getsockname
 # define sock_setopt   ::setsockopt
 # define sock_ioctl    ::ioctl
 # define sock_receive  ::read
-# define sock_send     ::write
+// a write to a connection reset by the peer fails rather than raising SIGPIPE, which would end the process.
+# ifdef MSG_NOSIGNAL
+#  define sock_send(handle, buffer, size) ::send(handle, buffer, size, MSG_NOSIGNAL)
+# else
+#  define sock_send     ::write
+# endif
 # define sock_recvfrom ::recvfrom
 # define sock_sendto   ::sendto
 # define sock_error()  errno
+# define sock_shutdown(handle) ::shutdown(handle, SHUT_RDWR)
 #endif
 
 namespace nitrus {
@@ -468,6 +480,22 @@ public:
 		}
 	}
 
+	/**
+	 * Returns the local endpoint of the socket, such as the port chosen by the system after binding to port zero.
+	 *
+	 * @return The local endpoint.
+	 */
+	Endpoint LocalEndpoint() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		sockaddr_in addr;
+		socklen_t size = sizeof(addr);
+
+		if (sock_getname(_handle, (struct sockaddr*) &addr, &size) != 0) {
+			throw InvalidHandleException();
+		}
+
+		return Resolve(addr);
+	}
+
 	/**
 	 * Connects the socket to the specified endpoint.
 	 *
@@ -504,6 +532,7 @@ public:
 	 *
 	 */
 	bool Poll(const SelectMode& mode, const TimeSpan& timeout = TimeSpan::Zero()) const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+#ifdef _WIN32
 		timeval tv;
 		fd_set fdset;
 
@@ -524,6 +553,30 @@ public:
 		}
 
 		return false;
+#else
+		// poll is used instead of select so that handles beyond FD_SETSIZE can be polled
+		struct pollfd descriptor;
+
+		descriptor.fd = _handle;
+		descriptor.events = mode == SelectMode_Read ? POLLIN : mode == SelectMode_Write ? POLLOUT : POLLPRI;
+		descriptor.revents = 0;
+
+		if (sock_poll(&descriptor, 1, (int) timeout.TotalMilliseconds()) <= 0) {
+			return false;
+		}
+
+		if (mode == SelectMode_Read) {
+			return (descriptor.revents & (POLLIN | POLLHUP | POLLERR)) != 0;
+		}
+		else if (mode == SelectMode_Write) {
+			return (descriptor.revents & (POLLOUT | POLLERR)) != 0;
+		}
+		else if (mode == SelectMode_Error) {
+			return (descriptor.revents & (POLLPRI | POLLERR)) != 0;
+		}
+
+		return false;
+#endif
 	}
 
 	/**
@@ -584,13 +637,18 @@ public:
 	 * If the socket is in blocking mode, this function will block until the specified number of bytes have been received.
 	 * If the socket is in non-blocking mode, this function will return immediately but may not read all of the bytes requested.
 	 * If not all data could be received, the length of the string returned will be less than the specified count.
+	 * Data is read into a buffer shared by all sockets on the event loop, so a socket holds no receive buffer between reads.
 	 *
 	 * @param count The number of bytes to receive.
 	 * @return The data received.
 	 */
 	std::string Receive(size_t count) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		static std::vector<char> buffer;
 		int bytesReceived;
-		std::vector<char> buffer(count);
+
+		if (buffer.size() < count) {
+			buffer.resize(count);
+		}
 
 		if ((bytesReceived = sock_receive(_handle, &buffer[0], count)) < 0) {
 			return std::string();
@@ -634,9 +692,23 @@ public:
 	 * @return The number of bytes sent.
 	 */
 	size_t Send(const std::string& value) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return Send(value.data(), value.size());
+	}
+
+	/**
+	 * Sends data to a connected socket.
+	 * If the socket is in blocking mode, this function will block until the specified number of bytes has been sent.
+	 * If the socket is in non-blocking mode, this function will return immediately but may not have sent all of the bytes requested.
+	 * If not all data could be sent, the value returned will be less than the specified size.
+	 *
+	 * @param data The data to send.
+	 * @param size The number of bytes to send.
+	 * @return The number of bytes sent.
+	 */
+	size_t Send(const char* data, size_t size) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
 		int bytesSent;
 
-		if ((bytesSent = sock_send(_handle, value.data(), value.size())) < 0) {
+		if ((bytesSent = sock_send(_handle, data, size)) < 0) {
 			if (sock_error() == ERR_INPROGRESS || sock_error() == ERR_TRYAGAIN) {
 				return 0;
 			}
@@ -674,6 +746,14 @@ public:
 		return bytesSent;
 	}
 
+	/**
+	 * Shuts down both directions of a connected socket without closing the handle.
+	 * Pending reads will return immediately as if the remote socket had been closed.
+	 */
+	void Shutdown() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		sock_shutdown(_handle);
+	}
+
 	/**
 	 * Deletes the socket.
 	 */
@@ -30,6 +30,13 @@
 
 #include "Socket.hpp"
 
+#include <algorithm>
+#include <vector>
+
+#ifdef __linux__
+# include <sys/epoll.h>
+#endif
+
 namespace nitrus {
 
 /**
@@ -40,7 +47,8 @@ class TcpClient : public Socket {
 public:
 
 	/**
-	 * How often the socket should check for pending data.
+	 * How often connected sockets are checked for pending data, and connecting sockets for a completed connection.
+	 * All connected sockets are checked together by a single scheduled delegate rather than one per socket.
 	 */
 	static TimeSpan DefaultDataPollFrequency;
 
@@ -102,12 +110,13 @@ public:
 	 */
 	class DataReceivedEventArgs : public EventArgs {
 	private:
-		std::string _data;
+		const std::string& _data;
 
 	public:
 
 		/**
-		 * Creates a new event argument with the specified data.
+		 * Creates a new event argument that refers to the specified data rather than copying it.
+		 * The data is only valid while the event is being raised.
 		 *
 		 * @param data The data sent to this socket.
 		 */
@@ -152,10 +161,57 @@ private:
 		Trigger_Disconnected
 	};
 
+private:
+
+	/**
+	 * The connected sockets that are checked for pending data.
+	 */
+	static std::vector<TcpClient*> Watched;
+
+	/**
+	 * The sockets that have pending data and are waiting to be updated.
+	 * Entries are cleared when a socket stops being watched so that deleted sockets are never updated.
+	 */
+	static std::vector<TcpClient*> Ready;
+
+	/**
+	 * Whether the watched sockets are currently scheduled to be polled.
+	 */
+	static bool Polling;
+
+	/**
+	 * The sockets waiting for a pending connection to complete.
+	 * Entries are cleared when a socket stops connecting so that deleted sockets are never checked.
+	 */
+	static std::vector<TcpClient*> Connecting;
+
+	/**
+	 * The sockets with queued data that will be written at the end of the current event loop iteration.
+	 * Entries are cleared when a socket is disconnected so that deleted sockets are never flushed.
+	 */
+	static std::vector<TcpClient*> Unflushed;
+
+	/**
+	 * The sockets with queued data that the connection would not take, which are flushed again after the data poll frequency.
+	 * Entries are cleared when a socket is disconnected so that deleted sockets are never flushed.
+	 */
+	static std::vector<TcpClient*> Blocked;
+
+#ifdef __linux__
+	/**
+	 * The epoll instance shared by all watched sockets.
+	 */
+	static int Epoll;
+#endif
+
 private:
 	StateMachine<State, Trigger> _stateMachine;
 	size_t _bufferSize;
-	TimeSpan _poll;
+	size_t _watchIndex;
+	bool _flushing;
+	bool _blocked;
+	bool _closing;
+	bool _connecting;
 	ClientConnectedEvent _clientConnected;
 	ClientDisconnectedEvent _clientDisconnected;
 	DataReceivedEvent _dataReceived;
@@ -164,10 +220,211 @@ private:
 private:
 	template <typename Signature> friend class Delegate;
 
+	/**
+	 * Checks all watched sockets for pending data and updates the ones that are ready.
+	 * This is scheduled once for all sockets, so an idle connection does not hold a pending delegate of its own.
+	 */
+	static void PollWatched() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		if (Watched.empty()) {
+			Polling = false;
+			return;
+		}
+
+#ifdef __linux__
+		static std::vector<epoll_event> events;
+		events.resize(Watched.size());
+
+		int count = ::epoll_wait(Epoll, &events[0], (int) events.size(), 0);
+
+		for (int i = 0; i < count; i++) {
+			Ready.push_back(static_cast<TcpClient*>(events[i].data.ptr));
+		}
+#else
+		for (size_t i = 0; i < Watched.size(); i++) {
+			if (Watched[i]->Poll(SelectMode_Read)) {
+				Ready.push_back(Watched[i]);
+			}
+		}
+#endif
+
+		bool busy = Ready.empty() == false;
+
+		for (size_t i = 0; i < Ready.size(); i++) {
+			if (Ready[i] != NULL) {
+				Ready[i]->Connected_Update();
+			}
+		}
+
+		Ready.clear();
+		Thread::SetTimeout(busy ? TimeSpan::Zero() : DefaultDataPollFrequency, delegate(&TcpClient::PollWatched));
+	}
+
+	/**
+	 * Checks all sockets with a pending connection.
+	 * This is scheduled once for all connecting sockets, so a socket can be deleted while it is still connecting.
+	 */
+	static void PollConnecting() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		for (size_t i = 0; i < Connecting.size(); i++) {
+			if (Connecting[i] != NULL) {
+				Connecting[i]->Connecting_Update();
+			}
+		}
+
+		Connecting.erase(std::remove(Connecting.begin(), Connecting.end(), (TcpClient*) NULL), Connecting.end());
+
+		if (Connecting.empty() == false) {
+			Thread::SetTimeout(DefaultDataPollFrequency, delegate(&TcpClient::PollConnecting));
+		}
+	}
+
+	/**
+	 * Writes the queued data of every socket that was sent to during this event loop iteration.
+	 */
+	static void FlushUnflushed() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		for (size_t i = 0; i < Unflushed.size(); i++) {
+			if (Unflushed[i] != NULL) {
+				Unflushed[i]->_flushing = false;
+				Unflushed[i]->Flush();
+			}
+		}
+
+		Unflushed.clear();
+	}
+
+	/**
+	 * Writes the queued data of every socket that the connection would not take before.
+	 * Sockets that still cannot write all of their data are flushed again after the data poll frequency.
+	 */
+	static void FlushBlocked() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		size_t count = Blocked.size();
+
+		for (size_t i = 0; i < count; i++) {
+			TcpClient* client = Blocked[i];
+
+			if (client != NULL) {
+				Blocked[i] = NULL;
+				client->_blocked = false;
+				client->Flush();
+			}
+		}
+
+		Blocked.erase(Blocked.begin(), Blocked.begin() + count);
+
+		if (Blocked.empty() == false) {
+			Thread::SetTimeout(DefaultDataPollFrequency, delegate(&TcpClient::FlushBlocked));
+		}
+	}
+
+	/**
+	 * Waits for the connection to take more data, rather than trying again at once.
+	 */
+	void Wait() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		if (_blocked) {
+			return;
+		}
+
+		_blocked = true;
+		Blocked.push_back(this);
+
+		if (Blocked.size() == 1) {
+			Thread::SetTimeout(DefaultDataPollFrequency, delegate(&TcpClient::FlushBlocked));
+		}
+	}
+
+	/**
+	 * Removes this socket from the sockets waiting to be flushed.
+	 */
+	void CancelFlush() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		if (_flushing) {
+			for (size_t i = 0; i < Unflushed.size(); i++) {
+				if (Unflushed[i] == this) {
+					Unflushed[i] = NULL;
+				}
+			}
+
+			_flushing = false;
+		}
+
+		if (_blocked) {
+			for (size_t i = 0; i < Blocked.size(); i++) {
+				if (Blocked[i] == this) {
+					Blocked[i] = NULL;
+				}
+			}
+
+			_blocked = false;
+		}
+	}
+
+	/**
+	 * Starts checking this socket for pending data.
+	 */
+	void Watch() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		if (_watchIndex != std::string::npos) {
+			return;
+		}
+
+#ifdef __linux__
+		if (Epoll < 0) {
+			Epoll = ::epoll_create(1);
+		}
+
+		epoll_event event = epoll_event();
+		event.events = EPOLLIN;
+		event.data.ptr = this;
+		::epoll_ctl(Epoll, EPOLL_CTL_ADD, _handle, &event);
+#endif
+
+		_watchIndex = Watched.size();
+		Watched.push_back(this);
+
+		if (Polling == false) {
+			Polling = true;
+			Thread::Invoke(delegate(&TcpClient::PollWatched));
+		}
+	}
+
+	/**
+	 * Stops checking this socket for pending data.
+	 */
+	void Unwatch() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		if (_watchIndex == std::string::npos) {
+			return;
+		}
+
+#ifdef __linux__
+		epoll_event event = epoll_event();
+		::epoll_ctl(Epoll, EPOLL_CTL_DEL, _handle, &event);
+#endif
+
+		Watched[_watchIndex] = Watched.back();
+		Watched[_watchIndex]->_watchIndex = _watchIndex;
+		Watched.pop_back();
+		_watchIndex = std::string::npos;
+
+		for (size_t i = 0; i < Ready.size(); i++) {
+			if (Ready[i] == this) {
+				Ready[i] = NULL;
+			}
+		}
+	}
+
+	/**
+	 * Removes this socket from the sockets waiting for a pending connection.
+	 */
+	void CancelConnecting() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		if (_connecting) {
+			std::replace(Connecting.begin(), Connecting.end(), this, (TcpClient*) NULL);
+			_connecting = false;
+		}
+	}
+
 	/**
 	 * Checks if the socket is connected.
+	 *
+	 * @return True if the connection has completed or failed, false if it is still pending.
 	 */
-	void Connecting_OnEntry() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+	bool Connecting_Update() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
 		if (Poll(SelectMode_Write)) {
 			_stateMachine.Fire(Trigger_Connected);
 		}
@@ -175,7 +432,25 @@ private:
 			_stateMachine.Fire(Trigger_Disconnected);
 		}
 		else {
-			Thread::SetTimeout(_poll, delegate(&TcpClient::Connecting_OnEntry, this));
+			return false;
+		}
+
+		return true;
+	}
+
+	/**
+	 * Checks if the socket is connected, and starts checking it periodically if the connection is still pending.
+	 */
+	void Connecting_OnEntry() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		if (Connecting_Update()) {
+			return;
+		}
+
+		_connecting = true;
+		Connecting.push_back(this);
+
+		if (Connecting.size() == 1) {
+			Thread::SetTimeout(DefaultDataPollFrequency, delegate(&TcpClient::PollConnecting));
 		}
 	}
 
@@ -183,47 +458,52 @@ private:
 	 * Triggers the connected event and starts checking for incoming data.
 	 */
 	void Connected_OnEntry() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		CancelConnecting();
 		_sendBuffer.clear();
+		Watch();
 		_clientConnected(ClientConnectedEventArgs(), this);
-		Thread::Invoke(delegate(&TcpClient::Connected_Update, this));
 	}
 
 	/**
 	 * Sends another chunk of queued data.
+	 * If the connection takes none of it, the rest is sent once the connection has had time to drain rather than retried at once.
 	 */
 	void Sending_OnEntry() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
 		size_t count = Socket::Send(_sendBuffer);
 		_sendBuffer.erase(0, count);
 
-		if (_sendBuffer.empty() == false) {
+		if (_sendBuffer.empty()) {
+			std::string().swap(_sendBuffer);
+		}
+		else if (count > 0) {
 			_stateMachine.Fire(Trigger_Send);
 		}
+		else {
+			Wait();
+		}
 	}
 
 	/**
 	 * Triggers the disconnected event.
 	 */
 	void Disconnected_OnEntry() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		CancelConnecting();
+		Unwatch();
+		CancelFlush();
 		_clientDisconnected(ClientDisconnectedEventArgs(), this);
 	}
 
 	/**
-	 * Checks for incoming data on the socket.
+	 * Reads incoming data from a socket that has been polled as ready.
 	 */
 	void Connected_Update() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
 		std::string data;
 
-		if (Poll(SelectMode_Read)) {
-			if ((data = Receive(_bufferSize)).empty()) {
-				_stateMachine.Fire(Trigger_Disconnected);
-			}
-			else {
-				_dataReceived(DataReceivedEventArgs(data), this);
-				Thread::Invoke(delegate(&TcpClient::Connected_Update, this));
-			}
+		if ((data = Receive(_bufferSize)).empty()) {
+			_stateMachine.Fire(Trigger_Disconnected);
 		}
 		else {
-			Thread::SetTimeout(_poll, delegate(&TcpClient::Connected_Update, this));
+			_dataReceived(DataReceivedEventArgs(data), this);
 		}
 	}
 
@@ -244,9 +524,8 @@ public:
 	 * Creates a new connected socket.
 	 *
 	 * @param bufferSize The maximum number of bytes capable of being received.
-	 * @param poll The maximum update interval used to check for incoming data.
 	 */
-	TcpClient(size_t bufferSize = DefaultDataBufferSize, const TimeSpan& poll = DefaultDataPollFrequency) : Socket(AF_INET, SOCK_STREAM, IPPROTO_TCP), _stateMachine(State_Idle), _bufferSize(bufferSize), _poll(poll), _clientConnected(), _clientDisconnected(), _dataReceived(), _sendBuffer() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+	TcpClient(size_t bufferSize = DefaultDataBufferSize) : Socket(AF_INET, SOCK_STREAM, IPPROTO_TCP), _stateMachine(State_Idle), _bufferSize(bufferSize), _watchIndex(std::string::npos), _flushing(false), _blocked(false), _closing(false), _connecting(false), _clientConnected(), _clientDisconnected(), _dataReceived(), _sendBuffer() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
 		_stateMachine.Configure(State_Idle)
 			.Permit(Trigger_Connected, State_Connected)
 			.Permit(Trigger_Connect, State_Connecting);
@@ -310,19 +589,105 @@ public:
 
 	/**
 	 * Sends data to a connected socket.
-	 * If not all data could be sent, the remaining data is queued and another send is attempted later.
+	 * The data is queued and written at the end of the current event loop iteration, so that the many small pieces of a message are written together.
 	 *
 	 * @param value The data to send.
 	 */
 	void Send(const std::string& value) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-		_sendBuffer += value;
-		_stateMachine.Fire(Trigger_Send);
+		Send(value.data(), value.size());
+	}
+
+	/**
+	 * Sends data to a connected socket.
+	 * The data is queued and written at the end of the current event loop iteration, so that the many small pieces of a message are written together.
+	 *
+	 * @param data The data to send.
+	 * @param size The number of bytes to send.
+	 */
+	void Send(const char* data, size_t size) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		_sendBuffer.append(data, size);
+
+		if (_flushing == false) {
+			_flushing = true;
+			Unflushed.push_back(this);
+
+			if (Unflushed.size() == 1) {
+				Thread::Invoke(delegate(&TcpClient::FlushUnflushed));
+			}
+		}
 	}
 
 	/**
-	 * Disconnects the socket.
+	 * The data queued to be sent, so that a writer can append to it in place rather than building a copy to pass to Send.
+	 * Anything appended is written once Send is next called, even with no data.
+	 *
+	 * @return The queued data.
+	 */
+	std::string& Queued() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _sendBuffer;
+	}
+
+	/**
+	 * Writes as much queued data to the socket as it takes now, and the rest once the connection has drained.
+	 * If the data cannot be written because the connection has failed, the socket is shut down and the disconnection is reported when the socket is next read.
+	 * A socket that was disconnected with data still queued is disconnected once the data has been written.
+	 */
+	void Flush() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		if (_sendBuffer.empty() || (_stateMachine.State() != State_Connected && _stateMachine.State() != State_Sending)) {
+			return;
+		}
+
+		try {
+			_stateMachine.Fire(Trigger_Send);
+		}
+		catch (const SendException& e) {
+			std::string().swap(_sendBuffer);
+			Shutdown();
+		}
+
+		// this may delete the socket, so nothing can follow it.
+		if (_closing && _sendBuffer.empty()) {
+			_closing = false;
+			_stateMachine.Fire(Trigger_Disconnected);
+		}
+	}
+
+	/**
+	 * Stops reading from the socket, so that incoming data waits in the connection until Resume is called.
+	 * This holds off a sender that is faster than the data can be passed on; a disconnection is not noticed while the socket is paused.
+	 */
+	void Pause() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		Unwatch();
+	}
+
+	/**
+	 * Starts reading from a paused socket again.
+	 * This does nothing if the socket is not connected or is being disconnected.
+	 */
+	void Resume() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		if ((_stateMachine.State() == State_Connected || _stateMachine.State() == State_Sending) && _closing == false) {
+			Watch();
+		}
+	}
+
+	/**
+	 * Disconnects the socket after writing any queued data.
+	 * If the connection will not take all of the data yet, the socket stops reading and is disconnected once the data has been written.
+	 * This does nothing if the socket is not connected or has already been disconnected.
 	 */
 	void Disconnect() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		if (_stateMachine.CanFire(Trigger_Disconnected) == false || _closing) {
+			return;
+		}
+
+		Flush();
+
+		if (_sendBuffer.empty() == false && _stateMachine.State() == State_Sending) {
+			_closing = true;
+			Unwatch();
+			return;
+		}
+
 		_stateMachine.Fire(Trigger_Disconnected);
 	}
 
@@ -333,11 +698,24 @@ public:
 		if(_stateMachine.State() == State_Connected || _stateMachine.State() == State_Connecting) {
 			_stateMachine.Fire(Trigger_Disconnected);
 		}
+
+		Unwatch();
+		CancelFlush();
+		CancelConnecting();
 	}
 };
 
 TimeSpan TcpClient::DefaultDataPollFrequency = TimeSpan::FromMilliseconds(1);
 size_t TcpClient::DefaultDataBufferSize = 4096;
+std::vector<TcpClient*> TcpClient::Watched = std::vector<TcpClient*>();
+std::vector<TcpClient*> TcpClient::Ready = std::vector<TcpClient*>();
+bool TcpClient::Polling = false;
+std::vector<TcpClient*> TcpClient::Connecting = std::vector<TcpClient*>();
+std::vector<TcpClient*> TcpClient::Unflushed = std::vector<TcpClient*>();
+std::vector<TcpClient*> TcpClient::Blocked = std::vector<TcpClient*>();
+#ifdef __linux__
+int TcpClient::Epoll = -1;
+#endif
 
 }
 
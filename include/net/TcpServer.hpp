@@ -45,6 +45,11 @@ public:
 	 */
 	static TimeSpan DefaultAcceptPollFrequency;
 
+	/**
+	 * The maximum number of pending client connections accepted each time the server checks.
+	 */
+	static size_t DefaultAcceptBatchSize;
+
 	/**
 	 * A class that encapsulates a pending connection to the socket.
 	 */
@@ -135,12 +140,21 @@ private:
 	 * Checks for pending client connections to this socket.
 	 */
 	void Update() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-		if (Poll(SelectMode_Read)) {
+		for (size_t i = 0; i < DefaultAcceptBatchSize && Poll(SelectMode_Read); i++) {
 			Socket::Endpoint endpoint;
 			TcpClient* client = new TcpClient();
 
 			if (Socket::Accept(*client, endpoint)) {
 				client->Block(false);
+
+				// sends are already gathered into one write per event loop iteration, so waiting to coalesce small writes only delays the end of a response.
+				// a connection that was reset before it was accepted may refuse the option, which is harmless.
+				try {
+					client->SetOption(IPPROTO_TCP, TCP_NODELAY, 1);
+				}
+				catch (const Socket::InvalidOptionException& e) {
+
+				}
 				_clientAccepted(ClientAcceptedEventArgs(client, endpoint), this);
 				client->ClientDisconnected() += delegate(&TcpServer::OnClientDisconnected, this);
 
@@ -152,6 +166,7 @@ private:
 			else {
 				delete client;
 				Log::Warning("A client was pending for the tcp server but it could not be accepted.");
+				break;
 			}
 		}
 
@@ -198,6 +213,7 @@ public:
 };
 
 TimeSpan TcpServer::DefaultAcceptPollFrequency = TimeSpan::FromMilliseconds(1);
+size_t TcpServer::DefaultAcceptBatchSize = 64;
 
 }
 
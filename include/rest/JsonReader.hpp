@@ -0,0 +1,1061 @@
+/*
+ * Copyright (c) 2012 Christopher M. Baker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef JSONREADER_HPP_
+#define JSONREADER_HPP_
+
+#include "../StackTrace.hpp"
+#include "../Application.hpp"
+#include "../Arena.hpp"
+
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include <string>
+
+namespace nitrus {
+
+class JsonParser;
+
+/**
+ * A class that encapsulates a single value of a parsed JSON document.
+ * Values are allocated from an arena and are valid until it is reset; strings without escapes refer to the parsed text rather than copying it, so the text must also outlive its values.
+ * Looking up a member or element that does not exist gives a null value, so that optional fields can be read without checking for each one.
+ */
+class JsonValue {
+public:
+
+	/**
+	 * The types of JSON values.
+	 */
+	enum Type {
+		Type_Null,
+		Type_Boolean,
+		Type_Number,
+		Type_String,
+		Type_Array,
+		Type_Object
+	};
+
+	/**
+	 * A null value returned for members and elements that do not exist.
+	 */
+	static const JsonValue Missing;
+
+private:
+	friend class JsonParser;
+
+	Type _type;
+	bool _boolean;
+	bool _integral;
+	int64_t _integer;
+	double _number;
+	const char* _data;
+	size_t _size;
+	const char* _key;
+	size_t _keySize;
+	size_t _count;
+	JsonValue* _first;
+	JsonValue* _last;
+	JsonValue* _next;
+
+public:
+
+	/**
+	 * Creates a new null value.
+	 */
+	JsonValue() : _type(Type_Null), _boolean(false), _integral(false), _integer(0), _number(0), _data(NULL), _size(0), _key(NULL), _keySize(0), _count(0), _first(NULL), _last(NULL), _next(NULL) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+	}
+
+	/**
+	 * The type of the value.
+	 *
+	 * @return The type.
+	 */
+	Type GetType() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _type;
+	}
+
+	/**
+	 * Determines whether the value is null, which includes members and elements that do not exist.
+	 *
+	 * @return True if the value is null, false otherwise.
+	 */
+	bool IsNull() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _type == Type_Null;
+	}
+
+	/**
+	 * Gets a boolean value.
+	 *
+	 * @param defaultValue The default value to return if this is not a boolean.
+	 * @return The boolean.
+	 */
+	bool Boolean(bool defaultValue = false) const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _type == Type_Boolean ? _boolean : defaultValue;
+	}
+
+	/**
+	 * Gets a number value.
+	 *
+	 * @param defaultValue The default value to return if this is not a number.
+	 * @return The number.
+	 */
+	double Number(double defaultValue = 0) const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _type == Type_Number ? _number : defaultValue;
+	}
+
+	/**
+	 * Gets a number value as an integer.
+	 * Integers that fit in 64 bits are exact; other numbers are truncated.
+	 *
+	 * @param defaultValue The default value to return if this is not a number.
+	 * @return The integer.
+	 */
+	int64_t Integer(int64_t defaultValue = 0) const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _type != Type_Number ? defaultValue : _integral ? _integer : (int64_t) _number;
+	}
+
+	/**
+	 * Determines whether a number was written as an integer that fits in 64 bits, so that Integer is exact.
+	 *
+	 * @return True if the number is an exact integer, false otherwise.
+	 */
+	bool IsIntegral() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _type == Type_Number && _integral;
+	}
+
+	/**
+	 * Gets a copy of a string value.
+	 *
+	 * @param defaultValue The default value to return if this is not a string.
+	 * @return The decoded string.
+	 */
+	std::string String(const std::string& defaultValue = "") const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _type == Type_String ? std::string(_data, _size) : defaultValue;
+	}
+
+	/**
+	 * The decoded characters of a string value, without copying them.
+	 *
+	 * @return The characters, which are not terminated, or NULL if this is not a string.
+	 */
+	const char* Data() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _data;
+	}
+
+	/**
+	 * The number of decoded characters of a string value.
+	 *
+	 * @return The number of characters.
+	 */
+	size_t Size() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _size;
+	}
+
+	/**
+	 * Determines whether a string value equals a string, without copying it.
+	 *
+	 * @param value The string.
+	 * @return True if this is an equal string, false otherwise.
+	 */
+	bool Equals(const std::string& value) const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _type == Type_String && _size == value.size() && memcmp(_data, value.data(), _size) == 0;
+	}
+
+	/**
+	 * Gets a copy of the key of an object member.
+	 *
+	 * @return The decoded key, which is empty if this is not an object member.
+	 */
+	std::string Key() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return std::string(_key == NULL ? "" : _key, _keySize);
+	}
+
+	/**
+	 * The number of elements of an array or members of an object.
+	 *
+	 * @return The number of elements or members.
+	 */
+	size_t Count() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _count;
+	}
+
+	/**
+	 * The first element of an array or member of an object.
+	 *
+	 * @return The value, or NULL if there is none.
+	 */
+	const JsonValue* First() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _first;
+	}
+
+	/**
+	 * The element or member after this one.
+	 *
+	 * @return The value, or NULL if this is the last.
+	 */
+	const JsonValue* Next() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _next;
+	}
+
+	/**
+	 * Finds the first member of an object with a key.
+	 *
+	 * @param key The key.
+	 * @return The member, or NULL if there is none.
+	 */
+	const JsonValue* Find(const std::string& key) const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		for (const JsonValue* i = _type == Type_Object ? _first : NULL; i != NULL; i = i->_next) {
+			if (i->_keySize == key.size() && memcmp(i->_key, key.data(), key.size()) == 0) {
+				return i;
+			}
+		}
+
+		return NULL;
+	}
+
+	/**
+	 * Gets the first member of an object with a key.
+	 *
+	 * @param key The key.
+	 * @return The member, or a null value if there is none.
+	 */
+	const JsonValue& operator [] (const std::string& key) const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		const JsonValue* value = Find(key);
+		return value == NULL ? Missing : *value;
+	}
+
+	/**
+	 * Gets an element of an array, by walking the elements before it.
+	 *
+	 * @param index The position of the element.
+	 * @return The element, or a null value if there is none.
+	 */
+	const JsonValue& operator [] (size_t index) const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		const JsonValue* value = _type == Type_Array ? _first : NULL;
+
+		for (; value != NULL && index > 0; index--) {
+			value = value->_next;
+		}
+
+		return value == NULL ? Missing : *value;
+	}
+
+	/**
+	 * Deletes this value.
+	 * Values allocated from an arena are never deleted; their memory is reclaimed when the arena is reset.
+	 */
+	virtual ~JsonValue() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+	}
+};
+
+/**
+ * A class that parses JSON text into values allocated from an arena, in a single pass.
+ * Runs of string characters are skipped eight at a time by testing a whole word for a quote, a backslash or a control character, and strings without escapes are not copied.
+ * The grammar is checked strictly, so trailing commas, comments, unquoted keys and leading zeros are all errors, as is nesting deeper than MaximumDepth.
+ */
+class JsonParser {
+public:
+
+	/**
+	 * The deepest nesting of arrays and objects that is parsed before giving up, so that hostile input cannot exhaust the stack.
+	 */
+	static size_t MaximumDepth;
+
+private:
+	const char* _text;
+	size_t _size;
+	size_t _position;
+	Arena* _arena;
+	bool _failed;
+
+	/**
+	 * Determines whether any byte of a word ends a run of plain string characters: a quote, a backslash or a control character.
+	 *
+	 * @param word The word.
+	 * @return Non-zero if a byte ends the run, zero otherwise.
+	 */
+	static uint64_t EndsRun(uint64_t word) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		static const uint64_t ones = 0x0101010101010101ULL;
+		static const uint64_t highs = 0x8080808080808080ULL;
+		uint64_t quotes = word ^ (ones * '"');
+		uint64_t backslashes = word ^ (ones * '\\');
+
+		return (((word - ones * 0x20) & ~word) | ((quotes - ones) & ~quotes) | ((backslashes - ones) & ~backslashes)) & highs;
+	}
+
+	/**
+	 * Converts a hexadecimal digit to its value.
+	 *
+	 * @param c The digit.
+	 * @return The value, or -1 if the character is not a hexadecimal digit.
+	 */
+	static int Hex(char c) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+	}
+
+	/**
+	 * Reads the four hexadecimal digits of a unicode escape.
+	 *
+	 * @param position The position of the first digit.
+	 * @return The code unit, or -1 if the digits are not valid.
+	 */
+	long CodeUnit(size_t position) const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		long unit = 0;
+
+		if (position + 4 > _size) {
+			return -1;
+		}
+
+		for (size_t i = position; i < position + 4; i++) {
+			int digit = Hex(_text[i]);
+
+			if (digit < 0) {
+				return -1;
+			}
+
+			unit = unit << 4 | digit;
+		}
+
+		return unit;
+	}
+
+	/**
+	 * Records that the text is not valid.
+	 *
+	 * @return NULL, for convenience.
+	 */
+	JsonValue* Fail() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		_failed = true;
+		return NULL;
+	}
+
+	/**
+	 * Creates a new value in the arena.
+	 *
+	 * @param type The type of the value.
+	 * @return The value.
+	 */
+	JsonValue* Create(JsonValue::Type type) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		JsonValue* value = new (_arena->Allocate(sizeof(JsonValue))) JsonValue();
+		value->_type = type;
+
+		return value;
+	}
+
+	/**
+	 * Parses a string, decoding it into the arena if it has escapes.
+	 *
+	 * @param data The decoded characters.
+	 * @param size The number of decoded characters.
+	 * @return True if the string is valid, false otherwise.
+	 */
+	bool ParseString(const char*& data, size_t& size) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		size_t begin = ++_position;
+		size_t i = begin;
+		bool escaped = false;
+
+		for (;;) {
+			for (; i + sizeof(uint64_t) <= _size; i += sizeof(uint64_t)) {
+				uint64_t word;
+				memcpy(&word, _text + i, sizeof(word));
+
+				if (EndsRun(word)) {
+					break;
+				}
+			}
+
+			for (; i < _size && (unsigned char) _text[i] >= 0x20 && _text[i] != '"' && _text[i] != '\\'; i++) {
+			}
+
+			if (i >= _size || (unsigned char) _text[i] < 0x20) {
+				return false;
+			}
+			else if (_text[i] == '"') {
+				break;
+			}
+
+			// escapes are checked when decoding, so here only the escaped character is skipped.
+			escaped = true;
+			i += 2;
+		}
+
+		_position = i + 1;
+
+		if (escaped == false) {
+			data = _text + begin;
+			size = i - begin;
+			return true;
+		}
+
+		char* decoded = static_cast<char*>(_arena->Allocate(i - begin));
+		size = 0;
+
+		for (size_t j = begin; j < i; j++) {
+			if (_text[j] != '\\') {
+				decoded[size++] = _text[j];
+				continue;
+			}
+
+			switch (_text[++j]) {
+			case '"': decoded[size++] = '"'; break;
+			case '\\': decoded[size++] = '\\'; break;
+			case '/': decoded[size++] = '/'; break;
+			case 'b': decoded[size++] = '\b'; break;
+			case 'f': decoded[size++] = '\f'; break;
+			case 'n': decoded[size++] = '\n'; break;
+			case 'r': decoded[size++] = '\r'; break;
+			case 't': decoded[size++] = '\t'; break;
+			case 'u': {
+				long code = CodeUnit(j + 1);
+				j += 4;
+
+				if (code >= 0xD800 && code <= 0xDBFF) {
+					long low = j + 2 < i && _text[j + 1] == '\\' && _text[j + 2] == 'u' ? CodeUnit(j + 3) : -1;
+
+					if (low < 0xDC00 || low > 0xDFFF) {
+						return false;
+					}
+
+					code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+					j += 6;
+				}
+				else if (code < 0 || (code >= 0xDC00 && code <= 0xDFFF)) {
+					return false;
+				}
+
+				// a code point is encoded as utf-8, which is never longer than its escape.
+				if (code < 0x80) {
+					decoded[size++] = (char) code;
+				}
+				else if (code < 0x800) {
+					decoded[size++] = (char) (0xC0 | code >> 6);
+					decoded[size++] = (char) (0x80 | (code & 0x3F));
+				}
+				else if (code < 0x10000) {
+					decoded[size++] = (char) (0xE0 | code >> 12);
+					decoded[size++] = (char) (0x80 | (code >> 6 & 0x3F));
+					decoded[size++] = (char) (0x80 | (code & 0x3F));
+				}
+				else {
+					decoded[size++] = (char) (0xF0 | code >> 18);
+					decoded[size++] = (char) (0x80 | (code >> 12 & 0x3F));
+					decoded[size++] = (char) (0x80 | (code >> 6 & 0x3F));
+					decoded[size++] = (char) (0x80 | (code & 0x3F));
+				}
+
+				break;
+			}
+			default:
+				return false;
+			}
+		}
+
+		data = decoded;
+		return true;
+	}
+
+	/**
+	 * Parses a number.
+	 *
+	 * @return The value, or NULL if the number is not valid.
+	 */
+	JsonValue* ParseNumber() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		size_t begin = _position;
+		bool negative = _text[_position] == '-';
+		bool integral = true;
+		uint64_t magnitude = 0;
+		size_t digits = 0;
+
+		if (negative) {
+			_position++;
+		}
+
+		if (_position < _size && _text[_position] == '0') {
+			_position++;
+			digits = 1;
+		}
+		else {
+			for (; _position < _size && _text[_position] >= '0' && _text[_position] <= '9'; _position++, digits++) {
+				magnitude = magnitude * 10 + (_text[_position] - '0');
+			}
+		}
+
+		if (digits == 0) {
+			return Fail();
+		}
+
+		if (_position < _size && _text[_position] == '.') {
+			size_t fraction = ++_position;
+			integral = false;
+
+			for (; _position < _size && _text[_position] >= '0' && _text[_position] <= '9'; _position++) {
+			}
+
+			if (_position == fraction) {
+				return Fail();
+			}
+		}
+
+		if (_position < _size && (_text[_position] == 'e' || _text[_position] == 'E')) {
+			integral = false;
+
+			if (++_position < _size && (_text[_position] == '+' || _text[_position] == '-')) {
+				_position++;
+			}
+
+			size_t exponent = _position;
+
+			for (; _position < _size && _text[_position] >= '0' && _text[_position] <= '9'; _position++) {
+			}
+
+			if (_position == exponent) {
+				return Fail();
+			}
+		}
+
+		JsonValue* value = Create(JsonValue::Type_Number);
+
+		// up to eighteen digits always fit, so most integers are converted without strtod.
+		if (integral && digits <= 18) {
+			value->_integral = true;
+			value->_integer = negative ? -(int64_t) magnitude : (int64_t) magnitude;
+			value->_number = (double) value->_integer;
+		}
+		else {
+			std::string number(_text + begin, _position - begin);
+			value->_number = strtod(number.c_str(), NULL);
+
+			if (integral && value->_number > -9.2e18 && value->_number < 9.2e18) {
+				value->_integral = true;
+				value->_integer = strtoll(number.c_str(), NULL, 10);
+			}
+		}
+
+		return value;
+	}
+
+	/**
+	 * Parses one of the literals true, false and null.
+	 *
+	 * @return The value, or NULL if the literal is not valid.
+	 */
+	JsonValue* ParseLiteral() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		static const char* literals[] = { "true", "false", "null" };
+
+		for (size_t i = 0; i < 3; i++) {
+			size_t length = strlen(literals[i]);
+
+			if (_size - _position >= length && memcmp(_text + _position, literals[i], length) == 0) {
+				JsonValue* value = Create(i == 2 ? JsonValue::Type_Null : JsonValue::Type_Boolean);
+				value->_boolean = i == 0;
+				_position += length;
+
+				return value;
+			}
+		}
+
+		return Fail();
+	}
+
+	/**
+	 * Adds an element or member to an array or object.
+	 *
+	 * @param parent The array or object.
+	 * @param child The element or member.
+	 */
+	static void Append(JsonValue* parent, JsonValue* child) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		if (parent->_last == NULL) {
+			parent->_first = child;
+		}
+		else {
+			parent->_last->_next = child;
+		}
+
+		parent->_last = child;
+		parent->_count++;
+	}
+
+	/**
+	 * Parses an array.
+	 *
+	 * @param depth The depth of the array.
+	 * @return The value, or NULL if the array is not valid.
+	 */
+	JsonValue* ParseArray(size_t depth) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		JsonValue* array = Create(JsonValue::Type_Array);
+
+		_position++;
+
+		if (Peek() == ']') {
+			_position++;
+			return array;
+		}
+
+		for (;;) {
+			JsonValue* element = ParseValue(depth + 1);
+
+			if (element == NULL) {
+				return NULL;
+			}
+
+			Append(array, element);
+
+			char c = Peek();
+			_position++;
+
+			if (c == ']') {
+				return array;
+			}
+			else if (c != ',') {
+				return Fail();
+			}
+		}
+	}
+
+	/**
+	 * Parses an object.
+	 *
+	 * @param depth The depth of the object.
+	 * @return The value, or NULL if the object is not valid.
+	 */
+	JsonValue* ParseObject(size_t depth) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		JsonValue* object = Create(JsonValue::Type_Object);
+
+		_position++;
+
+		if (Peek() == '}') {
+			_position++;
+			return object;
+		}
+
+		for (;;) {
+			const char* key;
+			size_t keySize;
+
+			if (Peek() != '"' || ParseString(key, keySize) == false || Peek() != ':') {
+				return Fail();
+			}
+
+			_position++;
+			JsonValue* member = ParseValue(depth + 1);
+
+			if (member == NULL) {
+				return NULL;
+			}
+
+			member->_key = key;
+			member->_keySize = keySize;
+			Append(object, member);
+
+			char c = Peek();
+			_position++;
+
+			if (c == '}') {
+				return object;
+			}
+			else if (c != ',') {
+				return Fail();
+			}
+		}
+	}
+
+public:
+
+	/**
+	 * Creates a new parser for a range of characters.
+	 *
+	 * @param text The characters, which must outlive the values parsed from them.
+	 * @param size The number of characters.
+	 * @param arena The memory used for the values.
+	 */
+	JsonParser(const char* text, size_t size, Arena& arena) : _text(text), _size(size), _position(0), _arena(&arena), _failed(false) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+	}
+
+	/**
+	 * Skips whitespace and returns the next character without consuming it.
+	 *
+	 * @return The character, or zero at the end of the text.
+	 */
+	char Peek() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		while (_position < _size && (_text[_position] == ' ' || _text[_position] == '\n' || _text[_position] == '\r' || _text[_position] == '\t')) {
+			_position++;
+		}
+
+		return _position < _size ? _text[_position] : 0;
+	}
+
+	/**
+	 * Consumes the next character.
+	 */
+	void Skip() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		_position++;
+	}
+
+	/**
+	 * Parses the next value.
+	 *
+	 * @param depth The depth of the value.
+	 * @return The value, or NULL if the value is not valid.
+	 */
+	JsonValue* ParseValue(size_t depth = 0) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		char c = Peek();
+
+		if (depth >= MaximumDepth) {
+			return Fail();
+		}
+
+		switch (c) {
+		case '{':
+			return ParseObject(depth);
+		case '[':
+			return ParseArray(depth);
+		case '"': {
+			JsonValue* value = Create(JsonValue::Type_String);
+			return ParseString(value->_data, value->_size) ? value : Fail();
+		}
+		case 't':
+		case 'f':
+		case 'n':
+			return ParseLiteral();
+		default:
+			return c == '-' || (c >= '0' && c <= '9') ? ParseNumber() : Fail();
+		}
+	}
+
+	/**
+	 * Determines whether the text was found not to be valid.
+	 *
+	 * @return True if the text is not valid, false otherwise.
+	 */
+	bool Failed() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _failed;
+	}
+
+	/**
+	 * The position reached in the text, which is where an error was found if the text is not valid.
+	 *
+	 * @return The position.
+	 */
+	size_t Position() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _position;
+	}
+
+	/**
+	 * Deletes this parser.
+	 */
+	virtual ~JsonParser() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+	}
+};
+
+/**
+ * A class that parses a whole JSON document, such as a request body, into values allocated from an arena.
+ * For a rest request, the arena of the client can be used so that the document is released when the response ends:
+ *
+ *   JsonDocument json(args.Content(), args.Client()->Memory());
+ *
+ *   if (json.Valid()) {
+ *     std::string name = json.Root()["name"].String();
+ *   }
+ */
+class JsonDocument {
+private:
+	JsonParser _parser;
+	JsonValue* _root;
+
+	/**
+	 * Copies a document, which is not allowed since its values belong to an arena.
+	 *
+	 * @param that The document to copy.
+	 */
+	JsonDocument(const JsonDocument& that);
+
+	/**
+	 * Copies a document, which is not allowed since its values belong to an arena.
+	 *
+	 * @param that The document to copy.
+	 * @return A reference to this document.
+	 */
+	JsonDocument& operator = (const JsonDocument& that);
+
+public:
+
+	/**
+	 * Parses a document.
+	 *
+	 * @param text The text of the document, which must outlive the document.
+	 * @param arena The memory used for the values, which must outlive the document.
+	 */
+	JsonDocument(const std::string& text, Arena& arena) : _parser(text.data(), text.size(), arena), _root(NULL) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		_root = _parser.ParseValue();
+
+		if (_root != NULL && _parser.Peek() != 0) {
+			_root = NULL;
+		}
+	}
+
+	/**
+	 * Determines whether the document is valid JSON.
+	 *
+	 * @return True if the document is valid, false otherwise.
+	 */
+	bool Valid() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _root != NULL;
+	}
+
+	/**
+	 * The position of the error in a document that is not valid.
+	 *
+	 * @return The position.
+	 */
+	size_t ErrorPosition() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _parser.Position();
+	}
+
+	/**
+	 * The value of the document.
+	 *
+	 * @return The value, or a null value if the document is not valid.
+	 */
+	const JsonValue& Root() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _root == NULL ? JsonValue::Missing : *_root;
+	}
+
+	/**
+	 * Deletes this document.
+	 */
+	virtual ~JsonDocument() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+	}
+};
+
+/**
+ * A class that parses the elements of a JSON array one at a time, such as a large batch in a request body.
+ * Only the current element is held in memory, and each is parsed as it is reached, so a document much larger than any of its elements can be read in bounded memory.
+ *
+ *   JsonReader reader(args.Content());
+ *
+ *   while (reader.Next()) {
+ *     Import(reader.Current());
+ *   }
+ *
+ *   if (reader.Valid() == false) {
+ *     // the array was not valid json, though the elements before the error were read
+ *   }
+ */
+class JsonReader {
+private:
+	Arena _arena;
+	JsonParser _parser;
+	JsonValue* _current;
+	bool _started;
+	bool _ended;
+	bool _valid;
+
+	/**
+	 * Whether the unit test of this class has been registered to run when the application is initialized.
+	 */
+	static bool UnitTestRegistered;
+
+	/**
+	 * Copies a reader, which is not allowed since its values belong to its arena.
+	 *
+	 * @param that The reader to copy.
+	 */
+	JsonReader(const JsonReader& that);
+
+	/**
+	 * Copies a reader, which is not allowed since its values belong to its arena.
+	 *
+	 * @param that The reader to copy.
+	 * @return A reference to this reader.
+	 */
+	JsonReader& operator = (const JsonReader& that);
+
+	/**
+	 * Records that the end of the array, or an error, has been reached.
+	 *
+	 * @param valid Whether the array was valid.
+	 * @return False, for convenience.
+	 */
+	bool End(bool valid) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		_ended = true;
+		_valid = valid;
+
+		return false;
+	}
+
+public:
+
+	/**
+	 * Creates a new reader for an array.
+	 *
+	 * @param text The text of the array, which must outlive the reader.
+	 */
+	JsonReader(const std::string& text) : _arena(), _parser(text.data(), text.size(), _arena), _current(NULL), _started(false), _ended(false), _valid(false) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+	}
+
+	/**
+	 * Parses the next element of the array, releasing the one before it.
+	 *
+	 * @return True if there was another element, false at the end of the array or if the text is not valid.
+	 */
+	bool Next() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		_arena.Reset();
+		_current = NULL;
+
+		if (_ended) {
+			return false;
+		}
+
+		char c = _parser.Peek();
+
+		if (_started == false) {
+			_started = true;
+
+			if (c != '[') {
+				return End(false);
+			}
+
+			_parser.Skip();
+
+			if (_parser.Peek() == ']') {
+				_parser.Skip();
+				return End(_parser.Peek() == 0);
+			}
+		}
+		else if (c == ']') {
+			_parser.Skip();
+			return End(_parser.Peek() == 0);
+		}
+		else if (c == ',') {
+			_parser.Skip();
+		}
+		else {
+			return End(false);
+		}
+
+		_current = _parser.ParseValue(1);
+		return _current != NULL || End(false);
+	}
+
+	/**
+	 * The element parsed by the last call to Next.
+	 *
+	 * @return The element, or a null value if there is none.
+	 */
+	const JsonValue& Current() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _current == NULL ? JsonValue::Missing : *_current;
+	}
+
+	/**
+	 * Determines whether the array has been read to its end without finding an error.
+	 *
+	 * @return True if the array was valid, false otherwise.
+	 */
+	bool Valid() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _valid;
+	}
+
+	/**
+	 * Performs unit testing on functions in this class and the classes it uses to ensure expected operation.
+	 */
+	static void UnitTest() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		Arena arena;
+		std::string text = " {\"id\": -42, \"big\": 12345678901234567890, \"ratio\": 2.5e-3, \"ok\": true, \"none\": null,"
+			" \"tags\": [\"a\", [], {}], \"text\": \"say \\\"hi\\\"\\n\\u00e9\\ud83d\\ude00\", \"plain\": \"no escapes here at all\"} ";
+		JsonDocument document(text, arena);
+		const JsonValue& root = document.Root();
+
+		assert(document.Valid());
+		assert(root.GetType() == JsonValue::Type_Object && root.Count() == 8);
+		assert(root["id"].Integer() == -42 && root["id"].IsIntegral());
+		assert(root["big"].Number() == 12345678901234567890.0 && root["big"].IsIntegral() == false);
+		assert(root["ratio"].Number() == 2.5e-3);
+		assert(root["ok"].Boolean() && root["none"].IsNull() && root["missing"].IsNull());
+		assert(root["tags"].Count() == 3 && root["tags"][0].Equals("a") && root["tags"][1].Count() == 0 && root["tags"][5].IsNull());
+		assert(root["text"].String() == "say \"hi\"\n\xC3\xA9\xF0\x9F\x98\x80");
+		assert(root["plain"].Data() > text.data() && root["plain"].Data() < text.data() + text.size());
+		assert(root.First()->Key() == "id" && root.First()->Next()->Key() == "big");
+
+		const char* invalid[] = { "", "[1,]", "{\"a\":1,}", "[01]", "[1.]", "[-]", "{a:1}", "[\"\\x\"]", "[\"\t\"]", "[\"\\ud800\"]", "[1] x", "tru", "[\"abc" };
+
+		for (size_t i = 0; i < sizeof(invalid) / sizeof(*invalid); i++) {
+			assert(JsonDocument(invalid[i], arena).Valid() == false);
+		}
+
+		std::string deep = std::string(JsonParser::MaximumDepth + 1, '[') + std::string(JsonParser::MaximumDepth + 1, ']');
+		assert(JsonDocument(deep, arena).Valid() == false);
+
+		// the closing quote is found wherever it falls within a word.
+		for (size_t i = 0; i < 20; i++) {
+			std::string quoted = "\"" + std::string(i, 'a') + "\\\"" + std::string(20 - i, 'b') + "\"";
+			JsonDocument string(quoted, arena);
+			assert(string.Valid() && string.Root().Size() == 21);
+		}
+
+		std::string array = "[{\"id\":1}, {\"id\":2} ,{\"id\":3}]";
+		JsonReader reader(array);
+		int64_t sum = 0;
+
+		while (reader.Next()) {
+			sum += reader.Current()["id"].Integer();
+		}
+
+		assert(sum == 6 && reader.Valid());
+
+		std::string broken = "[1, 2, }";
+		JsonReader partial(broken);
+
+		assert(partial.Next() && partial.Next() && partial.Next() == false && partial.Valid() == false);
+
+		std::string empty = "[ ]";
+		JsonReader none(empty);
+		assert(none.Next() == false && none.Valid());
+	}
+
+	/**
+	 * Deletes this reader.
+	 */
+	virtual ~JsonReader() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+	}
+};
+
+bool JsonReader::UnitTestRegistered = Application::RegisterUnitTest(&JsonReader::UnitTest);
+
+const JsonValue JsonValue::Missing;
+size_t JsonParser::MaximumDepth = 512;
+
+}
+
+#endif /* JSONREADER_HPP_ */
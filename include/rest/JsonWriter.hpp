@@ -0,0 +1,491 @@
+/*
+ * Copyright (c) 2012 Christopher M. Baker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef JSONWRITER_HPP_
+#define JSONWRITER_HPP_
+
+#include "../StackTrace.hpp"
+#include "../Application.hpp"
+#include "../http/HttpServer.hpp"
+
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+namespace nitrus {
+
+/**
+ * A class that serializes values as JSON, either into a string or directly into the data queued on a connection as the content of a response.
+ * Commas and colons are placed automatically, so objects and arrays are written as a sequence of calls:
+ *
+ *   JsonWriter json(args.Client());
+ *   json.BeginObject().Key("id").Integer(42).Key("tags").BeginArray().String("a").String("b").EndArray().EndObject().Close();
+ *
+ * When writing a response, the content is written in place, with no copy, and is sent as one chunk each time it grows past a threshold, so a large collection is sent in a few large chunks rather than one per element.
+ * The writer must be closed, or deleted, before the response is ended and before returning to the event loop.
+ */
+class JsonWriter {
+public:
+
+	/**
+	 * The number of bytes written before a chunk is sent.
+	 */
+	static size_t DefaultFlushThreshold;
+
+private:
+	HttpServer::HttpClient* _client;
+	std::string* _output;
+	size_t _begin;
+	size_t _threshold;
+	std::vector<bool> _scopes;
+	bool _first;
+	bool _keyed;
+
+	/**
+	 * Whether the unit test of this class has been registered to run when the application is initialized.
+	 */
+	static bool UnitTestRegistered;
+
+	/**
+	 * Copies a json writer, which is not allowed since only one writer may write to the output at a time.
+	 *
+	 * @param that The writer to copy.
+	 */
+	JsonWriter(const JsonWriter& that);
+
+	/**
+	 * Copies a json writer, which is not allowed since only one writer may write to the output at a time.
+	 *
+	 * @param that The writer to copy.
+	 * @return A reference to this writer.
+	 */
+	JsonWriter& operator = (const JsonWriter& that);
+
+	/**
+	 * Writes the comma that separates a value from the one before it, unless it is the first value in its object or array or follows a key.
+	 */
+	void Separate() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		if (_keyed) {
+			_keyed = false;
+		}
+		else if (_first) {
+			_first = false;
+		}
+		else {
+			_output->push_back(',');
+		}
+	}
+
+	/**
+	 * Sends a chunk if enough has been written since the last one.
+	 */
+	void Written() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		if (_client != NULL && _output != NULL && _output->size() - _begin >= _threshold) {
+			Flush();
+		}
+	}
+
+	/**
+	 * Determines whether any byte of a word needs to be escaped in a json string: a quote, a backslash or a control character.
+	 *
+	 * @param word The word.
+	 * @return Non-zero if a byte needs to be escaped, zero otherwise.
+	 */
+	static uint64_t NeedsEscape(uint64_t word) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		static const uint64_t ones = 0x0101010101010101ULL;
+		static const uint64_t highs = 0x8080808080808080ULL;
+		uint64_t quotes = word ^ (ones * '"');
+		uint64_t backslashes = word ^ (ones * '\\');
+
+		return (((word - ones * 0x20) & ~word) | ((quotes - ones) & ~quotes) | ((backslashes - ones) & ~backslashes)) & highs;
+	}
+
+	/**
+	 * Writes a quoted and escaped string.
+	 *
+	 * @param data The characters of the string.
+	 * @param size The number of characters.
+	 */
+	void Quote(const char* data, size_t size) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		static const char* hex = "0123456789abcdef";
+		size_t begin = 0;
+		size_t i = 0;
+
+		_output->push_back('"');
+
+		while (i < size) {
+			// runs of characters that need no escaping are skipped a word at a time and copied at once.
+			for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+				uint64_t word;
+				memcpy(&word, data + i, sizeof(word));
+
+				if (NeedsEscape(word)) {
+					break;
+				}
+			}
+
+			for (; i < size; i++) {
+				unsigned char c = data[i];
+
+				if (c < 0x20 || c == '"' || c == '\\') {
+					break;
+				}
+			}
+
+			_output->append(data + begin, i - begin);
+
+			if (i == size) {
+				break;
+			}
+
+			unsigned char c = data[i];
+
+			switch (c) {
+			case '"': _output->append("\\\"", 2); break;
+			case '\\': _output->append("\\\\", 2); break;
+			case '\n': _output->append("\\n", 2); break;
+			case '\r': _output->append("\\r", 2); break;
+			case '\t': _output->append("\\t", 2); break;
+			case '\b': _output->append("\\b", 2); break;
+			case '\f': _output->append("\\f", 2); break;
+			default:
+				_output->append("\\u00", 4);
+				_output->push_back(hex[c >> 4]);
+				_output->push_back(hex[c & 0xF]);
+			}
+
+			begin = ++i;
+		}
+
+		_output->push_back('"');
+	}
+
+public:
+
+	/**
+	 * Creates a new json writer that appends to a string.
+	 *
+	 * @param output The string to append to.
+	 */
+	JsonWriter(std::string& output) : _client(NULL), _output(&output), _begin(output.size()), _threshold(0), _scopes(), _first(true), _keyed(false) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+	}
+
+	/**
+	 * Creates a new json writer that writes the content of a response.
+	 * The response must have been begun, and any headers sent, before the writer is created.
+	 *
+	 * @param client The client to respond to.
+	 * @param threshold The number of bytes written before a chunk is sent.
+	 */
+	JsonWriter(HttpServer::HttpClient* client, size_t threshold = DefaultFlushThreshold) : _client(client), _output(&client->BeginContent()), _begin(0), _threshold(threshold), _scopes(), _first(true), _keyed(false) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		_begin = _output->size();
+	}
+
+	/**
+	 * Begins an object.
+	 *
+	 * @return A reference to this writer.
+	 */
+	JsonWriter& BeginObject() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		Separate();
+		_output->push_back('{');
+		_scopes.push_back(_first);
+		_first = true;
+
+		return *this;
+	}
+
+	/**
+	 * Ends the current object.
+	 *
+	 * @return A reference to this writer.
+	 */
+	JsonWriter& EndObject() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		_output->push_back('}');
+		_first = _scopes.back();
+		_scopes.pop_back();
+		Written();
+
+		return *this;
+	}
+
+	/**
+	 * Begins an array.
+	 *
+	 * @return A reference to this writer.
+	 */
+	JsonWriter& BeginArray() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		Separate();
+		_output->push_back('[');
+		_scopes.push_back(_first);
+		_first = true;
+
+		return *this;
+	}
+
+	/**
+	 * Ends the current array.
+	 *
+	 * @return A reference to this writer.
+	 */
+	JsonWriter& EndArray() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		_output->push_back(']');
+		_first = _scopes.back();
+		_scopes.pop_back();
+		Written();
+
+		return *this;
+	}
+
+	/**
+	 * Writes the key of the next member of the current object.
+	 *
+	 * @param key The key.
+	 * @return A reference to this writer.
+	 */
+	JsonWriter& Key(const std::string& key) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		Separate();
+		Quote(key.data(), key.size());
+		_output->push_back(':');
+		_keyed = true;
+
+		return *this;
+	}
+
+	/**
+	 * Writes a string value.
+	 *
+	 * @param value The string.
+	 * @return A reference to this writer.
+	 */
+	JsonWriter& String(const std::string& value) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		Separate();
+		Quote(value.data(), value.size());
+		Written();
+
+		return *this;
+	}
+
+	/**
+	 * Writes a signed integer value.
+	 *
+	 * @param value The integer.
+	 * @return A reference to this writer.
+	 */
+	JsonWriter& Integer(int64_t value) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		char digits[24];
+		char* end = digits + sizeof(digits);
+		char* begin = end;
+		uint64_t magnitude = value < 0 ? 0 - (uint64_t) value : (uint64_t) value;
+
+		do {
+			*--begin = (char) ('0' + magnitude % 10);
+			magnitude /= 10;
+		} while (magnitude != 0);
+
+		if (value < 0) {
+			*--begin = '-';
+		}
+
+		Separate();
+		_output->append(begin, end - begin);
+		Written();
+
+		return *this;
+	}
+
+	/**
+	 * Writes an unsigned integer value.
+	 *
+	 * @param value The integer.
+	 * @return A reference to this writer.
+	 */
+	JsonWriter& Unsigned(uint64_t value) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		char digits[24];
+		char* end = digits + sizeof(digits);
+		char* begin = end;
+
+		do {
+			*--begin = (char) ('0' + value % 10);
+			value /= 10;
+		} while (value != 0);
+
+		Separate();
+		_output->append(begin, end - begin);
+		Written();
+
+		return *this;
+	}
+
+	/**
+	 * Writes a number value with the fewest digits that read back as the same number.
+	 * Infinities and values that are not a number cannot be represented in json and are written as null.
+	 *
+	 * @param value The number.
+	 * @return A reference to this writer.
+	 */
+	JsonWriter& Number(double value) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		char digits[32];
+
+		if (value != value || value - value != 0) {
+			return Null();
+		}
+
+		snprintf(digits, sizeof(digits), "%.15g", value);
+
+		if (strtod(digits, NULL) != value) {
+			snprintf(digits, sizeof(digits), "%.17g", value);
+		}
+
+		Separate();
+		_output->append(digits);
+		Written();
+
+		return *this;
+	}
+
+	/**
+	 * Writes a boolean value.
+	 *
+	 * @param value The boolean.
+	 * @return A reference to this writer.
+	 */
+	JsonWriter& Boolean(bool value) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		Separate();
+		_output->append(value ? "true" : "false");
+		Written();
+
+		return *this;
+	}
+
+	/**
+	 * Writes a null value.
+	 *
+	 * @return A reference to this writer.
+	 */
+	JsonWriter& Null() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		Separate();
+		_output->append("null", 4);
+		Written();
+
+		return *this;
+	}
+
+	/**
+	 * Writes a value that has already been serialized as json, such as one kept from an earlier response.
+	 *
+	 * @param json The serialized value.
+	 * @return A reference to this writer.
+	 */
+	JsonWriter& Raw(const std::string& json) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		Separate();
+		_output->append(json);
+		Written();
+
+		return *this;
+	}
+
+	/**
+	 * Sends what has been written so far as a chunk of the response, and writes it to the connection.
+	 * This does nothing for a writer that appends to a string.
+	 *
+	 * @return A reference to this writer.
+	 */
+	JsonWriter& Flush() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		if (_client != NULL && _output != NULL) {
+			_client->EndContent();
+			_client->Connection()->Flush();
+			_output = &_client->BeginContent();
+			_begin = _output->size();
+		}
+
+		return *this;
+	}
+
+	/**
+	 * Sends what has been written so far as the last chunk written by this writer, which can not be used afterwards.
+	 * The response may then be ended, or more content sent.
+	 */
+	void Close() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		if (_client != NULL && _output != NULL) {
+			_client->EndContent();
+		}
+
+		_output = NULL;
+	}
+
+	/**
+	 * Performs unit testing on functions in this class to ensure expected operation.
+	 */
+	static void UnitTest() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		std::string output;
+		JsonWriter json(output);
+
+		json.BeginObject()
+			.Key("id").Integer(-42)
+			.Key("count").Unsigned(18446744073709551615ULL)
+			.Key("ratio").Number(0.1)
+			.Key("big").Number(1e300)
+			.Key("nan").Number(sqrt(-1.0))
+			.Key("ok").Boolean(true)
+			.Key("none").Null()
+			.Key("tags").BeginArray().String("a").BeginArray().EndArray().BeginObject().EndObject().Raw("[1]").EndArray()
+			.Key("text").String("say \"hi\"\\\n\t\x01 to everyone in the room")
+			.EndObject();
+
+		assert(output == "{\"id\":-42,\"count\":18446744073709551615,\"ratio\":0.1,\"big\":1e+300,\"nan\":null,\"ok\":true,\"none\":null,"
+			"\"tags\":[\"a\",[],{},[1]],\"text\":\"say \\\"hi\\\"\\\\\\n\\t\\u0001 to everyone in the room\"}");
+
+		// characters that need escaping are found wherever they fall within a word.
+		for (size_t i = 0; i < 20; i++) {
+			std::string quoted;
+			JsonWriter(quoted).String(std::string(i, 'a') + "\"" + std::string(20 - i, 'b'));
+			assert(quoted == "\"" + std::string(i, 'a') + "\\\"" + std::string(20 - i, 'b') + "\"");
+		}
+
+		std::string smallest;
+		JsonWriter(smallest).Integer(INT64_MIN);
+		assert(smallest == "-9223372036854775808");
+	}
+
+	/**
+	 * Deletes this json writer, sending anything written since the last chunk.
+	 */
+	virtual ~JsonWriter() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		Close();
+	}
+};
+
+bool JsonWriter::UnitTestRegistered = Application::RegisterUnitTest(&JsonWriter::UnitTest);
+
+size_t JsonWriter::DefaultFlushThreshold = 16384;
+
+}
+
+#endif /* JSONWRITER_HPP_ */
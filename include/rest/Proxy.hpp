@@ -0,0 +1,761 @@
+/*
+ * Copyright (c) 2012 Christopher M. Baker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef PROXY_HPP_
+#define PROXY_HPP_
+
+#include "../StackTrace.hpp"
+#include "../String.hpp"
+#include "../Thread.hpp"
+#include "../http/HttpServer.hpp"
+#include "../http/HttpAgent.hpp"
+
+#include <deque>
+#include <vector>
+#include <utility>
+
+namespace nitrus {
+
+/**
+ * A class that forwards http requests to a pool of upstream servers and relays their responses.
+ * Requests are sent to the healthy upstream with the fewest outstanding requests, over persistent connections that are reused between requests.
+ * Request and response content is relayed as it arrives rather than after the whole message has been received.
+ * When a client reads the response more slowly than the upstream server sends it, the proxy stops reading from the upstream server until the client catches up.
+ * A proxy must outlive the router it is attached to.
+ */
+class Proxy {
+public:
+
+	/**
+	 * How often upstream servers are checked when health checks are enabled.
+	 */
+	static TimeSpan DefaultHealthCheckFrequency;
+
+	/**
+	 * How long an upstream server has to answer a health check before it is considered unhealthy.
+	 */
+	static TimeSpan DefaultHealthCheckTimeout;
+
+	/**
+	 * The number of bytes of response content waiting to be sent to a client before the proxy stops reading the response from the upstream server.
+	 */
+	static size_t DefaultMaximumUnsent;
+
+	/**
+	 * A class that encapsulates a single upstream server and its health.
+	 */
+	class Upstream {
+	private:
+		HttpAgent* _agent;
+		Socket::Endpoint _endpoint;
+		bool _healthy;
+		size_t _outstanding;
+		size_t _requests;
+		std::string _healthPath;
+		TimeSpan _healthFrequency;
+		HttpAgent::Request* _probe;
+		int _probeCode;
+		DateTime _probeStarted;
+
+	private:
+		template <typename Signature> friend class Delegate;
+
+		/**
+		 * Starts a health check.
+		 */
+		void Probe() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_probeCode = 0;
+			_probeStarted = DateTime::Utc();
+			_probe = &_agent->Begin(_endpoint, "GET", _healthPath);
+			_probe->ResponseStarted() += delegate(&Upstream::OnProbeResponseStarted, this);
+			_probe->ResponseEnded() += delegate(&Upstream::OnProbeResponseEnded, this);
+			_probe->RequestFailed() += delegate(&Upstream::OnProbeFailed, this);
+			_probe->SendHeader("Host", _endpoint.Address()).Send("").End();
+
+			Thread::SetTimeout(DefaultHealthCheckTimeout, delegate(&Upstream::OnProbeTimeout, this));
+		}
+
+		/**
+		 * Records the result of a health check and schedules the next one.
+		 *
+		 * @param healthy Whether the upstream server answered the health check successfully.
+		 */
+		void FinishProbe(bool healthy) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_probe = NULL;
+			_healthy = healthy;
+
+			Thread::SetTimeout(_healthFrequency, delegate(&Upstream::Probe, this));
+		}
+
+		/**
+		 * Called when a health check response has started.
+		 *
+		 * @param args The event arguments.
+		 * @param sender The health check request.
+		 */
+		void OnProbeResponseStarted(const HttpClient::ResponseStartedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_probeCode = args.Code();
+		}
+
+		/**
+		 * Called when a health check response has ended. Any 2xx or 3xx response is considered healthy.
+		 *
+		 * @param args The event arguments.
+		 * @param sender The health check request.
+		 */
+		void OnProbeResponseEnded(const HttpClient::ResponseEndedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			if (sender == _probe) {
+				FinishProbe(_probeCode >= 200 && _probeCode < 400);
+			}
+		}
+
+		/**
+		 * Called when a health check could not be sent or its connection was lost.
+		 *
+		 * @param args The event arguments.
+		 * @param sender The health check request.
+		 */
+		void OnProbeFailed(const HttpAgent::RequestFailedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			if (sender == _probe) {
+				FinishProbe(false);
+			}
+		}
+
+		/**
+		 * Called when a health check has taken too long.
+		 * A timeout left over from a health check that already finished finds a later health check that has not run for long enough, and is ignored.
+		 */
+		void OnProbeTimeout() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			if (_probe != NULL && DateTime::Utc() - _probeStarted >= DefaultHealthCheckTimeout) {
+				_probe->Cancel();
+				FinishProbe(false);
+			}
+		}
+
+	public:
+
+		/**
+		 * Creates a new upstream server.
+		 *
+		 * @param agent The agent used to send requests to the server.
+		 * @param endpoint The endpoint of the server.
+		 */
+		Upstream(HttpAgent* agent, const Socket::Endpoint& endpoint) : _agent(agent), _endpoint(endpoint), _healthy(true), _outstanding(0), _requests(0), _healthPath(), _healthFrequency(), _probe(NULL), _probeCode(0), _probeStarted() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+		}
+
+		/**
+		 * Starts checking the health of the upstream server.
+		 *
+		 * @param path The path requested to check the health of the server.
+		 * @param frequency How often the server is checked.
+		 */
+		void HealthCheck(const std::string& path, const TimeSpan& frequency) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_healthPath = path;
+			_healthFrequency = frequency;
+			Probe();
+		}
+
+		/**
+		 * Records that a request has been forwarded to the upstream server.
+		 */
+		void Acquire() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_outstanding++;
+			_requests++;
+		}
+
+		/**
+		 * Records that a forwarded request has finished.
+		 * If the request failed and health checks are enabled, the upstream server is considered unhealthy until the next successful health check.
+		 *
+		 * @param failed Whether the request failed.
+		 */
+		void Release(bool failed) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_outstanding--;
+
+			if (failed && _healthFrequency > TimeSpan::Zero()) {
+				_healthy = false;
+			}
+		}
+
+		/**
+		 * The endpoint of the upstream server.
+		 *
+		 * @return The endpoint.
+		 */
+		const Socket::Endpoint& Endpoint() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _endpoint;
+		}
+
+		/**
+		 * Whether the upstream server is accepting requests.
+		 *
+		 * @return True if the server is healthy, false otherwise.
+		 */
+		bool Healthy() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _healthy;
+		}
+
+		/**
+		 * The number of requests currently being handled by the upstream server.
+		 *
+		 * @return The number of requests.
+		 */
+		size_t Outstanding() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _outstanding;
+		}
+
+		/**
+		 * The total number of requests forwarded to the upstream server.
+		 *
+		 * @return The number of requests.
+		 */
+		size_t Requests() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _requests;
+		}
+
+		/**
+		 * Deletes the upstream server.
+		 */
+		virtual ~Upstream() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+		}
+	};
+
+	typedef std::vector<Upstream*> UpstreamCollection;
+
+private:
+
+	/**
+	 * A class that relays a single request to an upstream server and its response back to the client.
+	 * The http server only accepts a response once the request has ended, so a response that starts earlier is queued until then.
+	 */
+	class Exchange {
+	private:
+		typedef std::vector<std::pair<std::string, std::string> > Headers;
+
+		Proxy* _proxy;
+		HttpServer::HttpClient* _client;
+		Upstream* _upstream;
+		HttpAgent::Request* _request;
+		bool _requestEnded;
+		bool _responseStarted;
+		bool _responseEnded;
+		bool _done;
+		bool _paused;
+		int _code;
+		std::string _description;
+		Headers _responseHeaders;
+		std::deque<std::string> _responseContent;
+		size_t _responseContentSize;
+
+	private:
+		template <typename Signature> friend class Delegate;
+
+		/**
+		 * Determines whether a header only applies to a single connection and must not be forwarded.
+		 * Framing headers are included because both connections frame content themselves.
+		 *
+		 * @param key The header key.
+		 * @return True if the header must not be forwarded, false otherwise.
+		 */
+		static bool IsHopByHop(const std::string& key) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			std::string lower = String::ToLowerCase(key);
+
+			return lower == "connection" || lower == "keep-alive" || lower == "transfer-encoding" || lower == "content-length"
+				|| lower == "te" || lower == "trailer" || lower == "upgrade" || lower == "proxy-connection" || lower == "proxy-authorization";
+		}
+
+		/**
+		 * Sends the queued response to the client once the request has ended, and finishes the exchange if the response has also ended.
+		 */
+		void SendResponse() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			if (_requestEnded == false || _responseStarted == false) {
+				return;
+			}
+
+			if (_code != 0) {
+				_client->Begin("HTTP/1.1", _code, _description.c_str());
+				_code = 0;
+			}
+
+			for (Headers::iterator i = _responseHeaders.begin(); i != _responseHeaders.end(); i++) {
+				_client->SendHeader(i->first, i->second);
+			}
+
+			_responseHeaders.clear();
+
+			for (std::deque<std::string>::iterator i = _responseContent.begin(); i != _responseContent.end(); i++) {
+				_client->Send(*i);
+			}
+
+			_responseContent.clear();
+			_responseContentSize = 0;
+
+			if (_responseEnded) {
+				Detach();
+				_client->Send("").End();
+			}
+		}
+
+		/**
+		 * Stops reading the response from the upstream server while too much of it is waiting to be sent to the client.
+		 */
+		void Throttle() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			if (_paused == false && _request != NULL && _client->Unsent() + _responseContentSize >= DefaultMaximumUnsent) {
+				_paused = true;
+				_request->Pause();
+				Thread::SetTimeout(TcpClient::DefaultDataPollFrequency, delegate(&Exchange::Drain, this));
+			}
+		}
+
+		/**
+		 * Called periodically while the response is paused. Reading resumes once the client has caught up.
+		 */
+		void Drain() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			if (_done || _request == NULL) {
+				_paused = false;
+			}
+			else if (_client->Unsent() + _responseContentSize >= DefaultMaximumUnsent) {
+				Thread::SetTimeout(TcpClient::DefaultDataPollFrequency, delegate(&Exchange::Drain, this));
+			}
+			else {
+				_paused = false;
+				_request->Resume();
+			}
+		}
+
+		/**
+		 * Responds to the client with an error because the request could not be forwarded.
+		 * The response is queued until the request has ended.
+		 *
+		 * @param code The response code.
+		 * @param description The description of the response code.
+		 */
+		void Reject(int code, const char* description) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_responseStarted = true;
+			_responseEnded = true;
+			_code = code;
+			_description = description;
+			_responseHeaders.push_back(std::make_pair("Content-Type", "text/plain"));
+			_proxy->_failed++;
+
+			SendResponse();
+		}
+
+		/**
+		 * Stops handling events from the client and schedules this exchange to be deleted.
+		 */
+		void Detach() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_done = true;
+			_client->HeaderReceived() -= delegate(&Exchange::OnRequestHeaderReceived, this);
+			_client->ContentReceived() -= delegate(&Exchange::OnRequestContentReceived, this);
+			_client->RequestEnded() -= delegate(&Exchange::OnRequestEnded, this);
+			_client->ClientDisconnected() -= delegate(&Exchange::OnClientDisconnected, this);
+
+			_proxy->Retire(this);
+		}
+
+		/**
+		 * Called when a request header has been received from the client.
+		 *
+		 * @param args The event arguments.
+		 * @param sender The sender of the event.
+		 */
+		void OnRequestHeaderReceived(const HttpServer::HttpClient::HeaderReceivedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			if (_done == false && _request != NULL && IsHopByHop(args.Key()) == false) {
+				_request->SendHeader(args.Key(), args.Value());
+			}
+		}
+
+		/**
+		 * Called when request content has been received from the client.
+		 *
+		 * @param args The event arguments.
+		 * @param sender The sender of the event.
+		 */
+		void OnRequestContentReceived(const HttpServer::HttpClient::ContentReceivedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			if (_done == false && _request != NULL) {
+				_request->Send(args.Content());
+			}
+		}
+
+		/**
+		 * Called when the request from the client has ended.
+		 *
+		 * @param args The event arguments.
+		 * @param sender The sender of the event.
+		 */
+		void OnRequestEnded(const HttpServer::HttpClient::RequestEndedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			if (_done) {
+				return;
+			}
+
+			_requestEnded = true;
+
+			if (_request != NULL) {
+				_request->Send("").End();
+			}
+
+			SendResponse();
+		}
+
+		/**
+		 * Called when the client has disconnected before the exchange finished.
+		 *
+		 * @param args The event arguments.
+		 * @param sender The sender of the event.
+		 */
+		void OnClientDisconnected(const HttpServer::HttpClient::ClientDisconnectedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			if (_done) {
+				return;
+			}
+
+			if (_request != NULL) {
+				_request->Cancel();
+				_request = NULL;
+				_upstream->Release(false);
+			}
+
+			Detach();
+		}
+
+		/**
+		 * Called when the upstream server has started its response.
+		 *
+		 * @param args The event arguments.
+		 * @param sender The sender of the event.
+		 */
+		void OnResponseStarted(const HttpClient::ResponseStartedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			if (_done) {
+				return;
+			}
+
+			_responseStarted = true;
+			_code = args.Code();
+			_description = args.Description();
+
+			SendResponse();
+		}
+
+		/**
+		 * Called when a response header has been received from the upstream server.
+		 *
+		 * @param args The event arguments.
+		 * @param sender The sender of the event.
+		 */
+		void OnResponseHeaderReceived(const HttpClient::HeaderReceivedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			if (_done || IsHopByHop(args.Key())) {
+				return;
+			}
+
+			if (_requestEnded) {
+				_client->SendHeader(args.Key(), args.Value());
+			}
+			else {
+				_responseHeaders.push_back(std::make_pair(args.Key(), args.Value()));
+			}
+		}
+
+		/**
+		 * Called when response content has been received from the upstream server.
+		 *
+		 * @param args The event arguments.
+		 * @param sender The sender of the event.
+		 */
+		void OnResponseContentReceived(const HttpClient::ContentReceivedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			if (_done) {
+				return;
+			}
+
+			if (_requestEnded) {
+				_client->Send(args.Content());
+			}
+			else {
+				_responseContent.push_back(args.Content());
+				_responseContentSize += args.Content().size();
+			}
+
+			Throttle();
+		}
+
+		/**
+		 * Called when the upstream server has ended its response.
+		 *
+		 * @param args The event arguments.
+		 * @param sender The sender of the event.
+		 */
+		void OnResponseEnded(const HttpClient::ResponseEndedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			if (_done) {
+				return;
+			}
+
+			_request = NULL;
+			_responseEnded = true;
+			_upstream->Release(false);
+
+			SendResponse();
+		}
+
+		/**
+		 * Called when the request to the upstream server has failed.
+		 * If nothing has been sent to the client yet, the client receives a 502 response; otherwise the client connection is shut down so that the truncated response is noticed.
+		 *
+		 * @param args The event arguments.
+		 * @param sender The sender of the event.
+		 */
+		void OnRequestFailed(const HttpAgent::RequestFailedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			if (_done) {
+				return;
+			}
+
+			_request = NULL;
+			_upstream->Release(true);
+
+			if (_responseStarted == false) {
+				Reject(502, "Bad Gateway");
+			}
+			else {
+				Detach();
+				_client->Connection()->Shutdown();
+			}
+		}
+
+	public:
+
+		/**
+		 * Creates a new exchange and starts forwarding the request.
+		 *
+		 * @param proxy The proxy that owns the exchange.
+		 * @param client The client that sent the request.
+		 * @param upstream The upstream server to forward to, or NULL if no upstream server is available.
+		 * @param method The request method.
+		 * @param path The request path.
+		 */
+		Exchange(Proxy* proxy, HttpServer::HttpClient* client, Upstream* upstream, const std::string& method, const std::string& path) : _proxy(proxy), _client(client), _upstream(upstream), _request(NULL), _requestEnded(false), _responseStarted(false), _responseEnded(false), _done(false), _paused(false), _code(0), _description(), _responseHeaders(), _responseContent(), _responseContentSize(0) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			client->HeaderReceived() += delegate(&Exchange::OnRequestHeaderReceived, this);
+			client->ContentReceived() += delegate(&Exchange::OnRequestContentReceived, this);
+			client->RequestEnded() += delegate(&Exchange::OnRequestEnded, this);
+			client->ClientDisconnected() += delegate(&Exchange::OnClientDisconnected, this);
+
+			if (upstream == NULL) {
+				Reject(503, "Service Unavailable");
+				return;
+			}
+
+			upstream->Acquire();
+
+			_request = &proxy->_agent.Begin(upstream->Endpoint(), method, path);
+			_request->ResponseStarted() += delegate(&Exchange::OnResponseStarted, this);
+			_request->HeaderReceived() += delegate(&Exchange::OnResponseHeaderReceived, this);
+			_request->ContentReceived() += delegate(&Exchange::OnResponseContentReceived, this);
+			_request->ResponseEnded() += delegate(&Exchange::OnResponseEnded, this);
+			_request->RequestFailed() += delegate(&Exchange::OnRequestFailed, this);
+			_request->SendHeader("X-Forwarded-For", client->Endpoint().Address());
+		}
+
+		/**
+		 * Deletes this exchange.
+		 */
+		virtual ~Exchange() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			if (_paused) {
+				Thread::Cancel(delegate(&Exchange::Drain, this));
+			}
+		}
+	};
+
+	HttpAgent _agent;
+	UpstreamCollection _upstreams;
+	std::vector<Exchange*> _retired;
+	size_t _next;
+	size_t _forwarded;
+	size_t _failed;
+
+private:
+	template <typename Signature> friend class Delegate;
+
+	/**
+	 * Proxies own their upstream servers and cannot be copied.
+	 *
+	 * @param that The proxy to clone.
+	 */
+	Proxy(const Proxy& that);
+
+	/**
+	 * Proxies own their upstream servers and cannot be copied.
+	 *
+	 * @param that The proxy to clone.
+	 * @return A reference to this proxy.
+	 */
+	Proxy& operator = (const Proxy& that);
+
+	/**
+	 * Selects the healthy upstream server with the fewest outstanding requests.
+	 * Servers with the same number of outstanding requests are selected in turn.
+	 *
+	 * @return The upstream server, or NULL if none are healthy.
+	 */
+	Upstream* Select() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		Upstream* selected = NULL;
+
+		for (size_t i = 0; i < _upstreams.size(); i++) {
+			Upstream* upstream = _upstreams[(_next + i) % _upstreams.size()];
+
+			if (upstream->Healthy() && (selected == NULL || upstream->Outstanding() < selected->Outstanding())) {
+				selected = upstream;
+			}
+		}
+
+		_next++;
+		return selected;
+	}
+
+	/**
+	 * Schedules a finished exchange to be deleted once the event loop has finished dispatching its events.
+	 *
+	 * @param exchange The exchange.
+	 */
+	void Retire(Exchange* exchange) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		if (_retired.empty()) {
+			Thread::Invoke(delegate(&Proxy::Collect, this));
+		}
+
+		_retired.push_back(exchange);
+	}
+
+	/**
+	 * Deletes the finished exchanges.
+	 */
+	void Collect() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		for (std::vector<Exchange*>::iterator i = _retired.begin(); i != _retired.end(); i++) {
+			delete *i;
+		}
+
+		_retired.clear();
+	}
+
+public:
+
+	/**
+	 * Creates a new proxy without any upstream servers.
+	 */
+	Proxy() : _agent(), _upstreams(), _retired(), _next(0), _forwarded(0), _failed(0) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+	}
+
+	/**
+	 * Adds an upstream server to the pool.
+	 *
+	 * @param endpoint The endpoint of the server.
+	 * @return A reference to this proxy.
+	 */
+	Proxy& Add(const Socket::Endpoint& endpoint) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		_upstreams.push_back(new Upstream(&_agent, endpoint));
+		return *this;
+	}
+
+	/**
+	 * Periodically checks the health of every upstream server in the pool.
+	 * Unhealthy servers receive no requests until they pass a health check.
+	 *
+	 * @param path The path requested to check the health of a server.
+	 * @param frequency How often each server is checked.
+	 * @return A reference to this proxy.
+	 */
+	Proxy& HealthCheck(const std::string& path, const TimeSpan& frequency = DefaultHealthCheckFrequency) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		for (UpstreamCollection::iterator i = _upstreams.begin(); i != _upstreams.end(); i++) {
+			(*i)->HealthCheck(path, frequency);
+		}
+
+		return *this;
+	}
+
+	/**
+	 * Forwards a request that has just started to an upstream server.
+	 * This must be called when the request starts so that the headers and content can be relayed as they arrive.
+	 *
+	 * @param client The client that sent the request.
+	 * @param method The request method.
+	 * @param path The request path.
+	 */
+	void Forward(HttpServer::HttpClient* client, const std::string& method, const std::string& path) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		_forwarded++;
+		new Exchange(this, client, Select(), method, path);
+	}
+
+	/**
+	 * The upstream servers in the pool.
+	 *
+	 * @return The upstream servers.
+	 */
+	const UpstreamCollection& Upstreams() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _upstreams;
+	}
+
+	/**
+	 * The agent that holds the connections to the upstream servers, for its connection reuse statistics.
+	 *
+	 * @return The agent.
+	 */
+	const HttpAgent& Agent() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _agent;
+	}
+
+	/**
+	 * The number of requests forwarded by this proxy.
+	 *
+	 * @return The number of requests.
+	 */
+	size_t Forwarded() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _forwarded;
+	}
+
+	/**
+	 * The number of requests answered with an error because no upstream server was available or the upstream connection failed.
+	 *
+	 * @return The number of requests.
+	 */
+	size_t Failed() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _failed;
+	}
+
+	/**
+	 * Deletes this proxy and its upstream servers.
+	 */
+	virtual ~Proxy() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		Thread::Cancel(delegate(&Proxy::Collect, this));
+		Collect();
+
+		for (UpstreamCollection::iterator i = _upstreams.begin(); i != _upstreams.end(); i++) {
+			delete *i;
+		}
+	}
+};
+
+TimeSpan Proxy::DefaultHealthCheckFrequency = TimeSpan::FromSeconds(5);
+TimeSpan Proxy::DefaultHealthCheckTimeout = TimeSpan::FromSeconds(2);
+size_t Proxy::DefaultMaximumUnsent = 262144;
+
+}
+
+#endif /* PROXY_HPP_ */
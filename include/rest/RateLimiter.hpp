@@ -0,0 +1,373 @@
+/*
+ * Copyright (c) 2012 Christopher M. Baker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef RATELIMITER_HPP_
+#define RATELIMITER_HPP_
+
+#include "../StackTrace.hpp"
+#include "../String.hpp"
+#include "../DateTime.hpp"
+
+#include <assert.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace nitrus {
+
+/**
+ * A class that limits how often each client may make requests, with a token bucket for each client.
+ * A bucket holds up to a burst of tokens and refills at a steady rate, and each request takes a token or is refused.
+ * Clients are told apart by a key, such as their address or the value of an api key header.
+ *
+ * Each bucket is kept as the time at which it will be full again, so it is refilled lazily when it is next used and needs no timer.
+ * Buckets are kept in a table of fixed size, with each key hashed to a set of four slots, so the memory used is bounded however many clients there are.
+ * A bucket that has been idle long enough to be full is the same as no bucket at all, so its slot is taken by the next key that needs one.
+ * If every slot of a set is in use, the bucket closest to full is evicted, which only ever lets a client make more requests, never fewer.
+ */
+class RateLimiter {
+public:
+
+	/**
+	 * The number of clients that a limiter keeps buckets for by default.
+	 */
+	static size_t DefaultCapacity;
+
+private:
+
+	/**
+	 * The number of slots in each set of the table.
+	 */
+	enum { Ways = 4 };
+
+	/**
+	 * A structure that holds the bucket of one client.
+	 */
+	struct Slot {
+		uint64_t key;
+		uint64_t full;
+	};
+
+	double _rate;
+	size_t _burst;
+	std::string _header;
+	size_t _sets;
+	std::vector<Slot> _slots;
+	uint64_t _allowed;
+	uint64_t _limited;
+	uint64_t _evictions;
+
+private:
+
+	/**
+	 * Limiters refer to their own table and cannot be copied.
+	 *
+	 * @param that The limiter to clone.
+	 */
+	RateLimiter(const RateLimiter& that);
+
+	/**
+	 * Limiters refer to their own table and cannot be copied.
+	 *
+	 * @param that The limiter to clone.
+	 * @return A reference to this limiter.
+	 */
+	RateLimiter& operator = (const RateLimiter& that);
+
+	/**
+	 * Hashes a key to a non-zero value, since zero marks an empty slot.
+	 *
+	 * @param key The key.
+	 * @return The hash of the key.
+	 */
+	static uint64_t Hash(const std::string& key) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		uint64_t hash = 14695981039346656037ULL;
+
+		for (size_t i = 0; i < key.size(); i++) {
+			hash = (hash ^ (unsigned char) key[i]) * 1099511628211ULL;
+		}
+
+		return hash == 0 ? 1 : hash;
+	}
+
+	/**
+	 * The number of microseconds between tokens.
+	 *
+	 * @return The number of microseconds.
+	 */
+	uint64_t Interval() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return (uint64_t) (1000000 / _rate);
+	}
+
+public:
+
+	/**
+	 * Creates a new limiter that tells clients apart by their address.
+	 *
+	 * @param rate The number of requests each client may make per second over time.
+	 * @param burst The number of requests each client may make at once.
+	 */
+	RateLimiter(double rate = 10, size_t burst = 20) : _rate(rate), _burst(burst), _header(), _sets(0), _slots(), _allowed(0), _limited(0), _evictions(0) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		Rate(rate).Burst(burst).Capacity(DefaultCapacity);
+	}
+
+	/**
+	 * Sets the number of requests each client may make per second over time.
+	 *
+	 * @param rate The number of requests per second.
+	 * @return A reference to this limiter.
+	 */
+	RateLimiter& Rate(double rate) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		_rate = rate > 0.000001 ? rate : 0.000001;
+		return *this;
+	}
+
+	/**
+	 * Sets the number of requests each client may make at once, after being idle.
+	 *
+	 * @param burst The number of requests.
+	 * @return A reference to this limiter.
+	 */
+	RateLimiter& Burst(size_t burst) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		_burst = burst == 0 ? 1 : burst;
+		return *this;
+	}
+
+	/**
+	 * Sets the request header that tells clients apart, such as "X-Api-Key".
+	 * Requests without the header are told apart by their address.
+	 *
+	 * @param header The name of the header, or empty to tell clients apart by their address.
+	 * @return A reference to this limiter.
+	 */
+	RateLimiter& Header(const std::string& header) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		_header = String::ToLowerCase(header);
+		return *this;
+	}
+
+	/**
+	 * The request header that tells clients apart.
+	 *
+	 * @return The name of the header in lower case, or empty if clients are told apart by their address.
+	 */
+	const std::string& Header() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _header;
+	}
+
+	/**
+	 * Sets the number of clients to keep buckets for, which is rounded up to a power of two, and forgets every bucket.
+	 * Each client takes sixteen bytes, which are allocated when the first request is counted.
+	 *
+	 * @param capacity The number of clients.
+	 * @return A reference to this limiter.
+	 */
+	RateLimiter& Capacity(size_t capacity) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		_sets = 1;
+
+		while (_sets * Ways < capacity) {
+			_sets *= 2;
+		}
+
+		std::vector<Slot>().swap(_slots);
+		return *this;
+	}
+
+	/**
+	 * The number of clients that buckets are kept for.
+	 *
+	 * @return The number of clients.
+	 */
+	size_t Capacity() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _sets * Ways;
+	}
+
+	/**
+	 * Takes a token from the bucket of a client at the specified time.
+	 *
+	 * @param key The key of the client.
+	 * @param now The time in microseconds, which must not go backwards.
+	 * @return Zero if the request may be made, or the number of microseconds until it may.
+	 */
+	uint64_t Take(const std::string& key, uint64_t now) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		uint64_t hash = Hash(key);
+		uint64_t interval = Interval();
+		uint64_t tolerance = interval * (_burst - 1);
+		Slot* set;
+		Slot* slot = NULL;
+
+		if (_slots.empty()) {
+			Slot empty = { 0, 0 };
+			_slots.assign(_sets * Ways, empty);
+		}
+
+		set = &_slots[(size_t) ((hash >> 32) & (_sets - 1)) * Ways];
+
+		for (size_t i = 0; i < Ways && slot == NULL; i++) {
+			if (set[i].key == hash) {
+				slot = &set[i];
+			}
+		}
+
+		// the slot of a full bucket is as good as empty, otherwise the bucket closest to full is evicted.
+		if (slot == NULL) {
+			slot = &set[0];
+
+			for (size_t i = 1; i < Ways && slot->full > now; i++) {
+				if (set[i].full < slot->full) {
+					slot = &set[i];
+				}
+			}
+
+			if (slot->full > now) {
+				_evictions++;
+			}
+
+			slot->key = hash;
+			slot->full = now;
+		}
+
+		uint64_t full = slot->full > now ? slot->full : now;
+
+		if (full - now > tolerance) {
+			_limited++;
+			return full - now - tolerance;
+		}
+
+		slot->full = full + interval;
+		_allowed++;
+		return 0;
+	}
+
+	/**
+	 * Takes a token from the bucket of a client now.
+	 *
+	 * @param key The key of the client.
+	 * @return Zero if the request may be made, or the number of microseconds until it may.
+	 */
+	uint64_t Take(const std::string& key) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return Take(key, DateTime::Microseconds());
+	}
+
+	/**
+	 * Forgets every bucket, so that every client may make a full burst of requests.
+	 */
+	void Clear() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		std::vector<Slot>().swap(_slots);
+	}
+
+	/**
+	 * The number of bytes used by the table of buckets.
+	 *
+	 * @return The number of bytes.
+	 */
+	size_t Bytes() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _slots.size() * sizeof(Slot);
+	}
+
+	/**
+	 * The number of requests that were allowed.
+	 *
+	 * @return The number of requests.
+	 */
+	uint64_t Allowed() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _allowed;
+	}
+
+	/**
+	 * The number of requests that were refused.
+	 *
+	 * @return The number of requests.
+	 */
+	uint64_t Limited() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _limited;
+	}
+
+	/**
+	 * The number of buckets that were evicted before they were full, to make room for another client.
+	 *
+	 * @return The number of buckets.
+	 */
+	uint64_t Evictions() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _evictions;
+	}
+
+	/**
+	 * Performs unit testing on functions in this class to ensure expected operation.
+	 */
+	static void UnitTest() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		RateLimiter limiter(10, 3);
+		uint64_t now = 1000000000;
+
+		assert(limiter.Bytes() == 0 && limiter.Capacity() == DefaultCapacity);
+
+		// a burst of three is allowed at once, and then one request every tenth of a second.
+		assert(limiter.Take("a", now) == 0 && limiter.Take("a", now) == 0 && limiter.Take("a", now) == 0);
+		assert(limiter.Take("a", now) == 100000);
+		assert(limiter.Take("a", now + 60000) == 40000);
+		assert(limiter.Take("a", now + 100000) == 0 && limiter.Take("a", now + 100000) == 100000);
+		assert(limiter.Bytes() == DefaultCapacity * sizeof(Slot));
+
+		// other clients have buckets of their own, and an idle client is given a full burst again.
+		assert(limiter.Take("b", now + 100000) == 0);
+		assert(limiter.Take("a", now + 1000000) == 0 && limiter.Take("a", now + 1000000) == 0 && limiter.Take("a", now + 1000000) == 0);
+		assert(limiter.Take("a", now + 1000000) != 0);
+		assert(limiter.Allowed() == 8 && limiter.Limited() == 4 && limiter.Evictions() == 0);
+
+		// a table of four slots holds a single set, so a fifth busy client evicts the bucket closest to full.
+		limiter.Capacity(4).Burst(1);
+
+		for (int i = 0; i < 4; i++) {
+			assert(limiter.Take(String::Format("%d", i), now + i) == 0);
+		}
+
+		assert(limiter.Take("4", now + 4) == 0 && limiter.Evictions() == 1);
+		assert(limiter.Take("1", now + 5) != 0);
+
+		// the evicted client is given a full burst again, at the expense of the next bucket closest to full.
+		assert(limiter.Take("0", now + 5) == 0 && limiter.Evictions() == 2);
+		assert(limiter.Take("1", now + 6) == 0 && limiter.Evictions() == 3);
+
+		// idle buckets make room without an eviction.
+		assert(limiter.Take("5", now + 1000000) == 0 && limiter.Evictions() == 3);
+		assert(limiter.Bytes() == 4 * sizeof(Slot));
+
+		limiter.Clear();
+		assert(limiter.Bytes() == 0 && limiter.Take("1", now + 1000000) == 0);
+
+		limiter.Header("X-Api-Key");
+		assert(limiter.Header() == "x-api-key");
+	}
+
+	/**
+	 * Deletes this limiter.
+	 */
+	virtual ~RateLimiter() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+	}
+};
+
+size_t RateLimiter::DefaultCapacity = 65536;
+
+}
+
+#endif /* RATELIMITER_HPP_ */
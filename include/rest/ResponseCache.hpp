@@ -0,0 +1,531 @@
+/*
+ * Copyright (c) 2012 Christopher M. Baker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef RESPONSECACHE_HPP_
+#define RESPONSECACHE_HPP_
+
+#include "../StackTrace.hpp"
+#include "../String.hpp"
+#include "../DateTime.hpp"
+#include "../http/HttpServer.hpp"
+#include "../http/QueryString.hpp"
+
+#include <assert.h>
+#include <algorithm>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace nitrus {
+
+/**
+ * A class that keeps recorded responses so that repeated requests can be answered without running their handlers again.
+ * Responses are found by a key made from the request method, the normalized path and any headers the response varies by.
+ * Each response expires after the time it was stored with, and once the cache holds more than its capacity the least recently used responses are evicted.
+ * Only complete 200 OK responses are kept, and not those whose Cache-Control header forbids it.
+ * A cache must outlive the clients whose responses it records.
+ */
+class ResponseCache {
+public:
+	typedef std::multimap<std::string, std::string> HeaderCollection;
+
+	/**
+	 * The number of bytes of responses that a cache holds by default.
+	 */
+	static size_t DefaultCapacity;
+
+private:
+
+	/**
+	 * A stored response, the key it was stored under and when it expires.
+	 */
+	struct Entry {
+		std::string key;
+		HttpServer::Response response;
+		DateTime expires;
+		size_t size;
+	};
+
+	typedef std::list<Entry> Entries;
+	typedef std::map<std::string, Entries::iterator> Index;
+
+	/**
+	 * A class that waits for the response to a request that missed the cache, and stores it once it has ended.
+	 */
+	class Pending {
+	private:
+		ResponseCache* _cache;
+		std::string _key;
+		TimeSpan _duration;
+
+	private:
+		template <typename Signature> friend class Delegate;
+
+		/**
+		 * Pending responses free themselves once the response has been recorded and cannot be copied.
+		 *
+		 * @param that The pending response to clone.
+		 */
+		Pending(const Pending& that);
+
+		/**
+		 * Pending responses free themselves once the response has been recorded and cannot be copied.
+		 *
+		 * @param that The pending response to clone.
+		 * @return A reference to this pending response.
+		 */
+		Pending& operator = (const Pending& that);
+
+		/**
+		 * Called when the response has been recorded.
+		 * This will store the response if it can be cached, and then free this pending response.
+		 *
+		 * @param args The event arguments.
+		 * @param sender The sender of the event.
+		 */
+		void OnResponseRecorded(const HttpServer::HttpClient::ResponseRecordedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			if (Cacheable(args.Recorded())) {
+				_cache->Store(_key, args.Recorded(), _duration);
+			}
+
+			delete this;
+		}
+
+	public:
+
+		/**
+		 * Creates a new pending response and starts recording the response to the current request of a client.
+		 *
+		 * @param cache The cache to store the response in.
+		 * @param client The client.
+		 * @param key The key to store the response under.
+		 * @param duration How long the response is kept.
+		 */
+		Pending(ResponseCache* cache, HttpServer::HttpClient* client, const std::string& key, const TimeSpan& duration) : _cache(cache), _key(key), _duration(duration) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			client->Record(HttpServer::HttpClient::ResponseRecordedEventHandler(&Pending::OnResponseRecorded, this));
+		}
+
+		/**
+		 * Deletes this pending response.
+		 */
+		virtual ~Pending() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+		}
+	};
+
+	size_t _capacity;
+	size_t _bytes;
+	Entries _entries;
+	Index _index;
+	uint64_t _hits;
+	uint64_t _misses;
+	uint64_t _evictions;
+	uint64_t _expirations;
+
+private:
+
+	/**
+	 * Caches refer to their own entries and cannot be copied.
+	 *
+	 * @param that The cache to clone.
+	 */
+	ResponseCache(const ResponseCache& that);
+
+	/**
+	 * Caches refer to their own entries and cannot be copied.
+	 *
+	 * @param that The cache to clone.
+	 * @return A reference to this cache.
+	 */
+	ResponseCache& operator = (const ResponseCache& that);
+
+	/**
+	 * Removes an entry.
+	 *
+	 * @param entry The entry.
+	 */
+	void Remove(Entries::iterator entry) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		_bytes -= entry->size;
+		_index.erase(entry->key);
+		_entries.erase(entry);
+	}
+
+	/**
+	 * Evicts the least recently used entries until the cache holds no more than its capacity.
+	 */
+	void Evict() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		while (_bytes > _capacity && _entries.empty() == false) {
+			Remove(--_entries.end());
+			_evictions++;
+		}
+	}
+
+	/**
+	 * Appends a decoded key or value of a query parameter to a cache key, encoding the characters that separate parameters and headers so that different query strings cannot give the same key.
+	 *
+	 * @param key The cache key.
+	 * @param value The decoded key or value.
+	 */
+	static void AppendParameter(std::string& key, const std::string& value) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		for (size_t i = 0; i < value.size(); i++) {
+			char c = value[i];
+
+			if (c == '%') {
+				key += "%25";
+			}
+			else if (c == '&') {
+				key += "%26";
+			}
+			else if (c == '=') {
+				key += "%3D";
+			}
+			else if (c == '\n') {
+				key += "%0A";
+			}
+			else {
+				key += c;
+			}
+		}
+	}
+
+	/**
+	 * Compares two query parameters by key only, so that a stable sort keeps the values of a repeated key in order.
+	 *
+	 * @param a The first parameter.
+	 * @param b The second parameter.
+	 * @return True if the first key is less than the second, false otherwise.
+	 */
+	static bool KeyLess(const std::pair<std::string, std::string>& a, const std::pair<std::string, std::string>& b) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return a.first < b.first;
+	}
+
+public:
+
+	/**
+	 * Determines whether a recorded response may be cached: it must be complete, a 200 OK response, and not marked no-store or private.
+	 *
+	 * @param response The response.
+	 * @return True if the response may be cached, false otherwise.
+	 */
+	static bool Cacheable(const HttpServer::Response& response) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		if (response.Complete() == false || response.Status() != 200) {
+			return false;
+		}
+
+		std::string headers = "\r\n" + String::ToLowerCase(response.Headers());
+		size_t control = headers.find("\r\ncache-control:");
+
+		if (control == std::string::npos) {
+			return true;
+		}
+
+		std::string value = headers.substr(control, headers.find("\r\n", control + 2) - control);
+		return value.find("no-store") == std::string::npos && value.find("private") == std::string::npos;
+	}
+
+	/**
+	 * Makes the key for a request.
+	 * The path is normalized as the router compares it: repeated slashes and a trailing slash are ignored, and query parameters are decoded and may be given in any order.
+	 *
+	 * @param method The http method.
+	 * @param path The path requested, including any query string.
+	 * @param headers The request headers.
+	 * @param vary The lowercase names of the headers that the response varies by.
+	 * @return The key.
+	 */
+	static std::string Key(const std::string& method, const std::string& path, const HeaderCollection& headers, const std::vector<std::string>& vary) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		size_t query = path.find('?');
+		size_t end = query == std::string::npos ? path.size() : query;
+		std::string key = String::ToUpperCase(method) + ' ';
+		size_t begin = key.size();
+
+		for (size_t i = 0; i < end; i++) {
+			if (path[i] != '/' || key[key.size() - 1] != '/') {
+				key += path[i];
+			}
+		}
+
+		if (key.size() > begin + 1 && key[key.size() - 1] == '/') {
+			key.erase(key.size() - 1);
+		}
+
+		if (query != std::string::npos) {
+			QueryString parameters(path, query + 1);
+			std::vector<std::pair<std::string, std::string> > sorted;
+
+			for (size_t i = 0; i < parameters.Count(); i++) {
+				sorted.push_back(std::make_pair(parameters.Key(i), parameters.Assigned(i) ? "=" + parameters.Value(i) : ""));
+			}
+
+			std::stable_sort(sorted.begin(), sorted.end(), KeyLess);
+
+			for (size_t i = 0; i < sorted.size(); i++) {
+				key += i == 0 ? '?' : '&';
+				AppendParameter(key, sorted[i].first);
+
+				if (sorted[i].second.empty() == false) {
+					key += '=';
+					AppendParameter(key, sorted[i].second.substr(1));
+				}
+			}
+		}
+
+		// the header values follow the path on lines of their own, since a line feed cannot appear in the path and is encoded in the query.
+		for (size_t i = 0; i < vary.size(); i++) {
+			key += '\n';
+
+			for (HeaderCollection::const_iterator j = headers.begin(); j != headers.end(); j++) {
+				if (String::ToLowerCase(j->first) == vary[i]) {
+					key += j->second;
+					break;
+				}
+			}
+		}
+
+		return key;
+	}
+
+	/**
+	 * Creates a new empty cache.
+	 *
+	 * @param capacity The number of bytes of responses to hold before evicting the least recently used.
+	 */
+	ResponseCache(size_t capacity = DefaultCapacity) : _capacity(capacity), _bytes(0), _entries(), _index(), _hits(0), _misses(0), _evictions(0), _expirations(0) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+	}
+
+	/**
+	 * Sets the number of bytes of responses to hold, evicting the least recently used responses if the cache already holds more.
+	 *
+	 * @param capacity The number of bytes.
+	 * @return A reference to this cache.
+	 */
+	ResponseCache& Capacity(size_t capacity) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		_capacity = capacity;
+		Evict();
+
+		return *this;
+	}
+
+	/**
+	 * Finds the response stored under a key, counting a hit or a miss.
+	 * A response that has expired is removed and counts as a miss.
+	 *
+	 * @param key The key.
+	 * @return The response, which is valid until the cache is next changed, or NULL if there is none.
+	 */
+	const HttpServer::Response* Find(const std::string& key) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		Index::iterator i = _index.find(key);
+
+		if (i == _index.end()) {
+			_misses++;
+			return NULL;
+		}
+
+		if (i->second->expires <= DateTime::Utc()) {
+			Remove(i->second);
+			_expirations++;
+			_misses++;
+			return NULL;
+		}
+
+		// the most recently used entry is kept at the front, so that the back is evicted first.
+		_entries.splice(_entries.begin(), _entries, i->second);
+		_hits++;
+
+		return &i->second->response;
+	}
+
+	/**
+	 * Stores a response under a key, replacing any response already stored under it.
+	 * A response larger than the capacity of the cache is not stored.
+	 *
+	 * @param key The key.
+	 * @param response The response.
+	 * @param duration How long the response is kept.
+	 */
+	void Store(const std::string& key, const HttpServer::Response& response, const TimeSpan& duration) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		Index::iterator i = _index.find(key);
+		Entry entry = { key, response, DateTime::Utc() + duration, key.size() * 2 + response.Size() };
+
+		if (i != _index.end()) {
+			Remove(i->second);
+		}
+
+		if (entry.size > _capacity) {
+			return;
+		}
+
+		_entries.push_front(entry);
+		_index[key] = _entries.begin();
+		_bytes += entry.size;
+
+		Evict();
+	}
+
+	/**
+	 * Records the response to the current request of a client, and stores it under a key once it has ended if it can be cached.
+	 *
+	 * @param client The client.
+	 * @param key The key.
+	 * @param duration How long the response is kept.
+	 */
+	void Record(HttpServer::HttpClient* client, const std::string& key, const TimeSpan& duration) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		new Pending(this, client, key, duration);
+	}
+
+	/**
+	 * Removes every response.
+	 */
+	void Clear() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		_entries.clear();
+		_index.clear();
+		_bytes = 0;
+	}
+
+	/**
+	 * The number of bytes of responses held before evicting the least recently used.
+	 *
+	 * @return The number of bytes.
+	 */
+	size_t Capacity() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _capacity;
+	}
+
+	/**
+	 * The number of bytes held by the stored responses and their keys.
+	 *
+	 * @return The number of bytes.
+	 */
+	size_t Bytes() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _bytes;
+	}
+
+	/**
+	 * The number of stored responses, including any that have expired but have not yet been looked up.
+	 *
+	 * @return The number of responses.
+	 */
+	size_t Count() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _entries.size();
+	}
+
+	/**
+	 * The total number of lookups that found a response.
+	 *
+	 * @return The number of lookups.
+	 */
+	uint64_t Hits() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _hits;
+	}
+
+	/**
+	 * The total number of lookups that found no response, including those that found an expired response.
+	 *
+	 * @return The number of lookups.
+	 */
+	uint64_t Misses() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _misses;
+	}
+
+	/**
+	 * The total number of responses evicted to stay within the capacity.
+	 *
+	 * @return The number of responses.
+	 */
+	uint64_t Evictions() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _evictions;
+	}
+
+	/**
+	 * The total number of responses removed because they had expired.
+	 *
+	 * @return The number of responses.
+	 */
+	uint64_t Expirations() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		return _expirations;
+	}
+
+	/**
+	 * Performs unit testing on functions in this class to ensure expected operation.
+	 */
+	static void UnitTest() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		HeaderCollection headers;
+		std::vector<std::string> vary;
+
+		headers.insert(std::make_pair("Accept", "application/json"));
+		vary.push_back("accept");
+
+		assert(Key("get", "/entities/", HeaderCollection(), std::vector<std::string>()) == "GET /entities");
+		assert(Key("GET", "//entities//42", HeaderCollection(), std::vector<std::string>()) == "GET /entities/42");
+		assert(Key("GET", "/", HeaderCollection(), std::vector<std::string>()) == "GET /");
+		assert(Key("GET", "/a//?b", HeaderCollection(), std::vector<std::string>()) == "GET /a?b");
+		assert(Key("GET", "/search?page=2&q=a+b", HeaderCollection(), std::vector<std::string>()) == Key("GET", "/search?q=a%20b&page=2", HeaderCollection(), std::vector<std::string>()));
+		assert(Key("GET", "/search?q=a%26b", HeaderCollection(), std::vector<std::string>()) != Key("GET", "/search?q=a&b", HeaderCollection(), std::vector<std::string>()));
+		assert(Key("GET", "/search?q=1&q=2", HeaderCollection(), std::vector<std::string>()) != Key("GET", "/search?q=2&q=1", HeaderCollection(), std::vector<std::string>()));
+		assert(Key("GET", "/entities", headers, vary) == "GET /entities\napplication/json");
+		assert(Key("GET", "/entities", HeaderCollection(), vary) == "GET /entities\n");
+
+		HttpServer::Response ok("HTTP/1.1", 200, "OK", "Content-Type: text/plain\r\n", "0123456789");
+		assert(Cacheable(ok));
+		assert(Cacheable(HttpServer::Response("HTTP/1.1", 404, "Not Found", "", "")) == false);
+		assert(Cacheable(HttpServer::Response("HTTP/1.1", 200, "OK", "Cache-Control: no-store\r\n", "")) == false);
+		assert(Cacheable(HttpServer::Response("HTTP/1.1", 200, "OK", "Server: nitrus\r\nCache-Control: max-age=5\r\n", "")));
+		assert(Cacheable(HttpServer::Response()) == false);
+
+		ResponseCache cache((2 + ok.Size()) * 2);
+
+		cache.Store("a", ok, TimeSpan::FromMinutes(1));
+		cache.Store("b", ok, TimeSpan::FromMinutes(1));
+		assert(cache.Count() == 2 && cache.Bytes() == cache.Capacity());
+		assert(cache.Find("a") != NULL && cache.Find("a")->Content() == "0123456789");
+
+		// "b" is now the least recently used, so it is evicted to make room.
+		cache.Store("c", ok, TimeSpan::FromMinutes(1));
+		assert(cache.Find("b") == NULL && cache.Find("a") != NULL && cache.Find("c") != NULL);
+		assert(cache.Evictions() == 1 && cache.Hits() == 4 && cache.Misses() == 1);
+
+		cache.Store("a", ok, TimeSpan::Zero());
+		assert(cache.Find("a") == NULL && cache.Expirations() == 1 && cache.Count() == 1);
+
+		cache.Store("big", HttpServer::Response("HTTP/1.1", 200, "OK", "", std::string(cache.Capacity(), 'x')), TimeSpan::FromMinutes(1));
+		assert(cache.Find("big") == NULL && cache.Find("c") != NULL);
+
+		cache.Capacity(0);
+		assert(cache.Count() == 0 && cache.Bytes() == 0);
+	}
+
+	/**
+	 * Deletes this cache.
+	 */
+	virtual ~ResponseCache() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+	}
+};
+
+size_t ResponseCache::DefaultCapacity = 64 * 1024 * 1024;
+
+}
+
+#endif /* RESPONSECACHE_HPP_ */
@@ -25,15 +25,30 @@
 #define REST_HPP_
 
 #include "../StackTrace.hpp"
+#include "../Application.hpp"
 #include "../Log.hpp"
 #include "../Event.hpp"
 #include "../String.hpp"
+#include "../Random.hpp"
+#include "../Histogram.hpp"
+#include "../WorkerPool.hpp"
 #include "../state/StateMachine.hpp"
 #include "../http/HttpServer.hpp"
+#include "Proxy.hpp"
+#include "RateLimiter.hpp"
+#include "../http/QueryString.hpp"
+#include "JsonWriter.hpp"
+#include "JsonReader.hpp"
+#include "ResponseCache.hpp"
 #include "../fs/File.hpp"
+#include "../fs/FileCache.hpp"
 #include "../fs/Directory.hpp"
 
+#include <algorithm>
+#include <deque>
 #include <map>
+#include <vector>
+#include <stdint.h>
 
 namespace nitrus {
 
@@ -50,21 +65,54 @@ public:
 	public:
 		typedef std::multimap<std::string, std::string> HeaderCollection;
 		typedef std::map<std::string, std::string> MatchCollection;
+		typedef std::vector<std::pair<std::string, int64_t> > CaptureCollection;
+
+	private:
+		class ClientHandler;
+		class RouteTree;
+
+	public:
 
 		/**
 		 * A class that encapsulates a web request received from an http client.
+		 * The request of a connection is received into one of these in place, and is then passed by reference through routing to its handler, with the matches of the route filled in as it is routed, so nothing of the request is copied.
 		 */
 		class RequestEventArgs : public EventArgs {
 		private:
+			friend class ClientHandler;
+			friend class RouteTree;
+
 			HttpServer::HttpClient* _client;
 			std::string _method;
 			std::string _path;
 			HeaderCollection _headers;
 			std::string _content;
 			MatchCollection _matches;
+			CaptureCollection _captures;
+
+			/**
+			 * Releases the memory held for the request, leaving only its client.
+			 */
+			void Release() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				std::string().swap(_method);
+				std::string().swap(_path);
+				HeaderCollection().swap(_headers);
+				std::string().swap(_content);
+				MatchCollection().swap(_matches);
+				CaptureCollection().swap(_captures);
+			}
 
 		public:
 
+			/**
+			 * Creates a new empty event argument for a web request from the specified client.
+			 *
+			 * @param client The client that sent the request.
+			 */
+			explicit RequestEventArgs(HttpServer::HttpClient* client) : _client(client), _method(), _path(), _headers(), _content(), _matches(), _captures() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+			}
+
 			/**
 			 * Creates a new event argument for a web request.
 			 *
@@ -74,8 +122,9 @@ public:
 			 * @param headers The request headers.
 			 * @param content The request content.
 			 * @param matches The matched routing keys and values.
+			 * @param captures The values matched by the routing keys in the path, in order, and their numbers if the keys were typed.
 			 */
-			RequestEventArgs(HttpServer::HttpClient* client, const std::string& method, const std::string& path, const HeaderCollection& headers, const std::string& content, const MatchCollection& matches) : _client(client), _method(method), _path(path), _headers(headers), _content(content), _matches(matches) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			RequestEventArgs(HttpServer::HttpClient* client, const std::string& method, const std::string& path, const HeaderCollection& headers, const std::string& content, const MatchCollection& matches, const CaptureCollection& captures = CaptureCollection()) : _client(client), _method(method), _path(path), _headers(headers), _content(content), _matches(matches), _captures(captures) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
 
 			}
 
@@ -84,7 +133,7 @@ public:
 			 *
 			 * @param that The request to clone.
 			 */
-			RequestEventArgs(const RequestEventArgs& that) : _client(that._client), _method(that._method), _path(that._path), _headers(that._headers), _content(that._content), _matches(that._matches) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			RequestEventArgs(const RequestEventArgs& that) : _client(that._client), _method(that._method), _path(that._path), _headers(that._headers), _content(that._content), _matches(that._matches), _captures(that._captures) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
 
 			}
 
@@ -101,10 +150,27 @@ public:
 				_headers = that._headers;
 				_content = that._content;
 				_matches = that._matches;
+				_captures = that._captures;
 
 				return *this;
 			}
 
+			/**
+			 * Takes the method, path, headers, content and matches of another request without copying them, leaving it empty.
+			 * The client of each request is kept.
+			 *
+			 * @param that The request to take from.
+			 */
+			void Take(RequestEventArgs& that) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				Release();
+				_method.swap(that._method);
+				_path.swap(that._path);
+				_headers.swap(that._headers);
+				_content.swap(that._content);
+				_matches.swap(that._matches);
+				_captures.swap(that._captures);
+			}
+
 			/**
 			 * The client that sent the request.
 			 *
@@ -141,6 +207,26 @@ public:
 				return _headers;
 			}
 
+			/**
+			 * Gets the value of the first request header with the specified key.
+			 * Header keys are compared without regard to case.
+			 *
+			 * @param key The header key.
+			 * @param defaultValue The default value to return if not found.
+			 * @return The header value if the key exists, the default value otherwise.
+			 */
+			std::string Header(const std::string& key, const std::string& defaultValue = "") const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				std::string lowercase = String::ToLowerCase(key);
+
+				for (HeaderCollection::const_iterator i = _headers.begin(); i != _headers.end(); i++) {
+					if (String::ToLowerCase(i->first) == lowercase) {
+						return i->second;
+					}
+				}
+
+				return defaultValue;
+			}
+
 			/**
 			 * The http request content.
 			 *
@@ -192,6 +278,36 @@ public:
 				return i == _matches.end() ? defaultValue : String::Convert<T>(i->second);
 			}
 
+			/**
+			 * The values matched by the routing keys in the path, in the order the keys appear in the routing expression.
+			 *
+			 * @return The captures.
+			 */
+			const CaptureCollection& Captures() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				return _captures;
+			}
+
+			/**
+			 * Gets the value matched by a routing key in the path, by position.
+			 *
+			 * @param index The position of the routing key in the routing expression, from zero.
+			 * @return The matched value.
+			 */
+			const std::string& Capture(size_t index) const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				return _captures.at(index).first;
+			}
+
+			/**
+			 * Gets the number matched by a typed routing key in the path, by position.
+			 * The number was parsed while routing, so reading it costs nothing; for a routing key without a type this is zero.
+			 *
+			 * @param index The position of the routing key in the routing expression, from zero.
+			 * @return The matched number.
+			 */
+			int64_t Number(size_t index) const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				return _captures.at(index).second;
+			}
+
 			/**
 			 * Deletes this event argument.
 			 */
@@ -204,461 +320,2542 @@ public:
 		typedef Event<const RequestEventArgs&> RequestEvent;
 
 		/**
-		 * A class that encapsulates a routing configuration.
+		 * A function run before the handler of a request, such as to authenticate it.
+		 * It returns true to let the request continue, or false if it has answered the request itself, so that later filters and the handler are skipped.
 		 */
-		class Configuration {
-		private:
-			typedef std::map<std::string, RequestEventHandler> Handlers;
-			Handlers _handlers;
+		typedef Delegate<bool (const RequestEventArgs&, void*)> RequestFilter;
 
+		/**
+		 * A class that encapsulates a request handled on a worker thread.
+		 * It has everything of the request but its client, which belongs to the event loop and cannot be used while the handler runs.
+		 */
+		class WorkRequest : private RequestEventArgs {
 		public:
+			using RequestEventArgs::Method;
+			using RequestEventArgs::Path;
+			using RequestEventArgs::Headers;
+			using RequestEventArgs::Header;
+			using RequestEventArgs::Content;
+			using RequestEventArgs::Matches;
+			using RequestEventArgs::Match;
+			using RequestEventArgs::Captures;
+			using RequestEventArgs::Capture;
+			using RequestEventArgs::Number;
 
 			/**
-			 * Creates a new routing configuration.
+			 * Creates a new request for a worker thread by taking the request of a connection without copying it, leaving only its client.
+			 *
+			 * @param args The request to take.
 			 */
-			Configuration() : _handlers() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-
+			explicit WorkRequest(RequestEventArgs& args) : RequestEventArgs(NULL) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				Take(args);
 			}
 
 			/**
-			 * Invokes the handler for the specified request event.
-			 *
-			 * @param args The request event arguments.
-			 * @param sender The sender of the arguments.
-			 * @return True if the request could be handled, false otherwise.
+			 * Deletes this request.
 			 */
-			bool operator ()(const RequestEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-				Handlers::iterator i = _handlers.find(String::ToUpperCase(args.Method()));
+			virtual ~WorkRequest() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
 
-				if (i == _handlers.end()) {
-					return false;
-				}
+			}
+		};
 
-				try {
-					i->second(args, sender);
-				}
-				catch (...) {
-					args.Client()->Begin("HTTP/1.1", 400, "Bad Request")
-						.SendHeader("Server", "nitrus")
-						.SendHeader("Content-Type", "text/plain")
-						.Send(StackTrace::ToExceptionString())
-						.End();
-				}
+		/**
+		 * A function that handles a request on a worker thread, such as one that does heavy processing.
+		 * It is given the request, taken from the connection without copying it and without its client, and writes its response, which is sent once it returns.
+		 */
+		typedef Delegate<void (const WorkRequest&, HttpServer::Response&)> WorkHandler;
+
+		/**
+		 * A class that encapsulates the end of a response to a routed request.
+		 */
+		class ResponseEventArgs : public EventArgs {
+		private:
+			HttpServer::HttpClient* _client;
+			const std::string& _route;
+			int _status;
+			uint64_t _bytes;
+			uint64_t _latency;
+
+		public:
+
+			/**
+			 * Creates a new event argument for the end of a response.
+			 *
+			 * @param client The client that sent the request.
+			 * @param route The routing expression that matched the request.
+			 * @param status The response code.
+			 * @param bytes The number of bytes of content sent.
+			 * @param latency The number of microseconds from the first byte of the request to the end of the response.
+			 */
+			ResponseEventArgs(HttpServer::HttpClient* client, const std::string& route, int status, uint64_t bytes, uint64_t latency) : _client(client), _route(route), _status(status), _bytes(bytes), _latency(latency) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
 
-				return true;
 			}
 
 			/**
-			 * Binds an event handler to an http method for this configuration.
+			 * The client that sent the request.
 			 *
-			 * @param method The method to bind to.
-			 * @param handler The event handler to bind.
-			 * @return A reference to this configuration.
+			 * @return The client.
 			 */
-			Configuration& Bind(const std::string& method, const RequestEventHandler& handler) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-				_handlers[String::ToUpperCase(method)] = handler;
-				return *this;
+			HttpServer::HttpClient* Client() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				return _client;
 			}
 
 			/**
-			 * Binds an event handler to the http GET method for this configuration.
+			 * The routing expression that matched the request.
 			 *
-			 * @param handler The event handler to bind.
-			 * @return A reference to this configuration.
+			 * @return The routing expression.
 			 */
-			Configuration& Get(const RequestEventHandler& handler) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-				return Bind("GET", handler);
+			const std::string& Route() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				return _route;
 			}
 
 			/**
-			 * Binds an event handler to the http PUT method for this configuration.
+			 * The response code.
 			 *
-			 * @param handler The event handler to bind.
-			 * @return A reference to this configuration.
+			 * @return The response code.
 			 */
-			Configuration& Put(const RequestEventHandler& handler) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-				return Bind("PUT", handler);
+			int Status() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				return _status;
 			}
 
 			/**
-			 * Binds an event handler to the http POST method for this configuration.
+			 * The number of bytes of content sent.
 			 *
-			 * @param handler The event handler to bind.
-			 * @return A reference to this configuration.
+			 * @return The number of bytes.
 			 */
-			Configuration& Post(const RequestEventHandler& handler) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-				return Bind("POST", handler);
+			uint64_t Bytes() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				return _bytes;
 			}
 
 			/**
-			 * Binds an event handler to the http DELETE method for this configuration.
+			 * The time from the first byte of the request to the end of the response.
 			 *
-			 * @param handler The event handler to bind.
-			 * @return A reference to this configuration.
+			 * @return The number of microseconds.
 			 */
-			Configuration& Delete(const RequestEventHandler& handler) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-				return Bind("DELETE", handler);
+			uint64_t Latency() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				return _latency;
 			}
 
 			/**
-			 * Deletes this routing configuration.
+			 * Deletes this event argument.
 			 */
-			virtual ~Configuration() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			virtual ~ResponseEventArgs() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
 
 			}
 		};
 
-	private:
+		typedef EventHandler<const ResponseEventArgs&> ResponseEventHandler;
+		typedef Event<const ResponseEventArgs&> ResponseEvent;
 
 		/**
-		 * A class that encapsulates the routing logic for an http client.
+		 * A class that counts the responses to the requests for a route by status class, and their latencies from the first byte of the request to the end of the response.
+		 * For a route whose handlers run on worker threads, it also counts how long requests waited for a worker, and how many requests shared the response to an identical request.
 		 */
-		class ClientHandler : public EventArgs {
-		private:
-			RequestEventHandler _requestHandler;
-			HttpServer::HttpClient* _client;
-			std::string _method;
-			std::string _path;
-			HeaderCollection _headers;
-			std::string _content;
+		class RouteMetrics {
+		public:
+
+			/**
+			 * The highest latency, in microseconds, that is told apart from longer ones.
+			 */
+			static uint64_t HighestLatency;
 
 		private:
+			uint64_t _requests;
+			uint64_t _statuses[5];
+			uint64_t _coalesced;
+			Histogram _latency;
+			Histogram _queue;
+
+		public:
 
 			/**
-			 * Called when a client request has been started.
-			 * This will initialize some member variables that will be used after the request has completed.
+			 * Creates new empty metrics.
+			 * Latencies are kept to two significant digits, which bounds the memory used by each route to a few tens of kilobytes.
+			 */
+			RouteMetrics() : _requests(0), _coalesced(0), _latency(HighestLatency, 2), _queue(HighestLatency, 2) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				std::fill(_statuses, _statuses + 5, 0);
+			}
+
+			/**
+			 * Counts a response.
 			 *
-			 * @param args The event arguments.
-			 * @param sender The sender of the event.
+			 * @param status The response code.
+			 * @param latency The number of microseconds from the first byte of the request to the end of the response.
 			 */
-			void OnClientRequestStarted(const HttpClient::RequestStartedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-				_method = args.Method();
-				_path = args.Path();
-				_headers.clear();
-				_content.clear();
+			void Record(int status, uint64_t latency) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				_requests++;
+
+				if (status >= 100 && status < 600) {
+					_statuses[status / 100 - 1]++;
+				}
+
+				_latency.Record(latency);
 			}
 
 			/**
-			 * Called when a single header key and value has been received.
-			 * This will add the key and value to a collection that will be used after the request has completed.
+			 * Counts how long a request waited before a worker thread started on it.
 			 *
-			 * @param args The event arguments.
-			 * @param sender The sender of the event.
+			 * @param queued The number of microseconds from when the request was routed to when its handler started.
 			 */
-			void OnHeaderReceived(const HttpClient::HeaderReceivedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-				_headers.insert(std::make_pair(args.Key(), args.Value()));
+			void Queued(uint64_t queued) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				_queue.Record(queued);
 			}
 
 			/**
-			 * Called when partial content has been received
-			 * This will append to a content buffer that will be used after the request has completed.
+			 * Counts a request that was given the response to an identical request already in progress, rather than running its handler.
+			 */
+			void Joined() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				_coalesced++;
+			}
+
+			/**
+			 * The number of responses counted.
 			 *
-			 * @param args The event arguments.
-			 * @param sender The sender of the event.
+			 * @return The number of responses.
 			 */
-			void OnContentReceived(const HttpClient::ContentReceivedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-				_content += args.Content();
+			uint64_t Requests() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				return _requests;
 			}
 
 			/**
-			 * Called when a request has ended.
-			 * This will call the event handler passing an event argument that is a collection of all of the http variables.
+			 * The number of responses counted with a response code in a status class.
 			 *
-			 * @param args The event arguments.
-			 * @param sender The sender of the event.
+			 * @param status The status class, from 1 for 1xx responses to 5 for 5xx responses.
+			 * @return The number of responses.
 			 */
-			void OnClientRequestEnded(const HttpClient::RequestEndedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-				_requestHandler(RequestEventArgs(_client, _method, _path, _headers, _content, MatchCollection()), this);
+			uint64_t Status(int status) const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				return status >= 1 && status <= 5 ? _statuses[status - 1] : 0;
 			}
 
 			/**
-			 * Called when the client that this object is handling has disconnected.
-			 * This will delete the reference to this object.
+			 * The latencies of the responses counted, in microseconds.
 			 *
-			 * @param args The event arguments.
-			 * @param sender The sender of the event.
+			 * @return The histogram of latencies.
 			 */
-			void OnClientDisconnected(const HttpClient::ClientDisconnectedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-				delete this;
+			const Histogram& Latency() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				return _latency;
 			}
 
-		public:
+			/**
+			 * How long requests waited for a worker thread, in microseconds.
+			 *
+			 * @return The histogram of waits, which is empty unless the handlers of the route run on worker threads.
+			 */
+			const Histogram& Queue() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				return _queue;
+			}
 
 			/**
-			 * Creates a new client handler to manage http requests.
+			 * The number of requests that were given the response to an identical request already in progress.
 			 *
-			 * @param requestHandler The event handler to invoke when a request has been received.
-			 * @param client The client to manage.
+			 * @return The number of requests, which is zero unless the route coalesces requests.
 			 */
-			ClientHandler(const RequestEventHandler& requestHandler, HttpServer::HttpClient* client) : _requestHandler(requestHandler), _client(client), _method(), _path(), _headers(), _content() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-				client->RequestStarted() += delegate(&ClientHandler::OnClientRequestStarted, this);
-				client->HeaderReceived() += delegate(&ClientHandler::OnHeaderReceived, this);
-				client->ContentReceived() += delegate(&ClientHandler::OnContentReceived, this);
-				client->RequestEnded() += delegate(&ClientHandler::OnClientRequestEnded, this);
-				client->ClientDisconnected() += delegate(&ClientHandler::OnClientDisconnected, this);
+			uint64_t Coalesced() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				return _coalesced;
 			}
 
 			/**
-			 * Creates a new client handler from the specified client handler.
+			 * Writes the metrics as a JSON object, with latencies in microseconds.
+			 * The waits for a worker thread are written as queue, and the coalesced requests as coalesced, only if any were counted.
 			 *
-			 * @param that The client handler to clone.
+			 * @param json The writer.
+			 * @param route The routing expression the metrics were counted for.
 			 */
-			ClientHandler(const ClientHandler& that) : _requestHandler(that._requestHandler), _client(that._client), _method(that._method), _path(that._path), _headers(that._headers), _content(that._content) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			void Write(JsonWriter& json, const std::string& route) const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				json.BeginObject()
+					.Key("route").String(route)
+					.Key("requests").Unsigned(_requests)
+					.Key("status").BeginObject();
+
+				for (int i = 1; i <= 5; i++) {
+					json.Key(String::Format("%dxx", i)).Unsigned(Status(i));
+				}
+
+				json.EndObject()
+					.Key("latency").BeginObject()
+						.Key("mean").Number(_latency.Mean())
+						.Key("p50").Unsigned(_latency.Percentile(50))
+						.Key("p90").Unsigned(_latency.Percentile(90))
+						.Key("p99").Unsigned(_latency.Percentile(99))
+						.Key("p999").Unsigned(_latency.Percentile(99.9))
+						.Key("max").Unsigned(_latency.Maximum())
+					.EndObject();
+
+				if (_queue.Count() > 0) {
+					json.Key("queue").BeginObject()
+						.Key("mean").Number(_queue.Mean())
+						.Key("p50").Unsigned(_queue.Percentile(50))
+						.Key("p99").Unsigned(_queue.Percentile(99))
+						.Key("max").Unsigned(_queue.Maximum())
+						.EndObject();
+				}
+
+				if (_coalesced > 0) {
+					json.Key("coalesced").Unsigned(_coalesced);
+				}
 
+				json.EndObject();
 			}
 
 			/**
-			 * Copies the specified client handler into this client handler.
-			 *
-			 * @param that The client handler to clone.
-			 * @return A reference to this client handler.
+			 * Performs unit testing on functions in this class to ensure expected operation.
 			 */
-			ClientHandler& operator = (const ClientHandler& that) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-				_requestHandler = that._requestHandler;
-				_client = that._client;
-				_method = that._method;
-				_path = that._path;
-				_headers = that._headers;
-				_content = that._content;
+			static void UnitTest() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				RouteMetrics metrics;
+				std::string output;
+				JsonWriter json(output);
 
-				return *this;
+				metrics.Record(200, 1000);
+				metrics.Record(204, 3000);
+				metrics.Record(404, 2000);
+				metrics.Record(0, 5000);
+				metrics.Record(503, HighestLatency * 2);
+
+				assert(metrics.Requests() == 5);
+				assert(metrics.Status(2) == 2 && metrics.Status(4) == 1 && metrics.Status(5) == 1 && metrics.Status(1) == 0 && metrics.Status(6) == 0);
+				assert(metrics.Latency().Minimum() == 1000 && metrics.Latency().Maximum() == HighestLatency);
+
+				metrics.Write(json, "/entities");
+				json.Close();
+
+				assert(output.find("{\"route\":\"/entities\",\"requests\":5,\"status\":{\"1xx\":0,\"2xx\":2,\"3xx\":0,\"4xx\":1,\"5xx\":1},\"latency\":{") == 0);
+				assert(output.find("\"max\":60000000}}") != std::string::npos);
+
+				metrics.Queued(250);
+				output.clear();
+
+				JsonWriter queued(output);
+				metrics.Write(queued, "/entities");
+				queued.Close();
+
+				assert(metrics.Queue().Count() == 1 && metrics.Queue().Maximum() == 250);
+				assert(output.find("\"max\":60000000},\"queue\":{\"mean\":250,") != std::string::npos);
+				assert(output.find("coalesced") == std::string::npos);
+
+				metrics.Joined();
+				metrics.Joined();
+				output.clear();
+
+				JsonWriter coalesced(output);
+				metrics.Write(coalesced, "/entities");
+				coalesced.Close();
+
+				assert(metrics.Coalesced() == 2);
+				assert(output.find("\"max\":250},\"coalesced\":2}") != std::string::npos);
 			}
 
 			/**
-			 * Deletes this client handler.
+			 * Deletes these metrics.
 			 */
-			virtual ~ClientHandler() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			virtual ~RouteMetrics() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
 
 			}
 		};
 
 		/**
-		 * A class that encapsulates a comparison between a routing expression and a request path.
+		 * A class that encapsulates a routing configuration.
+		 * A request is passed through the filters of the router and then those of the route before it reaches its handler, and once its response has ended it is counted in the metrics of the route and passed to the response handlers of the route and then those of the router.
+		 * GET requests may be answered from a response cache, which is opt-in for each route.
+		 * Handlers may also be offloaded to the worker threads of the router, so that they do not hold up the event loop, with a limit on how many requests for the route run at once, and identical GET requests for them may share one run of the handler.
 		 */
-		class ExpressionComparer {
+		class Configuration {
 		private:
 
 			/**
-			 * Extracts the name of the replaceable routing key.
-			 *
-			 * @param value The expression to parse.
-			 * @param key The buffer to store the routing key. If successful, this will be assigned the name of the key.
-			 * @return True if parsing was successful, false otherwise.
+			 * A class that encapsulates a request whose handler runs on a worker thread.
+			 * The handler is given the request, taken from the connection without copying it, so nothing it reads is changed by the event loop while it runs, and its response is sent from the event loop once it returns.
+			 * Clients that sent an identical request in the meantime may join it, and are sent the same response.
+			 * If a client disconnects in the meantime the response is discarded for that client.
 			 */
-			static bool GetReplaceable(const std::string& value, std::string& key) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-				if (value.empty() == false && value.at(0) == '{' && *(value.rbegin()) == '}') {
-					key = value.substr(1, value.size() - 2);
-					return true;
+			class Offloaded {
+			private:
+				Configuration* _route;
+				HttpServer::HttpClient* _client;
+				std::vector<HttpServer::HttpClient*> _joined;
+				std::string _key;
+				WorkHandler _handler;
+				WorkRequest _request;
+				HttpServer::Response _response;
+				uint64_t _routed;
+				uint64_t _started;
+
+			private:
+
+				/**
+				 * Offloaded requests are owned by their configuration and cannot be copied.
+				 *
+				 * @param that The offloaded request to clone.
+				 */
+				Offloaded(const Offloaded& that);
+
+				/**
+				 * Offloaded requests are owned by their configuration and cannot be copied.
+				 *
+				 * @param that The offloaded request to clone.
+				 * @return A reference to this offloaded request.
+				 */
+				Offloaded& operator = (const Offloaded& that);
+
+				/**
+				 * Called when a client has disconnected before the response was sent.
+				 *
+				 * @param args The event arguments.
+				 * @param sender The sender of the event.
+				 */
+				void OnClientDisconnected(const HttpServer::HttpClient::ClientDisconnectedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+					HttpServer::HttpClient* client = (HttpServer::HttpClient*) sender;
+
+					client->ClientDisconnected() -= delegate(&Offloaded::OnClientDisconnected, this);
+
+					if (client == _client) {
+						_client = NULL;
+					}
+					else {
+						_joined.erase(std::remove(_joined.begin(), _joined.end(), client), _joined.end());
+					}
 				}
 
-				return false;
-			}
+			public:
+
+				/**
+				 * Creates a new offloaded request.
+				 *
+				 * @param route The configuration the request was routed to.
+				 * @param args The request event arguments, which are taken, leaving only their client.
+				 * @param handler The handler to run on a worker thread.
+				 * @param key The key that identical requests share, or empty if other requests cannot join this one.
+				 */
+				Offloaded(Configuration* route, RequestEventArgs& args, const WorkHandler& handler, const std::string& key) : _route(route), _client(args.Client()), _joined(), _key(key), _handler(handler), _request(args), _response(), _routed(DateTime::Microseconds()), _started(0) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+					_client->ClientDisconnected() += delegate(&Offloaded::OnClientDisconnected, this);
+				}
 
-			/**
-			 * Determines whether an expression and a base path are considered equal.
-			 * If the expression contains routing keys, the key value pair is inserted into a match collection.
-			 *
-			 * @param expression The expression to match against.
-			 * @param path The path used to match.
-			 * @param matches A collection used to store the routing keys and values.
-			 * @return True if the path matches the expression, false otherwise.
-			 */
-			static bool PathsAreEqual(const std::string& expression, const std::string& path, MatchCollection& matches) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-				std::vector<std::string> expressions = String::Split(expression, '/');
-				std::vector<std::string> paths = String::Split(path, '/');
-				std::string key;
+				/**
+				 * Adds a client that sent an identical request, which is sent the same response.
+				 *
+				 * @param client The client.
+				 */
+				void Join(HttpServer::HttpClient* client) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+					client->ClientDisconnected() += delegate(&Offloaded::OnClientDisconnected, this);
+					_joined.push_back(client);
+				}
 
-				if (expressions.size() != paths.size()) {
-					return false;
+				/**
+				 * The key that identical requests share.
+				 *
+				 * @return The key, or empty if other requests cannot join this one.
+				 */
+				const std::string& Key() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+					return _key;
 				}
 
-				for (size_t i = 0; i != expressions.size(); i++) {
-					if (expressions[i] == paths[i]) {
-						// we have matched the path
-					}
-					else if (GetReplaceable(expressions[i], key)) {
-						// we have matched the expression
-						matches[key] = paths[i];
+				/**
+				 * Determines whether every client waiting for the response has disconnected.
+				 *
+				 * @return True if no client is waiting, false otherwise.
+				 */
+				bool Abandoned() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+					return _client == NULL && _joined.empty();
+				}
+
+				/**
+				 * The number of microseconds from when the request was routed to when its handler started.
+				 *
+				 * @return The number of microseconds.
+				 */
+				uint64_t Queued() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+					return _started - _routed;
+				}
+
+				/**
+				 * Runs the handler.
+				 * This runs on a worker thread, so it only touches the copy of the request and the response.
+				 */
+				void Run() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+					_started = DateTime::Microseconds();
+
+					try {
+						_handler(_request, _response);
+
+						if (_response.Complete() == false) {
+							_response.Begin("HTTP/1.1", 500, "Internal Server Error")
+								.SendHeader("Server", "nitrus")
+								.SendHeader("Content-Type", "text/plain")
+								.Send("The handler did not end its response.")
+								.End();
+						}
 					}
-					else {
-						return false;
+					catch (...) {
+						_response.Begin("HTTP/1.1", 400, "Bad Request")
+							.SendHeader("Server", "nitrus")
+							.SendHeader("Content-Type", "text/plain")
+							.Send(StackTrace::ToExceptionString())
+							.End();
 					}
 				}
 
-				return true;
-			}
+				/**
+				 * Called on the event loop once the handler has returned.
+				 */
+				void Completed() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+					_route->Finished(this);
+				}
+
+				/**
+				 * Sends the response written by the handler to each client that is still connected.
+				 * The clients are let go of first, since sending a response may start the next request of a client or disconnect it.
+				 */
+				void Respond() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+					std::vector<HttpServer::HttpClient*> clients;
+
+					if (_client != NULL) {
+						clients.push_back(_client);
+						_client = NULL;
+					}
+
+					clients.insert(clients.end(), _joined.begin(), _joined.end());
+					_joined.clear();
+
+					for (size_t i = 0; i < clients.size(); i++) {
+						clients[i]->ClientDisconnected() -= delegate(&Offloaded::OnClientDisconnected, this);
+					}
+
+					for (size_t i = 0; i < clients.size(); i++) {
+						clients[i]->Replay(_response);
+					}
+				}
+
+				/**
+				 * Deletes this offloaded request.
+				 */
+				virtual ~Offloaded() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+					if (_client != NULL) {
+						_client->ClientDisconnected() -= delegate(&Offloaded::OnClientDisconnected, this);
+					}
+
+					for (size_t i = 0; i < _joined.size(); i++) {
+						_joined[i]->ClientDisconnected() -= delegate(&Offloaded::OnClientDisconnected, this);
+					}
+				}
+			};
+
+			typedef std::map<std::string, RequestEventHandler> Handlers;
+			typedef std::map<std::string, WorkHandler> WorkHandlers;
+			typedef std::map<std::string, Offloaded*> Flights;
+
+			Handlers _handlers;
+			WorkHandlers _work;
+			Router* _router;
+			std::string _expression;
+			std::vector<RequestFilter> _filters;
+			ResponseEvent _responded;
+			RouteMetrics _metrics;
+			TimeSpan _duration;
+			std::vector<std::string> _vary;
+			size_t _concurrency;
+			size_t _running;
+			std::deque<Offloaded*> _waiting;
+			std::vector<Offloaded*> _started;
+			bool _coalesce;
+			std::vector<std::string> _shared;
+			Flights _flights;
+
+		private:
+
+			/**
+			 * Splits a list of header names separated by commas.
+			 *
+			 * @param names The header names, such as "Accept, Authorization".
+			 * @return The header names in lower case, without any that are empty.
+			 */
+			static std::vector<std::string> HeaderNames(const std::string& names) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				std::vector<std::string> split = String::Split(names, ',');
+				std::vector<std::string> result;
+
+				for (size_t i = 0; i < split.size(); i++) {
+					std::string name = String::ToLowerCase(String::Trim(split[i]));
+
+					if (name.empty() == false) {
+						result.push_back(name);
+					}
+				}
+
+				return result;
+			}
+
+			/**
+			 * Runs an offloaded request on a worker thread, or inline if this configuration has no router.
+			 *
+			 * @param offloaded The offloaded request.
+			 */
+			void Start(Offloaded* offloaded) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				_running++;
+				_started.push_back(offloaded);
+
+				if (_router == NULL) {
+					offloaded->Run();
+					Finished(offloaded);
+					return;
+				}
+
+				_router->Workers().Queue(delegate(&Offloaded::Run, offloaded), delegate(&Offloaded::Completed, offloaded));
+			}
+
+			/**
+			 * Sends the response to an offloaded request once its handler has returned, and starts the requests that were waiting for it.
+			 * Waiting requests whose clients have all disconnected are dropped without running.
+			 *
+			 * @param offloaded The offloaded request.
+			 */
+			void Finished(Offloaded* offloaded) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				_running--;
+				_started.erase(std::remove(_started.begin(), _started.end(), offloaded), _started.end());
+				_metrics.Queued(offloaded->Queued());
+
+				// identical requests that arrive from here on, such as the next pipelined request of a client, start a request of their own.
+				_flights.erase(offloaded->Key());
+				offloaded->Respond();
+				delete offloaded;
+
+				while (_waiting.empty() == false && _running < _concurrency) {
+					Offloaded* next = _waiting.front();
+					_waiting.pop_front();
+
+					if (next->Abandoned()) {
+						_flights.erase(next->Key());
+						delete next;
+					}
+					else {
+						Start(next);
+					}
+				}
+			}
+
+			/**
+			 * Passes a request through a list of filters until one of them answers it.
+			 *
+			 * @param filters The filters.
+			 * @param args The request event arguments.
+			 * @param sender The sender of the arguments.
+			 * @return True if every filter let the request continue, false otherwise.
+			 */
+			static bool Filter(const std::vector<RequestFilter>& filters, const RequestEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				for (size_t i = 0; i < filters.size(); i++) {
+					if (filters[i](args, sender) == false) {
+						return false;
+					}
+				}
+
+				return true;
+			}
+
+		public:
+
+			/**
+			 * Creates a new routing configuration.
+			 *
+			 * @param router The router whose filters, response handlers and cache are used for this configuration.
+			 * @param expression The routing expression of this configuration.
+			 */
+			Configuration(Router* router = NULL, const std::string& expression = "") : _handlers(), _work(), _router(router), _expression(expression), _filters(), _responded(), _metrics(), _duration(), _vary(), _concurrency(1), _running(0), _waiting(), _started(), _coalesce(false), _shared(), _flights() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+			}
+
+			/**
+			 * Invokes the handler for the specified request event.
+			 * A request whose handler runs on a worker thread is taken from the arguments, leaving only their client.
+			 *
+			 * @param args The request event arguments.
+			 * @param sender The sender of the arguments.
+			 * @return True if the request could be handled, false otherwise.
+			 */
+			bool operator ()(RequestEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				std::string method = String::ToUpperCase(args.Method());
+				Handlers::iterator i = _handlers.find(method);
+				WorkHandlers::iterator w = i == _handlers.end() ? _work.find(method) : _work.end();
+
+				if (i == _handlers.end() && w == _work.end()) {
+					return false;
+				}
+
+				// the client handler whose request is being routed counts the response against this configuration once it ends.
+				if (_router != NULL && _router->_routing != NULL) {
+					_router->_routing->Routed(this);
+				}
+
+				try {
+					if ((_router != NULL && Filter(_router->_filters, args, sender) == false) || Filter(_filters, args, sender) == false) {
+						return true;
+					}
+
+					bool cached = _router != NULL && _duration > TimeSpan::Zero() && method == "GET";
+					std::string key;
+
+					if (cached) {
+						key = ResponseCache::Key(method, args.Path(), args.Headers(), _vary);
+						const HttpServer::Response* response = _router->_cache.Find(key);
+
+						if (response != NULL) {
+							args.Client()->Replay(*response);
+							return true;
+						}
+					}
+
+					if (w != _work.end()) {
+						std::string flight;
+
+						if (_coalesce && method == "GET") {
+							flight = ResponseCache::Key(method, args.Path(), args.Headers(), _shared);
+							Flights::iterator f = _flights.find(flight);
+
+							if (f != _flights.end()) {
+								f->second->Join(args.Client());
+								_metrics.Joined();
+								return true;
+							}
+						}
+
+						if (cached) {
+							_router->_cache.Record(args.Client(), key, _duration);
+						}
+
+						Offloaded* offloaded = new Offloaded(this, args, w->second, flight);
+
+						if (flight.empty() == false) {
+							_flights[flight] = offloaded;
+						}
+
+						if (_running < _concurrency) {
+							Start(offloaded);
+						}
+						else {
+							_waiting.push_back(offloaded);
+						}
+
+						return true;
+					}
+
+					if (cached) {
+						_router->_cache.Record(args.Client(), key, _duration);
+					}
+
+					i->second(args, sender);
+				}
+				catch (...) {
+					args.Client()->Begin("HTTP/1.1", 400, "Bad Request")
+						.SendHeader("Server", "nitrus")
+						.SendHeader("Content-Type", "text/plain")
+						.Send(StackTrace::ToExceptionString())
+						.End();
+				}
+
+				return true;
+			}
+
+			/**
+			 * Binds an event handler to an http method for this configuration.
+			 *
+			 * @param method The method to bind to.
+			 * @param handler The event handler to bind.
+			 * @return A reference to this configuration.
+			 */
+			Configuration& Bind(const std::string& method, const RequestEventHandler& handler) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				_handlers[String::ToUpperCase(method)] = handler;
+				_work.erase(String::ToUpperCase(method));
+				return *this;
+			}
+
+			/**
+			 * Binds a handler that runs on a worker thread of the router to an http method for this configuration, so that it does not hold up the event loop.
+			 * Requests pass through the filters and the cache on the event loop as usual, and at most Concurrency of them run at once, while the rest wait in the order they arrived.
+			 *
+			 * @param method The method to bind to.
+			 * @param handler The handler to bind, which must only use the request and response it is given.
+			 * @return A reference to this configuration.
+			 */
+			Configuration& Offload(const std::string& method, const WorkHandler& handler) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				_work[String::ToUpperCase(method)] = handler;
+				_handlers.erase(String::ToUpperCase(method));
+				return *this;
+			}
+
+			/**
+			 * Limits how many requests for this configuration run on worker threads at once, which is one unless changed.
+			 * How long requests wait for their turn is counted in the metrics of the configuration.
+			 *
+			 * @param concurrency The number of requests.
+			 * @return A reference to this configuration.
+			 */
+			Configuration& Concurrency(size_t concurrency) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				_concurrency = concurrency == 0 ? 1 : concurrency;
+				return *this;
+			}
+
+			/**
+			 * Binds an event handler to the http GET method for this configuration.
+			 *
+			 * @param handler The event handler to bind.
+			 * @return A reference to this configuration.
+			 */
+			Configuration& Get(const RequestEventHandler& handler) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				return Bind("GET", handler);
+			}
+
+			/**
+			 * Binds an event handler to the http PUT method for this configuration.
+			 *
+			 * @param handler The event handler to bind.
+			 * @return A reference to this configuration.
+			 */
+			Configuration& Put(const RequestEventHandler& handler) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				return Bind("PUT", handler);
+			}
+
+			/**
+			 * Binds an event handler to the http POST method for this configuration.
+			 *
+			 * @param handler The event handler to bind.
+			 * @return A reference to this configuration.
+			 */
+			Configuration& Post(const RequestEventHandler& handler) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				return Bind("POST", handler);
+			}
+
+			/**
+			 * Binds an event handler to the http DELETE method for this configuration.
+			 *
+			 * @param handler The event handler to bind.
+			 * @return A reference to this configuration.
+			 */
+			Configuration& Delete(const RequestEventHandler& handler) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				return Bind("DELETE", handler);
+			}
+
+			/**
+			 * Caches the responses to GET requests for this configuration, so that a repeated request is answered without invoking its handler.
+			 * Requests share a response if they have the same path, ignoring repeated and trailing slashes and the order of query parameters, and the same values for each header the response varies by.
+			 * Only complete 200 OK responses are cached, and not those sent with Cache-Control: no-store or private.
+			 *
+			 * @param duration How long a response is kept, or zero to stop caching.
+			 * @param vary The names of the request headers the response varies by, separated by commas, such as "Accept, Authorization".
+			 * @return A reference to this configuration.
+			 */
+			Configuration& Cache(const TimeSpan& duration, const std::string& vary = "") { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				_duration = duration;
+				_vary = HeaderNames(vary);
+				return *this;
+			}
+
+			/**
+			 * Coalesces identical GET requests for this configuration whose handler runs on a worker thread, so that the handler runs once for all of them.
+			 * A request that arrives while an identical one is waiting or running joins it and is sent the same response, which protects an expensive handler from a burst of requests for the same resource, such as when its cached response expires.
+			 * Requests are identical under the same rules as for the cache, and a request only joins one that has not yet been answered, so nothing is served once it is stale.
+			 *
+			 * @param coalesce True to coalesce requests, false otherwise.
+			 * @param vary The names of the request headers the response varies by, separated by commas, such as "Accept, Authorization".
+			 * @return A reference to this configuration.
+			 */
+			Configuration& Coalesce(bool coalesce = true, const std::string& vary = "") { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				_coalesce = coalesce;
+				_shared = HeaderNames(vary);
+				return *this;
+			}
+
+			/**
+			 * Counts a response to a request handled by this configuration and passes it to the response handlers of this configuration and then those of the router.
+			 * This is called by the router when the response has ended.
+			 *
+			 * @param args The end of the response.
+			 */
+			void Responded(const ResponseEventArgs& args) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				_metrics.Record(args.Status(), args.Latency());
+				_responded(args, this);
+
+				if (_router != NULL) {
+					_router->_responded(args, this);
+				}
+			}
+
+			/**
+			 * Adds a filter that requests for this configuration pass through, after the filters of the router, before they reach their handler.
+			 *
+			 * @param filter The filter.
+			 * @return A reference to this configuration.
+			 */
+			Configuration& Before(const RequestFilter& filter) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				_filters.push_back(filter);
+				return *this;
+			}
+
+			/**
+			 * Adds a handler that is invoked when a response to a request for this configuration has ended, before the response handlers of the router.
+			 *
+			 * @param handler The handler.
+			 * @return A reference to this configuration.
+			 */
+			Configuration& After(const ResponseEventHandler& handler) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				_responded += handler;
+				return *this;
+			}
+
+			/**
+			 * The routing expression of this configuration.
+			 *
+			 * @return The routing expression.
+			 */
+			const std::string& Expression() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				return _expression;
+			}
+
+			/**
+			 * The responses counted for this configuration, including those answered by a filter or from the cache.
+			 *
+			 * @return The metrics.
+			 */
+			const RouteMetrics& Metrics() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				return _metrics;
+			}
+
+			/**
+			 * Deletes the offloaded requests that are running or waiting to run, without responding to them.
+			 * This is called when the router is deleted, once its worker threads have stopped and the work they had not handed back has been dropped.
+			 */
+			void Drop() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				for (std::vector<Offloaded*>::iterator i = _started.begin(); i != _started.end(); i++) {
+					delete *i;
+				}
+
+				for (std::deque<Offloaded*>::iterator i = _waiting.begin(); i != _waiting.end(); i++) {
+					delete *i;
+				}
+
+				_started.clear();
+				_waiting.clear();
+				_flights.clear();
+				_running = 0;
+			}
+
+			/**
+			 * Deletes this routing configuration.
+			 */
+			virtual ~Configuration() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+			}
+		};
+
+	private:
+
+		/**
+		 * A class that encapsulates the routing logic for an http client.
+		 */
+		class ClientHandler : public EventArgs {
+		public:
+			typedef EventHandler<RequestEventArgs&> RequestReceivedEventHandler;
+
+		private:
+			RequestReceivedEventHandler _requestHandler;
+			Router* _router;
+			HttpServer::HttpClient* _client;
+			RequestEventArgs _request;
+			bool _proxied;
+			Configuration* _route;
+			RateLimiter* _limiter;
+
+		private:
+
+			/**
+			 * Takes a token for the current request from the rate limiter that applies to it, and rejects the request if there is none.
+			 * The client does not notify this handler of anything more about a rejected request.
+			 *
+			 * @param key The key of the client.
+			 * @return True if the request may continue, false if it was rejected.
+			 */
+			bool Admit(const std::string& key) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				RateLimiter* limiter = _limiter;
+				uint64_t wait;
+
+				_limiter = NULL;
+
+				if ((wait = limiter->Take(key)) == 0) {
+					return true;
+				}
+
+				_proxied = false;
+				_request.Release();
+
+				_client->Reject(429, "Too Many Requests", TimeSpan::FromMilliseconds(wait / 1000.0));
+				return false;
+			}
+
+			/**
+			 * Called when a client request has been started.
+			 * This will begin receiving the request in place.
+			 * A request that is rate limited by the address of the client is admitted or rejected here, and one limited by a header once the header has been received.
+			 * Requests forwarded to a proxy are relayed as they arrive and are otherwise ignored by this handler.
+			 *
+			 * @param args The event arguments.
+			 * @param sender The sender of the event.
+			 */
+			void OnClientRequestStarted(const HttpClient::RequestStartedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				_proxied = false;
+
+				// a forwarded request is relayed as soon as it starts, so it cannot wait for a header to be limited by.
+				if ((_limiter = _router->Limiter(args.Path())) != NULL && (_limiter->Header().empty() || _router->Forwards(args.Path())) && Admit(_client->Endpoint().Address()) == false) {
+					return;
+				}
+
+				if ((_proxied = _router->Forward(_client, args.Method(), args.Path()))) {
+					return;
+				}
+
+				_request._method = args.Method();
+				_request._path = args.Path();
+				_request._headers.clear();
+				_request._content.clear();
+				_request._matches.clear();
+				_request._captures.clear();
+			}
+
+			/**
+			 * Called when a single header key and value has been received.
+			 * This will add the key and value to the headers of the request.
+			 *
+			 * @param args The event arguments.
+			 * @param sender The sender of the event.
+			 */
+			void OnHeaderReceived(const HttpClient::HeaderReceivedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				if (_limiter != NULL && String::ToLowerCase(args.Key()) == _limiter->Header() && Admit(args.Value()) == false) {
+					return;
+				}
+
+				if (_proxied) {
+					return;
+				}
+
+				_request._headers.insert(std::make_pair(args.Key(), args.Value()));
+			}
+
+			/**
+			 * Called when partial content has been received
+			 * This will append to the content of the request.
+			 *
+			 * @param args The event arguments.
+			 * @param sender The sender of the event.
+			 */
+			void OnContentReceived(const HttpClient::ContentReceivedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				// the headers have all been received, so a request without the header it is limited by is limited by address.
+				if (_limiter != NULL && Admit(_client->Endpoint().Address()) == false) {
+					return;
+				}
+
+				if (_proxied) {
+					return;
+				}
+
+				_request._content += args.Content();
+			}
+
+			/**
+			 * Called when a request has ended.
+			 * This will call the event handler passing the request by reference, so that it is routed and handled without being copied.
+			 *
+			 * @param args The event arguments.
+			 * @param sender The sender of the event.
+			 */
+			void OnClientRequestEnded(const HttpClient::RequestEndedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				RequestEventArgs request(_client);
+
+				if (_limiter != NULL && Admit(_client->Endpoint().Address()) == false) {
+					return;
+				}
+
+				if (_proxied) {
+					return;
+				}
+
+				// hand the request off so that this handler holds nothing while the connection is idle, and so that a pipelined request started by the response cannot change it while it is handled.
+				request.Take(_request);
+				_requestHandler(request, this);
+			}
+
+			/**
+			 * Called when a response has ended.
+			 * This will count the response against the configuration that handled the request, if any.
+			 *
+			 * @param args The event arguments.
+			 * @param sender The sender of the event.
+			 */
+			void OnResponseEnded(const HttpClient::ResponseEndedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				Configuration* route = _route;
+
+				if (route == NULL) {
+					return;
+				}
+
+				_route = NULL;
+				route->Responded(ResponseEventArgs(_client, route->Expression(), args.Status(), args.Bytes(), args.Latency()));
+			}
+
+			/**
+			 * Called when the client that this object is handling has disconnected.
+			 * This will delete the reference to this object.
+			 *
+			 * @param args The event arguments.
+			 * @param sender The sender of the event.
+			 */
+			void OnClientDisconnected(const HttpClient::ClientDisconnectedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				delete this;
+			}
+
+		public:
+
+			/**
+			 * Creates a new client handler to manage http requests.
+			 *
+			 * @param requestHandler The event handler to invoke when a request has been received.
+			 * @param router The router that decides whether a request is forwarded to a proxy.
+			 * @param client The client to manage.
+			 */
+			ClientHandler(const RequestReceivedEventHandler& requestHandler, Router* router, HttpServer::HttpClient* client) : _requestHandler(requestHandler), _router(router), _client(client), _request(client), _proxied(false), _route(NULL), _limiter(NULL) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				client->RequestStarted() += delegate(&ClientHandler::OnClientRequestStarted, this);
+				client->HeaderReceived() += delegate(&ClientHandler::OnHeaderReceived, this);
+				client->ContentReceived() += delegate(&ClientHandler::OnContentReceived, this);
+				client->RequestEnded() += delegate(&ClientHandler::OnClientRequestEnded, this);
+				client->ResponseEnded() += delegate(&ClientHandler::OnResponseEnded, this);
+				client->ClientDisconnected() += delegate(&ClientHandler::OnClientDisconnected, this);
+			}
+
+			/**
+			 * Creates a new client handler from the specified client handler.
+			 *
+			 * @param that The client handler to clone.
+			 */
+			ClientHandler(const ClientHandler& that) : _requestHandler(that._requestHandler), _router(that._router), _client(that._client), _request(that._request), _proxied(that._proxied), _route(that._route), _limiter(that._limiter) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+			}
+
+			/**
+			 * Copies the specified client handler into this client handler.
+			 *
+			 * @param that The client handler to clone.
+			 * @return A reference to this client handler.
+			 */
+			ClientHandler& operator = (const ClientHandler& that) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				_requestHandler = that._requestHandler;
+				_router = that._router;
+				_client = that._client;
+				_request = that._request;
+				_proxied = that._proxied;
+				_route = that._route;
+				_limiter = that._limiter;
+
+				return *this;
+			}
+
+			/**
+			 * Notes the configuration that is handling the current request, so that its response is counted against it when it ends.
+			 *
+			 * @param route The configuration.
+			 */
+			void Routed(Configuration* route) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				_route = route;
+			}
+
+			/**
+			 * Deletes this client handler.
+			 */
+			virtual ~ClientHandler() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+			}
+		};
+
+		/**
+		 * A class that encapsulates a comparison between a routing expression and a request path.
+		 * Both strings are compared in place as ranges of characters, so the only memory used is for the list of ranges which is taken from the request arena.
+		 */
+		class ExpressionComparer {
+		public:
+
+			/**
+			 * A range of characters within a string, stored as an offset and a length.
+			 */
+			typedef std::pair<size_t, size_t> Segment;
+			typedef std::vector<Segment, Arena::Allocator<Segment> > Segments;
+
+			/**
+			 * Splits a range of a string separated by a delimiter into individual ranges.
+			 * This produces the same parts as String::Split, in which a trailing delimiter does not produce an empty part.
+			 *
+			 * @param value The string to split.
+			 * @param segment The range of the string to split.
+			 * @param delimiter The delimiter that separates the individual parts.
+			 * @param split The container used to store the individual ranges.
+			 */
+			static void Split(const std::string& value, const Segment& segment, char delimiter, Segments& split) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				size_t begin = segment.first;
+				size_t end = segment.first + segment.second;
+
+				while (begin < end) {
+					size_t next = value.find(delimiter, begin);
+
+					if (next == std::string::npos || next > end) {
+						next = end;
+					}
+
+					split.push_back(Segment(begin, next - begin));
+					begin = next + 1;
+				}
+			}
+
+			/**
+			 * Splits an expression into its path and its query parameters at the first question mark, since an optional routing key in the query parameters contains a question mark of its own.
+			 * As with Split, an empty path or query string does not produce a range.
+			 *
+			 * @param expression The expression to split.
+			 * @param split The container used to store the path and query parameter ranges.
+			 */
+			static void SplitQuery(const std::string& expression, Segments& split) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				size_t question = expression.find('?');
+
+				if (question == std::string::npos) {
+					question = expression.size();
+				}
+
+				if (question != 0) {
+					split.push_back(Segment(0, question));
+				}
+
+				if (question + 1 < expression.size()) {
+					split.push_back(Segment(question + 1, expression.size() - question - 1));
+				}
+			}
+
+			/**
+			 * Determines whether two ranges of characters are equal.
+			 *
+			 * @param a The first string.
+			 * @param x The range of the first string.
+			 * @param b The second string.
+			 * @param y The range of the second string.
+			 * @return True if the ranges are equal, false otherwise.
+			 */
+			static bool Equal(const std::string& a, const Segment& x, const std::string& b, const Segment& y) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				return a.compare(x.first, x.second, b, y.first, y.second) == 0;
+			}
+
+			/**
+			 * Determines whether a range of an expression is a replaceable routing key.
+			 *
+			 * @param value The expression.
+			 * @param segment The range of the expression.
+			 * @return True if the range is surrounded by curly braces, false otherwise.
+			 */
+			static bool IsReplaceable(const std::string& value, const Segment& segment) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				return segment.second >= 2 && value[segment.first] == '{' && value[segment.first + segment.second - 1] == '}';
+			}
+
+			/**
+			 * Inserts the value of a replaceable routing key into a match collection.
+			 *
+			 * @param expression The expression containing the routing key.
+			 * @param key The range of the routing key, including the curly braces.
+			 * @param path The path containing the value.
+			 * @param value The range of the value.
+			 * @param matches A collection used to store the routing keys and values.
+			 */
+			static void Replace(const std::string& expression, const Segment& key, const std::string& path, const Segment& value, MatchCollection& matches) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				matches[expression.substr(key.first + 1, key.second - 2)] = path.substr(value.first, value.second);
+			}
+
+			/**
+			 * Determines whether an expression and a base path are considered equal.
+			 * If the expression contains routing keys, the key value pair is inserted into a match collection.
+			 *
+			 * @param expression The expression to match against.
+			 * @param x The range of the expression that contains the base path.
+			 * @param path The path used to match.
+			 * @param y The range of the path that contains the base path.
+			 * @param matches A collection used to store the routing keys and values.
+			 * @param arena The memory used while comparing.
+			 * @return True if the path matches the expression, false otherwise.
+			 */
+			static bool PathsAreEqual(const std::string& expression, const Segment& x, const std::string& path, const Segment& y, MatchCollection& matches, Arena& arena) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				Segments expressions = Segments(Arena::Allocator<Segment>(arena));
+				Segments paths = Segments(Arena::Allocator<Segment>(arena));
+
+				Split(expression, x, '/', expressions);
+				Split(path, y, '/', paths);
+
+				if (expressions.size() != paths.size()) {
+					return false;
+				}
+
+				for (size_t i = 0; i != expressions.size(); i++) {
+					if (Equal(expression, expressions[i], path, paths[i])) {
+						// we have matched the path
+					}
+					else if (IsReplaceable(expression, expressions[i])) {
+						// we have matched the expression
+						Replace(expression, expressions[i], path, paths[i], matches);
+					}
+					else {
+						return false;
+					}
+				}
+
+				return true;
+			}
+
+			/**
+			 * Determines whether a range of an expression is an optional routing key, of the form {key?}.
+			 *
+			 * @param value The expression.
+			 * @param segment The range of the expression.
+			 * @return True if the routing key is optional, false otherwise.
+			 */
+			static bool IsOptional(const std::string& value, const Segment& segment) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				return IsReplaceable(value, segment) && segment.second >= 3 && value[segment.first + segment.second - 2] == '?';
+			}
+
+			/**
+			 * Determines whether the query parameters of an expression, already split at each ampersand, match a decoded query string.
+			 * Parameters may be given in any order, and a parameter whose value is an optional routing key, as in page={page?}, may be left out.
+			 * Every parameter of the query string must be one the expression names; if a key is given more than once, its first value is used.
+			 * If the expression contains routing keys, the key and decoded value are inserted into a match collection.
+			 *
+			 * @param expression The expression to match against.
+			 * @param begin The first range of the expression that contains a query parameter.
+			 * @param end The range after the last one.
+			 * @param query The decoded query string.
+			 * @param matches A collection used to store the routing keys and values.
+			 * @return True if the parameters match the expression, false otherwise.
+			 */
+			template <typename Iterator> static bool ParametersAreEqual(const std::string& expression, Iterator begin, Iterator end, const QueryString& query, MatchCollection& matches) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				for (Iterator i = begin; i != end; i++) {
+					size_t equals = expression.find('=', i->first);
+					Segment key = equals < i->first + i->second ? Segment(i->first, equals - i->first) : *i;
+					Segment value = equals < i->first + i->second ? Segment(equals + 1, i->first + i->second - equals - 1) : Segment(0, 0);
+					size_t j = query.Find(expression, key.first, key.second);
+
+					if (j == std::string::npos) {
+						if (key.second == i->second || IsOptional(expression, value) == false) {
+							return false;
+						}
+					}
+					else if (key.second == i->second) {
+						if (query.Assigned(j)) {
+							return false;
+						}
+					}
+					else if (IsReplaceable(expression, value)) {
+						matches[expression.substr(value.first + 1, value.second - (IsOptional(expression, value) ? 3 : 2))] = query.Value(j);
+					}
+					else if (query.Assigned(j) == false || query.ValueEquals(j, expression, value.first, value.second) == false) {
+						return false;
+					}
+				}
+
+				// every parameter given must be named by the expression.
+				for (size_t j = 0; j < query.Count(); j++) {
+					Iterator i = begin;
+
+					for (; i != end; i++) {
+						size_t equals = expression.find('=', i->first);
+						size_t length = equals < i->first + i->second ? equals - i->first : i->second;
+
+						if (query.KeyEquals(j, expression, i->first, length)) {
+							break;
+						}
+					}
+
+					if (i == end) {
+						return false;
+					}
+				}
+
+				return true;
+			}
+
+			/**
+			 * Determines whether an expression and a query parameter string are considered equal.
+			 * If the expression contains routing keys, the key value pair is inserted into a match collection.
+			 *
+			 * @param expression The expression to match against.
+			 * @param x The range of the expression that contains the query parameters.
+			 * @param parameter The path containing the query parameters used to match.
+			 * @param y The range of the path that contains the query parameters.
+			 * @param matches A collection used to store the routing keys and values.
+			 * @param arena The memory used while comparing.
+			 * @return True if the parameters match the expression, false otherwise.
+			 */
+			static bool ParametersAreEqual(const std::string& expression, const Segment& x, const std::string& parameter, const Segment& y, MatchCollection& matches, Arena& arena) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				Segments expressions = Segments(Arena::Allocator<Segment>(arena));
+
+				Split(expression, x, '&', expressions);
+				return ParametersAreEqual(expression, expressions.begin(), expressions.end(), QueryString(parameter, y.first, y.second), matches);
+			}
+
+			/**
+			 * Determines whether an expression and a path are considered equal.
+			 * If the expression contains routing keys, the key value pair is inserted into a match collection.
+			 *
+			 * @param expression The expression to match against.
+			 * @param path The path used to match.
+			 * @param matches A collection used to store the routing keys and values.
+			 * @param arena The memory used while comparing.
+			 * @return True if the path matches the expression, false otherwise.
+			 */
+			static bool AreEqual(const std::string& expression, const std::string& path, MatchCollection& matches, Arena& arena) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				Segments expressionAndParameters = Segments(Arena::Allocator<Segment>(arena));
+				Segments pathAndParameters = Segments(Arena::Allocator<Segment>(arena));
+
+				SplitQuery(expression, expressionAndParameters);
+				Split(path, Segment(0, path.size()), '?', pathAndParameters);
+
+				if (expressionAndParameters.size() == 1 && pathAndParameters.size() == 1) {
+					return PathsAreEqual(expression, expressionAndParameters[0], path, pathAndParameters[0], matches, arena);
+				}
+				else if (expressionAndParameters.size() == 2 && pathAndParameters.size() == 2) {
+					return PathsAreEqual(expression, expressionAndParameters[0], path, pathAndParameters[0], matches, arena) && ParametersAreEqual(expression, expressionAndParameters[1], path, pathAndParameters[1], matches, arena);
+				}
+
+				return false;
+			}
+
+			/**
+			 * Performs unit testing on functions in this class to ensure expected operation.
+			 */
+			static void UnitTest() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				Arena arena;
+				MatchCollection matches;
+
+				assert(AreEqual("/entities", "/entities", matches, arena));
+				assert(AreEqual("/entities/", "/entities", matches, arena));
+				assert(AreEqual("/entities/{id}", "/entities/42", matches, arena) && matches["id"] == "42");
+				assert(AreEqual("/entities?id={id}&sort=name", "/entities?id=7&sort=name", matches, arena) && matches["id"] == "7");
+				assert(AreEqual("/entities?id={id}&sort=name", "/entities?sort=name&id=a%20b", matches, arena) && matches["id"] == "a b");
+				assert(AreEqual("/entities?q={q}&page={page?}", "/entities?q=x", matches, arena) && matches.count("page") == 0);
+				assert(AreEqual("/entities?q={q}&page={page?}", "/entities?page=2&q=y", matches, arena) && matches["page"] == "2");
+				assert(AreEqual("/entities?q={q}&page={page?}", "/entities?page=2", matches, arena) == false);
+				assert(AreEqual("/entities?q={q}", "/entities?q=x&other=1", matches, arena) == false);
+				assert(AreEqual("/entities?all", "/entities?all", matches, arena));
+				assert(AreEqual("/entities?all", "/entities?all=1", matches, arena) == false);
+				assert(AreEqual("/entities/{id}", "/entities", matches, arena) == false);
+				assert(AreEqual("/entities?sort=name", "/entities?sort=date", matches, arena) == false);
+				assert(AreEqual("/entities", "/entities?sort=name", matches, arena) == false);
+			}
+		};
+
+		/**
+		 * A class that finds the route for a request by walking a tree of the routing expressions one path segment at a time.
+		 * Expressions are split into segments once, when they are configured, and expressions that begin with the same segments share the nodes for them.
+		 * A lookup compares each segment of the path with the children of a single node, so its cost depends on the depth of the path rather than the number of routes, and the walk itself uses no memory beyond the request arena.
+		 * A literal segment is tried before a routing key, and a routing key before a wildcard; if no route below a node handles the request, the walk backs up and tries the next one.
+		 * Typed routing keys, such as {id:int}, only match segments of their type and are tried before untyped keys. Their values are parsed once, while walking.
+		 * The query string is decoded once per request, and its parameters are compared, in any order, once the path has reached a node with routes.
+		 */
+		class RouteTree {
+		private:
+			typedef ExpressionComparer::Segment Segment;
+			typedef ExpressionComparer::Segments Segments;
+
+			/**
+			 * The types of routing keys, in the order they are tried.
+			 */
+			enum Type {
+				Type_Unsigned,
+				Type_Integer,
+				Type_String,
+				Type_Count
+			};
+
+			/**
+			 * A range of the path matched by a routing key, and its number if the key was typed.
+			 */
+			struct Capture {
+				Segment segment;
+				int64_t number;
+			};
+
+			typedef std::vector<Capture, Arena::Allocator<Capture> > Captures;
+
+			/**
+			 * A routing expression, the ranges of its query parameters and the names of the routing keys in its path, in order.
+			 */
+			struct Entry {
+				std::string expression;
+				bool query;
+				std::vector<Segment> parameters;
+				std::vector<std::string> keys;
+				Configuration* configuration;
+			};
+
+			/**
+			 * A path segment shared by one or more routing expressions.
+			 * Literal children are kept sorted by segment so that they can be searched without copying the path.
+			 */
+			struct Node {
+				std::vector<std::pair<std::string, Node*> > children;
+				Node* keys[Type_Count];
+				Node* wildcard;
+				std::vector<Entry> routes;
+			};
+
+			std::deque<Node> _nodes;
+
+		private:
 
 			/**
-			 * Determines whether an expression and a query parameter string are considered equal.
-			 * If the expression contains routing keys, the key value pair is inserted into a match collection.
+			 * Route trees refer to their own nodes and cannot be copied.
 			 *
-			 * @param expression The expression to match against.
-			 * @param parameter The query parameters used to match.
-			 * @param matches A collection used to store the routing keys and values.
-			 * @return True if the parameters match the expression, false otherwise.
+			 * @param that The route tree to clone.
+			 */
+			RouteTree(const RouteTree& that);
+
+			/**
+			 * Route trees refer to their own nodes and cannot be copied.
+			 *
+			 * @param that The route tree to clone.
+			 * @return A reference to this route tree.
+			 */
+			RouteTree& operator = (const RouteTree& that);
+
+			/**
+			 * Creates a new node without children or routes.
+			 *
+			 * @return The node.
+			 */
+			Node* Create() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				Node node;
+				std::fill(node.keys, node.keys + Type_Count, (Node*) NULL);
+				node.wildcard = NULL;
+				_nodes.push_back(node);
+
+				return &_nodes.back();
+			}
+
+			/**
+			 * Finds the position of the first literal child that is not less than a segment.
+			 *
+			 * @param node The parent node.
+			 * @param value The string containing the segment.
+			 * @param segment The range of the segment.
+			 * @return The position of the child.
+			 */
+			static size_t Search(const Node* node, const std::string& value, const Segment& segment) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				size_t lower = 0;
+				size_t upper = node->children.size();
+
+				while (lower < upper) {
+					size_t middle = (lower + upper) / 2;
+
+					if (value.compare(segment.first, segment.second, node->children[middle].first) > 0) {
+						lower = middle + 1;
+					}
+					else {
+						upper = middle;
+					}
+				}
+
+				return lower;
+			}
+
+			/**
+			 * Determines whether a range of an expression is a wildcard, a routing key whose name ends with an asterisk.
+			 *
+			 * @param value The expression.
+			 * @param segment The range of the expression.
+			 * @return True if the range is a wildcard, false otherwise.
+			 */
+			static bool IsWildcard(const std::string& value, const Segment& segment) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				return ExpressionComparer::IsReplaceable(value, segment) && segment.second >= 3 && value[segment.first + segment.second - 2] == '*';
+			}
+
+			/**
+			 * Parses a range of a path as a decimal number, without allocating.
+			 *
+			 * @param value The path.
+			 * @param segment The range of the path.
+			 * @param sign Whether the number may be negative.
+			 * @param result The number, if the range was valid.
+			 * @return True if the range contains only a number that fits in 64 bits, false otherwise.
 			 */
-			static bool ParametersAreEqual(const std::string& expression, const std::string& parameter, MatchCollection& matches) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-				std::vector<std::string> expressions = String::Split(expression, '&');
-				std::vector<std::string> parameters = String::Split(parameter, '&');
+			static bool Parse(const std::string& value, const Segment& segment, bool sign, int64_t& result) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				size_t i = segment.first;
+				size_t end = segment.first + segment.second;
+				bool negative = sign && i < end && value[i] == '-';
+				uint64_t number = 0;
+
+				if (negative) {
+					i++;
+				}
 
-				if (expressions.size() != parameters.size()) {
+				if (i == end) {
 					return false;
 				}
 
-				for (size_t i = 0; i != expressions.size(); i++) {
-					std::string key;
-					std::vector<std::string> expressionKeyAndValue = String::Split(expressions[i], '=');
-					std::vector<std::string> parameterKeyAndValue = String::Split(parameters[i], '=');
+				for (; i < end; i++) {
+					unsigned digit = (unsigned char) value[i] - '0';
 
-					if (expressionKeyAndValue.size() != parameterKeyAndValue.size()) {
+					if (digit > 9 || number > ((uint64_t) INT64_MAX - digit) / 10) {
 						return false;
 					}
-					else if (expressionKeyAndValue.size() == 1 && expressionKeyAndValue[0] == parameterKeyAndValue[0]) {
-						// we have matched the parameter
+
+					number = number * 10 + digit;
+				}
+
+				result = negative ? -(int64_t) number : (int64_t) number;
+				return true;
+			}
+
+			/**
+			 * Finds the type of a routing key from the name given after a colon, as in {id:int}.
+			 * A routing key without a type, or with a type that is not known, matches any segment.
+			 *
+			 * @param value The expression.
+			 * @param segment The range of the routing key, including the curly braces.
+			 * @param name The range of the name of the routing key, without the type.
+			 * @return The type.
+			 */
+			static Type Typed(const std::string& value, const Segment& segment, Segment& name) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				size_t colon = value.find(':', segment.first);
+
+				name = Segment(segment.first + 1, segment.second - 2);
+
+				if (colon == std::string::npos || colon >= segment.first + segment.second) {
+					return Type_String;
+				}
+
+				std::string type = value.substr(colon + 1, segment.first + segment.second - colon - 2);
+				name.second = colon - name.first;
+
+				return type == "int" ? Type_Integer : type == "uint" ? Type_Unsigned : Type_String;
+			}
+
+			/**
+			 * Offers a request to the routes of a node, in the order of their expressions, until one of them handles it.
+			 * The matches of each route are filled into the request in place before it is offered, and cleared if no route handles it.
+			 *
+			 * @param node The node.
+			 * @param args The request event arguments.
+			 * @param sender The sender passed to the route handlers.
+			 * @param query The decoded query string, which has no parameters if the path has none.
+			 * @param captures The ranges of the path matched by routing keys so far.
+			 * @param arena The memory used while comparing.
+			 * @return True if a route handled the request, false otherwise.
+			 */
+			static bool Dispatch(Node* node, RequestEventArgs& args, void* sender, const QueryString& query, const Captures& captures, Arena& arena) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				const std::string& path = args.Path();
+
+				for (std::vector<Entry>::iterator i = node->routes.begin(); i != node->routes.end(); i++) {
+					if (i->query == false && query.Count() != 0) {
+						continue;
 					}
-					else if (expressionKeyAndValue.size() == 2 && expressionKeyAndValue[0] == parameterKeyAndValue[0] && GetReplaceable(expressionKeyAndValue[1], key)) {
-						// we have matched the expression
-						matches[key] = parameterKeyAndValue[1];
+
+					args._matches.clear();
+					args._captures.clear();
+
+					for (size_t j = 0; j < i->keys.size(); j++) {
+						args._captures.push_back(std::make_pair(path.substr(captures[j].segment.first, captures[j].segment.second), captures[j].number));
+						args._matches[i->keys[j]] = args._captures.back().first;
+					}
+
+					if (i->query && ExpressionComparer::ParametersAreEqual(i->expression, i->parameters.begin(), i->parameters.end(), query, args._matches) == false) {
+						continue;
+					}
+
+					if ((*i->configuration)(args, sender)) {
+						return true;
+					}
+				}
+
+				args._matches.clear();
+				args._captures.clear();
+				return false;
+			}
+
+			/**
+			 * Walks the tree from a node along the rest of a path, trying literal segments, then routing keys, then wildcards.
+			 * Segments are found in the same way as ExpressionComparer::Split, so a trailing slash does not produce an empty segment.
+			 *
+			 * @param node The node reached so far.
+			 * @param args The request event arguments.
+			 * @param sender The sender passed to the route handlers.
+			 * @param begin The position of the next segment in the path.
+			 * @param end The position of the end of the path, before any query string.
+			 * @param query The decoded query string, which has no parameters if the path has none.
+			 * @param captures The ranges of the path matched by routing keys so far.
+			 * @param arena The memory used while comparing.
+			 * @return True if a route handled the request, false otherwise.
+			 */
+			static bool Walk(Node* node, RequestEventArgs& args, void* sender, size_t begin, size_t end, const QueryString& query, Captures& captures, Arena& arena) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				const std::string& path = args.Path();
+
+				if (begin < end) {
+					size_t next = path.find('/', begin);
+
+					if (next == std::string::npos || next > end) {
+						next = end;
+					}
+
+					Segment segment(begin, next - begin);
+					size_t i = Search(node, path, segment);
+
+					if (i < node->children.size() && path.compare(segment.first, segment.second, node->children[i].first) == 0 && Walk(node->children[i].second, args, sender, next + 1, end, query, captures, arena)) {
+						return true;
+					}
+
+					for (int type = 0; type < Type_Count; type++) {
+						Capture capture = { segment, 0 };
+
+						if (node->keys[type] == NULL || (type != Type_String && Parse(path, segment, type == Type_Integer, capture.number) == false)) {
+							continue;
+						}
+
+						captures.push_back(capture);
+
+						if (Walk(node->keys[type], args, sender, next + 1, end, query, captures, arena)) {
+							return true;
+						}
+
+						captures.pop_back();
+					}
+				}
+				else if (Dispatch(node, args, sender, query, captures, arena)) {
+					return true;
+				}
+
+				if (node->wildcard != NULL) {
+					size_t start = begin < end ? begin : end;
+					size_t length = end - start;
+
+					// the rest of the path, without the trailing slash that would not have produced a segment.
+					Capture capture = { Segment(start, length > 0 && path[start + length - 1] == '/' ? length - 1 : length), 0 };
+					captures.push_back(capture);
+
+					if (Dispatch(node->wildcard, args, sender, query, captures, arena)) {
+						return true;
+					}
+
+					captures.pop_back();
+				}
+
+				return false;
+			}
+
+			/**
+			 * Records a routed request in the event argument passed as the sender.
+			 *
+			 * @param args The request event arguments.
+			 * @param sender The event argument to copy the request into.
+			 */
+			static void Record(const RequestEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				*static_cast<RequestEventArgs*>(sender) = args;
+			}
+
+			/**
+			 * Routes a request without a client for unit testing.
+			 *
+			 * @param method The http method.
+			 * @param path The path requested.
+			 * @param routed The request as received by the route that handled it.
+			 * @param arena The memory used while comparing.
+			 * @return True if a route handled the request, false otherwise.
+			 */
+			bool Test(const std::string& method, const std::string& path, RequestEventArgs& routed, Arena& arena) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				RequestEventArgs request(NULL, method, path, HeaderCollection(), "", MatchCollection());
+
+				routed = RequestEventArgs(NULL);
+				return Route(request, &routed, arena);
+			}
+
+		public:
+
+			/**
+			 * Creates a new route tree without any routes.
+			 */
+			RouteTree() : _nodes() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				Create();
+			}
+
+			/**
+			 * Adds a routing expression to the tree.
+			 * A path segment of the form {key:int} or {key:uint} only matches a decimal number that fits in 64 bits, and {key*} is a wildcard that matches the rest of the path, including any slashes, and must be the last segment.
+			 * Expressions that could never match a path, such as an empty expression, are ignored.
+			 *
+			 * @param expression The routing expression.
+			 * @param configuration The configuration invoked for requests matching the expression.
+			 */
+			void Add(const std::string& expression, Configuration& configuration) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				Arena arena;
+				Segments expressionAndParameters = Segments(Arena::Allocator<Segment>(arena));
+				Segments segments = Segments(Arena::Allocator<Segment>(arena));
+				Node* node = &_nodes.front();
+				Entry route;
+
+				ExpressionComparer::SplitQuery(expression, expressionAndParameters);
+
+				if (expressionAndParameters.empty()) {
+					return;
+				}
+
+				route.expression = expression;
+				route.query = expressionAndParameters.size() == 2;
+
+				if (route.query) {
+					Segments parameters = Segments(Arena::Allocator<Segment>(arena));
+					ExpressionComparer::Split(expression, expressionAndParameters[1], '&', parameters);
+					route.parameters.assign(parameters.begin(), parameters.end());
+				}
+
+				route.configuration = &configuration;
+
+				ExpressionComparer::Split(expression, expressionAndParameters[0], '/', segments);
+
+				for (size_t i = 0; i < segments.size(); i++) {
+					const Segment& segment = segments[i];
+
+					if (i + 1 == segments.size() && IsWildcard(expression, segment)) {
+						route.keys.push_back(expression.substr(segment.first + 1, segment.second - 3));
+						node = node->wildcard != NULL ? node->wildcard : (node->wildcard = Create());
+					}
+					else if (ExpressionComparer::IsReplaceable(expression, segment)) {
+						Segment name;
+						Type type = Typed(expression, segment, name);
+
+						route.keys.push_back(expression.substr(name.first, name.second));
+						node = node->keys[type] != NULL ? node->keys[type] : (node->keys[type] = Create());
+					}
+					else {
+						size_t j = Search(node, expression, segment);
+
+						if (j == node->children.size() || expression.compare(segment.first, segment.second, node->children[j].first) != 0) {
+							node->children.insert(node->children.begin() + j, std::make_pair(expression.substr(segment.first, segment.second), Create()));
+						}
+
+						node = node->children[j].second;
+					}
+				}
+
+				// routes that end at the same node are tried in the order of their expressions.
+				size_t j = 0;
+
+				while (j < node->routes.size() && node->routes[j].expression < expression) {
+					j++;
+				}
+
+				node->routes.insert(node->routes.begin() + j, route);
+			}
+
+			/**
+			 * Offers a request to the routes matching its path until one of them handles it.
+			 *
+			 * @param args The request event arguments, without matches, which are filled in for the route that handles the request.
+			 * @param sender The sender passed to the route handlers.
+			 * @param arena The memory used while comparing.
+			 * @return True if a route handled the request, false otherwise.
+			 */
+			bool Route(RequestEventArgs& args, void* sender, Arena& arena) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				const std::string& path = args.Path();
+				size_t query = path.find('?');
+				Captures captures = Captures(Arena::Allocator<Capture>(arena));
+				QueryString parameters;
+
+				if (path.empty()) {
+					return false;
+				}
+
+				if (query != std::string::npos) {
+					parameters.Parse(path.data() + query + 1, path.size() - query - 1);
+				}
+
+				return Walk(&_nodes.front(), args, sender, 0, query == std::string::npos ? path.size() : query, parameters, captures, arena);
+			}
+
+			/**
+			 * Performs unit testing on functions in this class to ensure expected operation.
+			 */
+			static void UnitTest() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				std::map<std::string, Configuration> configurations;
+				RouteTree tree;
+				Arena arena;
+				RequestEventArgs routed = RequestEventArgs(NULL, "", "", HeaderCollection(), "", MatchCollection());
+				const char* expressions[] = { "/entities", "/entities/{id}", "/entities/latest", "/entities/{id}/items/{item}", "/entities?sort={sort}", "/files/{path*}", "/things/special", "/orders/{id:int}", "/orders/{name}", "/pages/{page:uint}", "/search?q={q}&page={page?}", "/recent?page={page?}" };
+
+				for (size_t i = 0; i < sizeof(expressions) / sizeof(*expressions); i++) {
+					tree.Add(expressions[i], configurations[expressions[i]].Get(RequestEventHandler(Record)));
+				}
+
+				tree.Add("/things/{name}", configurations["/things/{name}"].Post(RequestEventHandler(Record)));
+
+				assert(tree.Test("GET", "/entities", routed, arena) && routed.Matches().empty());
+				assert(tree.Test("GET", "/entities/", routed, arena) && routed.Matches().empty());
+				assert(tree.Test("GET", "/entities/42", routed, arena) && routed.Match("id") == "42" && routed.Capture(0) == "42");
+				assert(tree.Test("GET", "/entities/latest", routed, arena) && routed.Matches().empty());
+				assert(tree.Test("GET", "/entities/7/items/3", routed, arena) && routed.Match("id") == "7" && routed.Match("item") == "3" && routed.Capture(1) == "3");
+				assert(tree.Test("GET", "/entities?sort=name", routed, arena) && routed.Match("sort") == "name" && routed.Captures().empty());
+				assert(tree.Test("GET", "/files/a/b/c.txt", routed, arena) && routed.Match("path") == "a/b/c.txt");
+				assert(tree.Test("GET", "/files", routed, arena) && routed.Match("path") == "");
+				assert(tree.Test("POST", "/things/special", routed, arena) && routed.Match("name") == "special");
+				assert(tree.Test("GET", "/orders/-17", routed, arena) && routed.Match("id") == "-17" && routed.Number(0) == -17);
+				assert(tree.Test("GET", "/orders/9223372036854775807", routed, arena) && routed.Number(0) == INT64_MAX);
+				assert(tree.Test("GET", "/orders/9223372036854775808", routed, arena) && routed.Match("name") == "9223372036854775808");
+				assert(tree.Test("GET", "/orders/12ab", routed, arena) && routed.Match("name") == "12ab" && routed.Number(0) == 0);
+				assert(tree.Test("GET", "/pages/3", routed, arena) && routed.Match("page") == "3" && routed.Number(0) == 3);
+				assert(tree.Test("GET", "/pages/-3", routed, arena) == false);
+				assert(tree.Test("GET", "/pages/", routed, arena) == false);
+				assert(tree.Test("GET", "/search?page=3&q=a+b%21", routed, arena) && routed.Match("q") == "a b!" && routed.Match("page") == "3");
+				assert(tree.Test("GET", "/search?q=why?", routed, arena) && routed.Match("q") == "why?");
+				assert(tree.Test("GET", "/search?q=c", routed, arena) && routed.Match("q") == "c" && routed.Match("page", "1") == "1");
+				assert(tree.Test("GET", "/recent", routed, arena) && routed.Matches().empty());
+				assert(tree.Test("GET", "/search?page=3", routed, arena) == false);
+				assert(tree.Test("GET", "/search?q=c&sort=name", routed, arena) == false);
+				assert(tree.Test("GET", "/entities?page=2", routed, arena) == false);
+				assert(tree.Test("GET", "/entities/7/items", routed, arena) == false);
+				assert(tree.Test("GET", "/entities/42?sort=name", routed, arena) == false);
+				assert(tree.Test("POST", "/entities", routed, arena) == false);
+				assert(tree.Test("GET", "/missing", routed, arena) == false);
+			}
+
+			/**
+			 * Deletes this route tree.
+			 */
+			virtual ~RouteTree() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+			}
+		};
+
+		/**
+		 * A class that encapsulates a single range of bytes requested with the http Range header.
+		 */
+		class ByteRange {
+		public:
+
+			/**
+			 * The maximum number of ranges, after overlapping and adjacent ranges are merged, that a request may ask for.
+			 */
+			static size_t MaximumRanges;
+
+		private:
+			uint64_t _first;
+			uint64_t _last;
+
+		public:
+			typedef std::vector<ByteRange> Collection;
+
+			/**
+			 * Creates a new byte range.
+			 *
+			 * @param first The position of the first byte in the range.
+			 * @param last The position of the last byte in the range (inclusive).
+			 */
+			ByteRange(uint64_t first = 0, uint64_t last = 0) : _first(first), _last(last) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+
+			}
+
+			/**
+			 * The position of the first byte in the range.
+			 *
+			 * @return The position.
+			 */
+			uint64_t First() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				return _first;
+			}
+
+			/**
+			 * The position of the last byte in the range (inclusive).
+			 *
+			 * @return The position.
+			 */
+			uint64_t Last() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				return _last;
+			}
+
+			/**
+			 * The number of bytes in the range.
+			 *
+			 * @return The length.
+			 */
+			uint64_t Length() const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				return _last - _first + 1;
+			}
+
+			/**
+			 * Formats the range as the value of a Content-Range header.
+			 *
+			 * @param size The complete size of the resource.
+			 * @return The header value.
+			 */
+			std::string ToContentRange(uint64_t size) const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				return String::Format("bytes %llu-%llu/%llu", (unsigned long long) _first, (unsigned long long) _last, (unsigned long long) size);
+			}
+
+		private:
+
+			/**
+			 * Parses a byte position, refusing values that do not fit in 64 bits.
+			 *
+			 * @param digits The decimal digits of the position.
+			 * @param value The parsed position.
+			 * @return True if the position is well formed and in range, false otherwise.
+			 */
+			static bool ParseNumber(const std::string& digits, uint64_t& value) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				value = 0;
+
+				if (digits.empty()) {
+					return false;
+				}
+
+				for (size_t i = 0; i < digits.size(); i++) {
+					uint64_t digit = digits[i] - '0';
+
+					if (value > (UINT64_MAX - digit) / 10) {
+						return false;
 					}
-					else if (expressionKeyAndValue.size() == 2 && expressionKeyAndValue[0] == parameterKeyAndValue[0] && expressionKeyAndValue[1] == parameterKeyAndValue[1]) {
-						// we have matched the key and value
+
+					value = value * 10 + digit;
+				}
+
+				return true;
+			}
+
+			/**
+			 * Sorts a collection of ranges and merges those that overlap or are adjacent.
+			 *
+			 * @param ranges The collection of ranges.
+			 */
+			static void Merge(Collection& ranges) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				std::sort(ranges.begin(), ranges.end());
+				size_t merged = 0;
+
+				for (size_t i = 1; i < ranges.size(); i++) {
+					ByteRange& last = ranges[merged];
+
+					if (ranges[i]._first <= last._last || ranges[i]._first - last._last == 1) {
+						last._last = std::max(last._last, ranges[i]._last);
 					}
 					else {
+						ranges[++merged] = ranges[i];
+					}
+				}
+
+				ranges.resize(ranges.empty() ? 0 : merged + 1);
+			}
+
+			/**
+			 * Parses a single byte range specifier such as "0-499", "9500-" or "-500".
+			 * If the specifier can be satisfied, the range is added to the collection.
+			 *
+			 * @param specifier The byte range specifier.
+			 * @param size The complete size of the resource.
+			 * @param ranges The collection used to store the satisfiable ranges.
+			 * @return True if the specifier is well formed, false otherwise.
+			 */
+			static bool ParseSpecifier(const std::string& specifier, uint64_t size, Collection& ranges) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				size_t dash = specifier.find('-');
+				uint64_t first, last, suffix;
+
+				if (dash == std::string::npos || specifier.size() == 1 || specifier.find_first_not_of("0123456789-") != std::string::npos || specifier.find('-', dash + 1) != std::string::npos) {
+					return false;
+				}
+				else if (dash == 0) {
+					// a suffix range requests the final bytes of the resource
+					if (ParseNumber(specifier.substr(1), suffix) == false) {
+						return false;
+					}
+					else if (suffix == 0 || size == 0) {
+						return true;
+					}
+
+					first = suffix < size ? size - suffix : 0;
+					last = size - 1;
+				}
+				else {
+					last = UINT64_MAX;
+
+					if (ParseNumber(specifier.substr(0, dash), first) == false || (dash + 1 != specifier.size() && ParseNumber(specifier.substr(dash + 1), last) == false)) {
+						return false;
+					}
+					else if (last < first) {
 						return false;
 					}
+					else if (first >= size) {
+						return true;
+					}
+					else if (last >= size) {
+						last = size - 1;
+					}
 				}
 
+				ranges.push_back(ByteRange(first, last));
 				return true;
 			}
 
 		public:
 
 			/**
-			 * Determines whether an expression and a path are considered equal.
-			 * If the expression contains routing keys, the key value pair is inserted into a match collection.
+			 * Parses the value of a Range header against a resource of the specified size.
+			 * Ranges that cannot be satisfied are not added to the collection, and the rest are sorted with overlapping and adjacent ranges merged.
+			 * A header that still asks for more than the maximum number of ranges is ignored, so that a small request cannot amplify into a large response.
 			 *
-			 * @param expression The expression to match against.
-			 * @param path The path used to match.
-			 * @param matches A collection used to store the routing keys and values.
-			 * @return True if the path matches the expression, false otherwise.
+			 * @param value The header value, for example "bytes=0-499,-500".
+			 * @param size The complete size of the resource.
+			 * @param ranges The collection used to store the satisfiable ranges.
+			 * @return True if the header is a well formed byte range set, false if the header should be ignored.
 			 */
-			static bool AreEqual(const std::string& expression, const std::string& path, MatchCollection& matches) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-				std::vector<std::string> expressionAndParameters = String::Split(expression, '?');
-				std::vector<std::string> pathAndParameters = String::Split(path, '?');
+			static bool Parse(const std::string& value, uint64_t size, Collection& ranges) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				std::string unit = "bytes=";
 
-				if (expressionAndParameters.size() == 1 && pathAndParameters.size() == 1) {
-					return PathsAreEqual(expressionAndParameters[0], pathAndParameters[0], matches);
+				if (value.compare(0, unit.size(), unit) != 0) {
+					return false;
 				}
-				else if (expressionAndParameters.size() == 2 && pathAndParameters.size() == 2) {
-					return PathsAreEqual(expressionAndParameters[0], pathAndParameters[0], matches) && ParametersAreEqual(expressionAndParameters[1], pathAndParameters[1], matches);
+
+				std::vector<std::string> specifiers = String::Split(value.substr(unit.size()), ',');
+
+				if (specifiers.empty()) {
+					return false;
 				}
 
-				return false;
+				for (size_t i = 0; i != specifiers.size(); i++) {
+					if (ParseSpecifier(String::Trim(specifiers[i]), size, ranges) == false) {
+						ranges.clear();
+						return false;
+					}
+				}
+
+				Merge(ranges);
+
+				if (ranges.size() > MaximumRanges) {
+					ranges.clear();
+					return false;
+				}
+
+				return true;
+			}
+
+			/**
+			 * Compares the position of this range to another range.
+			 *
+			 * @param that The range to compare to.
+			 * @return True if this range starts before the other range, false otherwise.
+			 */
+			bool operator < (const ByteRange& that) const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				return _first < that._first || (_first == that._first && _last < that._last);
+			}
+
+			/**
+			 * Performs unit testing on functions in this class to ensure expected operation.
+			 */
+			static void UnitTest() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				Collection ranges;
+				assert(Parse("bytes=0-499", 10000, ranges) && ranges.size() == 1 && ranges[0].First() == 0 && ranges[0].Last() == 499);
+				ranges.clear();
+				assert(Parse("bytes=9500-", 10000, ranges) && ranges.size() == 1 && ranges[0].First() == 9500 && ranges[0].Last() == 9999);
+				ranges.clear();
+				assert(Parse("bytes=-500", 10000, ranges) && ranges.size() == 1 && ranges[0].First() == 9500 && ranges[0].Length() == 500);
+				ranges.clear();
+				assert(Parse("bytes=0-0, -1", 10000, ranges) && ranges.size() == 2 && ranges[1].First() == 9999);
+				ranges.clear();
+				assert(Parse("bytes=500-599,0-99,100-199,150-300", 10000, ranges) && ranges.size() == 2 && ranges[0].First() == 0 && ranges[0].Last() == 300 && ranges[1].First() == 500);
+				ranges.clear();
+				assert(Parse("bytes=0-0,0-0,0-0,0-0,0-0,0-0,0-0,0-0,0-0,0-0,0-0,0-0,0-0,0-0,0-0,0-0,0-0,0-0", 10000, ranges) && ranges.size() == 1);
+				ranges.clear();
+				assert(Parse("bytes=0-0,2-2,4-4,6-6,8-8,10-10,12-12,14-14,16-16,18-18,20-20,22-22,24-24,26-26,28-28,30-30,32-32", 10000, ranges) == false && ranges.empty());
+				assert(Parse("bytes=99999999999999999999-", 10000, ranges) == false);
+				assert(Parse("bytes=0-99999999999999999999", 10000, ranges) == false);
+				assert(Parse("bytes=-99999999999999999999", 10000, ranges) == false);
+				assert(Parse("bytes=0-18446744073709551615", 10000, ranges) && ranges.size() == 1 && ranges[0].Last() == 9999);
+				ranges.clear();
+				assert(Parse("bytes=20000-", 10000, ranges) && ranges.empty());
+				ranges.clear();
+				assert(Parse("bytes=5-1", 10000, ranges) == false);
+				assert(Parse("lines=0-1", 10000, ranges) == false);
+				assert(ByteRange(0, 499).ToContentRange(10000) == "bytes 0-499/10000");
 			}
 		};
 
 		/**
 		 * A class that provides functionality for responding to a web request with file contents.
+		 * Files are found through a file cache, so a file that is held in memory is sent at once without any file system calls.
+		 * Larger files are read from the descriptor the cache keeps open, a chunk per event loop iteration, waiting whenever the client falls behind, and reading stops if the client disconnects.
+		 * Requests containing a Range header are answered with only the requested bytes of the file.
 		 */
 		class FileHandler {
+		public:
+
+			/**
+			 * The number of bytes read from a file in each event loop iteration.
+			 */
+			static size_t DefaultChunkSize;
+
 		private:
-			RequestEventArgs _args;
+			HttpServer::HttpClient* _client;
+			FileCache::Descriptor* _descriptor;
+			uint64_t _size;
+			ByteRange::Collection _ranges;
+			size_t _range;
+			uint64_t _offset;
+			uint64_t _remaining;
+			std::string _boundary;
+			std::string _contentType;
 
 		private:
 
 			/**
-			 * Called when a chunk of a file has been read.
+			 * File handlers share an open file and cannot be copied.
 			 *
-			 * @param args The event arguments.
-			 * @param sender The sender of the event.
+			 * @param that The file handler to clone.
+			 */
+			FileHandler(const FileHandler& that);
+
+			/**
+			 * File handlers share an open file and cannot be copied.
+			 *
+			 * @param that The file handler to clone.
+			 * @return A reference to this file handler.
+			 */
+			FileHandler& operator = (const FileHandler& that);
+
+			/**
+			 * Sends the part header of a range of a multipart response.
+			 *
+			 * @param client The client to respond to.
+			 * @param boundary The boundary between the parts.
+			 * @param contentType The content type of the file.
+			 * @param range The range.
+			 * @param size The size of the file.
+			 */
+			static void SendPartHeader(HttpServer::HttpClient* client, const std::string& boundary, const std::string& contentType, const ByteRange& range, uint64_t size) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				client->Send("\r\n--" + boundary + "\r\nContent-Type: " + contentType + "\r\nContent-Range: " + range.ToContentRange(size) + "\r\n\r\n");
+			}
+
+			/**
+			 * Sends part of file contents held in memory, copying it once onto the connection.
+			 *
+			 * @param client The client to respond to.
+			 * @param content The file contents.
+			 * @param first The position of the first byte to send.
+			 * @param length The number of bytes to send.
+			 */
+			static void SendContent(HttpServer::HttpClient* client, const std::string& content, uint64_t first, uint64_t length) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				client->BeginContent().append(content, (size_t) first, (size_t) length);
+				client->EndContent();
+			}
+
+			/**
+			 * Starts reading the current range of the file.
+			 * For multiple ranges, the part header is sent before the range contents.
+			 */
+			void ReadRange() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				const ByteRange& range = _ranges[_range];
+
+				if (_boundary.empty() == false) {
+					SendPartHeader(_client, _boundary, _contentType, range, _size);
+				}
+
+				_offset = range.First();
+				_remaining = range.Length();
+			}
+
+			/**
+			 * Reads the next chunk of the file onto the connection, or ends the response once every range has been read.
+			 * If the client has not taken the chunks already read, this waits rather than reading more.
+			 * Once the response has ended, or the client has disconnected, this will automatically free this file handler.
 			 */
-			void OnFileChunkRead(const File::ChunkReadEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-				_args.Client()->Send(args.Data());
+			void Update() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				if (_client == NULL) {
+					delete this;
+					return;
+				}
+
+				if (_client->Unsent() >= DefaultChunkSize * 4) {
+					Thread::SetTimeout(TcpClient::DefaultDataPollFrequency, delegate(&FileHandler::Update, this));
+					return;
+				}
+
+				if (_remaining > 0) {
+					size_t count = _remaining < DefaultChunkSize ? (size_t) _remaining : DefaultChunkSize;
+					std::string& queued = _client->BeginContent();
+					size_t position = queued.size();
+
+					queued.resize(position + count);
+					count = _descriptor->Read(&queued[position], count, _offset);
+					queued.resize(position + count);
+					_client->EndContent();
+
+					// a file that has shrunk since it was looked up ends early, as a partial read of the file would have.
+					_offset += count;
+					_remaining = count == 0 ? 0 : _remaining - count;
+				}
+
+				if (_remaining > 0) {
+					Thread::Invoke(delegate(&FileHandler::Update, this));
+					return;
+				}
+
+				if (++_range < _ranges.size()) {
+					ReadRange();
+					Thread::Invoke(delegate(&FileHandler::Update, this));
+					return;
+				}
+
+				if (_boundary.empty() == false) {
+					_client->Send("\r\n--" + _boundary + "--\r\n");
+				}
+
+				_client->End();
+				delete this;
 			}
 
 			/**
-			 * Called after the last chunk of a file has been read.
-			 * This will automatically free this file handler.
+			 * Called when the client has disconnected before the file was sent.
 			 *
 			 * @param args The event arguments.
 			 * @param sender The sender of the event.
 			 */
-			void OnFileEnded(const File::EndOfFileEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-				_args.Client()->End();
-				delete this;
+			void OnClientDisconnected(const HttpServer::HttpClient::ClientDisconnectedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				_client->ClientDisconnected() -= delegate(&FileHandler::OnClientDisconnected, this);
+				_client = NULL;
+			}
+
+			/**
+			 * Creates a new file handler that sends the ranges of an open file.
+			 * The response must have been begun, and its headers sent.
+			 *
+			 * @param client The client to respond to.
+			 * @param descriptor The open file, whose reference is released by this file handler.
+			 * @param size The size of the file.
+			 * @param ranges The ranges to send, in order.
+			 * @param boundary The boundary between the parts of a multipart response, or empty for a single range.
+			 * @param contentType The content type of the file, sent with each part of a multipart response.
+			 */
+			FileHandler(HttpServer::HttpClient* client, FileCache::Descriptor* descriptor, uint64_t size, const ByteRange::Collection& ranges, const std::string& boundary, const std::string& contentType) : _client(client), _descriptor(descriptor), _size(size), _ranges(ranges), _range(0), _offset(0), _remaining(0), _boundary(boundary), _contentType(contentType) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				_client->ClientDisconnected() += delegate(&FileHandler::OnClientDisconnected, this);
+				ReadRange();
+				Thread::Invoke(delegate(&FileHandler::Update, this));
+			}
+
+			/**
+			 * Deletes this file handler.
+			 */
+			virtual ~FileHandler() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				if (_client != NULL) {
+					_client->ClientDisconnected() -= delegate(&FileHandler::OnClientDisconnected, this);
+				}
+
+				_descriptor->Release();
 			}
 
 		public:
 
 			/**
-			 * Creates a new file handler.
+			 * Responds to a web request with file contents.
 			 * If the requested path is a directory the response will redirect to the "index.html" page in the directory.
-			 * If the requested path is a file the response will be the file contents.
+			 * If the requested path is a file the response will be the file contents, with a content type from its extension.
+			 * If the request contains a satisfiable Range header the response will be a 206 Partial Content response.
+			 * If the request asks for more ranges than allowed the Range header is ignored and the response will be the whole file.
+			 * If the request contains an unsatisfiable Range header the response will be a 416 Range Not Satisfiable response.
 			 * If the requested path could not be found the response will be a 404 Not Found response.
 			 *
 			 * @param args The request event arguments.
 			 * @param documentRoot The root directory containing the web documents.
+			 * @param files The cache to find the file through.
 			 */
-			FileHandler(const RequestEventArgs& args, const std::string& documentRoot) : _args(args) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-				if (Directory::Exists(documentRoot + args.Path())) {
-					args.Client()->Begin("HTTP/1.1", 303, "See Other")
+			static void Serve(const RequestEventArgs& args, const std::string& documentRoot, FileCache& files) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				HttpServer::HttpClient* client = args.Client();
+				const FileCache::Entry& file = files.Find(documentRoot + args.Path());
+
+				if (file.IsDirectory()) {
+					client->Begin("HTTP/1.1", 303, "See Other")
 						.SendHeader("Server", "nitrus")
 						.SendHeader("Location", args.Path() + "/index.html")
 						.Send("")
 						.End();
+					return;
 				}
-				else {
-					try {
-						File::Read(documentRoot + args.Path(), File::ChunkReadEventHandler(&FileHandler::OnFileChunkRead, this), File::EndOfFileEventHandler(&FileHandler::OnFileEnded, this));
-						args.Client()->Begin("HTTP/1.1", 200, "OK")
-							.SendHeader("Server", "nitrus");
+
+				if (file.Exists() == false) {
+					client->Begin("HTTP/1.1", 404, "Not Found")
+						.SendHeader("Server", "nitrus")
+						.SendHeader("Content-Type", "text/plain")
+						.Send("")
+						.End();
+					return;
+				}
+
+				uint64_t size = file.Size();
+				std::string range = args.Header("Range");
+				ByteRange::Collection ranges;
+				std::string boundary;
+
+				if (range.empty() || ByteRange::Parse(range, size, ranges) == false) {
+					ranges.assign(1, ByteRange(0, size == 0 ? 0 : size - 1));
+
+					client->Begin("HTTP/1.1", 200, "OK")
+						.SendHeader("Server", "nitrus")
+						.SendHeader("Accept-Ranges", "bytes")
+						.SendHeader("Content-Type", file.ContentType());
+
+					if (size == 0) {
+						client->Send("").End();
+						return;
 					}
-					catch (const File::FileNotFoundException& e) {
-						args.Client()->Begin("HTTP/1.1", 404, "Not Found")
-							.SendHeader("Server", "nitrus")
-							.SendHeader("Content-Type", "text/plain")
-							.Send("")
-							.End();
+				}
+				else if (ranges.empty()) {
+					client->Begin("HTTP/1.1", 416, "Range Not Satisfiable")
+						.SendHeader("Server", "nitrus")
+						.SendHeader("Content-Range", String::Format("bytes */%llu", (unsigned long long) size))
+						.Send("")
+						.End();
+					return;
+				}
+				else if (ranges.size() == 1) {
+					client->Begin("HTTP/1.1", 206, "Partial Content")
+						.SendHeader("Server", "nitrus")
+						.SendHeader("Accept-Ranges", "bytes")
+						.SendHeader("Content-Type", file.ContentType())
+						.SendHeader("Content-Range", ranges[0].ToContentRange(size));
+				}
+				else {
+					boundary = String::Format("nitrus%08x%08x", (unsigned int) Random::Uniform(0, 0xffffffff), (unsigned int) Random::Uniform(0, 0xffffffff));
+					client->Begin("HTTP/1.1", 206, "Partial Content")
+						.SendHeader("Server", "nitrus")
+						.SendHeader("Accept-Ranges", "bytes")
+						.SendHeader("Content-Type", "multipart/byteranges; boundary=" + boundary);
+				}
+
+				if (file.IsLoaded() == false) {
+					new FileHandler(client, file.Open(), size, ranges, boundary, file.ContentType());
+					return;
+				}
+
+				for (size_t i = 0; i < ranges.size(); i++) {
+					if (boundary.empty() == false) {
+						SendPartHeader(client, boundary, file.ContentType(), ranges[i], size);
 					}
+
+					SendContent(client, file.Content(), ranges[i].First(), ranges[i].Length());
 				}
-			}
 
-			/**
-			 * Deletes this file handler.
-			 */
-			virtual ~FileHandler() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+				if (boundary.empty() == false) {
+					client->Send("\r\n--" + boundary + "--\r\n");
+				}
 
+				client->End();
 			}
 		};
 
 
 	private:
 		typedef std::map<std::string, Configuration> Configurations;
+		typedef std::map<std::string, Proxy*> Proxies;
+		typedef std::map<std::string, RateLimiter*> Limiters;
 		Configurations _configurations;
+		RouteTree _routes;
+		Proxies _proxies;
+		Limiters _limiters;
 		std::string _documentRoot;
+		FileCache _files;
+		ResponseCache _cache;
+		std::vector<RequestFilter> _filters;
+		ResponseEvent _responded;
+		ClientHandler* _routing;
+		WorkerPool* _workers;
+
+		/**
+		 * Whether the unit test of this class has been registered to run when the application is initialized.
+		 */
+		static bool UnitTestRegistered;
 
 	private:
 
+		/**
+		 * Forwards a request that has just started to the proxy configured for its path, if any.
+		 * A prefix matches the path itself and any path below it, with or without a query string.
+		 *
+		 * @param client The client that sent the request.
+		 * @param method The request method.
+		 * @param path The request path.
+		 * @return True if the request was forwarded, false otherwise.
+		 */
+		bool Forward(HttpServer::HttpClient* client, const std::string& method, const std::string& path) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			for (Proxies::iterator i = _proxies.begin(); i != _proxies.end(); i++) {
+				if (Below(path, i->first)) {
+					i->second->Forward(client, method, path);
+					return true;
+				}
+			}
+
+			return false;
+		}
+
+		/**
+		 * Determines whether requests for a path are forwarded to a proxy.
+		 *
+		 * @param path The request path.
+		 * @return True if requests for the path are forwarded, false otherwise.
+		 */
+		bool Forwards(const std::string& path) const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			for (Proxies::const_iterator i = _proxies.begin(); i != _proxies.end(); i++) {
+				if (Below(path, i->first)) {
+					return true;
+				}
+			}
+
+			return false;
+		}
+
+		/**
+		 * Finds the rate limiter for a request that has just started, which is the one configured for the longest prefix of its path.
+		 *
+		 * @param path The request path.
+		 * @return The rate limiter, or NULL if requests for the path are not limited.
+		 */
+		RateLimiter* Limiter(const std::string& path) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			RateLimiter* limiter = NULL;
+			size_t longest = 0;
+
+			for (Limiters::iterator i = _limiters.begin(); i != _limiters.end(); i++) {
+				if (Below(path, i->first) && (limiter == NULL || i->first.size() > longest)) {
+					limiter = i->second;
+					longest = i->first.size();
+				}
+			}
+
+			return limiter;
+		}
+
+		/**
+		 * Determines whether a path is the specified path prefix or below it, with or without a query string.
+		 *
+		 * @param path The request path.
+		 * @param prefix The path prefix.
+		 * @return True if the prefix matches the path, false otherwise.
+		 */
+		static bool Below(const std::string& path, const std::string& prefix) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return path.compare(0, prefix.size(), prefix) == 0 && (path.size() == prefix.size() || path[prefix.size()] == '/' || path[prefix.size()] == '?');
+		}
+
 		/**
 		 * Called when a request has been received by the client handler.
-		 * This will search for a route that matches the request.
-		 * The first route found will be invoked (this may or may not be the first configuration defined so be careful to not define overlapping configurations).
-		 * If a route was not found, the undefined route handler is invoked.
-		 * If no undefined route handler was specified, a 404 Not Found response is returned.
+		 * This will search the route tree for a route that matches the request and handles its method.
+		 * Where routes overlap, literal segments are preferred to routing keys and routing keys to wildcards.
+		 * If no route handles the request, it is served from the document root.
 		 *
 		 * @param args The event arguments.
 		 * @param sender The sender of the event.
 		 */
-		void OnClientHandlerRequestReceived(const RequestEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-			for (Configurations::iterator i = _configurations.begin(); i != _configurations.end(); i++) {
-				RequestEventArgs arguments = args;
+		void OnClientHandlerRequestReceived(RequestEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			bool routed;
 
-				if (ExpressionComparer::AreEqual(i->first, arguments.Path(), arguments.Matches()) && i->second(arguments, this)) {
-					return;
-				}
+			_routing = static_cast<ClientHandler*>(sender);
+			routed = _routes.Route(args, this, args.Client()->Memory());
+			_routing = NULL;
+
+			if (routed) {
+				return;
 			}
 
-			new FileHandler(args, _documentRoot);
+			FileHandler::Serve(args, _documentRoot, _files);
 		}
 
 		/**
@@ -669,7 +2866,27 @@ public:
 		 * @param sender The sender of the event.
 		 */
 		void OnClientAccepted(const HttpServer::ClientAcceptedEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-			new ClientHandler(RequestEventHandler(&Router::OnClientHandlerRequestReceived, this), args.Client());
+			new ClientHandler(ClientHandler::RequestReceivedEventHandler(&Router::OnClientHandlerRequestReceived, this), this, args.Client());
+		}
+
+		/**
+		 * Called when the metrics of the routes have been requested.
+		 * This will respond with the metrics as JSON.
+		 *
+		 * @param args The event arguments.
+		 * @param sender The sender of the event.
+		 */
+		void OnMetricsRequested(const RequestEventArgs& args, void* sender) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			args.Client()->Begin("HTTP/1.1", 200, "OK")
+				.SendHeader("Server", "nitrus")
+				.SendHeader("Content-Type", "application/json")
+				.SendHeader("Cache-Control", "no-store");
+
+			JsonWriter json(args.Client());
+			WriteMetrics(json);
+			json.Close();
+
+			args.Client()->End();
 		}
 
 	public:
@@ -680,7 +2897,7 @@ public:
 		 * @param documentRoot The root directory for serving web content from disk.
 		 * @param undefinedRouteHandler The event handler invoked when a request does not match a pre-configured route.
 		 */
-		Router(const std::string documentRoot = "") : _configurations(), _documentRoot(documentRoot) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+		Router(const std::string documentRoot = "") : _configurations(), _routes(), _proxies(), _limiters(), _documentRoot(documentRoot), _files(), _cache(), _filters(), _responded(), _routing(NULL), _workers(NULL) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
 			ClientAccepted() += delegate(&Router::OnClientAccepted, this);
 		}
 
@@ -690,24 +2907,187 @@ public:
 		 * For example the expression /users/{userId} would match /users/bob and /users/billy.
 		 * Similarly, routing keys may be used for query parameters.
 		 * For example the expression /users?id={userId} would match /users?id=bob and /users?id=billy.
+		 * Query parameters may be given in any order and are percent-decoded, and a query routing key whose name ends with a question mark is optional.
+		 * For example the expression /users?name={name}&page={page?} would match /users?name=bob%20smith and /users?page=2&name=bob.
+		 * A routing key in the path may be given a type, int or uint, so that it only matches decimal numbers, which are parsed while routing and read with RequestEventArgs::Number.
+		 * For example the expression /users/{userId:int} would match /users/42 but not /users/bob.
+		 * A routing key whose name ends with an asterisk matches the rest of the path.
+		 * For example the expression /files/{path*} would match /files/a.txt and /files/docs/b.txt.
 		 *
 		 * @param expression The routing expression.
 		 * @return A reference to the routing configuration.
 		 */
 		Configuration& Configure(const std::string& expression) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
-			return _configurations[expression];
+			Configurations::iterator i = _configurations.find(expression);
+
+			if (i == _configurations.end()) {
+				i = _configurations.insert(std::make_pair(expression, Configuration(this, expression))).first;
+				_routes.Add(expression, i->second);
+			}
+
+			return i->second;
+		}
+
+		/**
+		 * Forwards every request below the specified path prefix to a proxy instead of routing it.
+		 * For example the prefix /api forwards /api, /api/users and /api?page=2 but not /apis.
+		 * Forwarded requests keep their original path.
+		 *
+		 * @param prefix The path prefix.
+		 * @param proxy The proxy to forward requests to.
+		 * @return A reference to this router.
+		 */
+		Router& Forward(const std::string& prefix, Proxy& proxy) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_proxies[prefix] = &proxy;
+			return *this;
+		}
+
+		/**
+		 * Limits how often each client may make requests below the specified path prefix, including those forwarded to a proxy.
+		 * A request over the limit is answered with 429 Too Many Requests as soon as the client it belongs to is known, before its content is read, and reaches no filter or handler.
+		 * Where prefixes overlap the longest one applies, so an empty prefix can set a limit for every request and a longer one a tighter limit for an expensive route.
+		 * Forwarded requests are always told apart by the address of the client, since they are relayed as soon as they start.
+		 *
+		 * @param prefix The path prefix, which matches as for Forward.
+		 * @param limiter The rate limiter, which must outlive this router.
+		 * @return A reference to this router.
+		 */
+		Router& Limit(const std::string& prefix, RateLimiter& limiter) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_limiters[prefix] = &limiter;
+			return *this;
+		}
+
+		/**
+		 * The cache shared by the routes configured with Configuration::Cache, which holds ResponseCache::DefaultCapacity bytes unless changed and counts its hits, misses and evictions.
+		 *
+		 * @return The response cache.
+		 */
+		ResponseCache& Cache() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _cache;
+		}
+
+		/**
+		 * The cache that files are served from the document root through, which holds FileCache::DefaultCapacity files unless changed.
+		 *
+		 * @return The file cache.
+		 */
+		FileCache& Files() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return _files;
+		}
+
+		/**
+		 * The worker threads that run the handlers bound with Configuration::Offload, which are started the first time they are needed.
+		 *
+		 * @return The worker pool.
+		 */
+		WorkerPool& Workers() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			if (_workers == NULL) {
+				_workers = new WorkerPool();
+			}
+
+			return *_workers;
+		}
+
+		/**
+		 * Sets the number of worker threads that run the handlers bound with Configuration::Offload, which is WorkerPool::DefaultThreads unless changed.
+		 * The threads are replaced only while no work is outstanding.
+		 *
+		 * @param threads The number of threads.
+		 * @return A reference to this router.
+		 */
+		Router& Workers(size_t threads) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			if (_workers == NULL || _workers->Outstanding() == 0) {
+				delete _workers;
+				_workers = new WorkerPool(threads);
+			}
+
+			return *this;
+		}
+
+		/**
+		 * Adds a filter that every routed request passes through, before the filters of its route.
+		 * Requests forwarded to a proxy or served from the document root are not filtered.
+		 *
+		 * @param filter The filter.
+		 * @return A reference to this router.
+		 */
+		Router& Before(const RequestFilter& filter) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_filters.push_back(filter);
+			return *this;
+		}
+
+		/**
+		 * Adds a handler that is invoked when the response to every routed request has ended, after the response handlers of its route.
+		 *
+		 * @param handler The handler.
+		 * @return A reference to this router.
+		 */
+		Router& After(const ResponseEventHandler& handler) { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			_responded += handler;
+			return *this;
+		}
+
+		/**
+		 * Writes the metrics of every configured route as a JSON array, with latencies in microseconds.
+		 *
+		 * @param json The writer.
+		 */
+		void WriteMetrics(JsonWriter& json) const { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			json.BeginArray();
+
+			for (Configurations::const_iterator i = _configurations.begin(); i != _configurations.end(); i++) {
+				i->second.Metrics().Write(json, i->first);
+			}
+
+			json.EndArray();
+		}
+
+		/**
+		 * Serves the metrics of every configured route, as written by WriteMetrics, for GET requests matching a routing expression.
+		 *
+		 * @param expression The routing expression, such as /metrics.
+		 * @return A reference to the routing configuration.
+		 */
+		Configuration& ServeMetrics(const std::string& expression = "/metrics") { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			return Configure(expression).Get(RequestEventHandler(&Router::OnMetricsRequested, this));
+		}
+
+		/**
+		 * Performs unit testing on functions in this class, and the routing, caching and rate limiting it is built from, to ensure expected operation.
+		 * These tests have no side effects, so they run when the application is initialized.
+		 */
+		static void UnitTest() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			ByteRange::UnitTest();
+			ExpressionComparer::UnitTest();
+			RouteTree::UnitTest();
+			RouteMetrics::UnitTest();
+			ResponseCache::UnitTest();
+			RateLimiter::UnitTest();
 		}
 
 		/**
 		 * Deletes this web request router.
+		 * The worker threads are stopped once they finish the handlers they are running, and requests whose handlers have not been handed back to the event loop are dropped without a response.
 		 */
 		virtual ~Router() { StackTrace trace(__METHOD__, __FILE__, __LINE__);
+			delete _workers;
 
+			for (Configurations::iterator i = _configurations.begin(); i != _configurations.end(); i++) {
+				i->second.Drop();
+			}
 		}
 	};
 
 };
 
+bool Rest::Router::UnitTestRegistered = Application::RegisterUnitTest(&Rest::Router::UnitTest);
+
+uint64_t Rest::Router::RouteMetrics::HighestLatency = 60000000;
+
+size_t Rest::Router::ByteRange::MaximumRanges = 16;
+
+size_t Rest::Router::FileHandler::DefaultChunkSize = 65536;
+
 }
 
 #endif /* REST_HPP_ */